@@ -0,0 +1,351 @@
+/**
+ * \file ai.c
+ * \brief Реализация автоигрока.
+ *
+ * Ход выбирается лучевым поиском в два уровня. Сначала генератор ходов
+ * перебирает все достижимые положения текущей фигуры, и в луче остаются
+ * AI_BEAM_WIDTH лучших по оценке поля. Затем для каждого из них перебираются
+ * положения следующей фигуры (из буфера next) от точки появления, и
+ * кандидат получает оценку лучшего продолжения. Второй уровень — основная
+ * работа, поэтому кандидаты раздаются рабочим потокам.
+ */
+
+#include "ai.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/// \brief Биты клеток поля в маске строки (без стен).
+#define FIELD_BITS ((uint16_t) ~ROW_EMPTY)
+/// \brief Пары соседних битов строки от левой стены до правой.
+#define TRANS_BITS \
+  ((uint16_t)(((1u << (FIELD_WIDTH + 1)) - 1u) << (ROW_OFFSET - 1)))
+/// \brief Оценка проигрышного положения.
+#define AI_LOST -1e18
+
+/**
+ * \brief Число взведённых битов в 16-битной маске.
+ * \param v Маска.
+ * \return Число единиц.
+ */
+static int popcount16(uint16_t v) {
+  v = (uint16_t)(v - ((v >> 1) & 0x5555u));
+  v = (uint16_t)((v & 0x3333u) + ((v >> 2) & 0x3333u));
+  v = (uint16_t)((v + (v >> 4)) & 0x0F0Fu);
+  return (v + (v >> 8)) & 0x1F;
+}
+
+/**
+ * \brief Считает признаки поля за один проход сверху вниз.
+ * Высота столбца — расстояние от дна до его верхней клетки, дыра — пустая
+ * клетка под занятой, переходы — смены занято/пусто между соседними клетками
+ * строки (вместе со стенами) и столбца (вместе с дном).
+ * \param rows Маски строк поля.
+ * \param f Признаки (заполняются, кроме lines).
+ */
+void aiFeatures(const uint16_t *rows, AiFeatures_t *f) {
+  int heights[FIELD_WIDTH] = {0};
+  uint16_t covered = 0;
+
+  f->holes = 0;
+  f->row_trans = 0;
+  f->col_trans = 0;
+  for (int y = 0; y < FIELD_HEIGHT; ++y) {
+    uint16_t row = rows[y];
+    uint16_t fresh = row & FIELD_BITS & (uint16_t)~covered;
+
+    for (int x = 0; fresh && x < FIELD_WIDTH; ++x) {
+      if (fresh & (1u << (x + ROW_OFFSET))) {
+        heights[x] = FIELD_HEIGHT - y;
+      }
+    }
+    f->holes += popcount16(covered & (uint16_t)~row);
+    covered |= row & FIELD_BITS;
+    f->row_trans += popcount16((row ^ (row >> 1)) & TRANS_BITS);
+    f->col_trans += popcount16((row ^ rows[y + 1]) & FIELD_BITS);
+  }
+
+  f->height = 0;
+  f->bumpiness = 0;
+  for (int x = 0; x < FIELD_WIDTH; ++x) {
+    f->height += heights[x];
+    if (x > 0) {
+      f->bumpiness += abs(heights[x] - heights[x - 1]);
+    }
+  }
+}
+
+/**
+ * \brief Оценивает поле линейной комбинацией признаков.
+ * \param rows Маски строк поля.
+ * \param lines Сколько строк снято по пути к этому полю.
+ * \return Оценка; чем больше, тем лучше.
+ */
+double aiEvaluate(const uint16_t *rows, int lines) {
+  AiFeatures_t f;
+
+  aiFeatures(rows, &f);
+  f.lines = lines;
+  return -0.51 * f.height + 0.76 * f.lines - 0.36 * f.holes -
+         0.18 * f.bumpiness - 0.10 * f.row_trans - 0.20 * f.col_trans;
+}
+
+/**
+ * \brief Маски строк поля без текущей фигуры.
+ * \param params Параметры игры (фигура лежит на поле).
+ * \param rows Маски строк (заполняются).
+ */
+static void baseRows(const GameParams_t *params, uint16_t *rows) {
+  const Shape *s = params->cur_shape;
+  const PieceGeom_t *g = &pieceTable[s->piece][s->rot];
+
+  memcpy(rows, params->core.rows, sizeof(params->core.rows));
+  for (int i = g->top; i <= g->bottom; ++i) {
+    rows[s->y + i] &= (uint16_t)~(g->rows[i] << (s->x + ROW_OFFSET));
+  }
+}
+
+/**
+ * \brief Досчитывает кандидата луча: лучшее положение следующей фигуры.
+ * \param ai Автоигрок.
+ * \param i Номер кандидата.
+ */
+static void expandCandidate(AiPlayer_t *ai, int i) {
+  AiCandidate_t *c = &ai->beam[i];
+  Shape spawn = {ai->next_piece, 0, 0, 3, 0};
+  Placement_t moves[MOVEGEN_MAX];
+  double best = AI_LOST;
+
+  int n = genPlacements(c->rows, &spawn, moves);
+  for (int k = 0; k < n; ++k) {
+    uint16_t tmp[FIELD_HEIGHT + PIECE_SIZE];
+    memcpy(tmp, c->rows, sizeof(tmp));
+    int lines = lockPlacement(tmp, spawn.piece, moves[k]);
+    double score = aiEvaluate(tmp, c->lines + lines);
+    if (score > best) {
+      best = score;
+    }
+  }
+
+  c->score = best;
+}
+
+/**
+ * \brief Разбирает кандидатов текущего хода, пока они не кончатся.
+ * \param ai Автоигрок.
+ */
+static void drainJobs(AiPlayer_t *ai) {
+  int i;
+
+  while ((i = atomic_fetch_add(&ai->next_job, 1)) < ai->beam_size) {
+    expandCandidate(ai, i);
+  }
+}
+
+/**
+ * \brief Рабочий поток: ждёт очередного хода, участвует в его поиске и
+ * отмечается в finished. Ход не завершается, пока не отметятся все потоки,
+ * поэтому к следующему ходу ни один поток не держит старых кандидатов.
+ * \param arg Автоигрок.
+ * \return NULL.
+ */
+static void *worker(void *arg) {
+  AiPlayer_t *ai = arg;
+
+  // Потоки создаются до первого хода, поэтому отсчёт идёт с нуля: поток,
+  // который запустился позже объявления хода, всё равно в нём участвует.
+  unsigned seen = 0;
+  pthread_mutex_lock(&ai->lock);
+  while (!ai->stop) {
+    if (ai->generation == seen) {
+      pthread_cond_wait(&ai->start, &ai->lock);
+    } else {
+      seen = ai->generation;
+      pthread_mutex_unlock(&ai->lock);
+      drainJobs(ai);
+      pthread_mutex_lock(&ai->lock);
+      if (++ai->finished == ai->thread_count) {
+        pthread_cond_signal(&ai->done);
+      }
+    }
+  }
+  pthread_mutex_unlock(&ai->lock);
+
+  return NULL;
+}
+
+/**
+ * \brief Создаёт автоигрока.
+ * \param threads Число рабочих потоков (0 — поиск идёт в вызывающем потоке).
+ * \return Автоигрок или NULL при нехватке памяти.
+ */
+AiPlayer_t *aiCreate(int threads) {
+  AiPlayer_t *ai = calloc(1, sizeof *ai);
+
+  if (ai) {
+    pthread_mutex_init(&ai->lock, NULL);
+    pthread_cond_init(&ai->start, NULL);
+    pthread_cond_init(&ai->done, NULL);
+    atomic_init(&ai->next_job, 0);
+    if (threads > 0) {
+      ai->threads = calloc((size_t)threads, sizeof(pthread_t));
+    }
+    while (ai->threads && ai->thread_count < threads &&
+           pthread_create(&ai->threads[ai->thread_count], NULL, worker, ai) ==
+               0) {
+      ++ai->thread_count;
+    }
+  }
+
+  return ai;
+}
+
+/**
+ * \brief Выбирает положение для текущей фигуры.
+ * \param ai Автоигрок.
+ * \param params Параметры игры (фигура лежит на поле).
+ * \param best Выбранное положение (заполняется).
+ * \return 1, если ход найден, 0, если фигуре некуда встать.
+ */
+int aiChoose(AiPlayer_t *ai, const GameParams_t *params, Placement_t *best) {
+  uint16_t base[FIELD_HEIGHT + PIECE_SIZE];
+  Placement_t moves[MOVEGEN_MAX];
+
+  baseRows(params, base);
+  int n = genPlacements(base, params->cur_shape, moves);
+
+  ai->beam_size = 0;
+  for (int k = 0; k < n; ++k) {
+    AiCandidate_t c;
+    memcpy(c.rows, base, sizeof(base));
+    c.move = moves[k];
+    c.lines = lockPlacement(c.rows, params->cur_shape->piece, moves[k]);
+    c.score = aiEvaluate(c.rows, c.lines);
+
+    int pos = ai->beam_size;
+    while (pos > 0 && ai->beam[pos - 1].score < c.score) {
+      if (pos < AI_BEAM_WIDTH) {
+        ai->beam[pos] = ai->beam[pos - 1];
+      }
+      --pos;
+    }
+    if (pos < AI_BEAM_WIDTH) {
+      ai->beam[pos] = c;
+      if (ai->beam_size < AI_BEAM_WIDTH) {
+        ++ai->beam_size;
+      }
+    }
+  }
+
+  ai->next_piece = params->core.next_piece;
+  if (ai->thread_count > 0 && ai->beam_size > 1) {
+    pthread_mutex_lock(&ai->lock);
+    ai->finished = 0;
+    atomic_store(&ai->next_job, 0);
+    ai->generation += 1;
+    pthread_cond_broadcast(&ai->start);
+    pthread_mutex_unlock(&ai->lock);
+
+    drainJobs(ai);
+    pthread_mutex_lock(&ai->lock);
+    while (ai->finished < ai->thread_count) {
+      pthread_cond_wait(&ai->done, &ai->lock);
+    }
+    pthread_mutex_unlock(&ai->lock);
+  } else {
+    for (int i = 0; i < ai->beam_size; ++i) {
+      expandCandidate(ai, i);
+    }
+  }
+
+  int pick = -1;
+  for (int i = 0; i < ai->beam_size; ++i) {
+    if (pick < 0 || ai->beam[i].score > ai->beam[pick].score) {
+      pick = i;
+    }
+  }
+  if (pick >= 0) {
+    *best = ai->beam[pick].move;
+  }
+
+  return pick >= 0;
+}
+
+/**
+ * \brief Применяет действие к ожидаемому положению фигуры.
+ * \param rows Маски строк поля без фигуры.
+ * \param s Положение фигуры (изменяется).
+ * \param act Действие.
+ */
+static void predict(const uint16_t *rows, Shape *s, UserAction_t act) {
+  int x = s->x + (act == Left ? -1 : act == Right ? 1 : 0);
+  int y = s->y + (act == Up);
+  int rot = act == Action ? pieceTable[s->piece][s->rot].next : s->rot;
+
+  if (fitsBoard(rows, s->piece, rot, x, y)) {
+    s->x = x;
+    s->y = y;
+    s->rot = rot;
+  }
+}
+
+/**
+ * \brief Возвращает следующее действие автоигрока для экземпляра игры.
+ * Пока фигура идёт по плану, продолжает его; при новой фигуре или
+ * расхождении с планом выбирает ход заново.
+ * \param ai Автоигрок.
+ * \param params Параметры игры.
+ * \return Действие: Start до начала партии, Up (ничего не делать) на паузе и
+ * после конца игры.
+ */
+UserAction_t aiAction(AiPlayer_t *ai, const GameParams_t *params) {
+  UserAction_t act = Up;
+
+  if (*(params->state) == STATE_START) {
+    act = Start;
+  } else if (*(params->state) == STATE_GAME) {
+    const Shape *s = params->cur_shape;
+    uint16_t base[FIELD_HEIGHT + PIECE_SIZE];
+    Placement_t best;
+
+    baseRows(params, base);
+    if (ai->engine != params || ai->pieces != params->core.pieces ||
+        ai->path_pos >= ai->path_len || s->x != ai->expect.x ||
+        s->y != ai->expect.y || s->rot != ai->expect.rot) {
+      ai->engine = params;
+      ai->pieces = params->core.pieces;
+      ai->path_pos = 0;
+      ai->path_len = 0;
+      if (aiChoose(ai, params, &best)) {
+        ai->path_len = placementPath(base, s, best, ai->path, MOVEGEN_PATH_MAX);
+      }
+    }
+
+    act = ai->path_pos < ai->path_len ? ai->path[ai->path_pos++] : Down;
+    ai->expect = *s;
+    predict(base, &ai->expect, act);
+  }
+
+  return act;
+}
+
+/**
+ * \brief Останавливает рабочие потоки и освобождает автоигрока.
+ * \param ai Автоигрок (NULL допустим).
+ */
+void aiDestroy(AiPlayer_t *ai) {
+  if (ai) {
+    pthread_mutex_lock(&ai->lock);
+    ai->stop = 1;
+    pthread_cond_broadcast(&ai->start);
+    pthread_mutex_unlock(&ai->lock);
+    for (int i = 0; i < ai->thread_count; ++i) {
+      pthread_join(ai->threads[i], NULL);
+    }
+    free(ai->threads);
+    pthread_cond_destroy(&ai->done);
+    pthread_cond_destroy(&ai->start);
+    pthread_mutex_destroy(&ai->lock);
+    free(ai);
+  }
+}
@@ -0,0 +1,77 @@
+/**
+ * \file ai.h
+ * \brief Автоигрок: оценка поля и лучевой поиск по текущей и следующей
+ * фигуре с раздачей кандидатов рабочим потокам.
+ */
+
+#ifndef AI_H
+#define AI_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "back.h"
+#include "movegen.h"
+
+/// \brief Сколько лучших положений текущей фигуры проверяется со следующей.
+#define AI_BEAM_WIDTH 16
+
+/// \brief Признаки поля, из которых складывается оценка.
+typedef struct {
+  int height;
+  int holes;
+  int bumpiness;
+  int row_trans;
+  int col_trans;
+  int lines;
+} AiFeatures_t;
+
+/// \brief Кандидат лучевого поиска: поле после первой фигуры и его оценка.
+typedef struct {
+  uint16_t rows[FIELD_HEIGHT + PIECE_SIZE];
+  Placement_t move;
+  int lines;
+  double score;
+} AiCandidate_t;
+
+/**
+ * \brief Автоигрок.
+ *
+ * Рабочие потоки создаются один раз и ждут на start; на каждый ход им
+ * раздаются кандидаты первого уровня (счётчик next_job), каждый поток
+ * досчитывает для них лучший ход следующей фигуры и отмечается в finished.
+ * Кроме пула здесь лежит план текущего хода: путь к выбранному положению и
+ * ожидаемое положение фигуры после очередного действия — пока фигура там, где
+ * ожидалось, план продолжается, иначе (сработала гравитация, вмешался игрок)
+ * строится заново.
+ */
+typedef struct AiPlayer {
+  pthread_t *threads;
+  int thread_count;
+  pthread_mutex_t lock;
+  pthread_cond_t start;
+  pthread_cond_t done;
+  unsigned generation;
+  int stop;
+  int finished;
+  atomic_int next_job;
+  AiCandidate_t beam[AI_BEAM_WIDTH];
+  int beam_size;
+  int next_piece;
+
+  const GameParams_t *engine;
+  int pieces;
+  Shape expect;
+  UserAction_t path[MOVEGEN_PATH_MAX];
+  int path_len;
+  int path_pos;
+} AiPlayer_t;
+
+void aiFeatures(const uint16_t *rows, AiFeatures_t *f);
+double aiEvaluate(const uint16_t *rows, int lines);
+AiPlayer_t *aiCreate(int threads);
+int aiChoose(AiPlayer_t *ai, const GameParams_t *params, Placement_t *best);
+UserAction_t aiAction(AiPlayer_t *ai, const GameParams_t *params);
+void aiDestroy(AiPlayer_t *ai);
+
+#endif
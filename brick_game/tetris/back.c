@@ -8,13 +8,39 @@
 
 #include "back.h"
 
+#include "pool.h"
+#include "record.h"
+#include "repeat.h"
+#include "stats.h"
+#include "trace.h"
+#include "zobrist.h"
+
 #include <stdio.h>  /**< Для работы с NULL и файловыми функциями */
-#include <stdlib.h> /**< Для malloc, calloc, free, rand */
-#include <stdlib.h>
+#include <stdlib.h> /**< Для malloc, calloc, free */
+#include <string.h>
 #include <time.h>
 
+/// \brief Экземпляр по умолчанию, с которым работают userInput/updtInfo.
+static GameParams_t *default_params = NULL;
+
+/**
+ * \brief Отмечает, что цвета строк first..last поменялись: поднимает версию
+ * поля и записывает её этим строкам.
+ * \param params Указатель на структуру параметров игры.
+ * \param first Первая строка (отрицательные номера пропускаются).
+ * \param last Последняя строка (строки за дном пропускаются).
+ */
+void touchRows(GameParams_t *params, int first, int last) {
+  params->field_version += 1;
+  for (int y = first < 0 ? 0 : first; y <= last && y < FIELD_HEIGHT; ++y) {
+    params->row_version[y] = params->field_version;
+  }
+}
+
 /**
  * \brief Полностью очищает игровое поле, устанавливая все ячейки в 0.
+ * Маски строк сбрасываются к пустым (остаются только стены), строки под полем
+ * заполняются целиком и играют роль дна, все столбцы становятся пустыми.
  * \param params Указатель на структуру параметров игры.
  */
 void clearField(GameParams_t *params) {
@@ -22,9 +48,132 @@ void clearField(GameParams_t *params) {
     for (int j = 0; j < FIELD_WIDTH; ++j) {
       params->data->field[i][j] = 0;
     }
+    params->core.rows[i] = ROW_EMPTY;
+  }
+  for (int i = FIELD_HEIGHT; i < FIELD_HEIGHT + PIECE_SIZE; ++i) {
+    params->core.rows[i] = ROW_FULL;
   }
+  for (int j = 0; j < FIELD_WIDTH; ++j) {
+    params->core.skyline[j] = FIELD_HEIGHT;
+  }
+  params->core.hash = zobristNext(params->core.next_piece);
+  touchRows(params, 0, FIELD_HEIGHT - 1);
 }
 
+/**
+ * \brief Записывает цвет в клетку поля, синхронно обновляя маску строки.
+ * \param params Указатель на структуру параметров игры.
+ * \param y Строка клетки.
+ * \param x Столбец клетки.
+ * \param color Цвет (0 — пустая клетка).
+ */
+void setCell(GameParams_t *params, int y, int x, int color) {
+  uint16_t bit = (uint16_t)(1u << (x + ROW_OFFSET));
+
+  params->data->field[y][x] = color;
+  touchRows(params, y, y);
+  if ((color != 0) != ((params->core.rows[y] & bit) != 0)) {
+    params->core.hash ^= zobristCells(y, bit);
+  }
+  if (color != 0) {
+    params->core.rows[y] |= bit;
+    if (y < params->core.skyline[x]) {
+      params->core.skyline[x] = (int8_t)y;
+    }
+  } else {
+    params->core.rows[y] &= (uint16_t)~bit;
+    if (y == params->core.skyline[x]) {
+      updtSkyline(params);
+    }
+  }
+}
+
+/**
+ * \brief Пересчитывает высоты столбцов по маскам строк.
+ * Проход идёт сверху вниз, и каждый столбец получает строку первой занятой
+ * клетки; пустые столбцы получают FIELD_HEIGHT.
+ * \param params Указатель на структуру параметров игры.
+ */
+void updtSkyline(GameParams_t *params) {
+  uint16_t seen = ROW_EMPTY;
+
+  for (int x = 0; x < FIELD_WIDTH; ++x) {
+    params->core.skyline[x] = FIELD_HEIGHT;
+  }
+  for (int y = 0; y < FIELD_HEIGHT && seen != ROW_FULL; ++y) {
+    uint16_t fresh = params->core.rows[y] & (uint16_t)~seen;
+    for (int x = 0; fresh && x < FIELD_WIDTH; ++x) {
+      if (fresh & (1u << (x + ROW_OFFSET))) {
+        params->core.skyline[x] = (int8_t)y;
+      }
+    }
+    seen |= fresh;
+  }
+}
+
+/**
+ * \brief Геометрия всех фигур во всех ориентациях.
+ *
+ * Таблица получена из прежнего алгоритма поворота (транспонирование квадрата
+ * 4x4 со сдвигом на строку вверх, у палки — в столбец 1), поэтому поведение
+ * поворотов совпадает с ним один в один. Палка имеет три различные
+ * ориентации и после первого поворота переключается между 1 и 2, квадрат не
+ * вращается вовсе; неиспользуемые ячейки дублируют достижимые ориентации.
+ * Последнее поле — нижний профиль: самая нижняя занятая строка каждого
+ * столбца квадрата 4x4 (-1 для пустых столбцов).
+ */
+const PieceGeom_t pieceTable[PIECE_COUNT][ROT_COUNT] = {
+    /* I */
+    {
+        {{0xF, 0x0, 0x0, 0x0}, 0, 3, 0, 0, 1, {0, 0, 0, 0}},
+        {{0x2, 0x2, 0x2, 0x2}, 1, 1, 0, 3, 2, {-1, 3, -1, -1}},
+        {{0x0, 0xF, 0x0, 0x0}, 0, 3, 1, 1, 1, {1, 1, 1, 1}},
+        {{0x2, 0x2, 0x2, 0x2}, 1, 1, 0, 3, 2, {-1, 3, -1, -1}},
+    },
+    /* J */
+    {
+        {{0x1, 0x7, 0x0, 0x0}, 0, 2, 0, 1, 1, {1, 1, 1, -1}},
+        {{0x2, 0x2, 0x3, 0x0}, 0, 1, 0, 2, 2, {2, 2, -1, -1}},
+        {{0x0, 0x7, 0x4, 0x0}, 0, 2, 1, 2, 3, {1, 1, 2, -1}},
+        {{0x6, 0x2, 0x2, 0x0}, 1, 2, 0, 2, 0, {-1, 2, 0, -1}},
+    },
+    /* L */
+    {
+        {{0x4, 0x7, 0x0, 0x0}, 0, 2, 0, 1, 1, {1, 1, 1, -1}},
+        {{0x3, 0x2, 0x2, 0x0}, 0, 1, 0, 2, 2, {0, 2, -1, -1}},
+        {{0x0, 0x7, 0x1, 0x0}, 0, 2, 1, 2, 3, {2, 1, 1, -1}},
+        {{0x2, 0x2, 0x6, 0x0}, 1, 2, 0, 2, 0, {-1, 2, 2, -1}},
+    },
+    /* O */
+    {
+        {{0x6, 0x6, 0x0, 0x0}, 1, 2, 0, 1, 0, {-1, 1, 1, -1}},
+        {{0x6, 0x6, 0x0, 0x0}, 1, 2, 0, 1, 0, {-1, 1, 1, -1}},
+        {{0x6, 0x6, 0x0, 0x0}, 1, 2, 0, 1, 0, {-1, 1, 1, -1}},
+        {{0x6, 0x6, 0x0, 0x0}, 1, 2, 0, 1, 0, {-1, 1, 1, -1}},
+    },
+    /* S */
+    {
+        {{0x6, 0x3, 0x0, 0x0}, 0, 2, 0, 1, 1, {1, 1, 0, -1}},
+        {{0x1, 0x3, 0x2, 0x0}, 0, 1, 0, 2, 2, {1, 2, -1, -1}},
+        {{0x0, 0x6, 0x3, 0x0}, 0, 2, 1, 2, 3, {2, 2, 1, -1}},
+        {{0x2, 0x6, 0x4, 0x0}, 1, 2, 0, 2, 0, {-1, 1, 2, -1}},
+    },
+    /* T */
+    {
+        {{0x2, 0x7, 0x0, 0x0}, 0, 2, 0, 1, 1, {1, 1, 1, -1}},
+        {{0x2, 0x3, 0x2, 0x0}, 0, 1, 0, 2, 2, {1, 2, -1, -1}},
+        {{0x0, 0x7, 0x2, 0x0}, 0, 2, 1, 2, 3, {1, 2, 1, -1}},
+        {{0x2, 0x6, 0x2, 0x0}, 1, 2, 0, 2, 0, {-1, 2, 1, -1}},
+    },
+    /* Z */
+    {
+        {{0x3, 0x6, 0x0, 0x0}, 0, 2, 0, 1, 1, {0, 1, 1, -1}},
+        {{0x2, 0x3, 0x1, 0x0}, 0, 1, 0, 2, 2, {2, 1, -1, -1}},
+        {{0x0, 0x3, 0x6, 0x0}, 0, 2, 1, 2, 3, {1, 2, 2, -1}},
+        {{0x4, 0x6, 0x2, 0x0}, 1, 2, 0, 2, 0, {-1, 2, 1, -1}},
+    },
+};
+
 /**
  * \brief Удаляет текущую фигуру с поля, устанавливая соответствующие ячейки в
  * 0.
@@ -33,9 +182,15 @@ void clearField(GameParams_t *params) {
 void clearShape(GameParams_t *params) {
   int x = params->cur_shape->x;
   int y = params->cur_shape->y;
-  for (int i = 0; i < PIECE_SIZE; ++i) {
-    for (int j = 0; j < PIECE_SIZE; ++j) {
-      if (params->cur_shape->shape[i][j] != 0) {
+  const PieceGeom_t *g =
+      &pieceTable[params->cur_shape->piece][params->cur_shape->rot];
+
+  params->core.hash ^= zobristShape(params->cur_shape);
+  touchRows(params, y + g->top, y + g->bottom);
+  for (int i = g->top; i <= g->bottom; ++i) {
+    params->core.rows[y + i] &= (uint16_t) ~(g->rows[i] << (x + ROW_OFFSET));
+    for (int j = g->left; j <= g->right; ++j) {
+      if (g->rows[i] & (1u << j)) {
         params->data->field[y + i][x + j] = 0;
       }
     }
@@ -49,146 +204,143 @@ void clearShape(GameParams_t *params) {
 void placeShape(GameParams_t *params) {
   int x = params->cur_shape->x;
   int y = params->cur_shape->y;
-
-  for (int i = 0; i < PIECE_SIZE; ++i) {
-    for (int j = 0; j < PIECE_SIZE; ++j) {
-      if (params->cur_shape->shape[i][j] != 0) {
-        params->data->field[i + y][j + x] =
-            params->cur_shape->shape[i][j] * params->cur_shape->color;
+  const PieceGeom_t *g =
+      &pieceTable[params->cur_shape->piece][params->cur_shape->rot];
+
+  params->core.hash ^= zobristShape(params->cur_shape);
+  touchRows(params, y + g->top, y + g->bottom);
+  for (int i = g->top; i <= g->bottom; ++i) {
+    params->core.rows[y + i] |= (uint16_t)(g->rows[i] << (x + ROW_OFFSET));
+    for (int j = g->left; j <= g->right; ++j) {
+      if (g->rows[i] & (1u << j)) {
+        params->data->field[i + y][j + x] = params->cur_shape->color;
       }
     }
   }
 }
 
 /**
- * \brief Генерирует новую фигуру из набора стандартных семи случайным образом.
- * \param shape Инициализируемый двумерный массив размера PIECE_SIZE.
+ * \brief Фиксирует текущую фигуру на поле: размещает её и поднимает высоты
+ * столбцов, в которые она легла.
+ * \param params Указатель на структуру параметров игры.
  */
-void setNewShape(int **shape) {
-  const int shapes[7][PIECE_SIZE][PIECE_SIZE] = {
-      {{1, 1, 1, 1}, {0, 0, 0, 0}, {0, 0, 0, 0}, {0, 0, 0, 0}},
-
-      {{1, 0, 0, 0}, {1, 1, 1, 0}, {0, 0, 0, 0}, {0, 0, 0, 0}},
-
-      {{0, 0, 1, 0}, {1, 1, 1, 0}, {0, 0, 0, 0}, {0, 0, 0, 0}},
-
-      {{0, 1, 1, 0}, {0, 1, 1, 0}, {0, 0, 0, 0}, {0, 0, 0, 0}},
-
-      {{0, 1, 1, 0}, {1, 1, 0, 0}, {0, 0, 0, 0}, {0, 0, 0, 0}},
-
-      {{0, 1, 0, 0}, {1, 1, 1, 0}, {0, 0, 0, 0}, {0, 0, 0, 0}},
-
-      {{1, 1, 0, 0}, {0, 1, 1, 0}, {0, 0, 0, 0}, {0, 0, 0, 0}}};
-
-  int num_shape = rand() % 7;
+void lockShape(GameParams_t *params) {
+  int x = params->cur_shape->x;
+  int y = params->cur_shape->y;
+  const PieceGeom_t *g =
+      &pieceTable[params->cur_shape->piece][params->cur_shape->rot];
 
-  for (int i = 0; i < PIECE_SIZE; ++i) {
-    for (int j = 0; j < PIECE_SIZE; ++j) {
-      shape[i][j] = shapes[num_shape][i][j];
+  placeShape(params);
+  params->core.hash ^= zobristPiece(params->cur_shape);
+  for (int j = g->left; j <= g->right; ++j) {
+    int i = g->top;
+    while (!(g->rows[i] & (1u << j))) {
+      ++i;
+    }
+    if (y + i < params->core.skyline[x + j]) {
+      params->core.skyline[x + j] = (int8_t)(y + i);
     }
   }
 }
 
 /**
- * \brief Подсчитывает пустые столбцы слева от фигуры.
- * \param shape Двумерный массив фигуры.
- * \return Количество полностью пустых столбцов слева.
+ * \brief Переносит ориентацию фигуры в двумерный массив 4x4 (1 — занятая
+ * клетка). Используется для буфера next, который рисует фронт.
+ * \param target Заполняемый двумерный массив размера PIECE_SIZE.
+ * \param piece Номер фигуры.
+ * \param rot Ориентация фигуры.
  */
-int cntEmptyColsL(int **shape) {
-  int flag = 1;
-  int cnt = 0;
-
-  for (int i = 0; i < PIECE_SIZE && flag; ++i) {
-    for (int j = 0; j < PIECE_SIZE && flag; ++j) {
-      if (shape[j][i] != 0) {
-        flag = 0;
-      }
-    }
+void fillShape(int **target, int piece, int rot) {
+  const PieceGeom_t *g = &pieceTable[piece][rot];
 
-    if (flag) {
-      cnt += 1;
+  for (int i = 0; i < PIECE_SIZE; ++i) {
+    for (int j = 0; j < PIECE_SIZE; ++j) {
+      target[i][j] = (g->rows[i] >> j) & 1;
     }
   }
-
-  return cnt;
 }
 
 /**
- * \brief Подсчитывает количество полностью пустых столбцов справа от фигуры.
- * \param shape Двумерный массив фигуры.
- * \return Количество пустых столбцов справа.
+ * \brief Выбирает случайную фигуру: равновероятно или из перемешанного мешка
+ * всех семи фигур, в зависимости от randomizer.
+ * \param rng Генератор.
+ * \param randomizer Способ выбора (tetris_randomizer_t).
+ * \param bag Мешок из PIECE_COUNT фигур.
+ * \param bag_left Сколько фигур осталось в мешке (изменяется).
+ * \return Номер фигуры.
  */
-int cntEmptyColsR(int **shape) {
-  int flag = 1;
-  int cnt = 0;
+int drawPiece(Rng_t *rng, int randomizer, uint8_t *bag, int8_t *bag_left) {
+  int piece;
 
-  for (int i = 3; i >= 0 && flag; --i) {
-    for (int j = 0; j < PIECE_SIZE && flag; ++j) {
-      if (shape[j][i] != 0) {
-        flag = 0;
+  if (randomizer == TETRIS_RANDOM_BAG7) {
+    if (*bag_left == 0) {
+      for (int i = 0; i < PIECE_COUNT; ++i) {
+        bag[i] = (uint8_t)i;
       }
+      for (int i = PIECE_COUNT - 1; i > 0; --i) {
+        int j = rngBounded(rng, i + 1);
+        uint8_t tmp = bag[i];
+        bag[i] = bag[j];
+        bag[j] = tmp;
+      }
+      *bag_left = PIECE_COUNT;
     }
-
-    if (flag) {
-      cnt += 1;
-    }
+    *bag_left -= 1;
+    piece = bag[*bag_left];
+  } else {
+    piece = rngBounded(rng, PIECE_COUNT);
   }
 
-  return cnt;
+  return piece;
 }
 
 /**
- * \brief Вычисляет высоту фигуры.
- * Используется для корректной проверки выхода фигуры за нижнюю границу поля (в
- * isPossbl()).
- *
- * \param target Двумерный массив фигуры.
- * \return Высота фигуры в строках.
+ * \brief Выбирает случайную фигуру генератором экземпляра (см. drawPiece()).
+ * \param params Указатель на структуру параметров игры.
+ * \return Номер фигуры.
  */
-int height(int **target) {
-  int h = 0;
-  int flag = 0;
-
-  for (int i = 0; i < PIECE_SIZE; ++i) {
-    for (int j = 0; j < PIECE_SIZE; ++j) {
-      if (target[i][j] != 0) {
-        flag = 1;
-      }
-    }
-    if (flag) {
-      h += 1;
-      flag = 0;
-    }
-  }
+int randomPiece(GameParams_t *params) {
+  return drawPiece(&params->core.rng, params->core.randomizer, params->core.bag,
+                   &params->core.bag_left);
+}
 
-  return h;
+/**
+ * \brief Случайно выбирает следующую фигуру из набора стандартных семи и
+ * обновляет буфер next.
+ * \param params Указатель на структуру параметров игры.
+ */
+void setNewShape(GameParams_t *params) {
+  params->core.hash ^= zobristNext(params->core.next_piece);
+  params->core.next_piece = randomPiece(params);
+  params->core.hash ^= zobristNext(params->core.next_piece);
+  fillShape(params->data->next, params->core.next_piece, 0);
 }
 
 /**
- * \brief Проверяет, можно ли разместить фигуру в позиции (x,y).
- *  Выполняет проверку двух основных условий: границы поля и пересечение с уже
- * заполненными ячейками.
+ * \brief Проверяет, помещается ли ориентация фигуры в позицию (x,y) на поле,
+ * заданном только масками строк.
+ * Выход за границы поля определяется по габаритам ориентации из pieceTable,
+ * пересечение с заполненными ячейками — одной операцией AND на строку фигуры.
  *
- * \param params Параметры игры.
- * \param target Фигура.
+ * \param rows Маски строк поля (FIELD_HEIGHT + PIECE_SIZE штук).
+ * \param piece Номер фигуры.
+ * \param rot Ориентация фигуры.
  * \param x Координата x на поле.
  * \param y Координата y на поле.
  * \return 1, если возможно, иначе 0.
  */
-int isPossbl(const GameParams_t *params, int **target, int x, int y) {
+int fitsBoard(const uint16_t *rows, int piece, int rot, int x, int y) {
+  const PieceGeom_t *g = &pieceTable[piece][rot];
   int res = 1;
 
-  if (y + height(target) - 1 > FIELD_HEIGHT - 1 ||
-      x + 3 - cntEmptyColsR(target) > FIELD_WIDTH - 1 ||
-      x + cntEmptyColsL(target) < 0) {
+  if (x + g->left < 0 || x + g->right > FIELD_WIDTH - 1 || y + g->top < 0 ||
+      y + g->bottom > FIELD_HEIGHT - 1) {
     res = 0;
   }
 
-  for (int i = 0; i < PIECE_SIZE && res; ++i) {
-    for (int j = 0; j < PIECE_SIZE && res; ++j) {
-      if (target[i][j] != 0 && params->data->field[i + y][j + x] != 0) {
-        res = 0;
-      }
+  for (int i = g->top; i <= g->bottom && res; ++i) {
+    if (rows[y + i] & (uint16_t)(g->rows[i] << (x + ROW_OFFSET))) {
+      res = 0;
     }
   }
 
@@ -196,135 +348,103 @@ int isPossbl(const GameParams_t *params, int **target, int x, int y) {
 }
 
 /**
- * \brief Проверяет, является ли фигура квадратом.
- * Нужна для того, чтобы не поварачивать фигуру,
- * если она является квадратом, так как это не имеет смысла.
+ * \brief Проверяет, можно ли разместить фигуру в позиции (x,y).
  *
- * \param shape Фигура.
- * \return 1, если квадрат, иначе 0.
+ * \param params Параметры игры.
+ * \param piece Номер фигуры.
+ * \param rot Ориентация фигуры.
+ * \param x Координата x на поле.
+ * \param y Координата y на поле.
+ * \return 1, если возможно, иначе 0.
  */
-int isSquare(int **shape) {
-  int res = 0;
-  if (shape[0][1] != 0 && shape[0][2] != 0 && shape[1][1] != 0 &&
-      shape[1][2] != 0) {
-    res = 1;
-  }
-  return res;
+int isPossbl(const GameParams_t *params, int piece, int rot, int x, int y) {
+  return fitsBoard(params->core.rows, piece, rot, x, y);
 }
 
 /**
- * \brief Проверяет, является ли фигура вертикальной линией.
- * Нужна для более корректной отрисовки фигуры после поворота.
+ * @brief Поворачивает текущую фигуру, если это возможно.
+ *
+ * Новая ориентация берётся из поля next таблицы pieceTable, поэтому поворот
+ * не требует ни выделения памяти, ни пересчёта геометрии. У квадрата next
+ * указывает сам на себя, и поворот для него ничего не меняет.
  *
- * \param shape Фигура.
- * \return 1, если да, иначе 0.
+ * @param params Указатель на структуру с текущим состоянием и данными игры.
  */
-int isVertical(const int shape[PIECE_SIZE][PIECE_SIZE]) {
-  int res = 0;
-  int cnt = 0;
-
-  for (int x = 0; x < PIECE_SIZE && !res; ++x) {
-    for (int i = 0; i < PIECE_SIZE; ++i) {
-      if (shape[i][x] != 0) {
-        cnt += 1;
-      }
-    }
+void rotate(GameParams_t *params) {
+  int next = pieceTable[params->cur_shape->piece][params->cur_shape->rot].next;
 
-    if (cnt == 4) {
-      res = 1;
-    } else {
-      cnt = 0;
-    }
+  clearShape(params);
+  int fits = isPossbl(params, params->cur_shape->piece, next,
+                      params->cur_shape->x, params->cur_shape->y);
+  if (fits) {
+    params->cur_shape->rot = next;
+  }
+  placeShape(params);
+  if (statsEnabled()) {
+    statsRotate(!fits);
   }
-
-  return res;
 }
 
 /**
- * @brief Сдвигает символы в массиве после переворота для более красивого
- * отображения в поле
- *
- * @param tmp Массив с перевернутой фигурой
- * @param new Массив, куда запишется корректно перевернутая фигура
- */
-static void shiftAfterRotation(int tmp[PIECE_SIZE][PIECE_SIZE], int **new) {
-  if (isVertical(tmp)) {
-    for (int i = 0; i < PIECE_SIZE; ++i) {
-      for (int j = 0; j < PIECE_SIZE; ++j) {
-        if (j == 1) {
-          new[i][j] = 1;
-        } else {
-          new[i][j] = 0;
-        }
-      }
+ * \brief Проверяет, помещается ли текущая фигура на строке ny, не считая
+ * препятствием её собственные клетки (фигура может лежать на поле).
+ * \param params Параметры игры.
+ * \param ny Проверяемая координата y.
+ * \return 1, если помещается, иначе 0.
+ */
+static int fitsSelf(const GameParams_t *params, int ny) {
+  const Shape *s = params->cur_shape;
+  const PieceGeom_t *g = &pieceTable[s->piece][s->rot];
+  int res = 1;
+
+  for (int i = g->top; i <= g->bottom && res; ++i) {
+    uint16_t row = params->core.rows[ny + i];
+    int k = ny + i - s->y;
+    if (k >= g->top && k <= g->bottom) {
+      row &= (uint16_t)~(g->rows[k] << (s->x + ROW_OFFSET));
     }
-  } else {
-    for (int i = 0; i < PIECE_SIZE; ++i) {
-      for (int j = 0; j < PIECE_SIZE; ++j) {
-        if (i == PIECE_SIZE - 1) {
-          new[i][j] = 0;
-        } else {
-          new[i][j] = tmp[i + 1][j];
-        }
-      }
+    if (row & (uint16_t)(g->rows[i] << (s->x + ROW_OFFSET))) {
+      res = 0;
     }
   }
+
+  return res;
 }
 
 /**
- * @brief Поворачивает текущую фигуру на 90° по часовой стрелке, если это
- * возможно.
- *
- * Пошаговый алгоритм:
- *   1. Удаляет фигуру с поля (clearShape()).
- *   2. Формирует временный массив new с повёрнутым на 90° представлением
- * фигуры.
- *   3. Создаёт буфер cur, в который копирует new, сдвинув её вверх на одну
- * строку для корректного выравнивания.
- *   4. Проверяет возможность размещения cur на текущей позиции (isPossbl()).
- *   5. При допустимости поворота обновляет shape:
- *        - для вертикальной фигуры применяет new без сдвига.
- *        - для остальных фигур применяет сдвинутый cur.
- *   6. Освобождает память, занятую буфером cur.
- *   7. Размещает обновлённую фигуру на поле (placeShape()).
- *
- * @param params Указатель на структуру с текущим состоянием и данными игры.
+ * \brief Считает строку, на которой остановится текущая фигура при резком
+ * спуске (позиция «призрака»).
+ * Если в каждом столбце фигура выше верхней занятой клетки, ответ берётся
+ * сразу из нижнего профиля фигуры и высот столбцов. Иначе (фигура задвинута
+ * под навес) фигура опускается построчно.
+ * \param params Параметры игры; фигура может как лежать на поле, так и быть
+ * снята с него.
+ * \return Координата y фигуры после спуска.
  */
-void rotate(GameParams_t *params) {
-  clearShape(params);
-  int tmp[PIECE_SIZE][PIECE_SIZE];
-  int **new;
-  new = calloc(PIECE_SIZE, sizeof(int *));
-
-  if (!new) {
-    perror("calloc new[] failed");
-    exit(EXIT_FAILURE);
-  }
-
-  for (int i = 0; i < PIECE_SIZE; i++) {
-    new[i] = calloc(PIECE_SIZE, sizeof(int));
-  }
-  for (int i = 0; i < PIECE_SIZE; ++i) {
-    for (int j = 0; j < PIECE_SIZE; ++j) {
-      tmp[PIECE_SIZE - 1 - j][i] = params->cur_shape->shape[i][j];
+int ghostY(const GameParams_t *params) {
+  const Shape *s = params->cur_shape;
+  const PieceGeom_t *g = &pieceTable[s->piece][s->rot];
+  int land = FIELD_HEIGHT;
+  int above = 1;
+
+  for (int j = g->left; j <= g->right; ++j) {
+    int top = params->core.skyline[s->x + j];
+    if (s->y + g->profile[j] >= top) {
+      above = 0;
+    }
+    if (top - 1 - g->profile[j] < land) {
+      land = top - 1 - g->profile[j];
     }
   }
 
-  shiftAfterRotation(tmp, new);
-
-  if (isPossbl(params, new, params->cur_shape->x, params->cur_shape->y)) {
-    for (int i = 0; i < PIECE_SIZE; ++i) {
-      for (int j = 0; j < PIECE_SIZE; ++j) {
-        params->cur_shape->shape[i][j] = new[i][j];
-      }
+  if (!above) {
+    land = s->y;
+    while (fitsSelf(params, land + 1)) {
+      ++land;
     }
   }
-  for (int i = 0; i < PIECE_SIZE; i++) {
-    free(new[i]);
-    new[i] = NULL;
-  }
-  free(new);
-  placeShape(params);
+
+  return land;
 }
 
 /**
@@ -338,75 +458,78 @@ void rotate(GameParams_t *params) {
  * иначе 0.
  */
 int hasCollisBellow(GameParams_t *params) {
-  int fy, fx;
-  int res = 0;
-  for (int i = 0; i < PIECE_SIZE; ++i) {
-    for (int j = 0; j < PIECE_SIZE && !res; ++j) {
-      if (params->cur_shape->shape[i][j] != 0) {
-        fy = params->cur_shape->y + i + 1;
-        fx = params->cur_shape->x + j;
-
-        if (fy >= FIELD_HEIGHT || params->data->field[fy][fx] != 0) {
-          res = 1;
-        }
-      }
-    }
-  }
-  return res;
+  return !isPossbl(params, params->cur_shape->piece, params->cur_shape->rot,
+                   params->cur_shape->x, params->cur_shape->y + 1);
 }
 
 /**
  * \brief Размещает новую фигуру из буфера next на место текущей фигуры и
- * генерирует следующую.
+ * генерирует следующую. Вызывается только после фиксации (lockShape()),
+ * поэтому pieces, который растёт здесь, — сколько фигур зафиксировано с
+ * начала партии.
+ * Если фигура не поместилась, следующая не генерируется, а статистика
+ * учитывает неудачное появление.
  * \param params Параметры игры.
  */
 void spawnNew(GameParams_t *params) {
-  for (int i = 0; i < PIECE_SIZE; ++i) {
-    for (int j = 0; j < PIECE_SIZE; ++j) {
-      params->cur_shape->shape[i][j] = params->data->next[i][j];
-    }
-  }
+  traceBegin(TRACE_SPAWN);
+  params->core.pieces += 1;
+  params->cur_shape->piece = params->core.next_piece;
+  params->cur_shape->rot = 0;
   params->cur_shape->x = 3;
   params->cur_shape->y = 0;
-  params->cur_shape->color = (rand() % 7) + 1;
+  params->cur_shape->color = rngBounded(&params->core.rng, 7) + 1;
 
-  if (isPossbl(params, params->cur_shape->shape, params->cur_shape->x,
-               params->cur_shape->y)) {  // костыль против спавна новый х2
-    setNewShape(params->data->next);
+  int fits = isPossbl(params, params->cur_shape->piece, params->cur_shape->rot,
+                      params->cur_shape->x, params->cur_shape->y);
+  if (fits) {  // костыль против спавна новый х2
+    setNewShape(params);
   }
+  if (statsEnabled()) {
+    statsSpawn(!fits);
+  }
+  traceEnd(TRACE_SPAWN);
 }
 
 /**
- * \brief Обновляет счёт в зависимости от количества уничтоженных линий.
- * \param params Параметры игры.
+ * \brief Очки за одновременно снятые строки.
  * \param cnt Количество удалённых строк за ход.
+ * \return Очки (0, если строк не было).
  */
-void updtScore(GameParams_t *params, int cnt) {
+int lineScore(int cnt) {
+  int res = 0;
+
   if (cnt == 1) {
-    params->data->score += 100;
+    res = 100;
   } else if (cnt == 2) {
-    params->data->score += 300;
+    res = 300;
   } else if (cnt == 3) {
-    params->data->score += 700;
+    res = 700;
   } else if (cnt >= 4) {
-    params->data->score += 1500;
+    res = 1500;
   }
+
+  return res;
 }
 
 /**
- * \brief Обновляет рекордный счёт и сохраняет в файл.
+ * \brief Обновляет счёт в зависимости от количества уничтоженных линий.
+ * \param params Параметры игры.
+ * \param cnt Количество удалённых строк за ход.
+ */
+void updtScore(GameParams_t *params, int cnt) {
+  params->core.score += lineScore(cnt);
+}
+
+/**
+ * \brief Обновляет рекордный счёт. Новый рекорд передаётся в хранилище
+ * рекордов, которое запишет его в файл в фоне, не задерживая игру.
  * \param params Параметры игры.
  */
 void updtHighScore(GameParams_t *params) {
-  if (params->data->score > params->data->high_score) {
-    params->data->high_score = params->data->score;
-    FILE *f = fopen("record.txt", "w");
-    if (!f) {
-      perror("Error creating record.txt");
-    } else {
-      fprintf(f, "%d\n", params->data->high_score);
-      fclose(f);
-    }
+  if (params->core.score > params->core.high_score) {
+    params->core.high_score = params->core.score;
+    recordSubmit(params->record_path, params->core.high_score);
   }
 }
 
@@ -417,83 +540,120 @@ void updtHighScore(GameParams_t *params) {
  * \param cnt Количество удалённых строк.
  */
 void updtLevel(GameParams_t *params, int *new_lev, int cnt) {
-  if (params->data->score >= *new_lev && cnt != 0 && params->data->level < 10) {
-    params->data->level += 1;
+  if (params->core.score >= *new_lev && cnt != 0 && params->core.level < 10) {
+    params->core.level += 1;
     (*new_lev) += 600;
-    params->data->speed -= 100;
+    params->core.speed -= 100;
   }
 }
 
 /**
  * \brief Удаляет заполненные линии, сдвигает поле вниз. Обновляет параметры.
+ *
+ * Заполниться могли только строки, которые заняла последняя зафиксированная
+ * фигура (params->cur_shape), поэтому проверяются только они: маска строки
+ * сразу показывает, заполнена ли она. Поле уплотняется за один проход снизу
+ * вверх до верхней занятой строки: маски переносятся, а строки цветовой
+ * плоскости переставляются указателями, и освободившиеся строки очищаются и
+ * уходят наверх.
+ * Хеш позиции обновляется только по сдвинутым строкам: их старые маски
+ * убираются из него до уплотнения, новые добавляются после.
  * \param params Параметры игры.
  */
 void checkLines(GameParams_t *params) {
-  static int new_lev = 600;
-
+  const PieceGeom_t *g =
+      &pieceTable[params->cur_shape->piece][params->cur_shape->rot];
+  int first = params->cur_shape->y + g->top;
+  int last = params->cur_shape->y + g->bottom;
   int cnt = 0;
-  int flag = 1;
-  int indxs[FIELD_HEIGHT];
+  int *freed[PIECE_SIZE];
 
-  for (int y = 0; y < FIELD_HEIGHT; ++y) {
-    for (int x = 0; x < FIELD_WIDTH && flag; ++x) {
-      if (params->data->field[y][x] == 0) {
-        flag = 0;
-      }
-    }
+  if (first < 0) {
+    first = 0;
+  }
+  if (last > FIELD_HEIGHT - 1) {
+    last = FIELD_HEIGHT - 1;
+  }
 
-    if (flag) {
-      cnt += 1;
-      indxs[cnt - 1] = y;
-    } else {
-      flag = 1;
-    }
+  for (int y = first; y <= last; ++y) {
+    cnt += params->core.rows[y] == ROW_FULL;
   }
 
-  for (int k = cnt - 1; k >= 0; --k) {
-    int row = indxs[k];
+  if (cnt > 0) {
+    int **field = params->data->field;
+    int top = FIELD_HEIGHT;
+    int dst = last;
+    int n = 0;
+
     for (int x = 0; x < FIELD_WIDTH; ++x) {
-      params->data->field[row][x] = 0;
+      if (params->core.skyline[x] < top) {
+        top = params->core.skyline[x];
+      }
+    }
+    for (int y = top; y <= last; ++y) {
+      params->core.hash ^= zobristCells(y, params->core.rows[y]);
     }
 
-    for (int y = row; y >= 1; --y) {
+    for (int src = last; src >= top; --src) {
+      if (src >= first && params->core.rows[src] == ROW_FULL) {
+        freed[n++] = field[src];
+      } else {
+        params->core.rows[dst] = params->core.rows[src];
+        field[dst] = field[src];
+        --dst;
+      }
+    }
+    for (int k = 0; k < n; ++k, --dst) {
       for (int x = 0; x < FIELD_WIDTH; ++x) {
-        params->data->field[y][x] = params->data->field[y - 1][x];
+        freed[k][x] = 0;
       }
+      params->core.rows[dst] = ROW_EMPTY;
+      field[dst] = freed[k];
     }
-
-    for (int c = 0; c < k; ++c) {
-      indxs[c] += 1;
+    for (int y = top + n; y <= last; ++y) {
+      params->core.hash ^= zobristCells(y, params->core.rows[y]);
     }
+    touchRows(params, top, last);
+
+    updtSkyline(params);
   }
 
   updtScore(params, cnt);
   updtHighScore(params);
-  updtLevel(params, &new_lev, cnt);
+  updtLevel(params, &params->core.new_lev, cnt);
+  if (statsEnabled()) {
+    statsLock(cnt);
+  }
 }
 
 /**
- * \brief Автоматический спуск фигуры на одну линию вниз.
+ * \brief Автоматический спуск фигуры на одну линию вниз. В трассировке это
+ * отрезок TRACE_GRAVITY, а если фигура легла, в нём вложены TRACE_LOCK
+ * (фиксация и снятие линий) и TRACE_SPAWN.
  * \param params Параметры игры.
  */
 void autoDown(GameParams_t *params) {
+  traceBegin(TRACE_GRAVITY);
   clearShape(params);
 
   if (hasCollisBellow(params)) {
-    placeShape(params);
+    traceBegin(TRACE_LOCK);
+    lockShape(params);
     checkLines(params);
+    traceEnd(TRACE_LOCK);
     spawnNew(params);
   } else {
     params->cur_shape->y += 1;
   }
 
-  if (isPossbl(params, params->cur_shape->shape, params->cur_shape->x,
-               params->cur_shape->y)) {
+  if (isPossbl(params, params->cur_shape->piece, params->cur_shape->rot,
+               params->cur_shape->x, params->cur_shape->y)) {
     placeShape(params);
   } else {
     *(params->state) = STATE_EXIT;
-    params->data->pause = 2;
+    params->core.pause = 2;
   }
+  traceEnd(TRACE_GRAVITY);
 }
 
 /**
@@ -502,70 +662,142 @@ void autoDown(GameParams_t *params) {
  */
 void down(GameParams_t *params) {
   clearShape(params);
-  while (!hasCollisBellow(params)) {
-    params->cur_shape->y++;
-  }
-  placeShape(params);
-
+  params->cur_shape->y = ghostY(params);
+  traceBegin(TRACE_LOCK);
+  lockShape(params);
   checkLines(params);
+  traceEnd(TRACE_LOCK);
 
   spawnNew(params);
-  if (isPossbl(params, params->cur_shape->shape, params->cur_shape->x,
-               params->cur_shape->y)) {
+  if (isPossbl(params, params->cur_shape->piece, params->cur_shape->rot,
+               params->cur_shape->x, params->cur_shape->y)) {
     placeShape(params);
   } else {
     *(params->state) = STATE_EXIT;
-    params->data->pause = 2;
+    params->core.pause = 2;
   }
 }
 
 /**
- * \brief Освобождает всю выделенную память, связанную с параметрами игры.
+ * \brief Освобождает экземпляр игры. Экземпляр из пула возвращается в пул,
+ * отдельно созданный освобождается одним free().
  * \param params Указатель на структуру параметров игры.
  */
 void freeMemory(GameParams_t *params) {
-  if (params) {
-    if (params->data && params->data->field) {
-      for (int i = 0; i < FIELD_HEIGHT; i++) {
-        free(params->data->field[i]);
-        params->data->field[i] = NULL;
-      }
-      free(params->data->field);
-      params->data->field = NULL;
-    }
+  if (params && params == default_params) {
+    default_params = NULL;
+  }
 
-    if (params->data && params->data->next) {
-      for (int i = 0; i < PIECE_SIZE; i++) {
-        free(params->data->next[i]);
-        params->data->next[i] = NULL;
-      }
-      free(params->data->next);
-      params->data->next = NULL;
+  if (params && params->pool) {
+    poolRelease(params->pool, params);
+  } else {
+    free(params);
+  }
+}
+
+/**
+ * \brief Цвет клетки по маскам строк, когда цветовая плоскость устарела.
+ * Клетки падающей фигуры получают её цвет, зафиксированные клетки — прежний
+ * цвет, если он сохранился, иначе 7.
+ * \param params Экземпляр игры.
+ * \param y Строка клетки.
+ * \param x Столбец клетки.
+ * \return Цвет (0 — пустая клетка).
+ */
+static int viewColor(const GameParams_t *params, int y, int x) {
+  const Shape *s = &params->core.shape;
+  int dy = y - s->y;
+  int dx = x - s->x;
+  int placed = params->core.state == STATE_GAME ||
+               params->core.state == STATE_PAUSE;
+  int res = 0;
+
+  if ((params->core.rows[y] >> (x + ROW_OFFSET)) & 1u) {
+    res = params->data->field[y][x] ? params->data->field[y][x] : 7;
+    if (placed && dy >= 0 && dy < PIECE_SIZE && dx >= 0 && dx < PIECE_SIZE &&
+        ((pieceTable[s->piece][s->rot].rows[dy] >> dx) & 1u)) {
+      res = s->color;
     }
+  }
 
-    if (params->data) {
-      free(params->data);
-      params->data = NULL;
+  return res;
+}
+
+/**
+ * \brief Копирует состояние экземпляра в наблюдение без указателей.
+ * \param params Экземпляр игры.
+ * \param out Наблюдение (заполняется целиком).
+ */
+void fillObservation(const GameParams_t *params, tetris_observation_t *out) {
+  for (int y = 0; y < FIELD_HEIGHT; ++y) {
+    for (int x = 0; x < FIELD_WIDTH; ++x) {
+      out->field[y][x] = (unsigned char)(params->view_dirty
+                                             ? viewColor(params, y, x)
+                                             : params->data->field[y][x]);
+    }
+  }
+  for (int y = 0; y < PIECE_SIZE; ++y) {
+    uint8_t mask = pieceTable[params->core.next_piece][0].rows[y];
+    for (int x = 0; x < PIECE_SIZE; ++x) {
+      out->next[y][x] = (unsigned char)((mask >> x) & 1u);
     }
+  }
+  out->piece = params->cur_shape->piece;
+  out->next_piece = params->core.next_piece;
+  out->score = params->core.score;
+  out->high_score = params->core.high_score;
+  out->level = params->core.level;
+  out->speed = params->core.speed;
+  out->pause = params->core.pause;
+  out->pieces = params->core.pieces;
+}
 
-    if (params->cur_shape && params->cur_shape->shape) {
-      for (int i = 0; i < PIECE_SIZE; i++) {
-        free(params->cur_shape->shape[i]);
-        params->cur_shape->shape[i] = NULL;
+/**
+ * \brief Обновляет представление data по core: копирует числа и, если после
+ * restoreCore() цвета устарели, перерисовывает поле и буфер next.
+ * \param params Экземпляр игры.
+ */
+void syncView(GameParams_t *params) {
+  GameInfo_t *info = params->data;
+
+  if (params->view_dirty) {
+    for (int y = 0; y < FIELD_HEIGHT; ++y) {
+      for (int x = 0; x < FIELD_WIDTH; ++x) {
+        info->field[y][x] = viewColor(params, y, x);
       }
-      free(params->cur_shape->shape);
-      params->cur_shape->shape = NULL;
-      free(params->cur_shape);
-      params->cur_shape = NULL;
     }
+    fillShape(info->next, params->core.next_piece, 0);
+    params->view_dirty = 0;
+  }
+  info->score = params->core.score;
+  info->high_score = params->core.high_score;
+  info->level = params->core.level;
+  info->speed = params->core.speed;
+  info->pause = params->core.pause;
+}
 
-    if (params->state) {
-      free(params->state);
-      params->state = NULL;
-    }
+/**
+ * \brief Снимает состояние партии.
+ * \param params Экземпляр игры.
+ * \param core Снимок (заполняется).
+ */
+void saveCore(const GameParams_t *params, GameCore_t *core) {
+  memcpy(core, &params->core, sizeof *core);
+}
 
-    free(params);
-  }
+/**
+ * \brief Возвращает экземпляр к снимку, снятому saveCore() с этого или
+ * другого экземпляра. Цвета поля перерисуются при следующем чтении
+ * представления (syncView(), fillObservation()); удержание клавиши
+ * сбрасывается.
+ * \param params Экземпляр игры.
+ * \param core Снимок.
+ */
+void restoreCore(GameParams_t *params, const GameCore_t *core) {
+  memcpy(&params->core, core, sizeof *core);
+  params->view_dirty = 1;
+  params->repeat.active = 0;
+  touchRows(params, 0, FIELD_HEIGHT - 1);
 }
 
 /**
@@ -585,11 +817,13 @@ static void showErr(GameParams_t *params) {
  * \param params Указатель на структуру параметров игры.
  */
 void setStat(GameParams_t *params) {
-  params->data->score = 0;
-  params->data->high_score = 0;
-  params->data->level = 1;
-  params->data->speed = 1000;
-  params->data->pause = 0;
+  params->core.score = 0;
+  params->core.high_score = 0;
+  params->core.level = 1;
+  params->core.speed = 1000;
+  params->core.pause = 0;
+  params->core.new_lev = 600;
+  params->core.pieces = 0;
 }
 
 /**
@@ -597,80 +831,139 @@ void setStat(GameParams_t *params) {
  * \param params Указатель на структуру параметров игры.
  */
 void setCurShape(GameParams_t *params) {
-  params->cur_shape = malloc(sizeof *(params->cur_shape));
-  if (!params->cur_shape) {
-    showErr(params);
-  }
-  params->cur_shape->shape = calloc(PIECE_SIZE, sizeof(int *));
-  if (!params->cur_shape->shape) {
-    showErr(params);
-  }
-  for (int i = 0; i < PIECE_SIZE; i++) {
-    params->cur_shape->shape[i] = calloc(PIECE_SIZE, sizeof(int));
-  }
-  setNewShape(params->cur_shape->shape);
+  params->cur_shape->piece = randomPiece(params);
+  params->cur_shape->rot = 0;
   params->cur_shape->x = 3;
   params->cur_shape->y = 0;
-  params->cur_shape->color = (rand() % 7) + 1;
+  params->cur_shape->color = rngBounded(&params->core.rng, 7) + 1;
 }
 
 /**
- * \brief Инициализация и получение глобального указателя на параметры игры.
- * \return Указатель на статический объект GameParams_t.
+ * \brief Читает рекорд из файла рекордов.
+ * \param path Путь к файлу (NULL — record.txt, "" — рекорды не сохраняются).
+ * \return Сохранённый рекорд или 0, если файла нет.
  */
-GameParams_t *getParams() {
-  static GameParams_t *params = NULL;
+int readHighScore(const char *path) { return recordRead(path); }
 
-  if (params == NULL) {
-    srand((unsigned)time(NULL));
+/**
+ * \brief Зерно для экземпляра без явной конфигурации: текущее время,
+ * перемешанное с адресом экземпляра, чтобы созданные в одну секунду
+ * экземпляры не совпадали.
+ * \param params Экземпляр игры.
+ * \return Зерно генератора.
+ */
+static uint64_t defaultSeed(const GameParams_t *params) {
+  uint64_t z = (uint64_t)time(NULL) ^ ((uint64_t)(uintptr_t)params << 16);
 
-    params = malloc(sizeof *params);
-    if (!params) {
-      showErr(params);
-    }
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
 
-    params->state = malloc(sizeof *(params->state));
-    if (!params->state) {
-      showErr(params);
-    }
-    *(params->state) = STATE_START;
+/**
+ * \brief Раскладывает экземпляр игры внутри блока и приводит его в состояние
+ * STATE_START. Память не выделяется: все указатели ссылаются внутрь блока.
+ * \param block Блок памяти под экземпляр.
+ * \param high_score Рекорд, с которым начинается партия.
+ * \param config Зерно, способ выбора фигур и файл рекордов; NULL — равномерный
+ * выбор, зерно от текущего времени и record.txt.
+ * \return Указатель на параметры игры (совпадает с адресом блока).
+ */
+GameParams_t *initParams(GameBlock_t *block, int high_score,
+                         const tetris_config_t *config) {
+  GameParams_t *params = &block->params;
+
+  // снимки партии сравниваются и пишутся в повторы побайтно, поэтому в core
+  // не остаётся неинициализированных байт (например, неиспользуемого мешка)
+  memset(&params->core, 0, sizeof params->core);
+  if (config) {
+    params->seed = config->seed;
+    params->core.randomizer = config->randomizer;
+    params->record_path = config->record_path;
+  } else {
+    params->seed = defaultSeed(params);
+    params->core.randomizer = TETRIS_RANDOM_UNIFORM;
+    params->record_path = NULL;
+  }
+  rngSeed(&params->core.rng, params->seed);
+  params->core.bag_left = 0;
+
+  params->data = &block->info;
+  params->state = &params->core.state;
+  params->cur_shape = &params->core.shape;
+  params->pool = NULL;
+  params->view_dirty = 0;
+  params->field_version = 0;
+  memset(params->row_version, 0, sizeof params->row_version);
+  repeatInit(&params->repeat);
+
+  for (int i = 0; i < FIELD_HEIGHT; i++) {
+    block->field_rows[i] = block->field_cells[i];
+  }
+  for (int i = 0; i < PIECE_SIZE; i++) {
+    block->next_rows[i] = block->next_cells[i];
+  }
+  params->data->field = block->field_rows;
+  params->data->next = block->next_rows;
 
-    params->data = malloc(sizeof *(params->data));
-    if (!params->data) {
-      showErr(params);
-    }
+  *(params->state) = STATE_START;
+  setStat(params);
+  params->core.high_score = high_score;
+  setCurShape(params);
+  setNewShape(params);
+  clearField(params);
+  syncView(params);
 
-    setStat(params);
-    setCurShape(params);
+  return params;
+}
 
-    params->data->next = calloc(PIECE_SIZE, sizeof(int *));
-    for (int i = 0; i < PIECE_SIZE; i++) {
-      params->data->next[i] = calloc(PIECE_SIZE, sizeof(int));
-    }
-    setNewShape(params->data->next);
+/**
+ * \brief Создаёт новый независимый экземпляр игры в состоянии STATE_START.
+ * \param config Параметры экземпляра (NULL — параметры по умолчанию).
+ * \return Указатель на созданную структуру GameParams_t.
+ */
+GameParams_t *newParams(const tetris_config_t *config) {
+  GameBlock_t *block = aligned_alloc(CACHE_LINE, sizeof *block);
+  if (!block) {
+    showErr(NULL);
+  }
 
-    params->data->field = calloc(FIELD_HEIGHT, sizeof(int *));
-    for (int i = 0; i < FIELD_HEIGHT; i++) {
-      params->data->field[i] = calloc(FIELD_WIDTH, sizeof(int));
-    }
+  return initParams(block, readHighScore(config ? config->record_path : NULL),
+                    config);
+}
 
-    FILE *f = fopen("record.txt", "r");
-    if (f) {
-      fscanf(f, "%d", &(params->data->high_score));
-      fclose(f);
-    }
+/**
+ * \brief Инициализация и получение экземпляра игры по умолчанию.
+ * После Terminate экземпляр освобождается, и следующий вызов создаёт новый.
+ * \return Указатель на экземпляр GameParams_t по умолчанию.
+ */
+GameParams_t *getParams() {
+  if (default_params == NULL) {
+    default_params = newParams(NULL);
   }
 
-  return params;
+  return default_params;
 }
 
 /**
- * \brief Обновление состояния игры в ответ на действие пользователя.
+ * \brief Обновление состояния конкретного экземпляра игры в ответ на действие
+ * пользователя. Terminate переводит игру в STATE_EXIT, но память не
+ * освобождает — это делает владелец экземпляра. При включённой статистике
+ * время действия попадает в гистограмму его вида (statsAction()), при
+ * включённой трассировке действие игрока — отрезок TRACE_INPUT (тик
+ * гравитации Up отмечает сам autoDown()). При переходе в паузу или выход
+ * фоновый поток записи рекордов будится, но запись его не ждёт.
+ * \param params Экземпляр игры.
  * \param action Действие пользователя (Start, Pause, Left, Right, Up, Down,
  * Action, Terminate).
  */
-void updtInfo(UserAction_t action) {
-  GameParams_t *params = getParams();
+void updtGame(GameParams_t *params, UserAction_t action) {
+  GameState_t was = *(params->state);
+  uint64_t t0 = statsEnabled() ? statsClock() : 0;
+
+  if (action != Up) {
+    traceBegin(TRACE_INPUT);
+  }
 
   if (action == Start) {
     if (*(params->state) == STATE_START) {
@@ -681,37 +974,58 @@ void updtInfo(UserAction_t action) {
   } else if (action == Pause && *(params->state) != STATE_EXIT) {
     if (*(params->state) == STATE_PAUSE) {
       *(params->state) = STATE_GAME;
-      params->data->pause = 0;
+      params->core.pause = 0;
     } else {
       *(params->state) = STATE_PAUSE;
-      params->data->pause = 1;
+      params->core.pause = 1;
     }
   } else if (action == Terminate) {
-    freeMemory(params);
+    *(params->state) = STATE_EXIT;
   } else if ((action == Left || action == Right) &&
              *(params->state) == STATE_GAME) {
+    int dx = action == Left ? -1 : 1;
     clearShape(params);
-    if (action == Left &&
-        params->cur_shape->x - 1 >=
-            0 - cntEmptyColsL(params->cur_shape->shape) &&
-        isPossbl(params, params->cur_shape->shape, params->cur_shape->x - 1,
-                 params->cur_shape->y)) {
-      params->cur_shape->x -= 1;
-    } else if (action == Right &&
-               (params->cur_shape->x + 1) <=
-                   6 + cntEmptyColsR(params->cur_shape->shape) &&
-               isPossbl(params, params->cur_shape->shape,
-                        params->cur_shape->x + 1, params->cur_shape->y)) {
-      params->cur_shape->x += 1;
+    if (isPossbl(params, params->cur_shape->piece, params->cur_shape->rot,
+                 params->cur_shape->x + dx, params->cur_shape->y)) {
+      params->cur_shape->x += dx;
     }
     placeShape(params);
   } else if (action == Down && *(params->state) == STATE_GAME) {
     down(params);
   } else if (action == Action && *(params->state) == STATE_GAME) {
-    if (!isSquare(params->cur_shape->shape)) {
-      rotate(params);
-    }
+    rotate(params);
   } else if (action == Up && *(params->state) == STATE_GAME) {
     autoDown(params);
   }
-}
\ No newline at end of file
+
+  if (*(params->state) != was &&
+      (*(params->state) == STATE_PAUSE || *(params->state) == STATE_EXIT)) {
+    recordKick();
+  }
+  if (t0) {
+    statsAction(action, statsClock() - t0);
+  }
+  if (action != Up) {
+    traceEnd(TRACE_INPUT);
+  }
+}
+
+/**
+ * \brief Обновление состояния игры по умолчанию в ответ на действие
+ * пользователя. На Terminate экземпляр по умолчанию освобождается.
+ * \param action Действие пользователя (Start, Pause, Left, Right, Up, Down,
+ * Action, Terminate).
+ */
+void updtInfo(UserAction_t action) {
+  GameParams_t *params = getParams();
+
+  if (action == Terminate) {
+    uint64_t t0 = statsEnabled() ? statsClock() : 0;
+    freeMemory(params);
+    if (t0) {
+      statsAction(action, statsClock() - t0);
+    }
+  } else {
+    updtGame(params, action);
+  }
+}
@@ -10,42 +10,207 @@
 #define FIELD_WIDTH 10
 #define FIELD_HEIGHT 20
 #define PIECE_SIZE 4
+/// \brief Количество различных фигур.
+#define PIECE_COUNT 7
+/// \brief Количество ориентаций фигуры в таблице.
+#define ROT_COUNT 4
+/// \brief Размер кэш-линии, по которому выравниваются экземпляры игры.
+#define CACHE_LINE 64
+
+/// \brief Сдвиг столбца 0 внутри битовой маски строки (слева три бита стены).
+#define ROW_OFFSET 3
+/// \brief Маска полностью заполненной строки (вместе со стенами).
+#define ROW_FULL ((uint16_t)0xFFFFu)
+/// \brief Маска пустой строки: заняты только биты стен по краям поля.
+#define ROW_EMPTY \
+  ((uint16_t)(ROW_FULL & ~(((1u << FIELD_WIDTH) - 1u) << ROW_OFFSET)))
+
+#include <stdint.h>
 
 #include "../../layer/game.h"
+#include "rng.h"
 
 /// \brief Возможные состояния игрового цикла.
 typedef enum { STATE_START, STATE_GAME, STATE_PAUSE, STATE_EXIT } GameState_t;
 
+/// \brief Номера фигур в таблице pieceTable.
+typedef enum {
+  PIECE_I,
+  PIECE_J,
+  PIECE_L,
+  PIECE_O,
+  PIECE_S,
+  PIECE_T,
+  PIECE_Z
+} PieceId_t;
+
+/**
+ * \brief Заранее посчитанная геометрия одной ориентации фигуры.
+ * Строка i фигуры хранится маской rows[i] (бит j — столбец j квадрата 4x4),
+ * left/right/top/bottom — крайние занятые столбцы и строки, next — ориентация,
+ * в которую фигура переходит при повороте, profile[j] — нижняя занятая строка
+ * столбца j (-1, если столбец пуст).
+ */
+typedef struct {
+  uint8_t rows[PIECE_SIZE];
+  int8_t left;
+  int8_t right;
+  int8_t top;
+  int8_t bottom;
+  int8_t next;
+  int8_t profile[PIECE_SIZE];
+} PieceGeom_t;
+
+extern const PieceGeom_t pieceTable[PIECE_COUNT][ROT_COUNT];
+
 /// \brief Структура, описывающая текущую фигуру на поле.
 typedef struct {
+  int piece;
+  int rot;
   int color;
   int x;
   int y;
-  int **shape;
 } Shape;
 
-/// \brief Основная структура с параметрами игры.
+/**
+ * \brief Состояние партии без указателей.
+ *
+ * Здесь лежит всё, от чего зависит дальнейшая игра: маски строк поля (вместе
+ * с падающей фигурой), высоты столбцов, текущая и следующая фигуры, счёт,
+ * рекорд, уровень, скорость, состояние цикла и генератор фигур. Структура
+ * не содержит указателей и умещается в две кэш-линии, поэтому снимок партии
+ * и откат к нему — это memcpy (saveCore(), restoreCore()).
+ *
+ * rows — битовые маски занятости (бит ROW_OFFSET + x соответствует столбцу
+ * x). Биты за пределами поля всегда взведены и работают как стены, а
+ * PIECE_SIZE строк под полем заполнены целиком и служат дном, поэтому
+ * проверка столкновения сводится к AND масок, а заполненная строка равна
+ * ROW_FULL. skyline[x] — строка верхней зафиксированной клетки столбца x
+ * (FIELD_HEIGHT для пустого столбца); падающая фигура в нём не учитывается.
+ * Высоты обновляются при фиксации фигуры (lockShape()) и после снятия линий.
+ * При randomizer == TETRIS_RANDOM_BAG7 очередные фигуры берутся из bag, пока
+ * bag_left не обнулится. pieces — сколько фигур зафиксировано с начала
+ * партии. hash — хеш Зобриста поля, падающей и следующей фигур; он
+ * поддерживается инкрементально (см. zobrist.h).
+ */
+typedef struct {
+  uint16_t rows[FIELD_HEIGHT + PIECE_SIZE];
+  Rng_t rng;
+  uint64_t hash;
+  int score;
+  int high_score;
+  int new_lev;
+  int pieces;
+  Shape shape;
+  GameState_t state;
+  int16_t speed;
+  int8_t skyline[FIELD_WIDTH];
+  int8_t next_piece;
+  int8_t level;
+  int8_t pause;
+  int8_t randomizer;
+  int8_t bag_left;
+  uint8_t bag[PIECE_COUNT];
+} GameCore_t;
+
+_Static_assert(sizeof(GameCore_t) <= 2 * CACHE_LINE,
+               "GameCore_t must stay within two cache lines");
+
+/**
+ * \brief Автоповтор удерживаемой клавиши.
+ *
+ * das — задержка перед первым повтором сдвига, arr — период повторов сдвига,
+ * sdr — период повторов мягкого спуска (Up), всё в мс часов движка. Пока
+ * active, удерживается held; wait — сколько мс осталось до следующего
+ * повтора (не больше нуля — повтор уже наступил). В состояние партии не
+ * входит: это ввод, а не позиция.
+ */
 typedef struct {
+  int das;
+  int arr;
+  int sdr;
+  int active;
+  UserAction_t held;
+  int wait;
+} AutoRepeat_t;
+
+/**
+ * \brief Основная структура с параметрами игры.
+ *
+ * Партия целиком описывается core; cur_shape и state указывают внутрь него.
+ * data — представление для фронта: цвета клеток, буфер next и копия чисел из
+ * core, которую syncView() обновляет при чтении (updateCurrentState(),
+ * tetris_state()). Цвета зафиксированных клеток в core не входят, поэтому
+ * после restoreCore() цветовая плоскость перестраивается по маскам лениво
+ * (view_dirty).
+ *
+ * Всё состояние партии хранится здесь, поэтому в одном процессе может
+ * работать сколько угодно независимых экземпляров (см. tetris_engine_t).
+ * pool указывает на пул, из которого выдан экземпляр (NULL, если экземпляр
+ * выделен отдельно через newParams()). record_path — файл рекордов из
+ * конфигурации (NULL — record.txt).
+ *
+ * field_version растёт при каждом изменении цветов поля, а row_version[y]
+ * запоминает field_version последнего изменения строки y (touchRows()). По
+ * ним отрисовка узнаёт, какие строки поменялись с уже нарисованного снимка,
+ * даже если промежуточные снимки она пропустила.
+ *
+ * repeat — удерживаемая клавиша и настройки автоповтора (см. repeat.h).
+ */
+struct GameParams {
+  GameCore_t core;
   GameInfo_t *data;
   GameState_t *state;
   Shape *cur_shape;
-} GameParams_t;
+  struct EnginePool *pool;
+  uint64_t seed;
+  const char *record_path;
+  int view_dirty;
+  uint64_t field_version;
+  uint64_t row_version[FIELD_HEIGHT];
+  AutoRepeat_t repeat;
+};
 
+typedef struct GameParams GameParams_t;
+
+/**
+ * \brief Раскладка экземпляра игры в памяти.
+ *
+ * Экземпляр целиком живёт в одном блоке, выровненном по CACHE_LINE. В начале
+ * лежит состояние партии (GameCore_t), за ним — цветовая плоскость и буфер
+ * next, которые нужны только для отрисовки.
+ * Указатели data, state и cur_shape ссылаются внутрь этого же блока, поэтому
+ * экземпляр создаётся и освобождается одним вызовом аллокатора.
+ */
+typedef struct {
+  _Alignas(CACHE_LINE) GameParams_t params;
+  GameInfo_t info;
+  int *field_rows[FIELD_HEIGHT];
+  int *next_rows[PIECE_SIZE];
+  int field_cells[FIELD_HEIGHT][FIELD_WIDTH];
+  int next_cells[PIECE_SIZE][PIECE_SIZE];
+} GameBlock_t;
+
+void touchRows(GameParams_t *params, int first, int last);
 void clearField(GameParams_t *params);
+void setCell(GameParams_t *params, int y, int x, int color);
+void updtSkyline(GameParams_t *params);
 void clearShape(GameParams_t *params);
 void placeShape(GameParams_t *params);
-void setNewShape(int **shape);
-
-int cntEmptyColsL(int **shape);
-int cntEmptyColsR(int **shape);
-int height(int **target);
-int isPossbl(const GameParams_t *params, int **target, int x, int y);
-int isSquare(int **shape);
-int isVertical(const int target[PIECE_SIZE][PIECE_SIZE]);
+void lockShape(GameParams_t *params);
+void fillShape(int **target, int piece, int rot);
+int drawPiece(Rng_t *rng, int randomizer, uint8_t *bag, int8_t *bag_left);
+int randomPiece(GameParams_t *params);
+void setNewShape(GameParams_t *params);
+
+int fitsBoard(const uint16_t *rows, int piece, int rot, int x, int y);
+int isPossbl(const GameParams_t *params, int piece, int rot, int x, int y);
 void rotate(GameParams_t *params);
 
+int ghostY(const GameParams_t *params);
 int hasCollisBellow(GameParams_t *params);
 void spawnNew(GameParams_t *params);
+int lineScore(int cnt);
 void updtScore(GameParams_t *params, int cnt);
 void updtHighScore(GameParams_t *params);
 void updtLevel(GameParams_t *params, int *new_lev, int cnt);
@@ -54,11 +219,20 @@ void autoDown(GameParams_t *params);
 void down(GameParams_t *params);
 
 void freeMemory(GameParams_t *params);
+void fillObservation(const GameParams_t *params, tetris_observation_t *out);
+void syncView(GameParams_t *params);
+void saveCore(const GameParams_t *params, GameCore_t *core);
+void restoreCore(GameParams_t *params, const GameCore_t *core);
 
 void setStat(GameParams_t *params);
 void setCurShape(GameParams_t *params);
+int readHighScore(const char *path);
+GameParams_t *initParams(GameBlock_t *block, int high_score,
+                         const tetris_config_t *config);
+GameParams_t *newParams(const tetris_config_t *config);
 GameParams_t *getParams();
 
+void updtGame(GameParams_t *params, UserAction_t action);
 void updtInfo(UserAction_t action);
 
 #endif
\ No newline at end of file
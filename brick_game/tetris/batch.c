@@ -0,0 +1,312 @@
+/**
+ * \file batch.c
+ * \brief Реализация пакетного окружения.
+ *
+ * Ход делается проходами по всем полям сразу: сдвиг или поворот, спуск на
+ * строку, затем резкий спуск тех, кто его запросил, — все поля опускаются на
+ * строку за проход, пока хоть одно ещё падает. Проверка столкновения не
+ * ветвится и всегда смотрит PIECE_SIZE строк (пустые строки фигуры ничего не
+ * задевают), так что эти циклы одинаковы для всех полей. Фиксация фигуры,
+ * снятие линий и новая партия случаются редко и делаются отдельно только для
+ * тех полей, где фигура легла.
+ */
+
+#include "batch.h"
+
+#include <stdlib.h>
+#include <time.h>
+
+/**
+ * \brief Отводит место под массив внутри общего блока.
+ * \param off Занятый объём блока (увеличивается).
+ * \param size Размер массива.
+ * \return Смещение массива в блоке (кратно CACHE_LINE).
+ */
+static size_t carve(size_t *off, size_t size) {
+  size_t at = *off;
+
+  *off += (size + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+  return at;
+}
+
+/**
+ * \brief Проверяет, задевает ли ориентация фигуры в позиции (x, y) занятые
+ * клетки или стены поля k.
+ * y не больше FIELD_HEIGHT, поэтому все PIECE_SIZE строк лежат внутри поля
+ * вместе с дном.
+ * \param env Пакет.
+ * \param k Номер поля.
+ * \param piece Номер фигуры.
+ * \param rot Ориентация.
+ * \param x Координата x.
+ * \param y Координата y.
+ * \return 1 при столкновении, иначе 0.
+ */
+static inline int hits(const BatchEnv_t *env, int k, int piece, int rot, int x,
+                       int y) {
+  const uint8_t *m = pieceTable[piece][rot].rows;
+  const uint16_t *rows = env->rows + (size_t)y * (size_t)env->count + (size_t)k;
+  int sh = x + ROW_OFFSET;
+  uint32_t hit = sh < 0;
+
+  sh = sh < 0 ? 0 : sh;
+  for (int i = 0; i < PIECE_SIZE; ++i) {
+    uint32_t cells = (uint32_t)m[i] << sh;
+    hit |= (rows[(size_t)i * (size_t)env->count] & cells) | (cells >> 16);
+  }
+
+  return hit != 0;
+}
+
+/**
+ * \brief Начинает на поле k новую партию, как initParams() и Start у
+ * экземпляра игры.
+ * \param env Пакет.
+ * \param k Номер поля.
+ * \param seed Зерно партии.
+ */
+static void startBoard(BatchEnv_t *env, int k, uint64_t seed) {
+  size_t n = (size_t)env->count;
+
+  for (int y = 0; y < BATCH_ROWS; ++y) {
+    env->rows[(size_t)y * n + (size_t)k] =
+        y < FIELD_HEIGHT ? ROW_EMPTY : ROW_FULL;
+  }
+  env->seed[k] = seed;
+  rngSeed(&env->rng[k], seed);
+  env->bag_left[k] = 0;
+  env->score[k] = 0;
+  env->level[k] = 1;
+  env->new_lev[k] = 600;
+  env->pieces[k] = 0;
+  env->piece[k] = (int8_t)drawPiece(&env->rng[k], env->randomizer, env->bag[k],
+                                    &env->bag_left[k]);
+  rngBounded(&env->rng[k], 7);  // цвет: генератор идёт в ногу с экземпляром
+  env->rot[k] = 0;
+  env->x[k] = 3;
+  env->y[k] = 0;
+  env->next[k] = (int8_t)drawPiece(&env->rng[k], env->randomizer, env->bag[k],
+                                   &env->bag_left[k]);
+}
+
+/**
+ * \brief Фиксирует фигуру поля k, снимает заполненные строки, начисляет очки
+ * и выпускает следующую фигуру.
+ * Строки выше стакана пусты, поэтому уплотнение идёт снизу вверх только до
+ * первой пустой строки.
+ * \param env Пакет.
+ * \param k Номер поля.
+ * \param reward Очки за снятые строки (заполняется).
+ * \return 1, если новая фигура поместилась, 0 — конец партии.
+ */
+static int lockBoard(BatchEnv_t *env, int k, int *reward) {
+  size_t n = (size_t)env->count;
+  uint16_t *rows = env->rows + k;
+  const PieceGeom_t *g = &pieceTable[env->piece[k]][env->rot[k]];
+  int first = env->y[k] + g->top;
+  int last = env->y[k] + g->bottom;
+  int cnt = 0;
+
+  for (int i = g->top; i <= g->bottom; ++i) {
+    uint16_t *row = &rows[(size_t)(env->y[k] + i) * n];
+    *row |= (uint16_t)(g->rows[i] << (env->x[k] + ROW_OFFSET));
+    cnt += *row == ROW_FULL;
+  }
+
+  if (cnt > 0) {
+    int src = last;
+    int dst = last;
+    for (; src >= 0 && rows[(size_t)src * n] != ROW_EMPTY; --src) {
+      if (src < first || rows[(size_t)src * n] != ROW_FULL) {
+        rows[(size_t)dst-- * n] = rows[(size_t)src * n];
+      }
+    }
+    for (; dst > src; --dst) {
+      rows[(size_t)dst * n] = ROW_EMPTY;
+    }
+  }
+
+  *reward = lineScore(cnt);
+  env->score[k] += *reward;
+  if (env->score[k] >= env->new_lev[k] && cnt != 0 && env->level[k] < 10) {
+    env->level[k] += 1;
+    env->new_lev[k] += 600;
+  }
+
+  env->pieces[k] += 1;
+  env->piece[k] = env->next[k];
+  env->rot[k] = 0;
+  env->x[k] = 3;
+  env->y[k] = 0;
+  rngBounded(&env->rng[k], 7);
+
+  int alive = !hits(env, k, env->piece[k], 0, 3, 0);
+  if (alive) {
+    env->next[k] = (int8_t)drawPiece(&env->rng[k], env->randomizer,
+                                     env->bag[k], &env->bag_left[k]);
+  }
+
+  return alive;
+}
+
+/**
+ * \brief Создаёт пакет из count полей, каждое в начале партии.
+ * \param count Число полей.
+ * \param config Зерно и способ выбора фигур (record_path не используется):
+ * поле k получает зерно seed + k. NULL — равномерный выбор и зерно от
+ * текущего времени.
+ * \return Пакет или NULL при нехватке памяти или count <= 0.
+ */
+BatchEnv_t *batchCreate(int count, const tetris_config_t *config) {
+  BatchEnv_t *env = NULL;
+  size_t n = count > 0 ? (size_t)count : 0;
+  size_t size = 0;
+  size_t rows = carve(&size, BATCH_ROWS * n * sizeof(uint16_t));
+  size_t piece = carve(&size, n);
+  size_t rot = carve(&size, n);
+  size_t x = carve(&size, n);
+  size_t y = carve(&size, n);
+  size_t next = carve(&size, n);
+  size_t level = carve(&size, n);
+  size_t score = carve(&size, n * sizeof(int32_t));
+  size_t new_lev = carve(&size, n * sizeof(int32_t));
+  size_t pieces = carve(&size, n * sizeof(int32_t));
+  size_t lock = carve(&size, n);
+  size_t falling = carve(&size, n);
+  size_t rng = carve(&size, n * sizeof(Rng_t));
+  size_t seed = carve(&size, n * sizeof(uint64_t));
+  size_t bag_left = carve(&size, n);
+  size_t bag = carve(&size, n * sizeof(uint8_t[PIECE_COUNT]));
+
+  if (n > 0) {
+    env = malloc(sizeof *env);
+  }
+  if (env) {
+    char *block = aligned_alloc(CACHE_LINE, size);
+    if (!block) {
+      free(env);
+      env = NULL;
+    } else {
+      env->count = count;
+      env->block = block;
+      env->rows = (uint16_t *)(void *)(block + rows);
+      env->piece = (int8_t *)(block + piece);
+      env->rot = (int8_t *)(block + rot);
+      env->x = (int8_t *)(block + x);
+      env->y = (int8_t *)(block + y);
+      env->next = (int8_t *)(block + next);
+      env->level = (int8_t *)(block + level);
+      env->score = (int32_t *)(void *)(block + score);
+      env->new_lev = (int32_t *)(void *)(block + new_lev);
+      env->pieces = (int32_t *)(void *)(block + pieces);
+      env->lock = (uint8_t *)(block + lock);
+      env->falling = (uint8_t *)(block + falling);
+      env->rng = (Rng_t *)(void *)(block + rng);
+      env->seed = (uint64_t *)(void *)(block + seed);
+      env->bag_left = (int8_t *)(block + bag_left);
+      env->bag = (uint8_t(*)[PIECE_COUNT])(void *)(block + bag);
+
+      uint64_t base = config ? config->seed : (uint64_t)time(NULL);
+      env->randomizer =
+          config ? (int)config->randomizer : TETRIS_RANDOM_UNIFORM;
+      for (int k = 0; k < count; ++k) {
+        startBoard(env, k, base + (uint64_t)k);
+      }
+      env->next_seed = base + n;
+    }
+  }
+
+  return env;
+}
+
+/**
+ * \brief Заканчивает партию на поле k и начинает новую с зерном next_seed.
+ * \param env Пакет.
+ * \param k Номер поля.
+ */
+void batchReset(BatchEnv_t *env, int k) {
+  startBoard(env, k, env->next_seed);
+  env->next_seed += 1;
+}
+
+/**
+ * \brief Делает один ход на всех полях пакета.
+ *
+ * Left, Right и Action сдвигают или поворачивают фигуру, после чего она
+ * опускается на строку (или фиксируется, если ниже некуда), как от тика
+ * гравитации; Up, Start и Pause — просто тик. Down бросает фигуру до упора и
+ * сразу фиксирует её, тика после фиксации нет: новая фигура остаётся в
+ * строке 0 до следующего хода. Terminate заканчивает партию поля. Поле, на
+ * котором партия закончилась, сразу начинает новую (batchReset()).
+ *
+ * \param env Пакет.
+ * \param actions Действия, по одному на поле.
+ * \param rewards Очки, набранные за ход, по одному на поле (NULL — не нужны).
+ * \param done 1 для полей, где партия закончилась и началась новая
+ * (NULL — не нужно).
+ */
+void batchStep(BatchEnv_t *env, const UserAction_t *actions, int *rewards,
+               uint8_t *done) {
+  int n = env->count;
+  int any = 0;
+
+  for (int k = 0; k < n; ++k) {
+    UserAction_t a = actions[k];
+    int dx = (a == Right) - (a == Left);
+    int rot = a == Action ? pieceTable[env->piece[k]][env->rot[k]].next
+                          : env->rot[k];
+    int ok = !hits(env, k, env->piece[k], rot, env->x[k] + dx, env->y[k]);
+    env->x[k] = (int8_t)(env->x[k] + ok * dx);
+    env->rot[k] = (int8_t)(ok ? rot : env->rot[k]);
+  }
+
+  for (int k = 0; k < n; ++k) {
+    int fall = !hits(env, k, env->piece[k], env->rot[k], env->x[k],
+                     env->y[k] + 1);
+    int drop = actions[k] == Down;
+    env->y[k] = (int8_t)(env->y[k] + fall);
+    env->falling[k] = (uint8_t)(fall & drop);
+    env->lock[k] = (uint8_t)(((fall ^ 1) | drop) & (actions[k] != Terminate));
+    any |= fall & drop;
+  }
+
+  while (any) {
+    any = 0;
+    for (int k = 0; k < n; ++k) {
+      int fall = env->falling[k] && !hits(env, k, env->piece[k], env->rot[k],
+                                          env->x[k], env->y[k] + 1);
+      env->y[k] = (int8_t)(env->y[k] + fall);
+      env->falling[k] = (uint8_t)fall;
+      any |= fall;
+    }
+  }
+
+  for (int k = 0; k < n; ++k) {
+    int reward = 0;
+    int over = actions[k] == Terminate;
+
+    if (env->lock[k]) {
+      over = !lockBoard(env, k, &reward);
+    }
+    if (over) {
+      batchReset(env, k);
+    }
+    if (rewards) {
+      rewards[k] = reward;
+    }
+    if (done) {
+      done[k] = (uint8_t)over;
+    }
+  }
+}
+
+/**
+ * \brief Освобождает пакет.
+ * \param env Пакет (NULL допустим).
+ */
+void batchDestroy(BatchEnv_t *env) {
+  if (env) {
+    free(env->block);
+    free(env);
+  }
+}
@@ -0,0 +1,59 @@
+/**
+ * \file batch.h
+ * \brief Пакетное окружение: K полей в виде структуры массивов, которые
+ * делают ход одновременно.
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "back.h"
+
+/// \brief Число масок строк одного поля (вместе с дном).
+#define BATCH_ROWS (FIELD_HEIGHT + PIECE_SIZE)
+
+/**
+ * \brief Пакет из count полей.
+ *
+ * Каждый массив хранит одно свойство всех полей подряд, поэтому ход всех
+ * полей — это несколько проходов по массивам без вызовов функций на поле.
+ * Маски строк лежат по строкам: rows[y * count + k] — строка y поля k, так
+ * что одна и та же строка всех полей идёт подряд. В отличие от экземпляра
+ * игры, падающая фигура в rows не входит: она задаётся piece, rot, x и y.
+ *
+ * Поле k ведёт себя как экземпляр игры с зерном seed[k] и тем же
+ * randomizer: те же фигуры, счёт и уровни. Закончившееся поле сразу
+ * начинает новую партию с зерном next_seed (он растёт на единицу).
+ * Все массивы живут в одном блоке block, выровненном по CACHE_LINE.
+ */
+typedef struct BatchEnv {
+  int count;
+  int randomizer;
+  uint64_t next_seed;
+  void *block;
+
+  uint16_t *rows;
+  int8_t *piece;
+  int8_t *rot;
+  int8_t *x;
+  int8_t *y;
+  int8_t *next;
+  int8_t *level;
+  int32_t *score;
+  int32_t *new_lev;
+  int32_t *pieces;
+  uint8_t *lock;
+  uint8_t *falling;
+  Rng_t *rng;
+  uint64_t *seed;
+  int8_t *bag_left;
+  uint8_t (*bag)[PIECE_COUNT];
+} BatchEnv_t;
+
+BatchEnv_t *batchCreate(int count, const tetris_config_t *config);
+void batchReset(BatchEnv_t *env, int k);
+void batchStep(BatchEnv_t *env, const UserAction_t *actions, int *rewards,
+               uint8_t *done);
+void batchDestroy(BatchEnv_t *env);
+
+#endif
@@ -0,0 +1,77 @@
+/**
+ * \file input.c
+ * \brief Реализация очереди действий игрока.
+ */
+
+#include "input.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * \brief Создаёт пустую очередь.
+ * \return Очередь или NULL при нехватке памяти.
+ */
+InputRing_t *inputCreate(void) {
+  InputRing_t *q = aligned_alloc(CACHE_LINE, sizeof *q);
+
+  if (q) {
+    memset(q, 0, sizeof *q);
+    atomic_init(&q->tail, 0);
+    atomic_init(&q->head, 0);
+  }
+
+  return q;
+}
+
+/**
+ * \brief Кладёт действие в очередь. Вызывается только писателем.
+ * \param q Очередь.
+ * \param action Действие.
+ * \param stamp Метка времени действия (например, момент нажатия клавиши).
+ * \return 1 — положено, 0 — очередь полна и действие потеряно.
+ */
+int inputPush(InputRing_t *q, UserAction_t action, uint64_t stamp) {
+  size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+  int res = 1;
+
+  if (tail - q->head_seen == INPUT_CAP) {
+    q->head_seen = atomic_load_explicit(&q->head, memory_order_acquire);
+    res = tail - q->head_seen < INPUT_CAP;
+  }
+  if (res) {
+    q->events[tail % INPUT_CAP].action = action;
+    q->events[tail % INPUT_CAP].stamp = stamp;
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+  }
+
+  return res;
+}
+
+/**
+ * \brief Забирает самое старое действие. Вызывается только читателем.
+ * \param q Очередь.
+ * \param ev Действие с меткой времени (заполняется).
+ * \return 1, если действие было, иначе 0.
+ */
+int inputPop(InputRing_t *q, tetris_input_t *ev) {
+  size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+  int res = 1;
+
+  if (head == q->tail_seen) {
+    q->tail_seen = atomic_load_explicit(&q->tail, memory_order_acquire);
+    res = head != q->tail_seen;
+  }
+  if (res) {
+    *ev = q->events[head % INPUT_CAP];
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+  }
+
+  return res;
+}
+
+/**
+ * \brief Освобождает очередь.
+ * \param q Очередь (NULL допустим).
+ */
+void inputDestroy(InputRing_t *q) { free(q); }
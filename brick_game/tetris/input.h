@@ -0,0 +1,42 @@
+/**
+ * \file input.h
+ * \brief Кольцевая очередь действий игрока без блокировок: один поток
+ * (чтение клавиатуры) кладёт, другой (поток игры) забирает.
+ */
+
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "back.h"
+
+/// \brief Ёмкость очереди (степень двойки).
+#define INPUT_CAP 256
+
+/**
+ * \brief Очередь действий с метками времени.
+ *
+ * tail двигает только писатель, head — только читатель; каждый держит у себя
+ * последнее увиденное значение чужого индекса и перечитывает его, только
+ * когда очередь кажется полной (пустой). Индексы растут без ограничения, в
+ * кольце используется остаток от деления на INPUT_CAP. Индексы писателя,
+ * читателя и сами события лежат на разных кэш-линиях. Запись события
+ * публикуется release-записью tail, поэтому читатель, увидевший tail, видит
+ * и событие.
+ */
+typedef struct InputRing {
+  _Alignas(CACHE_LINE) atomic_size_t tail;
+  size_t head_seen;
+  _Alignas(CACHE_LINE) atomic_size_t head;
+  size_t tail_seen;
+  _Alignas(CACHE_LINE) tetris_input_t events[INPUT_CAP];
+} InputRing_t;
+
+InputRing_t *inputCreate(void);
+int inputPush(InputRing_t *q, UserAction_t action, uint64_t stamp);
+int inputPop(InputRing_t *q, tetris_input_t *ev);
+void inputDestroy(InputRing_t *q);
+
+#endif
@@ -0,0 +1,268 @@
+/**
+ * \file movegen.c
+ * \brief Реализация генератора ходов.
+ *
+ * Состояние фигуры — (x, y, ориентация). Для каждой ориентации и строки y
+ * маска fit говорит, при каких x фигура помещается (бит ROW_OFFSET + x, как в
+ * масках строк поля), а маска reach — в какие из них фигура может попасть по
+ * правилам игры: сдвигом влево/вправо, поворотом на месте и спуском на
+ * строку. Спуск только вниз, поэтому строки обходятся сверху вниз: в строке
+ * reach замыкается по сдвигам и поворотам, затем переносится на строку ниже.
+ * Ориентации, недостижимые поворотами из начальной, не рассматриваются.
+ * Все маски живут на стеке, куча не используется.
+ */
+
+#include "movegen.h"
+
+/// \brief Узел поиска пути: состояние, действие, которым в него пришли, и
+/// номер предыдущего узла.
+typedef struct {
+  int8_t x;
+  int8_t y;
+  int8_t rot;
+  int8_t act;
+  int16_t parent;
+} PathNode_t;
+
+/**
+ * \brief Считает, при каких x ориентация фигуры помещается в строку y.
+ * Клетка (i, j) фигуры свободна при сдвиге x, если свободен бит
+ * ROW_OFFSET + x + j строки y + i, поэтому маски свободных клеток сдвигаются
+ * на j и перемножаются — сразу для всех x.
+ * \param rows Маски строк поля.
+ * \param g Ориентация фигуры.
+ * \param y Строка.
+ * \return Маска допустимых x (бит ROW_OFFSET + x).
+ */
+static uint16_t fitRow(const uint16_t *rows, const PieceGeom_t *g, int y) {
+  uint16_t fit = ROW_FULL;
+
+  for (int i = g->top; i <= g->bottom; ++i) {
+    uint16_t free_cells = (uint16_t)~rows[y + i];
+    for (int j = g->left; j <= g->right; ++j) {
+      if (g->rows[i] & (1u << j)) {
+        fit &= (uint16_t)(free_cells >> j);
+      }
+    }
+  }
+
+  return fit;
+}
+
+/**
+ * \brief Замыкает достижимые положения строки по сдвигам и поворотам.
+ * \param t Ориентации фигуры.
+ * \param reach Достижимые x по ориентациям (дополняются).
+ * \param fit Допустимые x по ориентациям.
+ */
+static void closeRow(const PieceGeom_t *t, uint16_t *reach,
+                     const uint16_t *fit) {
+  int changed = 1;
+
+  while (changed) {
+    changed = 0;
+    for (int r = 0; r < ROT_COUNT; ++r) {
+      uint16_t v = reach[r];
+      uint16_t prev = 0;
+      while (v != prev) {
+        prev = v;
+        v |= (uint16_t)((v << 1) | (v >> 1)) & fit[r];
+      }
+      reach[r] = v;
+    }
+    for (int r = 0; r < ROT_COUNT; ++r) {
+      int nx = t[r].next;
+      uint16_t add = reach[r] & fit[nx] & (uint16_t)~reach[nx];
+      if (add) {
+        reach[nx] |= add;
+        changed = 1;
+      }
+    }
+  }
+}
+
+/**
+ * \brief Проверяет, совпадают ли две ориентации с точностью до сдвига.
+ * \param a Первая ориентация.
+ * \param b Вторая ориентация.
+ * \return 1, если занятые клетки совпадают, иначе 0.
+ */
+static int sameShape(const PieceGeom_t *a, const PieceGeom_t *b) {
+  int res = a->bottom - a->top == b->bottom - b->top;
+
+  for (int i = 0; i <= a->bottom - a->top && res; ++i) {
+    res = (a->rows[a->top + i] >> a->left) == (b->rows[b->top + i] >> b->left);
+  }
+
+  return res;
+}
+
+/**
+ * \brief Находит все различные положения, в которых фигура может
+ * зафиксироваться, начав с положения shape.
+ * Положения считаются одинаковыми, если фигура занимает одни и те же клетки
+ * (например, у S и Z ориентации 0 и 2 отличаются только сдвигом).
+ * \param rows Маски строк поля без самой фигуры.
+ * \param shape Фигура в начальном положении (color не используется).
+ * \param out Массив не меньше MOVEGEN_MAX элементов.
+ * \return Число найденных положений (0, если начальное положение занято).
+ */
+int genPlacements(const uint16_t *rows, const Shape *shape, Placement_t *out) {
+  const PieceGeom_t *t = pieceTable[shape->piece];
+  uint16_t reach[ROT_COUNT] = {0};
+  uint16_t fit[ROT_COUNT];
+  uint16_t seen[ROT_COUNT][FIELD_HEIGHT] = {{0}};
+  int canon[ROT_COUNT];
+  unsigned used = 0;
+  int alive = 1;
+  int n = 0;
+
+  for (int r = shape->rot; !(used & (1u << r)); r = t[r].next) {
+    used |= 1u << r;
+  }
+  for (int r = 0; r < ROT_COUNT; ++r) {
+    canon[r] = r;
+    for (int c = 0; c < r && canon[r] == r; ++c) {
+      if (sameShape(&t[c], &t[r])) {
+        canon[r] = c;
+      }
+    }
+    fit[r] = used & (1u << r) ? fitRow(rows, &t[r], shape->y) : 0;
+  }
+  reach[shape->rot] =
+      fit[shape->rot] & (uint16_t)(1u << (shape->x + ROW_OFFSET));
+
+  for (int y = shape->y; y < FIELD_HEIGHT && alive; ++y) {
+    uint16_t below[ROT_COUNT];
+
+    closeRow(t, reach, fit);
+    alive = 0;
+    for (int r = 0; r < ROT_COUNT; ++r) {
+      below[r] = used & (1u << r) ? fitRow(rows, &t[r], y + 1) : 0;
+      uint16_t lock = reach[r] & (uint16_t)~below[r];
+      for (int b = 0; lock; ++b, lock >>= 1) {
+        int x = b - ROW_OFFSET;
+        uint16_t *slot = &seen[canon[r]][y + t[r].top];
+        if ((lock & 1) && !(*slot & (1u << (x + t[r].left)))) {
+          *slot |= (uint16_t)(1u << (x + t[r].left));
+          out[n].x = (int8_t)x;
+          out[n].y = (int8_t)y;
+          out[n].rot = (int8_t)r;
+          ++n;
+        }
+      }
+      reach[r] &= below[r];
+      fit[r] = below[r];
+      alive |= reach[r] != 0;
+    }
+  }
+
+  return n;
+}
+
+/**
+ * \brief Ищет кратчайшую последовательность действий, которая приводит фигуру
+ * из положения shape в положение target и фиксирует её там.
+ * Путь состоит из Left, Right, Action (поворот) и Up (спуск на строку) и
+ * заканчивается резким спуском Down; спуски на строку перед ним опускаются.
+ * \param rows Маски строк поля без самой фигуры.
+ * \param shape Фигура в начальном положении.
+ * \param target Положение фиксации (например, из genPlacements()).
+ * \param path Буфер действий.
+ * \param cap Размер буфера.
+ * \return Длина пути или -1, если положение недостижимо или путь не
+ * помещается в буфер.
+ */
+int placementPath(const uint16_t *rows, const Shape *shape, Placement_t target,
+                  UserAction_t *path, int cap) {
+  static const UserAction_t moves[] = {Left, Right, Action, Up};
+  PathNode_t queue[MOVEGEN_MAX];
+  uint16_t visited[ROT_COUNT][FIELD_HEIGHT] = {{0}};
+  int head = 0;
+  int tail = 0;
+  int found = -1;
+
+  if (fitsBoard(rows, shape->piece, shape->rot, shape->x, shape->y)) {
+    queue[tail++] = (PathNode_t){(int8_t)shape->x, (int8_t)shape->y,
+                                 (int8_t)shape->rot, -1, -1};
+    visited[shape->rot][shape->y] |= (uint16_t)(1u << (shape->x + ROW_OFFSET));
+  }
+
+  while (head < tail && found < 0) {
+    PathNode_t cur = queue[head];
+    if (cur.x == target.x && cur.y == target.y && cur.rot == target.rot) {
+      found = head;
+    }
+    for (int m = 0; m < 4 && found < 0; ++m) {
+      int x = cur.x + (moves[m] == Left ? -1 : moves[m] == Right ? 1 : 0);
+      int y = cur.y + (moves[m] == Up);
+      int rot = moves[m] == Action ? pieceTable[shape->piece][cur.rot].next
+                                   : cur.rot;
+      if (fitsBoard(rows, shape->piece, rot, x, y) &&
+          !(visited[rot][y] & (1u << (x + ROW_OFFSET)))) {
+        uint16_t bit = (uint16_t)(1u << (x + ROW_OFFSET));
+        visited[rot][y] |= bit;
+        queue[tail++] = (PathNode_t){(int8_t)x, (int8_t)y, (int8_t)rot,
+                                     (int8_t)moves[m], (int16_t)head};
+      }
+    }
+    ++head;
+  }
+
+  int len = -1;
+  if (found >= 0) {
+    int steps = 0;
+    int skip = 1;
+    for (int k = found; queue[k].parent >= 0; k = queue[k].parent) {
+      if (!(skip && queue[k].act == Up)) {
+        skip = 0;
+        ++steps;
+      }
+    }
+    if (steps + 1 <= cap) {
+      len = steps + 1;
+      path[steps] = Down;
+      skip = 1;
+      for (int k = found; queue[k].parent >= 0; k = queue[k].parent) {
+        if (!(skip && queue[k].act == Up)) {
+          skip = 0;
+          path[--steps] = (UserAction_t)queue[k].act;
+        }
+      }
+    }
+  }
+
+  return len;
+}
+
+/**
+ * \brief Фиксирует фигуру в положении p на поле из масок строк и снимает
+ * заполненные строки.
+ * \param rows Маски строк поля без фигуры (изменяются).
+ * \param piece Номер фигуры.
+ * \param p Положение фиксации.
+ * \return Число снятых строк.
+ */
+int lockPlacement(uint16_t *rows, int piece, Placement_t p) {
+  const PieceGeom_t *g = &pieceTable[piece][p.rot];
+  int lines = 0;
+
+  for (int i = g->top; i <= g->bottom; ++i) {
+    rows[p.y + i] |= (uint16_t)(g->rows[i] << (p.x + ROW_OFFSET));
+    lines += rows[p.y + i] == ROW_FULL;
+  }
+
+  if (lines > 0) {
+    int dst = p.y + g->bottom;
+    for (int src = dst; src >= 0; --src) {
+      if (src < p.y + g->top || rows[src] != ROW_FULL) {
+        rows[dst--] = rows[src];
+      }
+    }
+    while (dst >= 0) {
+      rows[dst--] = ROW_EMPTY;
+    }
+  }
+
+  return lines;
+}
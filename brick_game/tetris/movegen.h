@@ -0,0 +1,29 @@
+/**
+ * \file movegen.h
+ * \brief Генератор ходов: все положения, в которых фигура может
+ * зафиксироваться, и последовательность действий, которая к ним приводит.
+ */
+
+#ifndef MOVEGEN_H
+#define MOVEGEN_H
+
+#include "back.h"
+
+/// \brief Верхняя граница числа различных положений фиксации.
+#define MOVEGEN_MAX (ROT_COUNT * FIELD_HEIGHT * 16)
+/// \brief Верхняя граница длины пути к положению фиксации.
+#define MOVEGEN_PATH_MAX (ROT_COUNT * FIELD_HEIGHT * 16)
+
+/// \brief Положение фиксации фигуры: координаты и ориентация.
+typedef struct {
+  int8_t x;
+  int8_t y;
+  int8_t rot;
+} Placement_t;
+
+int genPlacements(const uint16_t *rows, const Shape *shape, Placement_t *out);
+int placementPath(const uint16_t *rows, const Shape *shape, Placement_t target,
+                  UserAction_t *path, int cap);
+int lockPlacement(uint16_t *rows, int piece, Placement_t p);
+
+#endif
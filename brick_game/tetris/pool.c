@@ -0,0 +1,125 @@
+/**
+ * \file pool.c
+ * \brief Реализация пула блоков под экземпляры игры.
+ */
+
+#include "pool.h"
+
+#include <stdlib.h>
+
+/**
+ * \brief Возвращает ссылку на поле «следующий свободный блок», которое
+ * хранится в первых байтах свободного блока.
+ * \param block Свободный блок.
+ * \return Ссылка на указатель следующего свободного блока.
+ */
+static GameBlock_t **nextFree(GameBlock_t *block) {
+  return (GameBlock_t **)(void *)block;
+}
+
+/**
+ * \brief Выделяет очередной кусок пула и добавляет его блоки в список
+ * свободных.
+ * \param pool Пул.
+ * \return 1 при успехе, 0 при нехватке памяти.
+ */
+static int poolGrow(EnginePool_t *pool) {
+  size_t count = pool->chunk_blocks;
+  if (pool->total_blocks > count) {
+    count = pool->total_blocks;
+  }
+
+  PoolChunk_t *chunk =
+      aligned_alloc(CACHE_LINE, sizeof(PoolChunk_t) + count * sizeof(GameBlock_t));
+  int res = chunk != NULL;
+
+  if (res) {
+    GameBlock_t *blocks = (GameBlock_t *)(void *)(chunk + 1);
+
+    chunk->next = pool->chunks;
+    pool->chunks = chunk;
+    for (size_t i = count; i > 0; --i) {
+      *nextFree(&blocks[i - 1]) = pool->free_list;
+      pool->free_list = &blocks[i - 1];
+    }
+    pool->total_blocks += count;
+  }
+
+  return res;
+}
+
+/**
+ * \brief Создаёт пустой пул. Рекорд читается один раз и раздаётся всем
+ * экземплярам пула.
+ * \param chunk_blocks Минимальное число блоков в одном куске (0 — 64).
+ * \return Указатель на пул или NULL при нехватке памяти.
+ */
+EnginePool_t *poolCreate(size_t chunk_blocks) {
+  EnginePool_t *pool = malloc(sizeof *pool);
+
+  if (pool) {
+    pool->chunks = NULL;
+    pool->free_list = NULL;
+    pool->chunk_blocks = chunk_blocks ? chunk_blocks : 64;
+    pool->total_blocks = 0;
+    pool->high_score = readHighScore(NULL);
+  }
+
+  return pool;
+}
+
+/**
+ * \brief Выдаёт из пула новый экземпляр игры в состоянии STATE_START.
+ * Если в конфигурации указан свой файл рекордов, рекорд читается из него.
+ * \param pool Пул.
+ * \param config Параметры экземпляра (NULL — параметры по умолчанию).
+ * \return Указатель на экземпляр или NULL при нехватке памяти.
+ */
+GameParams_t *poolAcquire(EnginePool_t *pool, const tetris_config_t *config) {
+  GameParams_t *params = NULL;
+
+  if (pool->free_list || poolGrow(pool)) {
+    GameBlock_t *block = pool->free_list;
+    pool->free_list = *nextFree(block);
+    int high_score = pool->high_score;
+    if (config && config->record_path) {
+      high_score = readHighScore(config->record_path);
+    }
+    params = initParams(block, high_score, config);
+    params->pool = pool;
+  }
+
+  return params;
+}
+
+/**
+ * \brief Возвращает экземпляр в пул. Рекорд экземпляра запоминается, чтобы
+ * следующие партии начинались с него.
+ * \param pool Пул, из которого выдан экземпляр.
+ * \param params Экземпляр игры.
+ */
+void poolRelease(EnginePool_t *pool, GameParams_t *params) {
+  GameBlock_t *block = (GameBlock_t *)(void *)params;
+
+  if (params->core.high_score > pool->high_score) {
+    pool->high_score = params->core.high_score;
+  }
+  *nextFree(block) = pool->free_list;
+  pool->free_list = block;
+}
+
+/**
+ * \brief Освобождает пул вместе со всеми его блоками. Выданные экземпляры
+ * после этого использовать нельзя.
+ * \param pool Пул (NULL допустим).
+ */
+void poolDestroy(EnginePool_t *pool) {
+  if (pool) {
+    while (pool->chunks) {
+      PoolChunk_t *next = pool->chunks->next;
+      free(pool->chunks);
+      pool->chunks = next;
+    }
+    free(pool);
+  }
+}
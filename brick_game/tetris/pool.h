@@ -0,0 +1,40 @@
+/**
+ * \file pool.h
+ * \brief Пул блоков под экземпляры игры: блоки выделяются крупными кусками и
+ * переиспользуются после освобождения.
+ */
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+#include "back.h"
+
+/// \brief Кусок памяти пула: заголовок, за которым идут блоки GameBlock_t.
+typedef struct PoolChunk {
+  _Alignas(CACHE_LINE) struct PoolChunk *next;
+} PoolChunk_t;
+
+/**
+ * \brief Пул экземпляров игры.
+ *
+ * Свободные блоки связаны в список через свой первый указатель, поэтому выдача
+ * и возврат блока — O(1) без обращения к системному аллокатору. Когда
+ * свободные блоки кончаются, выделяется новый кусок размером не меньше уже
+ * выделенного объёма. Пул не потокобезопасен: каждому потоку нужен свой.
+ */
+typedef struct EnginePool {
+  PoolChunk_t *chunks;
+  GameBlock_t *free_list;
+  size_t chunk_blocks;
+  size_t total_blocks;
+  int high_score;
+} EnginePool_t;
+
+EnginePool_t *poolCreate(size_t chunk_blocks);
+GameParams_t *poolAcquire(EnginePool_t *pool, const tetris_config_t *config);
+void poolRelease(EnginePool_t *pool, GameParams_t *params);
+void poolDestroy(EnginePool_t *pool);
+
+#endif
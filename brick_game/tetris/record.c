@@ -0,0 +1,353 @@
+/**
+ * \file record.c
+ * \brief Реализация отложенной записи рекордов.
+ *
+ * recordSubmit() только запоминает рекорд в памяти и будит фоновый поток, так
+ * что игра никогда не ждёт диска; при паузе и выходе из партии поток будит
+ * recordKick(). Поток (или recordShutdown() при завершении процесса) пишет
+ * значение во временный файл и атомарно подменяет им основной через
+ * rename(). Чтение, сравнение и подмена идут под flock() на соседнем файле
+ * "<путь>.lock", и перед записью берётся максимум с тем, что уже лежит в
+ * файле, поэтому несколько процессов с одним файлом не портят его и не
+ * затирают чужой больший рекорд.
+ *
+ * Поток один на процесс и работает до его завершения: recordShutdown()
+ * стоит в atexit(), останавливает поток, дожидается его и дописывает
+ * остальное, так что временных файлов после выхода не остаётся. Вокруг
+ * fork() мьютексы берутся и отпускаются обработчиками pthread_atfork(), так
+ * что потомок не наследует их занятыми, а поток записи в потомке считается
+ * незапущенным.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "record.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+/// \brief Рекорд одного файла: сколько набрано и сколько уже записано.
+typedef struct {
+  char *path;
+  int pending;
+  int written;
+} RecordSlot_t;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t io_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+static RecordSlot_t slots[RECORD_SLOTS];
+static int slot_count = 0;
+static int dirty = 0;
+/// \brief 1 — поток записи работает, -1 — создать его не удалось, 0 — нет.
+static int writer_started = 0;
+static int writer_stopping = 0;
+static int hooks_installed = 0;
+static pthread_t writer_tid;
+
+/**
+ * \brief Приводит путь к рабочему виду: NULL — файл по умолчанию.
+ * \param path Путь из конфигурации.
+ * \return Путь к файлу или NULL, если рекорды не сохраняются (пустая строка).
+ */
+static const char *resolvePath(const char *path) {
+  if (!path) {
+    path = RECORD_DEFAULT_PATH;
+  }
+  return path[0] ? path : NULL;
+}
+
+/**
+ * \brief Находит ячейку файла, при необходимости заводит новую. Вызывается под
+ * lock.
+ * \param path Путь к файлу.
+ * \param create Заводить ли ячейку, если её нет.
+ * \return Ячейка или NULL, если её нет и завести нельзя.
+ */
+static RecordSlot_t *findSlot(const char *path, int create) {
+  RecordSlot_t *res = NULL;
+
+  for (int i = 0; i < slot_count && !res; ++i) {
+    if (strcmp(slots[i].path, path) == 0) {
+      res = &slots[i];
+    }
+  }
+  if (!res && create && slot_count < RECORD_SLOTS) {
+    char *copy = malloc(strlen(path) + 1);
+    if (copy) {
+      strcpy(copy, path);
+      res = &slots[slot_count++];
+      res->path = copy;
+      res->pending = 0;
+      res->written = 0;
+    }
+  }
+
+  return res;
+}
+
+/**
+ * \brief Читает рекорд из файла.
+ * \param path Путь к файлу.
+ * \return Рекорд или 0, если файла нет.
+ */
+static int readFile(const char *path) {
+  int score = 0;
+
+  FILE *f = fopen(path, "r");
+  if (f) {
+    if (fscanf(f, "%d", &score) != 1) {
+      score = 0;
+    }
+    fclose(f);
+  }
+
+  return score;
+}
+
+/**
+ * \brief Берёт межпроцессную блокировку файла рекорда: flock() на соседнем
+ * файле "<путь>.lock" (сам файл подменяется через rename(), и блокировка на
+ * нём не пережила бы подмены).
+ * \param path Путь к файлу рекорда.
+ * \return Дескриптор файла блокировки или -1, если взять её не удалось
+ * (тогда запись идёт без неё).
+ */
+static int lockFile(const char *path) {
+  size_t len = strlen(path) + sizeof ".lock";
+  char *name = malloc(len);
+  int res = -1;
+
+  if (name) {
+    snprintf(name, len, "%s.lock", path);
+    res = open(name, O_RDWR | O_CREAT, 0644);
+    if (res >= 0 && flock(res, LOCK_EX) != 0) {
+      close(res);
+      res = -1;
+    }
+    free(name);
+  }
+
+  return res;
+}
+
+/**
+ * \brief Записывает рекорд: временный файл рядом с основным, затем rename().
+ * \param path Путь к файлу.
+ * \param score Рекорд.
+ * \return 1 при успехе, иначе 0.
+ */
+static int writeFile(const char *path, int score) {
+  size_t len = strlen(path) + 32;
+  char *tmp = malloc(len);
+  int res = 0;
+
+  if (tmp) {
+    snprintf(tmp, len, "%s.%ld.tmp", path, (long)getpid());
+    FILE *f = fopen(tmp, "w");
+    if (!f) {
+      perror("Error creating record file");
+    } else {
+      int ok = fprintf(f, "%d\n", score) > 0;
+      ok = fclose(f) == 0 && ok;
+      if (ok && rename(tmp, path) == 0) {
+        res = 1;
+      } else {
+        perror("Error writing record file");
+        remove(tmp);
+      }
+    }
+    free(tmp);
+  }
+
+  return res;
+}
+
+/**
+ * \brief Выносит на диск все незаписанные рекорды. Запись идёт без lock,
+ * поэтому recordSubmit() в это время не блокируется.
+ */
+void recordFlush(void) {
+  pthread_mutex_lock(&io_lock);
+
+  pthread_mutex_lock(&lock);
+  dirty = 0;
+  int count = slot_count;
+  pthread_mutex_unlock(&lock);
+
+  for (int i = 0; i < count; ++i) {
+    pthread_mutex_lock(&lock);
+    const char *path = slots[i].path;
+    int score = slots[i].pending;
+    int need = score > slots[i].written;
+    pthread_mutex_unlock(&lock);
+
+    if (need) {
+      int fd = lockFile(path);
+      int on_disk = readFile(path);
+      if (on_disk >= score || writeFile(path, score)) {
+        pthread_mutex_lock(&lock);
+        if (score > slots[i].written) {
+          slots[i].written = score;
+        }
+        pthread_mutex_unlock(&lock);
+      }
+      if (fd >= 0) {
+        close(fd);
+      }
+    }
+  }
+
+  pthread_mutex_unlock(&io_lock);
+}
+
+/**
+ * \brief Фоновый поток записи: спит, пока не появятся новые рекорды или не
+ * попросят остановиться.
+ * \param arg Не используется.
+ * \return NULL после recordShutdown().
+ */
+static void *writer(void *arg) {
+  int stop = 0;
+
+  (void)arg;
+  while (!stop) {
+    pthread_mutex_lock(&lock);
+    while (!dirty && !writer_stopping) {
+      pthread_cond_wait(&wake, &lock);
+    }
+    stop = writer_stopping;
+    pthread_mutex_unlock(&lock);
+    if (!stop) {
+      recordFlush();
+    }
+  }
+
+  return NULL;
+}
+
+/// \brief Перед fork(): берёт мьютексы, чтобы их не держал другой поток.
+static void forkPrepare(void) {
+  pthread_mutex_lock(&io_lock);
+  pthread_mutex_lock(&lock);
+}
+
+/// \brief После fork() в родителе: отпускает мьютексы.
+static void forkParent(void) {
+  pthread_mutex_unlock(&lock);
+  pthread_mutex_unlock(&io_lock);
+}
+
+/**
+ * \brief После fork() в потомке: отпускает мьютексы; потока записи в потомке
+ * нет, и следующий рекорд запустит его заново.
+ */
+static void forkChild(void) {
+  writer_started = 0;
+  writer_stopping = 0;
+  pthread_mutex_unlock(&lock);
+  pthread_mutex_unlock(&io_lock);
+}
+
+/**
+ * \brief Запускает фоновый поток при первом рекорде. Вызывается под lock.
+ * Если поток создать не удалось, рекорды запишутся при выходе из процесса.
+ */
+static void startWriter(void) {
+  if (!hooks_installed) {
+    hooks_installed = 1;
+    atexit(recordShutdown);
+    pthread_atfork(forkPrepare, forkParent, forkChild);
+  }
+  writer_started =
+      pthread_create(&writer_tid, NULL, writer, NULL) == 0 ? 1 : -1;
+}
+
+/**
+ * \brief Останавливает фоновый поток, дожидается его и выносит на диск всё
+ * незаписанное. Вызывается при завершении процесса (atexit()); если после
+ * этого придёт рекорд, recordSubmit() запустит поток снова.
+ */
+void recordShutdown(void) {
+  pthread_mutex_lock(&lock);
+  int join = writer_started == 1 && !writer_stopping;
+  if (join) {
+    writer_stopping = 1;
+    pthread_cond_signal(&wake);
+  }
+  pthread_mutex_unlock(&lock);
+
+  if (join) {
+    pthread_join(writer_tid, NULL);
+    pthread_mutex_lock(&lock);
+    writer_stopping = 0;
+    writer_started = 0;
+    pthread_mutex_unlock(&lock);
+  }
+  recordFlush();
+}
+
+/**
+ * \brief Будит фоновый поток, чтобы он вынес незаписанные рекорды на диск,
+ * не дожидаясь записи. Если потока нет, рекорды запишутся при выходе.
+ */
+void recordKick(void) {
+  pthread_mutex_lock(&lock);
+  if (writer_started == 1) {
+    dirty = 1;
+    pthread_cond_signal(&wake);
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+/**
+ * \brief Читает рекорд: максимум из файла и ещё не записанного значения.
+ * \param path Путь к файлу (NULL — RECORD_DEFAULT_PATH, "" — рекорды не
+ * сохраняются).
+ * \return Рекорд или 0, если его нет.
+ */
+int recordRead(const char *path) {
+  int score = 0;
+
+  path = resolvePath(path);
+  if (path) {
+    score = readFile(path);
+    pthread_mutex_lock(&lock);
+    const RecordSlot_t *slot = findSlot(path, 0);
+    if (slot && slot->pending > score) {
+      score = slot->pending;
+    }
+    pthread_mutex_unlock(&lock);
+  }
+
+  return score;
+}
+
+/**
+ * \brief Запоминает новый рекорд; на диск он попадёт позже. Не ждёт ввода-
+ * вывода.
+ * \param path Путь к файлу (NULL — RECORD_DEFAULT_PATH, "" — рекорды не
+ * сохраняются).
+ * \param score Рекорд.
+ */
+void recordSubmit(const char *path, int score) {
+  path = resolvePath(path);
+  if (path) {
+    pthread_mutex_lock(&lock);
+    RecordSlot_t *slot = findSlot(path, 1);
+    if (slot && score > slot->pending) {
+      slot->pending = score;
+      dirty = 1;
+      if (!writer_started) {
+        startWriter();
+      }
+      pthread_cond_signal(&wake);
+    }
+    pthread_mutex_unlock(&lock);
+  }
+}
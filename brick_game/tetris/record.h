@@ -0,0 +1,23 @@
+/**
+ * \file record.h
+ * \brief Хранилище рекордов с отложенной записью: новые рекорды копятся в
+ * памяти, а на диск их выносит фоновый поток. recordKick() будит его без
+ * ожидания, recordShutdown() (при выходе из процесса) останавливает поток и
+ * дописывает всё незаписанное.
+ */
+
+#ifndef RECORD_H
+#define RECORD_H
+
+/// \brief Файл рекорда по умолчанию (в текущем каталоге).
+#define RECORD_DEFAULT_PATH "record.txt"
+/// \brief Сколько разных файлов рекордов может быть открыто в процессе.
+#define RECORD_SLOTS 8
+
+int recordRead(const char *path);
+void recordSubmit(const char *path, int score);
+void recordFlush(void);
+void recordShutdown(void);
+void recordKick(void);
+
+#endif
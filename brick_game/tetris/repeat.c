@@ -0,0 +1,196 @@
+/**
+ * \file repeat.c
+ * \brief Реализация автоповтора.
+ *
+ * Клавиша удерживается от repeatInput() с hold до repeatInput() без hold с
+ * тем же действием (отпускание) или до удержания другой клавиши. Нажатие
+ * применяется сразу, повторы — по часам движка, которые двигает
+ * repeatAdvance(): сдвиг повторяется через das мс и потом каждые arr мс,
+ * мягкий спуск — каждые sdr мс с самого нажатия. Все повторы, наступившие
+ * за один вызов, делаются одним проходом (repeatMove()): фигура снимается с
+ * поля и кладётся обратно один раз, а свободное место сбоку или снизу
+ * считается по маскам строк сразу на все шаги. Результат тот же, что у
+ * стольких же отдельных updtGame(), поэтому в повторе партии они
+ * записываются как отдельные действия.
+ */
+
+#include "repeat.h"
+
+#include "stats.h"
+#include "trace.h"
+
+/**
+ * \brief Задаёт настройки автоповтора по умолчанию; ничего не удерживается.
+ * \param r Автоповтор.
+ */
+void repeatInit(AutoRepeat_t *r) {
+  r->das = REPEAT_DAS;
+  r->arr = REPEAT_ARR;
+  r->sdr = REPEAT_SDR;
+  r->active = 0;
+  r->held = Start;
+  r->wait = 0;
+}
+
+/**
+ * \brief Меняет настройки автоповтора. Удерживаемая клавиша получит их со
+ * следующего повтора.
+ * \param r Автоповтор.
+ * \param das Задержка перед первым повтором сдвига, мс (меньше 0 — 0).
+ * \param arr Период повторов сдвига, мс; 0 — фигура сразу уходит до упора.
+ * \param sdr Период мягкого спуска, мс (меньше 1 — 1).
+ */
+void repeatConfig(AutoRepeat_t *r, int das, int arr, int sdr) {
+  r->das = das > 0 ? das : 0;
+  r->arr = arr > 0 ? arr : 0;
+  r->sdr = sdr > 1 ? sdr : 1;
+}
+
+/**
+ * \brief Считает, на сколько столбцов можно сдвинуть снятую с поля фигуру.
+ * Маска каждой строки фигуры сдвигается в регистре, пока не заденет занятую
+ * клетку или стену; ответ — минимум по строкам.
+ * \param params Параметры игры; фигура снята с поля.
+ * \param dx Направление: -1 — влево, 1 — вправо.
+ * \param limit Больше стольких столбцов не нужно.
+ * \return Число столбцов, не больше limit.
+ */
+static int shiftRoom(const GameParams_t *params, int dx, int limit) {
+  const Shape *s = params->cur_shape;
+  const PieceGeom_t *g = &pieceTable[s->piece][s->rot];
+  int room = limit;
+
+  for (int i = g->top; i <= g->bottom; ++i) {
+    uint32_t row = params->core.rows[s->y + i];
+    uint32_t cells = (uint32_t)g->rows[i] << (s->x + ROW_OFFSET);
+    int free = 0;
+
+    cells = dx < 0 ? cells >> 1 : cells << 1;
+    while (free < room && !(row & cells)) {
+      ++free;
+      cells = dx < 0 ? cells >> 1 : cells << 1;
+    }
+    room = free;
+  }
+
+  return room;
+}
+
+/**
+ * \brief Применяет действие n раз подряд так же, как n вызовов updtGame().
+ * Сдвиг делается одним проходом до препятствия, мягкий спуск — одним
+ * проходом до места, где фигура ляжет (ghostY()), и фиксацией, если шаги
+ * ещё остались; дальше спускается уже следующая фигура. В статистике
+ * такой проход — один вызов действия.
+ * \param params Параметры игры.
+ * \param action Действие.
+ * \param n Сколько раз.
+ * \return Для сдвига — на сколько столбцов сдвинулась фигура, для
+ * остальных действий — сколько раз действие применено.
+ */
+int repeatMove(GameParams_t *params, UserAction_t action, int n) {
+  int shift = action == Left || action == Right;
+  uint64_t t0 = statsEnabled() && n > 0 && (shift || action == Up)
+                    ? statsClock()
+                    : 0;
+  int res = 0;
+
+  if (shift && *(params->state) == STATE_GAME && n > 0) {
+    int dx = action == Left ? -1 : 1;
+    traceBegin(TRACE_INPUT);
+    clearShape(params);
+    res = shiftRoom(params, dx, n);
+    params->cur_shape->x += dx * res;
+    placeShape(params);
+    traceEnd(TRACE_INPUT);
+  } else if (action == Up) {
+    while (res < n && *(params->state) == STATE_GAME) {
+      clearShape(params);
+      int k = ghostY(params) - params->cur_shape->y;
+      k = k < n - res ? k : n - res;
+      params->cur_shape->y += k;
+      placeShape(params);
+      res += k;
+      if (res < n) {
+        autoDown(params);
+        res += 1;
+      }
+    }
+  } else if (!shift) {
+    for (; res < n; ++res) {
+      updtGame(params, action);
+    }
+  }
+  if (t0) {
+    statsAction(action, statsClock() - t0);
+  }
+
+  return res;
+}
+
+/**
+ * \brief Нажатие, удержание или отпускание клавиши.
+ * Сдвиг и мягкий спуск (Left, Right, Up) с hold начинают удержание, если
+ * эта клавиша ещё не удерживается, и применяются сразу; повторный вызов с
+ * hold для удерживаемой клавиши ничего не делает, а без hold — отпускает
+ * её. Остальные вызовы — обычное нажатие (updtGame()), удержание другой
+ * клавиши при этом не прерывается.
+ * \param params Параметры игры.
+ * \param action Действие.
+ * \param hold Клавиша удерживается.
+ * \return 1, если действие применено к игре, 0 — только удержание или
+ * отпускание.
+ */
+int repeatInput(GameParams_t *params, UserAction_t action, int hold) {
+  AutoRepeat_t *r = &params->repeat;
+  int held = r->active && r->held == action;
+
+  if (held && !hold) {
+    r->active = 0;
+  } else if (!held) {
+    if (hold && (action == Left || action == Right || action == Up)) {
+      r->active = 1;
+      r->held = action;
+      r->wait = action == Up ? r->sdr : r->das;
+    }
+    updtGame(params, action);
+  }
+
+  return !held;
+}
+
+/**
+ * \brief Продвигает часы движка и делает повторы удерживаемой клавиши,
+ * наступившие за это время. Часы идут только во время игры (не на паузе).
+ * Больше FIELD_WIDTH повторов сдвига или FIELD_HEIGHT повторов спуска за
+ * вызов не делается, остальные пропускаются.
+ * \param params Параметры игры.
+ * \param ms Сколько мс прошло с прошлого вызова.
+ * \param action Повторённое действие (заполняется, если клавиша
+ * удерживается).
+ * \return Сколько шагов сделано (как у repeatMove()).
+ */
+int repeatAdvance(GameParams_t *params, int ms, UserAction_t *action) {
+  AutoRepeat_t *r = &params->repeat;
+  int res = 0;
+
+  if (r->active && *(params->state) == STATE_GAME) {
+    int up = r->held == Up;
+    int period = up ? r->sdr : r->arr;
+    int limit = up ? FIELD_HEIGHT : FIELD_WIDTH;
+    int n = 0;
+
+    r->wait -= ms > 0 ? ms : 0;
+    while (r->wait <= 0 && n < limit) {
+      ++n;
+      r->wait += period;
+    }
+    if (r->wait <= 0) {
+      r->wait = period;
+    }
+    *action = r->held;
+    res = repeatMove(params, r->held, n);
+  }
+
+  return res;
+}
@@ -0,0 +1,26 @@
+/**
+ * \file repeat.h
+ * \brief Автоповтор удерживаемых клавиш по часам движка: задержка перед
+ * повтором сдвига (DAS), период повторов сдвига (ARR) и период мягкого
+ * спуска (SDR).
+ */
+
+#ifndef REPEAT_H
+#define REPEAT_H
+
+#include "back.h"
+
+/// \brief Задержка перед первым повтором сдвига по умолчанию, мс.
+#define REPEAT_DAS 167
+/// \brief Период повторов сдвига по умолчанию, мс.
+#define REPEAT_ARR 33
+/// \brief Период повторов мягкого спуска по умолчанию, мс.
+#define REPEAT_SDR 50
+
+void repeatInit(AutoRepeat_t *r);
+void repeatConfig(AutoRepeat_t *r, int das, int arr, int sdr);
+int repeatMove(GameParams_t *params, UserAction_t action, int n);
+int repeatInput(GameParams_t *params, UserAction_t action, int hold);
+int repeatAdvance(GameParams_t *params, int ms, UserAction_t *action);
+
+#endif
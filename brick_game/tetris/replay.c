@@ -0,0 +1,580 @@
+/**
+ * \file replay.c
+ * \brief Реализация записи и проигрывания повторов.
+ *
+ * Движок детерминирован: партия целиком задаётся зерном, способом выбора
+ * фигур, рекордом на начало и последовательностью действий (гравитация —
+ * тоже действие Up). Поэтому повтор хранит только их, а проигрывание создаёт
+ * экземпляр с тем же зерном и применяет действия подряд без пауз. После
+ * каждого действия сверяется контрольная сумма состояния, так что сборка с
+ * изменённым движком, которая где-то разошлась со старой, ловится на первом
+ * же расходящемся действии. Одинаковые сдвиги и спуски одного такта
+ * (автоповтор, навёрстанная гравитация) применяются одним проходом
+ * repeatMove(), как их применил и движок при записи, и сумма сверяется после
+ * последнего из них.
+ *
+ * Чтобы не проигрывать длинную партию с начала ради каждого перехода, в
+ * повтор пишутся ключевые кадры — полный GameCore_t через каждые
+ * REPLAY_KEY_TICKS тактов — и индекс к ним в конце файла. Повтор читается
+ * через mmap, поэтому бинарный поиск по индексу трогает только нужные
+ * страницы, а переход к такту — это restoreCore() ближайшего кадра и не
+ * больше REPLAY_KEY_TICKS тактов событий после него.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "replay.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "repeat.h"
+
+/**
+ * \brief Подмешивает слово в хеш.
+ * \param h Хеш.
+ * \param v Слово.
+ * \return Новый хеш.
+ */
+static uint64_t mix(uint64_t h, uint64_t v) {
+  h = (h ^ v) * 0x9E3779B97F4A7C15ULL;
+  return h ^ (h >> 29);
+}
+
+/**
+ * \brief Контрольная сумма состояния партии. Считается по значениям полей,
+ * а не по байтам GameCore_t, поэтому не зависит от раскладки структуры и
+ * совпадает у сборок с разным устройством движка.
+ * \param params Экземпляр игры.
+ * \return Контрольная сумма.
+ */
+uint32_t stateChecksum(const GameParams_t *params) {
+  const GameCore_t *c = &params->core;
+  const Shape *s = &c->shape;
+  uint64_t h = 0x243F6A8885A308D3ULL;
+
+  for (int y = 0; y < FIELD_HEIGHT; y += 4) {
+    h = mix(h, (uint64_t)c->rows[y] | (uint64_t)c->rows[y + 1] << 16 |
+                   (uint64_t)c->rows[y + 2] << 32 |
+                   (uint64_t)c->rows[y + 3] << 48);
+  }
+  h = mix(h, (uint64_t)(uint32_t)c->score |
+                 (uint64_t)(uint32_t)c->high_score << 32);
+  h = mix(h, (uint64_t)(uint32_t)c->pieces |
+                 (uint64_t)(uint16_t)c->speed << 32 |
+                 (uint64_t)(uint8_t)c->level << 48 |
+                 (uint64_t)(uint8_t)c->state << 56);
+  h = mix(h, (uint64_t)(uint8_t)s->piece | (uint64_t)(uint8_t)s->rot << 8 |
+                 (uint64_t)(uint8_t)s->x << 16 |
+                 (uint64_t)(uint8_t)s->y << 24 |
+                 (uint64_t)(uint8_t)s->color << 32 |
+                 (uint64_t)(uint8_t)c->next_piece << 40 |
+                 (uint64_t)(uint8_t)c->pause << 48);
+
+  return (uint32_t)(h >> 32);
+}
+
+/**
+ * \brief Пишет целое little-endian заданной длины.
+ * \param w Запись повтора.
+ * \param v Значение.
+ * \param bytes Число байт.
+ */
+static void putLe(ReplayWriter_t *w, uint64_t v, int bytes) {
+  for (int i = 0; i < bytes; ++i) {
+    if (fputc((int)((v >> (8 * i)) & 0xFF), w->file) == EOF) {
+      w->failed = 1;
+    }
+  }
+  w->offset += (uint64_t)bytes;
+}
+
+/**
+ * \brief Записывает целое little-endian заданной длины в память.
+ * \param p Куда писать.
+ * \param v Значение.
+ * \param bytes Число байт.
+ */
+static void setLe(uint8_t *p, uint64_t v, int bytes) {
+  for (int i = 0; i < bytes; ++i) {
+    p[i] = (uint8_t)((v >> (8 * i)) & 0xFF);
+  }
+}
+
+/**
+ * \brief Пишет беззнаковое целое в формате varint: по 7 бит на байт,
+ * старший бит — «дальше есть ещё байт».
+ * \param w Запись повтора.
+ * \param v Значение.
+ */
+static void putVarint(ReplayWriter_t *w, uint64_t v) {
+  while (v >= 0x80) {
+    putLe(w, (v & 0x7F) | 0x80, 1);
+    v >>= 7;
+  }
+  putLe(w, v, 1);
+}
+
+/**
+ * \brief Запоминает ключевой кадр: состояние после записанных событий. Если
+ * память под кадр не выделилась, кадр пропускается — переход к такту тогда
+ * начнётся с предыдущего кадра.
+ * \param w Запись повтора.
+ * \param params Экземпляр игры.
+ */
+static void addKey(ReplayWriter_t *w, const GameParams_t *params) {
+  size_t size = REPLAY_KEY_HEADER + sizeof(GameCore_t);
+
+  if (w->key_count == w->key_cap) {
+    long cap = w->key_cap ? 2 * w->key_cap : 64;
+    uint8_t *keys = realloc(w->keys, (size_t)cap * size);
+    if (keys) {
+      w->keys = keys;
+      w->key_cap = cap;
+    }
+  }
+  if (w->key_count < w->key_cap) {
+    uint8_t *key = w->keys + (size_t)w->key_count * size;
+    setLe(key, w->tick, 8);
+    setLe(key + 8, (uint64_t)w->events, 8);
+    setLe(key + 16, w->offset, 8);
+    memcpy(key + REPLAY_KEY_HEADER, &params->core, sizeof(GameCore_t));
+    w->key_count += 1;
+  }
+  w->key_tick = w->tick;
+}
+
+/**
+ * \brief Начинает запись повтора партии. Экземпляр должен быть в состоянии
+ * STATE_START: повтор начинается с начала партии.
+ * \param path Файл повтора (перезаписывается).
+ * \param params Экземпляр игры.
+ * \return Запись или NULL, если экземпляр уже играет, файл не открылся или
+ * не хватило памяти.
+ */
+ReplayWriter_t *replayCreate(const char *path, const GameParams_t *params) {
+  ReplayWriter_t *w = NULL;
+
+  if (*params->state == STATE_START) {
+    w = malloc(sizeof *w);
+  }
+  if (w) {
+    w->file = fopen(path, "wb");
+    w->tick = 0;
+    w->offset = 0;
+    w->events = 0;
+    w->failed = 0;
+    w->keys = NULL;
+    w->key_count = 0;
+    w->key_cap = 0;
+    w->key_open = 0;
+    if (!w->file) {
+      free(w);
+      w = NULL;
+    }
+  }
+  if (w) {
+    for (int i = 0; i < 4; ++i) {
+      putLe(w, (uint8_t)REPLAY_MAGIC[i], 1);
+    }
+    putLe(w, REPLAY_VERSION, 1);
+    putLe(w, (uint64_t)params->core.randomizer, 1);
+    putLe(w, params->seed, 8);
+    putLe(w, (uint32_t)params->core.high_score, 4);
+    addKey(w, params);
+  }
+
+  return w;
+}
+
+/**
+ * \brief Добавляет в повтор действие, уже применённое к экземпляру, и при
+ * необходимости ключевой кадр после него. Кадр, за которым пришло событие
+ * того же такта, отменяется и пишется заново после этого события: события
+ * одного такта могут проигрываться вместе (см. runTo()), поэтому кадр
+ * стоит только между тактами.
+ * \param w Запись повтора.
+ * \param params Экземпляр игры после действия.
+ * \param tick Такт действия (не меньше такта предыдущего действия).
+ * \param action Действие.
+ */
+void replayWrite(ReplayWriter_t *w, const GameParams_t *params, uint64_t tick,
+                 UserAction_t action) {
+  uint64_t delta = tick > w->tick ? tick - w->tick : 0;
+
+  if (delta == 0 && w->key_open) {
+    w->key_count -= 1;
+    w->key_tick = w->key_prev;
+  }
+  w->key_open = 0;
+  putVarint(w, delta << REPLAY_ACTION_BITS | (uint64_t)action);
+  putLe(w, stateChecksum(params) & 0xFFFF, 2);
+  w->tick += delta;
+  w->events += 1;
+  if (w->tick - w->key_tick >= REPLAY_KEY_TICKS) {
+    long had = w->key_count;
+    w->key_prev = w->key_tick;
+    addKey(w, params);
+    w->key_open = w->key_count > had;
+  }
+}
+
+/**
+ * \brief Дописывает повтор на диск и освобождает запись.
+ * \param w Запись повтора (NULL допустим).
+ * \return 0 при успехе, -1, если при записи была ошибка.
+ */
+int replayClose(ReplayWriter_t *w) {
+  int res = 0;
+
+  if (w) {
+    uint64_t index = w->offset;
+    size_t size = REPLAY_KEY_HEADER + sizeof(GameCore_t);
+
+    if (w->key_count > 0 &&
+        fwrite(w->keys, size, (size_t)w->key_count, w->file) !=
+            (size_t)w->key_count) {
+      w->failed = 1;
+    }
+    putLe(w, index, 8);
+    putLe(w, (uint64_t)w->key_count, 4);
+    putLe(w, sizeof(GameCore_t), 2);
+    putLe(w, size, 2);
+    for (int i = 0; i < 4; ++i) {
+      putLe(w, (uint8_t)REPLAY_INDEX_MAGIC[i], 1);
+    }
+    if (fclose(w->file) != 0 || w->failed) {
+      res = -1;
+    }
+    free(w->keys);
+    free(w);
+  }
+
+  return res;
+}
+
+/**
+ * \brief Читает целое little-endian заданной длины из заголовка.
+ * \param p Начало поля.
+ * \param bytes Число байт.
+ * \return Значение.
+ */
+static uint64_t getLe(const uint8_t *p, int bytes) {
+  uint64_t v = 0;
+
+  for (int i = 0; i < bytes; ++i) {
+    v |= (uint64_t)p[i] << (8 * i);
+  }
+
+  return v;
+}
+
+/**
+ * \brief Находит индекс ключевых кадров по хвосту файла. Если хвоста нет
+ * (запись оборвалась), события идут до конца файла и кадров нет. Кадры
+ * сборки с другим GameCore_t не используются, но граница событий берётся
+ * из хвоста.
+ * \param r Чтение повтора.
+ */
+static void findIndex(ReplayReader_t *r) {
+  const uint8_t *t = NULL;
+
+  r->end = r->size;
+  if (r->size >= REPLAY_HEADER_SIZE + REPLAY_TRAILER_SIZE) {
+    t = r->data + r->size - REPLAY_TRAILER_SIZE;
+  }
+  if (t && memcmp(t + 16, REPLAY_INDEX_MAGIC, 4) == 0) {
+    uint64_t index = getLe(t, 8);
+    uint64_t count = getLe(t + 8, 4);
+    uint64_t core = getLe(t + 12, 2);
+    uint64_t size = getLe(t + 14, 2);
+
+    if (index >= REPLAY_HEADER_SIZE && size >= REPLAY_KEY_HEADER &&
+        index + count * size + REPLAY_TRAILER_SIZE == r->size) {
+      r->end = (size_t)index;
+      if (core == sizeof(GameCore_t) &&
+          size == REPLAY_KEY_HEADER + sizeof(GameCore_t) && count > 0) {
+        r->keys = r->data + index;
+        r->key_count = (long)count;
+        r->key_size = (size_t)size;
+      }
+    }
+  }
+}
+
+/**
+ * \brief Отображает повтор в память только для чтения и разбирает заголовок
+ * и индекс ключевых кадров. События и кадры читаются с диска по мере
+ * обращения к ним.
+ * \param r Чтение повтора (заполняется; освобождается replayFree()).
+ * \param path Файл повтора.
+ * \return 0 при успехе, -1, если файл не читается или это не повтор.
+ */
+int replayOpen(ReplayReader_t *r, const char *path) {
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  int res = -1;
+
+  memset(r, 0, sizeof *r);
+  if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size >= REPLAY_HEADER_SIZE) {
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+      r->data = map;
+      r->size = (size_t)st.st_size;
+    }
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+  if (r->data && memcmp(r->data, REPLAY_MAGIC, 4) == 0 &&
+      (r->data[4] == 1 || r->data[4] == REPLAY_VERSION)) {
+    r->pos = REPLAY_HEADER_SIZE;
+    r->end = r->size;
+    r->randomizer = r->data[5];
+    r->seed = getLe(r->data + 6, 8);
+    r->high_score = (int)(uint32_t)getLe(r->data + 14, 4);
+    if (r->data[4] == REPLAY_VERSION) {
+      findIndex(r);
+    }
+    res = 0;
+  }
+  if (res != 0) {
+    replayFree(r);
+  }
+
+  return res;
+}
+
+/**
+ * \brief Читает следующее событие повтора.
+ * \param r Чтение повтора.
+ * \param ev Событие (заполняется).
+ * \return 1 — событие прочитано, 0 — повтор закончился, -1 — файл обрезан
+ * посреди события.
+ */
+int replayNext(ReplayReader_t *r, ReplayEvent_t *ev) {
+  uint64_t code = 0;
+  int shift = 0;
+  int more = 1;
+  int res = r->pos < r->end ? 1 : 0;
+
+  while (res == 1 && more) {
+    if (r->pos >= r->end || shift > 63) {
+      res = -1;
+    } else {
+      uint8_t b = r->data[r->pos++];
+      code |= (uint64_t)(b & 0x7F) << shift;
+      shift += 7;
+      more = b & 0x80;
+    }
+  }
+  if (res == 1 && r->pos + 2 > r->end) {
+    res = -1;
+  }
+  if (res == 1) {
+    r->tick += code >> REPLAY_ACTION_BITS;
+    r->event += 1;
+    ev->tick = r->tick;
+    ev->action = (UserAction_t)(code & ((1u << REPLAY_ACTION_BITS) - 1));
+    ev->check = (uint16_t)getLe(r->data + r->pos, 2);
+    r->pos += 2;
+  }
+
+  return res;
+}
+
+/**
+ * \brief Ищет бинарным поиском последний ключевой кадр не позже такта.
+ * \param r Чтение повтора.
+ * \param tick Такт.
+ * \return Номер кадра или -1, если подходящего кадра нет.
+ */
+long replayFindKey(const ReplayReader_t *r, uint64_t tick) {
+  long lo = 0;
+  long hi = r->key_count;
+
+  while (lo < hi) {
+    long mid = lo + (hi - lo) / 2;
+    if (getLe(r->keys + (size_t)mid * r->key_size, 8) <= tick) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  return lo - 1;
+}
+
+/**
+ * \brief Снимает отображение повтора.
+ * \param r Чтение повтора.
+ */
+void replayFree(ReplayReader_t *r) {
+  if (r->data) {
+    munmap((void *)(uintptr_t)r->data, r->size);
+  }
+  memset(r, 0, sizeof *r);
+}
+
+/**
+ * \brief Открывает повтор для проигрывания и создаёт для него экземпляр игры
+ * в начале партии.
+ * \param path Файл повтора.
+ * \return Проигрыватель или NULL, если файл не читается, это не повтор или
+ * не хватило памяти.
+ */
+ReplayPlayer_t *replayPlayerOpen(const char *path) {
+  ReplayPlayer_t *p = malloc(sizeof *p);
+
+  if (p && replayOpen(&p->r, path) != 0) {
+    free(p);
+    p = NULL;
+  }
+  if (p) {
+    tetris_config_t cfg = {p->r.seed, (tetris_randomizer_t)p->r.randomizer,
+                           ""};
+    p->block = aligned_alloc(CACHE_LINE, sizeof *p->block);
+    if (p->block) {
+      p->params = initParams(p->block, p->r.high_score, &cfg);
+    } else {
+      replayFree(&p->r);
+      free(p);
+      p = NULL;
+    }
+  }
+
+  return p;
+}
+
+/**
+ * \brief Проигрывает события подряд, пока их такт не больше заданного,
+ * сверяя контрольную сумму после каждого. Идущие подряд одинаковые Left,
+ * Right или Up одного такта применяются одним repeatMove(), и сумма
+ * сверяется после последнего из них: промежуточные суммы таких событий
+ * запись берёт с состояния после всего прохода.
+ * \param p Проигрыватель.
+ * \param tick Такт, до которого (включительно) идёт проигрывание.
+ * \return 0 — дошли, 1 — состояние разошлось с записанным (на событии
+ * p->r.event - 1), -1 — повтор обрезан посреди события.
+ */
+static int runTo(ReplayPlayer_t *p, uint64_t tick) {
+  int res = 0;
+  int more = 1;
+
+  while (res == 0 && more) {
+    ReplayReader_t at = p->r;
+    ReplayEvent_t ev;
+    int got = replayNext(&p->r, &ev);
+
+    if (got == 1 && ev.tick <= tick) {
+      int same = ev.action == Left || ev.action == Right || ev.action == Up;
+      int n = 1;
+      ReplayReader_t run = p->r;
+      ReplayEvent_t more;
+      while (same && replayNext(&run, &more) == 1 && more.tick == ev.tick &&
+             more.action == ev.action) {
+        p->r = run;
+        ev.check = more.check;
+        ++n;
+      }
+      repeatMove(p->params, ev.action, n);
+      if ((stateChecksum(p->params) & 0xFFFF) != ev.check) {
+        res = 1;
+      }
+    } else {
+      p->r = at;
+      more = 0;
+      res = got < 0 ? -1 : 0;
+    }
+  }
+
+  return res;
+}
+
+/**
+ * \brief Переводит экземпляр проигрывателя в состояние после всех событий
+ * с тактом не больше заданного. Если ближайший ключевой кадр ближе текущей
+ * позиции (или цель позади неё), экземпляр восстанавливается из кадра,
+ * иначе события проигрываются от текущей позиции. Без индекса назад
+ * приходится идти от начала партии.
+ * \param p Проигрыватель.
+ * \param tick Такт.
+ * \return 0 — дошли, 1 — состояние разошлось с записанным (на событии
+ * p->r.event - 1), -1 — повтор повреждён.
+ */
+int replaySeek(ReplayPlayer_t *p, uint64_t tick) {
+  long k = replayFindKey(&p->r, tick);
+  const uint8_t *key = k >= 0 ? p->r.keys + (size_t)k * p->r.key_size : NULL;
+  long key_event = key ? (long)getLe(key + 8, 8) : 0;
+  int res = 0;
+
+  if (p->r.tick > tick || p->r.event < key_event) {
+    if (key) {
+      GameCore_t core;
+      uint64_t pos = getLe(key + 16, 8);
+      memcpy(&core, key + REPLAY_KEY_HEADER, sizeof core);
+      restoreCore(p->params, &core);
+      p->r.tick = getLe(key, 8);
+      p->r.event = key_event;
+      p->r.pos = (size_t)pos;
+      res = pos >= REPLAY_HEADER_SIZE && pos <= p->r.end ? 0 : -1;
+    } else {
+      tetris_config_t cfg = {p->r.seed, (tetris_randomizer_t)p->r.randomizer,
+                             ""};
+      p->params = initParams(p->block, p->r.high_score, &cfg);
+      p->r.tick = 0;
+      p->r.event = 0;
+      p->r.pos = REPLAY_HEADER_SIZE;
+    }
+  }
+  if (res == 0) {
+    res = runTo(p, tick);
+  }
+
+  return res;
+}
+
+/**
+ * \brief Закрывает проигрыватель вместе с его экземпляром игры.
+ * \param p Проигрыватель (NULL допустим).
+ */
+void replayPlayerClose(ReplayPlayer_t *p) {
+  if (p) {
+    replayFree(&p->r);
+    free(p->block);
+    free(p);
+  }
+}
+
+/**
+ * \brief Проигрывает повтор без интерфейса так быстро, как может процессор,
+ * сверяя контрольную сумму после каждого действия. Ключевые кадры не
+ * используются: проверяется вся партия. Проигрывание останавливается на
+ * первом расхождении.
+ * \param path Файл повтора.
+ * \param out Итог проигрывания (заполняется).
+ * \return 0 — все суммы совпали, 1 — состояние разошлось (номер события в
+ * out->mismatch), -1 — файл не читается, повреждён или не хватило памяти.
+ */
+int replayRun(const char *path, tetris_replay_t *out) {
+  ReplayPlayer_t *p = replayPlayerOpen(path);
+  int res = -1;
+
+  memset(out, 0, sizeof *out);
+  out->mismatch = -1;
+  if (p) {
+    res = runTo(p, UINT64_MAX);
+    out->events = p->r.event;
+    out->ticks = p->r.tick;
+    out->mismatch = res == 1 ? p->r.event - 1 : -1;
+    out->score = p->params->core.score;
+    out->pieces = p->params->core.pieces;
+    replayPlayerClose(p);
+  }
+
+  return res;
+}
@@ -0,0 +1,127 @@
+/**
+ * \file replay.h
+ * \brief Запись партии в компактный двоичный повтор, его проигрывание без
+ * интерфейса с проверкой контрольных сумм состояния и переход к любому такту
+ * через ключевые кадры.
+ */
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdio.h>
+
+#include "back.h"
+
+/// \brief Сигнатура в начале файла повтора.
+#define REPLAY_MAGIC "TRPL"
+/// \brief Сигнатура в конце индекса ключевых кадров.
+#define REPLAY_INDEX_MAGIC "TRPX"
+/// \brief Версия формата повтора (1 — без индекса ключевых кадров).
+#define REPLAY_VERSION 2
+/// \brief Размер заголовка: сигнатура, версия, способ выбора фигур, зерно и
+/// рекорд на начало партии.
+#define REPLAY_HEADER_SIZE 18
+/// \brief Размер хвоста индекса: смещение индекса, число кадров, размер
+/// состояния, размер записи кадра и REPLAY_INDEX_MAGIC.
+#define REPLAY_TRAILER_SIZE 20
+/// \brief Размер записи кадра без состояния: такт, номер события и смещение.
+#define REPLAY_KEY_HEADER 24
+/// \brief Сколько бит кода события занимает действие.
+#define REPLAY_ACTION_BITS 3
+/// \brief Ключевой кадр пишется, когда с прошлого прошло столько тактов.
+#define REPLAY_KEY_TICKS 256
+
+/**
+ * \brief Событие повтора: действие, такт, на котором оно применено, и
+ * младшие 16 бит контрольной суммы состояния после него.
+ */
+typedef struct {
+  uint64_t tick;
+  UserAction_t action;
+  uint16_t check;
+} ReplayEvent_t;
+
+/**
+ * \brief Запись повтора.
+ *
+ * Формат: заголовок REPLAY_HEADER_SIZE байт (REPLAY_MAGIC, версия,
+ * randomizer, зерно — 8 байт, рекорд — 4 байта, всё little-endian), затем
+ * события. Событие — varint из разности тактов с предыдущим событием,
+ * сдвинутой на REPLAY_ACTION_BITS, и номера действия в младших битах, за ним
+ * 2 байта контрольной суммы. Действие в пределах 16 тактов от предыдущего
+ * занимает 3 байта.
+ *
+ * За событиями идёт индекс ключевых кадров, а в самом конце — хвост
+ * REPLAY_TRAILER_SIZE байт, по которому индекс находится без чтения
+ * событий. Кадр — такт, номер следующего события и его смещение в файле (по
+ * 8 байт), за ними GameCore_t целиком. Первый кадр — начало партии,
+ * следующие пишутся после события, если с прошлого кадра прошло не меньше
+ * REPLAY_KEY_TICKS тактов, и только между тактами. Кадры копятся в keys и
+ * дописываются в replayClose(); повтор, запись которого оборвалась, читается
+ * без индекса. key_open — последний кадр записан после последнего события и
+ * отменится, если следующее событие будет в том же такте (key_prev — такт
+ * кадра до него).
+ */
+typedef struct ReplayWriter {
+  FILE *file;
+  uint64_t tick;
+  uint64_t offset;
+  long events;
+  int failed;
+  uint8_t *keys;
+  long key_count;
+  long key_cap;
+  uint64_t key_tick;
+  uint64_t key_prev;
+  int key_open;
+} ReplayWriter_t;
+
+/**
+ * \brief Повтор, отображённый в память только для чтения, и позиция чтения
+ * в нём.
+ *
+ * События лежат в data до end. keys указывает на индекс ключевых кадров
+ * (key_count записей по key_size байт) или равен NULL, если индекса нет или
+ * он записан сборкой с другим GameCore_t. tick — такт последнего прочитанного
+ * события, event — сколько событий прочитано.
+ */
+typedef struct {
+  const uint8_t *data;
+  size_t size;
+  size_t end;
+  size_t pos;
+  uint64_t seed;
+  int randomizer;
+  int high_score;
+  uint64_t tick;
+  long event;
+  const uint8_t *keys;
+  long key_count;
+  size_t key_size;
+} ReplayReader_t;
+
+/**
+ * \brief Проигрыватель повтора: повтор и собственный экземпляр игры, который
+ * находится в состоянии после r.event событий повтора.
+ */
+typedef struct ReplayPlayer {
+  ReplayReader_t r;
+  GameBlock_t *block;
+  GameParams_t *params;
+} ReplayPlayer_t;
+
+uint32_t stateChecksum(const GameParams_t *params);
+ReplayWriter_t *replayCreate(const char *path, const GameParams_t *params);
+void replayWrite(ReplayWriter_t *w, const GameParams_t *params, uint64_t tick,
+                 UserAction_t action);
+int replayClose(ReplayWriter_t *w);
+int replayOpen(ReplayReader_t *r, const char *path);
+int replayNext(ReplayReader_t *r, ReplayEvent_t *ev);
+long replayFindKey(const ReplayReader_t *r, uint64_t tick);
+void replayFree(ReplayReader_t *r);
+ReplayPlayer_t *replayPlayerOpen(const char *path);
+int replaySeek(ReplayPlayer_t *p, uint64_t tick);
+void replayPlayerClose(ReplayPlayer_t *p);
+int replayRun(const char *path, tetris_replay_t *out);
+
+#endif
@@ -0,0 +1,51 @@
+/**
+ * \file rng.c
+ * \brief Реализация генератора PCG32 (XSH RR, 64-битное состояние).
+ *
+ * В отличие от rand(), генератор не имеет общего для процесса состояния и не
+ * берёт блокировок, а одинаковое зерно всегда даёт одинаковую
+ * последовательность.
+ */
+
+#include "rng.h"
+
+#define PCG_MULT 6364136223846793005ULL
+#define PCG_INC 1442695040888963407ULL
+
+/**
+ * \brief Инициализирует генератор зерном.
+ * \param rng Генератор.
+ * \param seed Зерно.
+ */
+void rngSeed(Rng_t *rng, uint64_t seed) {
+  rng->state = 0;
+  rngNext(rng);
+  rng->state += seed;
+  rngNext(rng);
+}
+
+/**
+ * \brief Выдаёт следующее 32-битное число.
+ * \param rng Генератор.
+ * \return Псевдослучайное число.
+ */
+uint32_t rngNext(Rng_t *rng) {
+  uint64_t old = rng->state;
+  rng->state = old * PCG_MULT + PCG_INC;
+
+  uint32_t xorshifted = (uint32_t)(((old >> 18u) ^ old) >> 27u);
+  uint32_t rot = (uint32_t)(old >> 59u);
+
+  return (xorshifted >> rot) | (xorshifted << ((32u - rot) & 31u));
+}
+
+/**
+ * \brief Выдаёт число из диапазона [0, bound) умножением со сдвигом, без
+ * деления.
+ * \param rng Генератор.
+ * \param bound Верхняя граница (больше 0).
+ * \return Псевдослучайное число.
+ */
+int rngBounded(Rng_t *rng, int bound) {
+  return (int)(((uint64_t)rngNext(rng) * (uint32_t)bound) >> 32);
+}
@@ -0,0 +1,21 @@
+/**
+ * \file rng.h
+ * \brief Небольшой генератор псевдослучайных чисел PCG32, у каждого
+ * экземпляра игры свой.
+ */
+
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+
+/// \brief Состояние генератора PCG32 (приращение фиксировано).
+typedef struct {
+  uint64_t state;
+} Rng_t;
+
+void rngSeed(Rng_t *rng, uint64_t seed);
+uint32_t rngNext(Rng_t *rng);
+int rngBounded(Rng_t *rng, int bound);
+
+#endif
@@ -0,0 +1,39 @@
+/**
+ * \file shard.c
+ * \brief Реализация списка блоков потоков.
+ */
+
+#include "shard.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * \brief Выделяет обнулённый блок, выровненный по CACHE_LINE, чтобы блоки
+ * разных потоков не делили строки кэша.
+ * \param size Размер блока (кратен CACHE_LINE: в начале блока Shard_t).
+ * \return Блок или NULL при нехватке памяти.
+ */
+void *shardNew(size_t size) {
+  void *res = aligned_alloc(CACHE_LINE, size);
+
+  if (res) {
+    memset(res, 0, size);
+  }
+
+  return res;
+}
+
+/**
+ * \brief Публикует заполненный блок: добавляет его в голову списка. После
+ * этого читатели видят всё, что записано в блок до вызова.
+ * \param list Голова списка.
+ * \param shard Блок.
+ */
+void shardPush(Shard_t *_Atomic *list, Shard_t *shard) {
+  shard->next = atomic_load_explicit(list, memory_order_relaxed);
+  while (!atomic_compare_exchange_weak_explicit(list, &shard->next, shard,
+                                                memory_order_release,
+                                                memory_order_relaxed)) {
+  }
+}
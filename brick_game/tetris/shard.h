@@ -0,0 +1,38 @@
+/**
+ * \file shard.h
+ * \brief Данные потоков без блокировок: каждый поток заводит себе блок
+ * (например, набор счётчиков или буфер трассировки) при первом обращении и
+ * пишет только в него, а читатели обходят блоки всех потоков по общему
+ * списку.
+ *
+ * Блок добавляется в голову списка через compare-and-swap и не
+ * освобождается до конца процесса. Поэтому обходить список можно в любой
+ * момент без блокировок, а данные завершившихся потоков остаются в нём.
+ */
+
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "back.h"
+
+/// \brief Звено списка блоков; должно быть первым полем блока.
+typedef struct Shard {
+  _Alignas(CACHE_LINE) struct Shard *next;
+} Shard_t;
+
+void *shardNew(size_t size);
+void shardPush(Shard_t *_Atomic *list, Shard_t *shard);
+
+/**
+ * \brief Первый блок списка; дальше блоки обходятся по next.
+ * \param list Голова списка.
+ * \return Блок, добавленный последним, или NULL.
+ */
+static inline Shard_t *shardFirst(Shard_t *_Atomic *list) {
+  return atomic_load_explicit(list, memory_order_acquire);
+}
+
+#endif
@@ -0,0 +1,90 @@
+/**
+ * \file snapshot.c
+ * \brief Реализация тройного буфера снимков.
+ */
+
+#include "snapshot.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * \brief Создаёт буфер. Пока ничего не опубликовано, читатель получает
+ * пустой снимок с версией 0.
+ * \return Буфер или NULL при нехватке памяти.
+ */
+SnapBuffer_t *snapCreate(void) {
+  SnapBuffer_t *buf = aligned_alloc(CACHE_LINE, sizeof *buf);
+
+  if (buf) {
+    memset(buf, 0, sizeof *buf);
+    buf->back = 0;
+    atomic_init(&buf->shared, 1u);
+    buf->front = 2;
+  }
+
+  return buf;
+}
+
+/**
+ * \brief Отдаёт писателю ячейку под следующий снимок. Читатель её не видит,
+ * пока не вызван snapCommit().
+ * \param buf Буфер.
+ * \return Снимок для заполнения (версию проставит snapCommit()).
+ */
+tetris_snapshot_t *snapBegin(SnapBuffer_t *buf) {
+  return &buf->slots[buf->back].snap;
+}
+
+/**
+ * \brief Публикует заполненный снимок: проставляет версию и обменивает ячейку
+ * писателя со средней. Release-семантика обмена гарантирует, что читатель,
+ * забравший ячейку, увидит снимок целиком.
+ * \param buf Буфер.
+ */
+void snapCommit(SnapBuffer_t *buf) {
+  buf->version += 1;
+  buf->slots[buf->back].snap.version = buf->version;
+  buf->back = atomic_exchange_explicit(&buf->shared, buf->back | SNAP_FRESH,
+                                       memory_order_acq_rel) &
+              ~SNAP_FRESH;
+}
+
+/**
+ * \brief Снимает состояние экземпляра игры вместе с версиями строк поля и
+ * публикует его.
+ * \param buf Буфер.
+ * \param params Экземпляр игры.
+ */
+void snapPublish(SnapBuffer_t *buf, const GameParams_t *params) {
+  tetris_snapshot_t *snap = snapBegin(buf);
+
+  fillObservation(params, &snap->obs);
+  snap->field_version = params->field_version;
+  for (int y = 0; y < FIELD_HEIGHT; ++y) {
+    snap->row_version[y] = params->row_version[y];
+  }
+  snapCommit(buf);
+}
+
+/**
+ * \brief Возвращает последний опубликованный снимок. Если с прошлого чтения
+ * ничего не публиковалось, возвращается тот же снимок (с той же версией).
+ * \param buf Буфер.
+ * \return Снимок; не меняется до следующего вызова snapRead().
+ */
+const tetris_snapshot_t *snapRead(SnapBuffer_t *buf) {
+  if (atomic_load_explicit(&buf->shared, memory_order_relaxed) & SNAP_FRESH) {
+    buf->front = atomic_exchange_explicit(&buf->shared, buf->front,
+                                          memory_order_acq_rel) &
+                 ~SNAP_FRESH;
+  }
+
+  return &buf->slots[buf->front].snap;
+}
+
+/**
+ * \brief Освобождает буфер.
+ * \param buf Буфер (NULL допустим).
+ */
+void snapDestroy(SnapBuffer_t *buf) { free(buf); }
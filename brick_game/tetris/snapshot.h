@@ -0,0 +1,48 @@
+/**
+ * \file snapshot.h
+ * \brief Тройной буфер снимков: поток игры публикует состояние, поток
+ * отрисовки читает последнее опубликованное, и никто никого не ждёт.
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdatomic.h>
+
+#include "back.h"
+
+/// \brief Флаг в shared: в средней ячейке лежит снимок, который читатель ещё
+/// не забрал.
+#define SNAP_FRESH 4u
+
+/// \brief Ячейка тройного буфера: снимок на своей кэш-линии.
+typedef struct {
+  _Alignas(CACHE_LINE) tetris_snapshot_t snap;
+} SnapSlot_t;
+
+/**
+ * \brief Тройной буфер снимков.
+ *
+ * Из трёх ячеек одна принадлежит писателю (back), одна — читателю (front), а
+ * номер третьей лежит в shared. Опубликовать снимок — атомарно обменять back
+ * с shared и взвести SNAP_FRESH; забрать — обменять front с shared, если
+ * флаг взведён. Писатель и читатель никогда не пишут и не читают одну ячейку
+ * одновременно, а снимок, отданный читателю, не меняется до его следующего
+ * чтения. Писатель и читатель — по одному потоку.
+ */
+typedef struct SnapBuffer {
+  SnapSlot_t slots[3];
+  _Alignas(CACHE_LINE) atomic_uint shared;
+  _Alignas(CACHE_LINE) unsigned back;
+  unsigned long long version;
+  _Alignas(CACHE_LINE) unsigned front;
+} SnapBuffer_t;
+
+SnapBuffer_t *snapCreate(void);
+tetris_snapshot_t *snapBegin(SnapBuffer_t *buf);
+void snapCommit(SnapBuffer_t *buf);
+void snapPublish(SnapBuffer_t *buf, const GameParams_t *params);
+const tetris_snapshot_t *snapRead(SnapBuffer_t *buf);
+void snapDestroy(SnapBuffer_t *buf);
+
+#endif
@@ -0,0 +1,341 @@
+/**
+ * \file stats.c
+ * \brief Реализация счётчиков движка.
+ *
+ * Набор счётчиков потока заводится при его первом подсчёте; счётчики
+ * завершившихся потоков остаются в сумме. Владелец увеличивает счётчик
+ * relaxed-загрузкой и relaxed-записью (других писателей у набора нет),
+ * читатели складывают наборы relaxed-загрузками: сумма, прочитанная во
+ * время игры, может не включать действия, которые выполняются в этот
+ * момент, но каждое значение в ней целое.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+_Static_assert(STATS_BUCKETS == TETRIS_STATS_BUCKETS &&
+                   STATS_ACTIONS == TETRIS_STATS_ACTIONS &&
+                   STATS_LINES == TETRIS_MAX_LINES + 1,
+               "stats layout must match tetris_stats_t");
+
+atomic_bool statsOn;
+
+/// \brief Список наборов счётчиков всех потоков.
+static Shard_t *_Atomic shards;
+
+/// \brief Набор счётчиков текущего потока (NULL — ещё не заведён).
+static _Thread_local StatsShard_t *local;
+
+/// \brief Имена действий для statsDump() в порядке UserAction_t.
+static const char *const actionNames[STATS_ACTIONS] = {
+    "Start", "Pause", "Terminate", "Left", "Right", "Up", "Down", "Action"};
+
+/**
+ * \brief Набор счётчиков текущего потока; заводится при первом вызове.
+ * \return Набор или NULL при нехватке памяти (подсчёт тогда пропускается).
+ */
+static StatsShard_t *localShard(void) {
+  if (!local) {
+    local = shardNew(sizeof *local);
+    if (local) {
+      shardPush(&shards, &local->link);
+    }
+  }
+
+  return local;
+}
+
+/**
+ * \brief Увеличивает счётчик своего потока.
+ * \param c Счётчик.
+ * \param n Приращение.
+ */
+static void bump(atomic_ullong *c, unsigned long long n) {
+  atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + n,
+                        memory_order_relaxed);
+}
+
+/**
+ * \brief Включает или выключает сбор статистики. Накопленное при этом не
+ * сбрасывается.
+ * \param on 1 — включить.
+ */
+void statsEnable(int on) {
+  atomic_store_explicit(&statsOn, on != 0, memory_order_relaxed);
+}
+
+/**
+ * \brief Монотонные часы для замера задержек.
+ * \return Наносекунды.
+ */
+uint64_t statsClock(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * \brief Учитывает выполненное действие.
+ * \param action Действие.
+ * \param ns Сколько оно заняло, нс.
+ */
+void statsAction(UserAction_t action, uint64_t ns) {
+  StatsShard_t *s = localShard();
+
+  if (s && action >= Start && action <= Action) {
+    StatsLatency_t *lat = &s->actions[action];
+    bump(&lat->count, 1);
+    bump(&lat->total_ns, ns);
+    if (ns > atomic_load_explicit(&lat->max_ns, memory_order_relaxed)) {
+      atomic_store_explicit(&lat->max_ns, ns, memory_order_relaxed);
+    }
+    bump(&lat->buckets[statsBucket(ns)], 1);
+  }
+}
+
+/**
+ * \brief Учитывает фиксацию фигуры.
+ * \param lines Сколько линий она сняла.
+ */
+void statsLock(int lines) {
+  StatsShard_t *s = localShard();
+
+  if (s && lines >= 0 && lines < STATS_LINES) {
+    bump(&s->lines[lines], 1);
+  }
+}
+
+/**
+ * \brief Учитывает появление новой фигуры.
+ * \param failed 1 — фигура не поместилась на поле.
+ */
+void statsSpawn(int failed) {
+  StatsShard_t *s = localShard();
+
+  if (s) {
+    bump(&s->spawns, 1);
+    bump(&s->spawn_fails, failed != 0);
+  }
+}
+
+/**
+ * \brief Учитывает попытку поворота.
+ * \param rejected 1 — isPossbl() не пустил фигуру в новую ориентацию.
+ */
+void statsRotate(int rejected) {
+  StatsShard_t *s = localShard();
+
+  if (s) {
+    bump(&s->rotations, 1);
+    bump(&s->rotate_rejects, rejected != 0);
+  }
+}
+
+/**
+ * \brief Корзина гистограммы для задержки.
+ * \param ns Задержка, нс.
+ * \return Номер корзины от 0 до STATS_BUCKETS - 1.
+ */
+int statsBucket(uint64_t ns) {
+  uint64_t v = ns < (1ull << STATS_MAX_BITS) ? ns
+                                              : (1ull << STATS_MAX_BITS) - 1;
+  int res = (int)v;
+
+  if (v >= STATS_SUB) {
+    int e = STATS_SUB_BITS;
+    while (v >> (e + 1)) {
+      ++e;
+    }
+    res = (e - STATS_SUB_BITS + 1) * STATS_SUB +
+          (int)((v >> (e - STATS_SUB_BITS)) & (STATS_SUB - 1));
+  }
+
+  return res;
+}
+
+/**
+ * \brief Наименьшая задержка, попадающая в корзину.
+ * \param bucket Номер корзины от 0 до STATS_BUCKETS.
+ * \return Задержка, нс.
+ */
+static uint64_t bucketLow(int bucket) {
+  uint64_t res = (uint64_t)bucket;
+
+  if (bucket >= STATS_SUB) {
+    int e = bucket / STATS_SUB + STATS_SUB_BITS - 1;
+    res = (uint64_t)(STATS_SUB + bucket % STATS_SUB) << (e - STATS_SUB_BITS);
+  }
+
+  return res;
+}
+
+/**
+ * \brief Наибольшая задержка, попадающая в корзину.
+ * \param bucket Номер корзины от 0 до STATS_BUCKETS - 1.
+ * \return Задержка, нс.
+ */
+uint64_t statsBucketTop(int bucket) { return bucketLow(bucket + 1) - 1; }
+
+/**
+ * \brief Складывает счётчики всех потоков.
+ * \param out Сумма (заполняется).
+ */
+void statsRead(tetris_stats_t *out) {
+  memset(out, 0, sizeof *out);
+
+  for (Shard_t *l = shardFirst(&shards); l; l = l->next) {
+    StatsShard_t *s = (StatsShard_t *)(void *)l;
+    for (int a = 0; a < STATS_ACTIONS; ++a) {
+      StatsLatency_t *src = &s->actions[a];
+      tetris_latency_t *dst = &out->actions[a];
+      unsigned long long max =
+          atomic_load_explicit(&src->max_ns, memory_order_relaxed);
+      dst->count += atomic_load_explicit(&src->count, memory_order_relaxed);
+      dst->total_ns +=
+          atomic_load_explicit(&src->total_ns, memory_order_relaxed);
+      dst->max_ns = max > dst->max_ns ? max : dst->max_ns;
+      for (int b = 0; b < STATS_BUCKETS; ++b) {
+        dst->buckets[b] +=
+            atomic_load_explicit(&src->buckets[b], memory_order_relaxed);
+      }
+    }
+    for (int k = 0; k < STATS_LINES; ++k) {
+      out->lines[k] += atomic_load_explicit(&s->lines[k], memory_order_relaxed);
+    }
+    out->spawns += atomic_load_explicit(&s->spawns, memory_order_relaxed);
+    out->spawn_fails +=
+        atomic_load_explicit(&s->spawn_fails, memory_order_relaxed);
+    out->rotations += atomic_load_explicit(&s->rotations, memory_order_relaxed);
+    out->rotate_rejects +=
+        atomic_load_explicit(&s->rotate_rejects, memory_order_relaxed);
+    out->threads += 1;
+  }
+}
+
+/**
+ * \brief Обнуляет счётчики всех потоков. Подсчёт, который поток делает в
+ * этот момент, может пережить обнуление, поэтому сбрасывать лучше, пока
+ * движок стоит.
+ */
+void statsReset(void) {
+  for (Shard_t *l = shardFirst(&shards); l; l = l->next) {
+    StatsShard_t *s = (StatsShard_t *)(void *)l;
+    for (int a = 0; a < STATS_ACTIONS; ++a) {
+      StatsLatency_t *lat = &s->actions[a];
+      atomic_store_explicit(&lat->count, 0, memory_order_relaxed);
+      atomic_store_explicit(&lat->total_ns, 0, memory_order_relaxed);
+      atomic_store_explicit(&lat->max_ns, 0, memory_order_relaxed);
+      for (int b = 0; b < STATS_BUCKETS; ++b) {
+        atomic_store_explicit(&lat->buckets[b], 0, memory_order_relaxed);
+      }
+    }
+    for (int k = 0; k < STATS_LINES; ++k) {
+      atomic_store_explicit(&s->lines[k], 0, memory_order_relaxed);
+    }
+    atomic_store_explicit(&s->spawns, 0, memory_order_relaxed);
+    atomic_store_explicit(&s->spawn_fails, 0, memory_order_relaxed);
+    atomic_store_explicit(&s->rotations, 0, memory_order_relaxed);
+    atomic_store_explicit(&s->rotate_rejects, 0, memory_order_relaxed);
+  }
+}
+
+/**
+ * \brief Квантиль задержки по гистограмме: верхняя граница корзины, в
+ * которую попадает доля q вызовов (но не больше наибольшей задержки).
+ * \param lat Задержки.
+ * \param q Доля от 0 до 1 (0.99 — p99).
+ * \return Задержка, нс; 0, если вызовов не было.
+ */
+uint64_t statsPercentile(const tetris_latency_t *lat, double q) {
+  uint64_t res = 0;
+
+  if (lat->count > 0) {
+    double want = q * (double)lat->count;
+    unsigned long long need = (unsigned long long)want;
+    need += (double)need < want;
+    need = need < 1 ? 1 : need > lat->count ? lat->count : need;
+
+    unsigned long long seen = 0;
+    int b = 0;
+    while (b < STATS_BUCKETS - 1 && seen + lat->buckets[b] < need) {
+      seen += lat->buckets[b++];
+    }
+    res = statsBucketTop(b);
+    res = res < lat->max_ns ? res : lat->max_ns;
+  }
+
+  return res;
+}
+
+/**
+ * \brief Пишет задержки одного вида действий объектом JSON.
+ * \param f Файл.
+ * \param name Имя действия.
+ * \param lat Задержки.
+ */
+static void dumpLatency(FILE *f, const char *name,
+                        const tetris_latency_t *lat) {
+  double mean = lat->count ? (double)lat->total_ns / (double)lat->count : 0;
+  int first = 1;
+
+  fprintf(f,
+          "    {\"action\": \"%s\", \"count\": %llu, \"mean_ns\": %.1f, "
+          "\"p50_ns\": %llu, \"p90_ns\": %llu, \"p99_ns\": %llu, "
+          "\"p999_ns\": %llu, \"max_ns\": %llu, \"buckets\": [",
+          name, lat->count, mean,
+          (unsigned long long)statsPercentile(lat, 0.5),
+          (unsigned long long)statsPercentile(lat, 0.9),
+          (unsigned long long)statsPercentile(lat, 0.99),
+          (unsigned long long)statsPercentile(lat, 0.999), lat->max_ns);
+  for (int b = 0; b < STATS_BUCKETS; ++b) {
+    if (lat->buckets[b]) {
+      fprintf(f, "%s[%llu, %llu]", first ? "" : ", ",
+              (unsigned long long)statsBucketTop(b), lat->buckets[b]);
+      first = 0;
+    }
+  }
+  fprintf(f, "]}");
+}
+
+/**
+ * \brief Пишет сложенную статистику в файл JSON: по каждому действию число
+ * вызовов, среднее, p50/p90/p99/p99.9, максимум и непустые корзины
+ * гистограммы парами [верхняя граница, число]; затем фиксации по числу
+ * снятых линий, появления фигур и повороты.
+ * \param path Файл (перезаписывается).
+ * \return 0 при успехе, -1 при ошибке записи (errno сохраняется).
+ */
+int statsDump(const char *path) {
+  tetris_stats_t *st = malloc(sizeof *st);
+  FILE *f = st ? fopen(path, "w") : NULL;
+  int res = -1;
+
+  if (f) {
+    statsRead(st);
+    fprintf(f, "{\n  \"threads\": %d,\n  \"actions\": [\n", st->threads);
+    for (int a = 0; a < STATS_ACTIONS; ++a) {
+      dumpLatency(f, actionNames[a], &st->actions[a]);
+      fprintf(f, "%s\n", a == STATS_ACTIONS - 1 ? "" : ",");
+    }
+    fprintf(f, "  ],\n  \"lines_per_lock\": [");
+    for (int k = 0; k < STATS_LINES; ++k) {
+      fprintf(f, "%s%llu", k ? ", " : "", st->lines[k]);
+    }
+    fprintf(f,
+            "],\n  \"spawns\": %llu,\n  \"spawn_fails\": %llu,\n"
+            "  \"rotations\": %llu,\n  \"rotate_rejects\": %llu\n}\n",
+            st->spawns, st->spawn_fails, st->rotations, st->rotate_rejects);
+    res = ferror(f) ? -1 : 0;
+    res = fclose(f) != 0 ? -1 : res;
+  }
+  free(st);
+
+  return res;
+}
@@ -0,0 +1,83 @@
+/**
+ * \file stats.h
+ * \brief Счётчики горячих путей движка: число и задержка действий по видам
+ * (гистограммы с логарифмическими корзинами), снятые линии на фиксацию,
+ * неудачные появления фигур и повороты, отвергнутые isPossbl().
+ *
+ * Сбор выключен по умолчанию; выключенный стоит одной relaxed-загрузки
+ * флага на месте подсчёта. Каждый поток пишет в собственный набор
+ * счётчиков (StatsShard_t, блок из shard.h), поэтому запись не требует ни
+ * блокировок, ни атомарных read-modify-write. Чтение складывает наборы всех
+ * потоков.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdatomic.h>
+
+#include "back.h"
+#include "shard.h"
+
+/// \brief Бит на долю октавы: корзина не шире 1/8 своего значения.
+#define STATS_SUB_BITS 3
+/// \brief Корзин на октаву.
+#define STATS_SUB (1 << STATS_SUB_BITS)
+/// \brief Задержки от 2^STATS_MAX_BITS нс попадают в последнюю корзину.
+#define STATS_MAX_BITS 40
+/// \brief Корзин в гистограмме: по одной на значения меньше STATS_SUB,
+/// дальше по STATS_SUB на октаву.
+#define STATS_BUCKETS ((STATS_MAX_BITS - STATS_SUB_BITS + 1) * STATS_SUB)
+/// \brief Видов действий (UserAction_t).
+#define STATS_ACTIONS (Action + 1)
+/// \brief Вариантов числа линий, снятых одной фиксацией (0..PIECE_SIZE).
+#define STATS_LINES (PIECE_SIZE + 1)
+
+/// \brief Число вызовов, суммарная и наибольшая задержка и гистограмма
+/// задержек одного вида действий.
+typedef struct {
+  atomic_ullong count;
+  atomic_ullong total_ns;
+  atomic_ullong max_ns;
+  atomic_ullong buckets[STATS_BUCKETS];
+} StatsLatency_t;
+
+/**
+ * \brief Счётчики одного потока. Пишет в них только сам поток, остальные
+ * лишь читают (statsRead()) или обнуляют (statsReset()); link связывает
+ * наборы всех потоков в список.
+ */
+typedef struct {
+  Shard_t link;
+  StatsLatency_t actions[STATS_ACTIONS];
+  atomic_ullong lines[STATS_LINES];
+  atomic_ullong spawns;
+  atomic_ullong spawn_fails;
+  atomic_ullong rotations;
+  atomic_ullong rotate_rejects;
+} StatsShard_t;
+
+extern atomic_bool statsOn;
+
+/**
+ * \brief Включён ли сбор статистики.
+ * \return 1, если включён.
+ */
+static inline int statsEnabled(void) {
+  return atomic_load_explicit(&statsOn, memory_order_relaxed);
+}
+
+void statsEnable(int on);
+uint64_t statsClock(void);
+void statsAction(UserAction_t action, uint64_t ns);
+void statsLock(int lines);
+void statsSpawn(int failed);
+void statsRotate(int rejected);
+int statsBucket(uint64_t ns);
+uint64_t statsBucketTop(int bucket);
+void statsRead(tetris_stats_t *out);
+void statsReset(void);
+uint64_t statsPercentile(const tetris_latency_t *lat, double q);
+int statsDump(const char *path);
+
+#endif
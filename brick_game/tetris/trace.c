@@ -0,0 +1,233 @@
+/**
+ * \file trace.c
+ * \brief Реализация трассировки.
+ *
+ * Буфер потока заводится при его первой отметке и получает номер по порядку
+ * заведения; отметки завершившихся потоков тоже попадают в выгрузку.
+ * Выгрузка может идти, пока потоки пишут: отметки копируются
+ * relaxed-загрузками атомарных полей ячеек, после чего head перечитывается,
+ * и те, которые владелец мог за это время затереть, отбрасываются. Как в
+ * seqlock, владелец ставит барьер release между прошлым сдвигом head и
+ * записью ячейки, а выгрузка — барьер acquire перед повторным чтением head.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+atomic_bool traceOn;
+
+/// \brief Список буферов всех потоков.
+static Shard_t *_Atomic rings;
+
+/// \brief Сколько буферов заведено (от него считаются номера потоков).
+static atomic_int ringCount;
+
+/// \brief Момент первого включения трассировки: от него отсчитывается время
+/// в выгрузке.
+static _Atomic uint64_t traceBase;
+
+/// \brief Буфер текущего потока (NULL — ещё не заведён).
+static _Thread_local TraceRing_t *local;
+
+/**
+ * \brief Монотонные часы отметок.
+ * \return Наносекунды.
+ */
+static uint64_t traceClock(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * \brief Буфер текущего потока; заводится при первом вызове.
+ * \return Буфер или NULL при нехватке памяти (отметки тогда пропускаются).
+ */
+static TraceRing_t *localRing(void) {
+  if (!local) {
+    local = shardNew(sizeof *local);
+    if (local) {
+      local->tid = atomic_fetch_add_explicit(&ringCount, 1,
+                                             memory_order_relaxed) + 1;
+      shardPush(&rings, &local->link);
+    }
+  }
+
+  return local;
+}
+
+/**
+ * \brief Пишет отметку в буфер текущего потока. Обычно вызывается через
+ * traceBegin()/traceEnd(), которые сначала проверяют флаг.
+ * \param name Имя отрезка.
+ * \param phase 'B' — начало, 'E' — конец.
+ */
+void tracePush(const char *name, char phase) {
+  TraceRing_t *r = localRing();
+
+  if (r) {
+    size_t h = atomic_load_explicit(&r->head, memory_order_relaxed);
+    TraceSlot_t *ev = &r->events[h % TRACE_RING];
+    // прошлый сдвиг head должен стать виден раньше, чем затирается ячейка:
+    // иначе выгрузка может принять затёртую отметку за целую
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&ev->ns, traceClock(), memory_order_relaxed);
+    atomic_store_explicit(&ev->name, name, memory_order_relaxed);
+    atomic_store_explicit(&ev->phase, phase, memory_order_relaxed);
+    atomic_store_explicit(&r->head, h + 1, memory_order_release);
+  }
+}
+
+/**
+ * \brief Включает или выключает трассировку. Записанные отметки при этом
+ * не сбрасываются.
+ * \param on 1 — включить.
+ */
+void traceEnable(int on) {
+  uint64_t none = 0;
+
+  if (on) {
+    atomic_compare_exchange_strong(&traceBase, &none, traceClock());
+  }
+  atomic_store_explicit(&traceOn, on != 0, memory_order_relaxed);
+}
+
+/**
+ * \brief Даёт текущему потоку имя, под которым он покажется в выгрузке.
+ * Действует, только если трассировка включена.
+ * \param name Имя (строка должна жить до выгрузки).
+ */
+void traceThread(const char *name) {
+  if (atomic_load_explicit(&traceOn, memory_order_relaxed)) {
+    TraceRing_t *r = localRing();
+    if (r) {
+      atomic_store_explicit(&r->name, name, memory_order_relaxed);
+    }
+  }
+}
+
+/**
+ * \brief Копирует отметки буфера, начиная с самой старой сохранившейся.
+ * \param r Буфер.
+ * \param out Копия (не меньше TRACE_RING отметок).
+ * \return Число скопированных отметок.
+ */
+static size_t copyRing(TraceRing_t *r, TraceEvent_t *out) {
+  size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+  size_t from = head > TRACE_RING ? head - TRACE_RING : 0;
+
+  for (size_t i = from; i < head; ++i) {
+    TraceSlot_t *ev = &r->events[i % TRACE_RING];
+    out[i - from].ns = atomic_load_explicit(&ev->ns, memory_order_relaxed);
+    out[i - from].name = atomic_load_explicit(&ev->name, memory_order_relaxed);
+    out[i - from].phase =
+        atomic_load_explicit(&ev->phase, memory_order_relaxed);
+  }
+
+  // владелец пишет отметку now в ячейку отметки now - TRACE_RING ещё до
+  // того, как сдвинет head, поэтому она и всё, что старше, ненадёжны
+  atomic_thread_fence(memory_order_acquire);
+  size_t now = atomic_load_explicit(&r->head, memory_order_relaxed);
+  size_t safe = now >= TRACE_RING ? now - TRACE_RING + 1 : 0;
+  size_t skip = safe > from ? safe - from : 0;
+  size_t res = 0;
+
+  if (skip < head - from) {
+    res = head - from - skip;
+    memmove(out, out + skip, res * sizeof *out);
+  }
+
+  return res;
+}
+
+/**
+ * \brief Пишет строку JSON в кавычках.
+ * \param f Файл.
+ * \param s Строка.
+ */
+static void putString(FILE *f, const char *s) {
+  fputc('"', f);
+  for (; *s; ++s) {
+    if (*s == '"' || *s == '\\') {
+      fputc('\\', f);
+      fputc(*s, f);
+    } else if ((unsigned char)*s >= 0x20) {
+      fputc(*s, f);
+    }
+  }
+  fputc('"', f);
+}
+
+/**
+ * \brief Пишет отметки одного потока. Концы отрезков, начала которых уже
+ * затёрты, пропускаются, чтобы отрезки в выгрузке были вложены правильно.
+ * \param f Файл.
+ * \param r Буфер потока.
+ * \param buf Место под копию отметок (TRACE_RING штук).
+ * \param first 1 — в выгрузке ещё ничего нет (обновляется).
+ */
+static void exportRing(FILE *f, TraceRing_t *r, TraceEvent_t *buf,
+                       int *first) {
+  const char *name = atomic_load_explicit(&r->name, memory_order_relaxed);
+  uint64_t base = atomic_load_explicit(&traceBase, memory_order_relaxed);
+  int pid = (int)getpid();
+  size_t n = copyRing(r, buf);
+  int depth = 0;
+
+  if (name) {
+    fprintf(f,
+            "%s  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, "
+            "\"tid\": %d, \"args\": {\"name\": ",
+            *first ? "" : ",\n", pid, r->tid);
+    putString(f, name);
+    fprintf(f, "}}");
+    *first = 0;
+  }
+  for (size_t i = 0; i < n; ++i) {
+    const TraceEvent_t *ev = &buf[i];
+    if (ev->phase == 'B' || depth > 0) {
+      depth += ev->phase == 'B' ? 1 : -1;
+      fprintf(f, "%s  {\"name\": ", *first ? "" : ",\n");
+      putString(f, ev->name);
+      fprintf(f, ", \"ph\": \"%c\", \"ts\": %.3f, \"pid\": %d, \"tid\": %d}",
+              ev->phase, (double)(ev->ns - base) / 1000.0, pid, r->tid);
+      *first = 0;
+    }
+  }
+}
+
+/**
+ * \brief Выгружает отметки всех потоков в файл JSON формата Chrome Trace
+ * Event (объект с массивом traceEvents): начало и конец отрезка — события
+ * "B" и "E", время — микросекунды от первого включения трассировки, имена
+ * потоков — метаданные thread_name.
+ * \param path Файл (перезаписывается).
+ * \return 0 при успехе, -1 при ошибке записи (errno сохраняется).
+ */
+int traceExport(const char *path) {
+  TraceEvent_t *buf = malloc(TRACE_RING * sizeof *buf);
+  FILE *f = buf ? fopen(path, "w") : NULL;
+  int res = -1;
+
+  if (f) {
+    int first = 1;
+    fprintf(f, "{\"traceEvents\": [\n");
+    for (Shard_t *l = shardFirst(&rings); l; l = l->next) {
+      exportRing(f, (TraceRing_t *)(void *)l, buf, &first);
+    }
+    fprintf(f, "\n], \"displayTimeUnit\": \"ns\"}\n");
+    res = ferror(f) ? -1 : 0;
+    res = fclose(f) != 0 ? -1 : res;
+  }
+  free(buf);
+
+  return res;
+}
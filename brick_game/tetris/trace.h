@@ -0,0 +1,96 @@
+/**
+ * \file trace.h
+ * \brief Трассировка этапов движка и интерфейса: отметки начала и конца
+ * отрезков (ввод, гравитация, фиксация, появление фигуры, отрисовка) в
+ * кольцевом буфере каждого потока и выгрузка в JSON формата Chrome Trace
+ * Event, который открывают chrome://tracing и Perfetto.
+ *
+ * Трассировка выключена по умолчанию; выключенная отметка стоит одной
+ * relaxed-загрузки флага. Каждый поток пишет в свой буфер (TraceRing_t,
+ * блок из shard.h). Буфер хранит последние TRACE_RING отметок: старые
+ * затираются, так что после медленного кадра в нём остаётся то, что к этому
+ * кадру привело.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdatomic.h>
+
+#include "back.h"
+#include "shard.h"
+
+/// \brief Отметок в буфере потока (степень двойки).
+#define TRACE_RING 32768
+
+/// \brief Имена отрезков движка.
+#define TRACE_INPUT "input"
+#define TRACE_GRAVITY "gravity"
+#define TRACE_LOCK "lock"
+#define TRACE_SPAWN "spawn"
+
+/**
+ * \brief Отметка: время по монотонным часам, имя отрезка (строка должна
+ * жить до выгрузки) и 'B' — начало или 'E' — конец.
+ */
+typedef struct {
+  uint64_t ns;
+  const char *name;
+  char phase;
+} TraceEvent_t;
+
+/**
+ * \brief Ячейка буфера с отметкой. Выгрузка читает ячейки, пока владелец
+ * пишет в них, поэтому поля атомарные; владелец пишет и читатель читает их
+ * relaxed-операциями, а порядок задаёт head.
+ */
+typedef struct {
+  _Atomic uint64_t ns;
+  const char *_Atomic name;
+  atomic_char phase;
+} TraceSlot_t;
+
+/**
+ * \brief Кольцевой буфер отметок одного потока. head — сколько отметок
+ * записано за всё время (отметка i лежит в events[i % TRACE_RING]); двигает
+ * его только владелец, release-записью после отметки. tid — номер потока в
+ * выгрузке, name — его имя (NULL — без имени), link связывает буферы всех
+ * потоков в список.
+ */
+typedef struct {
+  Shard_t link;
+  atomic_size_t head;
+  int tid;
+  const char *_Atomic name;
+  TraceSlot_t events[TRACE_RING];
+} TraceRing_t;
+
+extern atomic_bool traceOn;
+
+void tracePush(const char *name, char phase);
+
+/**
+ * \brief Отмечает начало отрезка, если трассировка включена.
+ * \param name Имя отрезка (строка должна жить до выгрузки).
+ */
+static inline void traceBegin(const char *name) {
+  if (atomic_load_explicit(&traceOn, memory_order_relaxed)) {
+    tracePush(name, 'B');
+  }
+}
+
+/**
+ * \brief Отмечает конец отрезка, если трассировка включена.
+ * \param name Имя отрезка (то же, что у начала).
+ */
+static inline void traceEnd(const char *name) {
+  if (atomic_load_explicit(&traceOn, memory_order_relaxed)) {
+    tracePush(name, 'E');
+  }
+}
+
+void traceEnable(int on);
+void traceThread(const char *name);
+int traceExport(const char *path);
+
+#endif
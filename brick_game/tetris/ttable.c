@@ -0,0 +1,113 @@
+/**
+ * \file ttable.c
+ * \brief Реализация таблицы транспозиций.
+ */
+
+#include "ttable.h"
+
+#include <stdlib.h>
+
+/**
+ * \brief Создаёт пустую таблицу.
+ * \param bytes Желаемый объём: берётся наибольшее число корзин-степень
+ * двойки, которое в него помещается (не меньше одной).
+ * \return Таблица или NULL при нехватке памяти.
+ */
+TTable_t *ttCreate(size_t bytes) {
+  TTable_t *tt = malloc(sizeof *tt);
+  size_t count = 1;
+
+  while (count * 2 * sizeof(TtBucket_t) <= bytes) {
+    count *= 2;
+  }
+  if (tt) {
+    tt->buckets = aligned_alloc(CACHE_LINE, count * sizeof(TtBucket_t));
+    if (!tt->buckets) {
+      free(tt);
+      tt = NULL;
+    } else {
+      tt->mask = count - 1;
+      ttClear(tt);
+    }
+  }
+
+  return tt;
+}
+
+/**
+ * \brief Ищет значение по ключу.
+ * \param tt Таблица.
+ * \param key Ключ (хеш позиции).
+ * \param data Значение (заполняется при попадании).
+ * \return 1 — значение найдено, 0 — промах.
+ */
+int ttProbe(TTable_t *tt, uint64_t key, uint64_t *data) {
+  TtEntry_t *slot = tt->buckets[key & tt->mask].slot;
+  int res = 0;
+
+  for (int i = 0; i < TT_BUCKET && !res; ++i) {
+    uint64_t d = atomic_load_explicit(&slot[i].data, memory_order_relaxed);
+    uint64_t c = atomic_load_explicit(&slot[i].check, memory_order_relaxed);
+    if (d != 0 && (c ^ d) == key) {
+      *data = d;
+      res = 1;
+    }
+  }
+
+  return res;
+}
+
+/**
+ * \brief Запоминает значение для ключа, заменяя прежнее значение этого ключа
+ * или вытесняя другую запись корзины.
+ * \param tt Таблица.
+ * \param key Ключ (хеш позиции).
+ * \param data Значение; 0 не хранится (пустая запись), поэтому вызывающий
+ * кодирует значения так, чтобы они не были нулём.
+ */
+void ttStore(TTable_t *tt, uint64_t key, uint64_t data) {
+  TtEntry_t *slot = tt->buckets[key & tt->mask].slot;
+  int victim = (int)(key >> 62);
+  int found = 0;
+
+  // своя запись важнее пустой: иначе у ключа появится вторая копия
+  for (int i = 0; i < TT_BUCKET && found < 2; ++i) {
+    uint64_t d = atomic_load_explicit(&slot[i].data, memory_order_relaxed);
+    uint64_t c = atomic_load_explicit(&slot[i].check, memory_order_relaxed);
+    if (d != 0 && (c ^ d) == key) {
+      victim = i;
+      found = 2;
+    } else if (d == 0 && !found) {
+      victim = i;
+      found = 1;
+    }
+  }
+
+  atomic_store_explicit(&slot[victim].data, data, memory_order_relaxed);
+  atomic_store_explicit(&slot[victim].check, key ^ data, memory_order_relaxed);
+}
+
+/**
+ * \brief Очищает таблицу. Не должна вызываться одновременно с другими
+ * операциями над ней.
+ * \param tt Таблица.
+ */
+void ttClear(TTable_t *tt) {
+  for (size_t b = 0; b <= tt->mask; ++b) {
+    for (int i = 0; i < TT_BUCKET; ++i) {
+      atomic_init(&tt->buckets[b].slot[i].check, 0);
+      atomic_init(&tt->buckets[b].slot[i].data, 0);
+    }
+  }
+}
+
+/**
+ * \brief Освобождает таблицу.
+ * \param tt Таблица (NULL допустим).
+ */
+void ttDestroy(TTable_t *tt) {
+  if (tt) {
+    free(tt->buckets);
+    free(tt);
+  }
+}
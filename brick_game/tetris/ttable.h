@@ -0,0 +1,55 @@
+/**
+ * \file ttable.h
+ * \brief Таблица транспозиций фиксированного размера без блокировок: кэш
+ * оценок позиций по хешу Зобриста, общий для нескольких потоков.
+ */
+
+#ifndef TTABLE_H
+#define TTABLE_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "back.h"
+
+/// \brief Записей в корзине: корзина занимает ровно одну кэш-линию.
+#define TT_BUCKET 4
+
+/**
+ * \brief Запись таблицы. check хранит XOR ключа и data: запись, которую
+ * другой поток переписал наполовину, не проходит проверку и считается
+ * промахом, поэтому обе половины пишутся и читаются без блокировок.
+ * data == 0 — пустая запись.
+ */
+typedef struct {
+  _Atomic uint64_t check;
+  _Atomic uint64_t data;
+} TtEntry_t;
+
+/// \brief Корзина: TT_BUCKET записей на одной кэш-линии.
+typedef struct {
+  _Alignas(CACHE_LINE) TtEntry_t slot[TT_BUCKET];
+} TtBucket_t;
+
+/**
+ * \brief Таблица транспозиций.
+ *
+ * Число корзин — степень двойки, корзина выбирается младшими битами ключа,
+ * запись внутри неё — совпадением ключа, иначе пустая, иначе вытесняется
+ * запись, выбранная старшими битами ключа. Размер таблицы задаётся при
+ * создании и не меняется. Чтение и запись — relaxed-атомики без блокировок;
+ * одновременная запись в одну запись из разных потоков может потерять одно
+ * из значений, но никогда не выдаст значение чужого ключа.
+ */
+typedef struct TTable {
+  TtBucket_t *buckets;
+  size_t mask;
+} TTable_t;
+
+TTable_t *ttCreate(size_t bytes);
+int ttProbe(TTable_t *tt, uint64_t key, uint64_t *data);
+void ttStore(TTable_t *tt, uint64_t key, uint64_t data);
+void ttClear(TTable_t *tt);
+void ttDestroy(TTable_t *tt);
+
+#endif
@@ -0,0 +1,157 @@
+/**
+ * \file zobrist.c
+ * \brief Ключи и вычисление хеша Зобриста.
+ *
+ * Ключи — фиксированные 64-битные константы (splitmix64 от зерна 0x5A0B1157),
+ * поэтому хеш одной позиции совпадает между запусками, экземплярами и
+ * сборками. Ключ клетки (y, x) — cellKeys[x], циклически сдвинутый на 3 * y
+ * бит: тогда ключ целой строки — XOR ключей её столбцов, сдвинутый один раз,
+ * и строка из маски хешируется без таблицы на каждую клетку.
+ */
+
+#include "zobrist.h"
+
+/// \brief Маска клеток поля внутри маски строки.
+#define FIELD_BITS ((1u << FIELD_WIDTH) - 1u)
+
+/// \brief Ключи клеток строки 0 по столбцам.
+static const uint64_t cellKeys[FIELD_WIDTH] = {
+    0x23DF402F19B1F492ULL, 0x03266266D439B9EEULL, 0xDDF5FA93FA0F2F53ULL,
+    0x72F28319F65D3F00ULL, 0x24E7FD13334B93EEULL, 0x071E0576E72B7887ULL,
+    0xF77F97BDAB0D4C13ULL, 0x163A077D77FDD8F4ULL, 0x48DF8415C62BA0BBULL,
+    0x594FBF2697F764A3ULL,
+};
+
+/// \brief Ключи вида и ориентации падающей фигуры.
+static const uint64_t pieceKeys[PIECE_COUNT][ROT_COUNT] = {
+    {0xA0E1D87E4303870DULL, 0x7E3AC6C50AFE2BBDULL,
+     0xD5464D9C3B04079FULL, 0x0162E81D27E8345FULL},
+    {0xD14DFABA1ECA2317ULL, 0xCA6A27C547543C83ULL,
+     0xD41B096F9307F4B8ULL, 0xC9171D2B703BF358ULL},
+    {0x834E049CCBE29E24ULL, 0xCD44289C51589EC4ULL,
+     0x8B65575E43FA0A4EULL, 0x8C5B753927D52041ULL},
+    {0x4A58900DA7A631ACULL, 0x0BB91748F0AE3396ULL,
+     0xDC26E3127DF5EA8CULL, 0x7233A75F8D74C97CULL},
+    {0x6B352777CBC70E4CULL, 0x7429AEC1DE0D62E6ULL,
+     0x2B543F1708695CF7ULL, 0xBD95AD51EF6EBB36ULL},
+    {0x2E23EA3C0ED18629ULL, 0x63974ED066A451F1ULL,
+     0xC92F9AE804B228DEULL, 0xF64F4FAD8E9ED66AULL},
+    {0xF459883ADDCBEF9BULL, 0xD885DC984ACDF1ABULL,
+     0x39508F3E83F344D4ULL, 0xB82DCD64A92DB31FULL},
+};
+
+/// \brief Ключи столбца фигуры; x бывает от -(PIECE_SIZE - 1).
+static const uint64_t xKeys[FIELD_WIDTH + PIECE_SIZE] = {
+    0x69184F41017A4EB3ULL, 0x471BED2D2ED04C0CULL, 0xD338D5BBDD6E4C5CULL,
+    0xA846F42A96551779ULL, 0x78AD850EA9FC4411ULL, 0xA3445BCF3590B5C0ULL,
+    0xC8F589126E437D0EULL, 0xD5619B5947B70B5CULL, 0xF659F8D3E934CDC0ULL,
+    0xBF71CC9B3BCF1161ULL, 0x40C24E51652762A8ULL, 0x7E54270A76F72989ULL,
+    0xECE67E20333C7212ULL, 0x82F2D0DE2B13A088ULL,
+};
+
+/// \brief Ключи строки фигуры.
+static const uint64_t yKeys[FIELD_HEIGHT] = {
+    0x0979BF465EE7A378ULL, 0x4A718FDA31369179ULL, 0x92617547D8829BA5ULL,
+    0x0EF935C3AB938E3DULL, 0xC4B29489BFC79ED6ULL, 0x99F36A4FF953D5F3ULL,
+    0x509C0BB7D4329255ULL, 0x4B9D3FDDCB2CB85AULL, 0x27CE9546112DD073ULL,
+    0x156341F6EB0A569AULL, 0x43231E99937EA728ULL, 0x74A2729CCAFED24EULL,
+    0x2FF8039D672E944BULL, 0x3B70995EEDCCEE48ULL, 0xF0F6B75E9997038CULL,
+    0x4B0A6733D1F91969ULL, 0xA0CB4C312130309EULL, 0x4DEAB40B77594AA9ULL,
+    0x1B4339DC3F20D413ULL, 0xF1D2F0D034AFC5F8ULL,
+};
+
+/// \brief Ключи следующей фигуры.
+static const uint64_t nextKeys[PIECE_COUNT] = {
+    0xDC9F0161A6E45F52ULL, 0xD05EF02E1091F59BULL, 0xD0C0A9F97AC5D034ULL,
+    0xF53C639A5BEC6F74ULL, 0x367E221EAF2D9CB4ULL, 0x18553EE1FB8333DDULL,
+    0xFB1D0ACF7F72009BULL,
+};
+
+/**
+ * \brief Циклический сдвиг влево.
+ * \param v Значение.
+ * \param n Сдвиг (0..63).
+ * \return Сдвинутое значение.
+ */
+static inline uint64_t rotl(uint64_t v, int n) {
+  return n ? (v << n) | (v >> (64 - n)) : v;
+}
+
+/**
+ * \brief Хеш клеток одной строки поля.
+ * Хеш линеен по XOR: хеш объединения непересекающихся наборов клеток равен
+ * XOR их хешей, поэтому клетки фигуры и целые строки можно добавлять и
+ * убирать по отдельности.
+ * \param y Строка поля (0..FIELD_HEIGHT-1).
+ * \param cells Маска строки в формате GameCore_t::rows; биты стен
+ * игнорируются.
+ * \return XOR ключей занятых клеток строки.
+ */
+uint64_t zobristCells(int y, uint16_t cells) {
+  uint64_t h = 0;
+  unsigned m = ((unsigned)cells >> ROW_OFFSET) & FIELD_BITS;
+
+  for (int x = 0; m; ++x, m >>= 1) {
+    if (m & 1u) {
+      h ^= cellKeys[x];
+    }
+  }
+
+  return rotl(h, 3 * y);
+}
+
+/**
+ * \brief Ключ падающей фигуры: её вид, ориентация и положение.
+ * \param shape Фигура.
+ * \return Ключ.
+ */
+uint64_t zobristPiece(const Shape *shape) {
+  return pieceKeys[shape->piece][shape->rot] ^
+         xKeys[shape->x + PIECE_SIZE - 1] ^ yKeys[shape->y];
+}
+
+/**
+ * \brief Ключ следующей фигуры.
+ * \param piece Номер фигуры.
+ * \return Ключ.
+ */
+uint64_t zobristNext(int piece) { return nextKeys[piece]; }
+
+/**
+ * \brief Вклад размещённой фигуры в хеш: её клетки и ключ фигуры.
+ * placeShape() и clearShape() применяют его XOR-ом.
+ * \param shape Фигура.
+ * \return Вклад.
+ */
+uint64_t zobristShape(const Shape *shape) {
+  const PieceGeom_t *g = &pieceTable[shape->piece][shape->rot];
+  uint64_t h = zobristPiece(shape);
+
+  for (int i = g->top; i <= g->bottom; ++i) {
+    h ^= zobristCells(shape->y + i,
+                      (uint16_t)(g->rows[i] << (shape->x + ROW_OFFSET)));
+  }
+
+  return h;
+}
+
+/**
+ * \brief Считает хеш позиции заново по всему полю.
+ * Совпадает с GameCore_t::hash в состояниях STATE_START, STATE_GAME и
+ * STATE_PAUSE (в STATE_START фигура ещё не на поле и в хеш не входит).
+ * Нужен для проверки инкрементального хеша.
+ * \param params Экземпляр игры.
+ * \return Хеш.
+ */
+uint64_t zobristFull(const GameParams_t *params) {
+  uint64_t h = zobristNext(params->core.next_piece);
+
+  for (int y = 0; y < FIELD_HEIGHT; ++y) {
+    h ^= zobristCells(y, params->core.rows[y]);
+  }
+  if (params->core.state != STATE_START) {
+    h ^= zobristPiece(&params->core.shape);
+  }
+
+  return h;
+}
@@ -0,0 +1,24 @@
+/**
+ * \file zobrist.h
+ * \brief Хеш Зобриста позиции: поле, текущая фигура и следующая фигура.
+ *
+ * Хеш — XOR ключей всех занятых клеток поля, ключа падающей фигуры (вид,
+ * ориентация, x, y) и ключа следующей фигуры. Он хранится в GameCore_t::hash
+ * и обновляется по ходу игры там же, где меняется позиция: placeShape() и
+ * clearShape() добавляют и убирают клетки и ключ фигуры, lockShape() убирает
+ * ключ фигуры (клетки остаются на поле), checkLines() перехеширует только
+ * сдвинутые строки, а setNewShape() меняет ключ следующей фигуры.
+ */
+
+#ifndef ZOBRIST_H
+#define ZOBRIST_H
+
+#include "back.h"
+
+uint64_t zobristCells(int y, uint16_t cells);
+uint64_t zobristPiece(const Shape *shape);
+uint64_t zobristNext(int piece);
+uint64_t zobristShape(const Shape *shape);
+uint64_t zobristFull(const GameParams_t *params);
+
+#endif
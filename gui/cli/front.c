@@ -2,35 +2,215 @@
  * \file front.c
  * \brief Интерфейсная часть игры Tetris на ncurses: отрисовка, обработка ввода
  * и запуск цикла.
+ *
+ * Ввод, игра и отрисовка идут в разных потоках. Поток ввода читает stdin сам,
+ * без getch() (ncurses не потокобезопасен), помечает каждую клавишу временем
+ * по монотонным часам и кладёт действие в очередь без блокировок
+ * (tetris_inputq_t). Поток игры владеет экземпляром: применяет по порядку все
+ * накопившиеся в очереди действия, тикает гравитацией и после каждого
+ * изменения публикует снимок в буфер снимков. Основной поток владеет
+ * терминалом и рисует последний снимок, когда поток игры сообщит о новом.
+ * Вывод в терминал поэтому никогда не задерживает ни ввод, ни игру, а снимок
+ * не меняется, пока его рисуют.
+ * Рисуется только то, что поменялось с прошлого нарисованного снимка: строки
+ * поля с более новой версией (row_version), в них — клетки другого цвета,
+ * панели — если сменились их числа или следующая фигура. Все окна выводятся
+ * на терминал одним doupdate().
+ *
+ * Все потоки спят в poll(), пока ничего не происходит: ввод — на stdin,
+ * основной — на канале пробуждения, в который поток игры пишет после
+ * публикации снимка, поток игры — на канале очереди действий и таймерах
+ * гравитации и автоигрока. Клавиша доходит до игры сразу, а гравитация идёт
+ * по монотонным часам: срок следующего спуска считается от срока
+ * предыдущего, а не от пробуждения. На Linux каналы — eventfd, таймеры —
+ * timerfd; на других системах (macOS) каналы — self-pipe, а сроки таймеров
+ * поток игры держит сам и передаёт ближайший в poll() как тайм-аут.
+ *
+ * Терминал не сообщает об отпускании клавиш, поэтому удержание угадывается
+ * по автоповтору терминала: та же клавиша сдвига или мягкого спуска, пришедшая
+ * раньше чем через HOLD_GAP_MS после предыдущей, считается удерживаемой, а
+ * пауза дольше HOLD_GAP_MS — отпусканием. Повторяет удерживаемую клавишу уже
+ * движок по своим часам (tetris_advance()) с периодами --das, --arr и --sdr,
+ * так что скорость не зависит от настроек терминала; пока клавиша
+ * удерживается, поток игры просыпается каждые HOLD_POLL_MS.
+ *
+ * С --record поток игры пишет каждое применённое действие с номером такта в
+ * повтор, который потом проигрывается без интерфейса (tetris_sim -P). С
+ * --latency после выхода печатается задержка от нажатия клавиши до вывода на
+ * терминал кадра с её результатом. С --stats FILE движок считает действия и
+ * их задержки, а поток игры пишет статистику в FILE по SIGUSR1 (kill -USR1)
+ * и после выхода. С --trace FILE движок и отрисовка отмечают начало и конец
+ * своих этапов, и трассировка так же пишется в FILE.
  */
 
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <limits.h>
 #include <locale.h>
 #include <ncurses.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <unistd.h>
+
+/// \brief 1 — каналы, таймеры и SIGUSR1 на eventfd, timerfd и signalfd
+/// (Linux), 0 — на self-pipe и тайм-аутах poll().
+#ifndef HAVE_LINUX_FDS
+#ifdef __linux__
+#define HAVE_LINUX_FDS 1
+#else
+#define HAVE_LINUX_FDS 0
+#endif
+#endif
+
+#if HAVE_LINUX_FDS
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#else
+#include <fcntl.h>
+#endif
 
 #include "../../layer/game.h"
 
-#define FIELD_WIDTH 10
-#define FIELD_HEIGHT 20
-#define DELAY 50
+#define FIELD_WIDTH TETRIS_FIELD_WIDTH
+#define FIELD_HEIGHT TETRIS_FIELD_HEIGHT
+/// \brief Длительность такта, которым меряется время в повторе, мс.
+#define TICK_MS 10
+/// \brief Больше стольких пропущенных спусков гравитация не навёрстывает
+/// (например, после SIGSTOP): дальше отсчёт начинается заново.
+#define GRAVITY_CATCHUP FIELD_HEIGHT
+/// \brief Как часто ходит автоигрок, мс.
+#define AI_DELAY 50
+#define AI_THREADS 2
+/// \brief Пауза между попытками положить Terminate в полную очередь, мкс.
+#define TERMINATE_RETRY_US 1000
+/// \brief Сколько байт stdin поток ввода читает за раз.
+#define READ_CHUNK 64
+/// \brief Код клавиши Escape: с него начинаются последовательности стрелок и
+/// функциональных клавиш.
+#define KEY_ESC 0x1b
+/// \brief Клавиша, пришедшая снова раньше этого срока, удерживается, мс
+/// (автоповтор терминалов — обычно 25–50 мс).
+#define HOLD_GAP_MS 60
+/// \brief Как часто поток игры двигает часы движка, пока клавиша
+/// удерживается, мс.
+#define HOLD_POLL_MS 5
+/// \brief Период повторов сдвига по умолчанию, мс.
+#define ARR_MS 33
+/// \brief Период мягкого спуска по умолчанию, мс.
+#define SDR_MS 50
+/// \brief Наибольшее значение --das, --arr и --sdr, мс.
+#define REPEAT_MAX_MS 10000
+
+/**
+ * \brief Настройки автоповтора: задержка перед повтором сдвига, период
+ * повторов сдвига и период мягкого спуска, мс.
+ */
+typedef struct {
+  int das;
+  int arr;
+  int sdr;
+} Repeat_t;
+
+/**
+ * \brief Окна интерфейса и последний нарисованный снимок (drawn == 0 — ещё
+ * ничего не нарисовано).
+ */
+typedef struct {
+  WINDOW *gaming;
+  WINDOW *statistics;
+  WINDOW *next;
+  tetris_snapshot_t shown;
+  int drawn;
+} Screen_t;
+
+/**
+ * \brief Канал пробуждения: rd ждут в poll(), в wr пишет будящий поток. На
+ * Linux это один eventfd (rd == wr), иначе — два конца self-pipe.
+ */
+typedef struct {
+  int rd;
+  int wr;
+} Wake_t;
+
+/**
+ * \brief Таймер потока игры. На Linux — timerfd (fd), иначе fd == -1 (poll()
+ * его пропускает), а срабатывание — срок due (мс, как nowMs(); UINT64_MAX —
+ * не взведён) с периодом period (0 — однократно).
+ */
+typedef struct {
+  int fd;
+  uint64_t due;
+  int period;
+} Timer_t;
+
+/// \brief Задержка ввода: сколько кадров измерено, их сумма и максимум, нс.
+typedef struct {
+  long count;
+  uint64_t total;
+  uint64_t max;
+} Latency_t;
+
+/**
+ * \brief Всё, что нужно потокам ввода, игры и отрисовки.
+ * wake — канал, который будит поток игры после записи в очередь input,
+ * redraw — который будит основной поток после публикации снимка, gravity и
+ * ai_timer — таймеры спуска и хода автоигрока. start — время запуска по
+ * монотонным часам, от него считаются такты повтора. applied — метка времени
+ * последней клавиши, результат которой уже опубликован; done поднимается,
+ * когда поток игры завершился. key и key_at — последняя клавиша игрока и её
+ * метка, held — она удерживается, clock — до какого момента (мс) продвинуты
+ * часы движка. stats и trace — файлы статистики и трассировки движка (NULL —
+ * не собираются), sigs — signalfd (вне Linux — self-pipe, в который пишет
+ * обработчик сигнала), по SIGUSR1 из которого поток игры пишет их.
+ */
+typedef struct {
+  tetris_inputq_t *input;
+  tetris_snapbuf_t *snaps;
+  tetris_ai_t *ai;
+  tetris_recorder_t *rec;
+  unsigned long long tick;
+  uint64_t start;
+  _Atomic uint64_t applied;
+  atomic_int done;
+  Wake_t wake;
+  Wake_t redraw;
+  Timer_t gravity;
+  Timer_t ai_timer;
+  Repeat_t repeat;
+  UserAction_t key;
+  uint64_t key_at;
+  int held;
+  uint64_t clock;
+  const char *stats;
+  const char *trace;
+  int sigs;
+} GameCtx_t;
 
 /**
  * \brief Инициализация библиотеки ncurses и цветовых пар для вывода.
  *
  * Настраивает локаль для поддержки Unicode, отключает отображение
- * вводимых символов и курсора, включает чтение специальных клавиш и
- * настраивает неблокирующий ввод. Также определяет цветовые пары для фигур и
- * игрового окна.
+ * вводимых символов и курсора и построчную буферизацию ввода (клавиши читает
+ * поток ввода прямо из stdin). Проверку ввода во время вывода (typeahead)
+ * отключает: stdin ncurses не читает. Также определяет цветовые пары для
+ * фигур и игрового окна.
  */
 static void startNcurses() {
   setlocale(LC_ALL, "");
   initscr();
+  cbreak();
   noecho();
   curs_set(0);
-  keypad(stdscr, TRUE);
-  nodelay(stdscr, TRUE);
+  typeahead(-1);
 
   start_color();
   init_color(8, 1000, 400, 700);
@@ -97,13 +277,14 @@ static void setWindows(WINDOW *gaming, WINDOW *statistics, WINDOW *next) {
 
 /**
  * \brief Преобразует код введённой клавиши в действие пользователя.
- * \param input Код клавиши, полученный от getch().
- * \return Действие пользователя типа UserAction_t.
+ * \param input Байт, прочитанный из stdin.
+ * \return Действие пользователя типа UserAction_t или -1, если клавиша ничего
+ * не значит.
  */
-static UserAction_t actionProcessing(int input) {
-  UserAction_t res;
+static int actionProcessing(int input) {
+  int res;
 
-  if (input == ' ' || input == '\n' || input == KEY_ENTER) {
+  if (input == ' ' || input == '\n' || input == '\r') {
     res = Start;
   } else if (input == 'a' || input == 'A') {
     res = Left;
@@ -111,6 +292,8 @@ static UserAction_t actionProcessing(int input) {
     res = Right;
   } else if (input == 's' || input == 'S') {
     res = Down;
+  } else if (input == 'x' || input == 'X') {
+    res = Up;
   } else if (input == 'r' || input == 'R') {
     res = Action;
   } else if (input == 'p' || input == 'P') {
@@ -118,179 +301,1017 @@ static UserAction_t actionProcessing(int input) {
   } else if (input == 'c' || input == 'C') {
     res = Terminate;
   } else {
-    res = Up;
+    res = -1;
   }
 
   return res;
 }
 
+/**
+ * \brief Рисует клетку поля: два символа цветом c (0 — пустая клетка).
+ * \param win Окно.
+ * \param y Строка окна.
+ * \param x Столбец окна (левый из двух символов).
+ * \param c Цвет.
+ */
+static void drawCell(WINDOW *win, int y, int x, int c) {
+  if (c) {
+    wattron(win, COLOR_PAIR(c));
+  }
+  mvwaddch(win, y, x, ' ');
+  mvwaddch(win, y, x + 1, ' ');
+  if (c) {
+    wattroff(win, COLOR_PAIR(c));
+  }
+}
+
 /**
  * \brief Отрисовывает игровое поле в заданном окне.
  *
- * Если игра не на паузе, очищает область и рисует все клетки фигур
- * с учётом их цвета. При состоянии паузы и конце игры рисует специальные
- * индикаторы.
+ * Если игра не на паузе, перерисовывает только строки, которые поменялись с
+ * нарисованного снимка (row_version), и в них — только клетки другого
+ * цвета. При состоянии паузы и конце игры рисует специальные индикаторы.
  *
  * \param win Окно, в котором рисуется игровое поле.
- * \param info Указатель на структуру GameInfo_t с текущими данными игры.
+ * \param snap Снимок игры.
+ * \param old Нарисованный снимок или NULL — перерисовать всё.
+ * \return 1, если окно менялось.
  */
-static void drawField(WINDOW *win, const GameInfo_t *info) {
-  if (info->pause == 0) {
-    for (int y = 0; y < FIELD_HEIGHT; ++y) {
-      for (int x = 0; x < 2 * FIELD_WIDTH; ++x) {
-        mvwaddch(win, y + 1, x + 1, ' ');
-      }
-    }
+static int drawField(WINDOW *win, const tetris_snapshot_t *snap,
+                     const tetris_snapshot_t *old) {
+  const tetris_observation_t *info = &snap->obs;
+  int touched = old == NULL;
 
+  if (info->pause == 0) {
     for (int y = 0; y < FIELD_HEIGHT; ++y) {
-      for (int x = 0; x < FIELD_WIDTH; ++x) {
+      int damaged = !old || snap->row_version[y] > old->field_version;
+      for (int x = 0; damaged && x < FIELD_WIDTH; ++x) {
         int c = info->field[y][x];
-        if (c) {
-          wattron(win, COLOR_PAIR(c));
-          mvwaddch(win, y + 1, 2 * x + 1, ' ');
-          mvwaddch(win, y + 1, 2 * x + 2, ' ');
-          wattroff(win, COLOR_PAIR(c));
+        if (!old || c != old->obs.field[y][x]) {
+          drawCell(win, y + 1, 2 * x + 1, c);
+          touched = 1;
         }
       }
     }
   }
 
-  if (info->pause == 1) {
+  if (info->pause == 1 && !old) {
     int pause[5][3] = {
         {10, 0, 0}, {10, 10, 0}, {10, 10, 10}, {10, 10, 0}, {10, 0, 0}};
     for (int y = 0; y < 5; ++y) {
       for (int x = 0; x < 3; ++x) {
-        int c = pause[y][x];
-        if (c != 0) {
-          wattron(win, COLOR_PAIR(c));
-          mvwaddch(win, y + 8, 2 * x + 8, ' ');
-          mvwaddch(win, y + 8, 2 * x + 9, ' ');
-          wattroff(win, COLOR_PAIR(c));
+        if (pause[y][x] != 0) {
+          drawCell(win, y + 8, 2 * x + 8, pause[y][x]);
         }
       }
     }
   }
 
-  if (info->pause == 2) {
+  if (info->pause == 2 && !old) {
     wattron(win, COLOR_PAIR(9));
     mvwprintw(win, 10, 6, "GAME OVER");
-    wattron(win, COLOR_PAIR(9));
+    wattroff(win, COLOR_PAIR(9));
   }
+
+  return touched;
 }
 
 /**
- * \brief Отрисовывает панель статистики (счёт, рекорд, уровень).
+ * \brief Отрисовывает панель статистики (счёт, рекорд, уровень), если числа
+ * поменялись.
  * \param win Окно статистики.
- * \param info Указатель на структуру GameInfo_t с текущими данными игры.
+ * \param info Снимок игры.
+ * \param old Нарисованный снимок или NULL — перерисовать.
+ * \return 1, если окно менялось.
  */
-static void drawStat(WINDOW *win, const GameInfo_t *info) {
-  for (int y = 0; y < 5; ++y) {
-    for (int x = 0; x < 2 * FIELD_WIDTH - 2; ++x) {
-      mvwaddch(win, y + 1, x + 1, ' ');
+static int drawStat(WINDOW *win, const tetris_observation_t *info,
+                    const tetris_observation_t *old) {
+  int touched = !old || old->score != info->score ||
+                old->high_score != info->high_score ||
+                old->level != info->level;
+
+  if (touched) {
+    for (int y = 0; y < 5; ++y) {
+      for (int x = 0; x < 2 * FIELD_WIDTH - 2; ++x) {
+        mvwaddch(win, y + 1, x + 1, ' ');
+      }
     }
+
+    wattron(win, COLOR_PAIR(8));
+    mvwprintw(win, 2, 2, "Score:      %d", info->score);
+    mvwprintw(win, 3, 2, "High Score: %d", info->high_score);
+    mvwprintw(win, 5, 2, "Level:      %d", info->level);
+    wattroff(win, COLOR_PAIR(8));
   }
 
-  wattron(win, COLOR_PAIR(8));
-  mvwprintw(win, 2, 2, "Score:      %d", info->score);
-  mvwprintw(win, 3, 2, "High Score: %d", info->high_score);
-  mvwprintw(win, 5, 2, "Level:      %d", info->level);
-  wattroff(win, COLOR_PAIR(8));
+  return touched;
 }
 
 /**
- * \brief Отрисовывает окно с превью следующей фигуры.
+ * \brief Отрисовывает окно с превью следующей фигуры, если она сменилась.
  * \param win Окно превью следующей фигуры.
- * \param info Указатель на структуру GameInfo_t с текущими данными игры.
+ * \param info Снимок игры.
+ * \param old Нарисованный снимок или NULL — перерисовать.
+ * \return 1, если окно менялось.
+ */
+static int drawNext(WINDOW *win, const tetris_observation_t *info,
+                    const tetris_observation_t *old) {
+  int touched = !old || memcmp(old->next, info->next, sizeof info->next);
+
+  if (touched) {
+    for (int y = 1; y < 7; ++y) {
+      for (int x = 1; x < 2 * FIELD_WIDTH - 1; ++x) {
+        mvwaddch(win, y, x, ' ');
+      }
+    }
+
+    for (int y = 0; y < 4; ++y) {
+      for (int x = 0; x < 4; ++x) {
+        int c = info->next[y][x];
+        if (c) {
+          drawCell(win, y + 3, 2 * x + 6, c);
+        }
+      }
+    }
+  }
+
+  return touched;
+}
+
+/**
+ * \brief Перерисовывает то, что поменялось с нарисованного снимка, и выводит
+ * все изменения на терминал одним doupdate().
+ *
+ * Смена паузы или конца игры перерисовывает поле целиком: индикаторы
+ * рисуются поверх клеток. В трассировке рисование окон — отрезок draw, вывод
+ * на терминал — refresh.
+ * \param scr Окна и нарисованный снимок (обновляется).
+ * \param snap Новый снимок.
+ */
+static void updtScreen(Screen_t *scr, const tetris_snapshot_t *snap) {
+  int full = !scr->drawn || scr->shown.obs.pause != snap->obs.pause;
+  const tetris_observation_t *seen = scr->drawn ? &scr->shown.obs : NULL;
+
+  tetris_trace_begin("draw");
+  if (drawNext(scr->next, &snap->obs, seen)) {
+    wnoutrefresh(scr->next);
+  }
+  if (drawField(scr->gaming, snap, full ? NULL : &scr->shown)) {
+    wnoutrefresh(scr->gaming);
+  }
+  if (drawStat(scr->statistics, &snap->obs, seen)) {
+    wnoutrefresh(scr->statistics);
+  }
+  tetris_trace_end("draw");
+  tetris_trace_begin("refresh");
+  doupdate();
+  tetris_trace_end("refresh");
+
+  scr->shown = *snap;
+  scr->drawn = 1;
+}
+
+/**
+ * \brief Текущее время по монотонным часам.
+ * \return Наносекунды от произвольной точки отсчёта.
+ */
+static uint64_t nowNs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * \brief Текущее время по монотонным часам.
+ * \return Миллисекунды от той же точки отсчёта, что у nowNs().
  */
-static void drawNext(WINDOW *win, const GameInfo_t *info) {
-  for (int y = 1; y < 7; ++y) {
-    for (int x = 1; x < 2 * FIELD_WIDTH - 1; ++x) {
-      mvwaddch(win, y, x, ' ');
+static uint64_t nowMs(void) { return nowNs() / 1000000u; }
+
+#if HAVE_LINUX_FDS
+/**
+ * \brief Вычитывает счётчик eventfd или timerfd, не блокируясь.
+ * \param fd Дескриптор (открыт с O_NONBLOCK).
+ * \return Сколько раз он сработал с прошлого чтения (0 — ни разу).
+ */
+static uint64_t drainFd(int fd) {
+  uint64_t n = 0;
+
+  if (read(fd, &n, sizeof n) != (ssize_t)sizeof n) {
+    n = 0;
+  }
+
+  return n;
+}
+#else
+/**
+ * \brief Открывает self-pipe: оба конца неблокирующие и закрываются при
+ * exec().
+ * \param fds Концы канала (заполняются): fds[0] — чтение, fds[1] — запись.
+ * \return 0 при успехе, -1 при ошибке.
+ */
+static int openPipe(int fds[2]) {
+  int res = pipe(fds);
+
+  for (int i = 0; res == 0 && i < 2; ++i) {
+    if (fcntl(fds[i], F_SETFL, O_NONBLOCK) != 0 ||
+        fcntl(fds[i], F_SETFD, FD_CLOEXEC) != 0) {
+      res = -1;
     }
   }
 
-  for (int y = 0; y < 4; ++y) {
-    for (int x = 0; x < 4; ++x) {
-      int c = info->next[y][x];
-      if (c) {
-        wattron(win, COLOR_PAIR(c));
-        mvwaddch(win, y + 3, 2 * x + 6, ' ');
-        mvwaddch(win, y + 3, 2 * x + 7, ' ');
-        wattroff(win, COLOR_PAIR(c));
+  return res;
+}
+#endif
+
+/**
+ * \brief Открывает канал пробуждения.
+ * \param w Канал (заполняется; при ошибке концы равны -1 или открытым
+ * дескрипторам, которые закроет closeFds()).
+ * \return 0 при успехе, -1 при ошибке.
+ */
+static int openWake(Wake_t *w) {
+#if HAVE_LINUX_FDS
+  w->rd = w->wr = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  return w->rd < 0 ? -1 : 0;
+#else
+  int fds[2] = {-1, -1};
+  int res = openPipe(fds);
+  w->rd = fds[0];
+  w->wr = fds[1];
+  return res;
+#endif
+}
+
+/**
+ * \brief Будит поток, который ждёт канал.
+ * \param w Канал.
+ */
+static void notify(const Wake_t *w) {
+  uint64_t one = 1;
+
+  if (write(w->wr, &one, sizeof one) != (ssize_t)sizeof one) {
+    // канал переполнен — ждущий поток и так проснётся
+  }
+}
+
+/**
+ * \brief Вычитывает всё, что пришло в канал, не блокируясь.
+ * \param w Канал.
+ */
+static void drainWake(const Wake_t *w) {
+#if HAVE_LINUX_FDS
+  drainFd(w->rd);
+#else
+  unsigned char buf[64];
+  while (read(w->rd, buf, sizeof buf) > 0) {
+  }
+#endif
+}
+
+/**
+ * \brief Создаёт невзведённый таймер.
+ * \param t Таймер (заполняется).
+ * \return 0 при успехе, -1 при ошибке.
+ */
+static int openTimer(Timer_t *t) {
+  t->due = UINT64_MAX;
+  t->period = 0;
+#if HAVE_LINUX_FDS
+  t->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+#else
+  t->fd = -1;
+#endif
+  return HAVE_LINUX_FDS && t->fd < 0 ? -1 : 0;
+}
+
+/**
+ * \brief Взводит таймер на момент at по монотонным часам (однократно).
+ * \param t Таймер.
+ * \param at Момент срабатывания, мс (как nowMs()).
+ */
+static void armAt(Timer_t *t, uint64_t at) {
+#if HAVE_LINUX_FDS
+  struct timespec ts = {(time_t)(at / 1000u), (long)(at % 1000u) * 1000000L};
+  struct itimerspec its = {{0, 0}, ts};
+  timerfd_settime(t->fd, TFD_TIMER_ABSTIME, &its, NULL);
+#else
+  t->due = at;
+  t->period = 0;
+#endif
+}
+
+/**
+ * \brief Взводит таймер на срабатывание каждые period мс.
+ * \param t Таймер.
+ * \param period Период, мс.
+ */
+static void armEvery(Timer_t *t, int period) {
+#if HAVE_LINUX_FDS
+  struct timespec ts = {period / 1000, (long)(period % 1000) * 1000000L};
+  struct itimerspec its = {ts, ts};
+  timerfd_settime(t->fd, 0, &its, NULL);
+#else
+  t->due = nowMs() + (uint64_t)period;
+  t->period = period;
+#endif
+}
+
+/**
+ * \brief Проверяет, сработал ли таймер, и сбрасывает сработавший
+ * (периодический перевзводится на следующий срок).
+ * \param t Таймер.
+ * \return Сколько раз он сработал с прошлой проверки (0 — ни разу).
+ */
+static uint64_t fired(Timer_t *t) {
+#if HAVE_LINUX_FDS
+  return drainFd(t->fd);
+#else
+  uint64_t now = nowMs();
+  uint64_t n = 0;
+
+  if (t->due <= now) {
+    n = t->period > 0 ? 1 + (now - t->due) / (uint64_t)t->period : 1;
+    t->due = t->period > 0 ? t->due + n * (uint64_t)t->period : UINT64_MAX;
+  }
+
+  return n;
+#endif
+}
+
+/**
+ * \brief Тайм-аут poll() потока игры: на Linux таймеры будят его сами, иначе
+ * poll() должен вернуться к ближайшему сроку таймера.
+ * \param ctx Данные потока игры.
+ * \param timeout Тайм-аут без учёта таймеров, мс (-1 — бесконечно).
+ * \return Тайм-аут, мс (-1 — бесконечно).
+ */
+static int pollTimeout(const GameCtx_t *ctx, int timeout) {
+#if HAVE_LINUX_FDS
+  (void)ctx;
+#else
+  const Timer_t *timers[] = {&ctx->gravity, ctx->ai ? &ctx->ai_timer : NULL};
+  uint64_t now = nowMs();
+
+  for (size_t i = 0; i < sizeof timers / sizeof timers[0]; ++i) {
+    if (timers[i] && timers[i]->due != UINT64_MAX) {
+      uint64_t left = timers[i]->due > now ? timers[i]->due - now : 0;
+      if (timeout < 0 || left < (uint64_t)timeout) {
+        timeout = (int)left;
       }
     }
   }
+#endif
+  return timeout;
 }
 
 /**
- * \brief Обновляет все окна на экране – игровое поле, статистику, превью.
- * \param tmpGS Структура GameInfo_t с текущим состоянием игры.
- * \param next Окно для превью следующей фигуры.
- * \param gaming Игровое окно.
- * \param statistics Окно статистики.
+ * \brief Применяет действие к экземпляру по умолчанию и записывает его в
+ * повтор, если запись включена.
+ * \param ctx Данные потока игры.
+ * \param act Действие.
  */
-static void updtScreen(GameInfo_t tmpGS, WINDOW *next, WINDOW *gaming,
-                       WINDOW *statistics) {
-  drawNext(next, &tmpGS);
-  drawField(gaming, &tmpGS);
-  drawStat(statistics, &tmpGS);
+static void play(GameCtx_t *ctx, UserAction_t act) {
+  tetris_step(tetris_default_engine(), act);
+  tetris_record(ctx->rec, tetris_default_engine(), ctx->tick, act);
+}
 
-  wrefresh(next);
-  wrefresh(gaming);
-  wrefresh(statistics);
+/**
+ * \brief Отпускает удерживаемую клавишу. Отпускание ничего не меняет в
+ * партии, поэтому в повтор не пишется.
+ * \param ctx Данные потока игры.
+ */
+static void release(GameCtx_t *ctx) {
+  tetris_step_hold(tetris_default_engine(), ctx->key, false);
+  ctx->held = 0;
 }
 
 /**
- * \brief Главная функция: инициализирует ncurses, запускает игровой цикл
- * Tetris.
+ * \brief Применяет клавишу игрока. Та же клавиша сдвига или мягкого спуска
+ * в пределах HOLD_GAP_MS от предыдущей — автоповтор терминала: движок
+ * начинает удержание, а следующие такие же клавиши пропускает. Любая другая
+ * клавиша или пауза отпускают удерживаемую.
+ * \param ctx Данные потока игры.
+ * \param ev Действие и метка времени нажатия, нс.
+ */
+static void press(GameCtx_t *ctx, const tetris_input_t *ev) {
+  int again = ev->action == ctx->key &&
+              ev->stamp - ctx->key_at < HOLD_GAP_MS * 1000000ull;
+  bool hold = again && (ev->action == Left || ev->action == Right ||
+                        ev->action == Up);
+
+  if (ctx->held && !hold) {
+    release(ctx);
+  }
+  if (tetris_step_hold(tetris_default_engine(), ev->action, hold)) {
+    tetris_record(ctx->rec, tetris_default_engine(), ctx->tick, ev->action);
+  }
+  ctx->key = ev->action;
+  ctx->key_at = ev->stamp;
+  ctx->held = hold;
+}
+
+/**
+ * \brief Продвигает часы движка до now и пишет в повтор повторы
+ * удерживаемой клавиши, которые движок за это время сделал.
+ * \param ctx Данные потока игры.
+ * \param now Текущее время, мс.
+ * \return 1, если что-то поменялось.
+ */
+static int advance(GameCtx_t *ctx, uint64_t now) {
+  uint64_t ms = now - ctx->clock;
+  UserAction_t act = Up;
+  int n = tetris_advance(tetris_default_engine(),
+                         ms < INT_MAX ? (int)ms : INT_MAX, &act);
+
+  for (int i = 0; i < n; ++i) {
+    tetris_record(ctx->rec, tetris_default_engine(), ctx->tick, act);
+  }
+  ctx->clock = now;
+
+  return n > 0;
+}
+
+/**
+ * \brief Опускает фигуру за каждый наступивший срок гравитации и взводит
+ * таймер на следующий. Срок отсчитывается от предыдущего срока, поэтому
+ * спуски не уплывают от задержек пробуждения; больше GRAVITY_CATCHUP
+ * пропущенных спусков не навёрстывается.
+ * \param ctx Данные потока игры.
+ * \param due Срок очередного спуска, мс (сдвигается).
+ * \param now Текущее время, мс.
+ */
+static void applyGravity(GameCtx_t *ctx, uint64_t *due, uint64_t now) {
+  int n = 0;
+
+  while (*due <= now && n < GRAVITY_CATCHUP) {
+    play(ctx, Up);
+    *due += (uint64_t)updateCurrentState().speed;
+    ++n;
+  }
+  if (*due <= now) {
+    *due = now + (uint64_t)updateCurrentState().speed;
+  }
+  armAt(&ctx->gravity, *due);
+}
+
+/**
+ * \brief Пропускает байты управляющих последовательностей (стрелки,
+ * функциональные клавиши): ESC, затем '[' или 'O' с параметрами до
+ * завершающего байта. ESC с любым другим байтом (Alt+клавиша) пропускается
+ * вместе с ним.
+ * \param state Состояние разбора: 0 — вне последовательности, 1 — после ESC,
+ * 2 — внутри последовательности (обновляется).
+ * \param b Очередной байт.
+ * \return 1, если байт относится к последовательности.
+ */
+static int skipEscape(int *state, int b) {
+  int res = *state != 0 || b == KEY_ESC;
+
+  if (*state == 0) {
+    *state = b == KEY_ESC;
+  } else if (*state == 1) {
+    *state = b == '[' || b == 'O' ? 2 : 0;
+  } else if (b >= 0x40 && b <= 0x7e) {
+    *state = 0;
+  }
+
+  return res;
+}
+
+/**
+ * \brief Кладёт Terminate в очередь, даже если она полна: будит поток игры,
+ * чтобы он её разобрал, и пробует снова через TERMINATE_RETRY_US. Без этого
+ * поток ввода завершился бы, а потоки игры и отрисовки ждали бы вечно.
+ * \param ctx Данные потока игры.
+ * \param stamp Метка времени, нс.
+ */
+static void pushTerminate(GameCtx_t *ctx, uint64_t stamp) {
+  struct timespec pause = {0, TERMINATE_RETRY_US * 1000L};
+
+  while (!tetris_inputq_push(ctx->input, Terminate, stamp)) {
+    notify(&ctx->wake);
+    nanosleep(&pause, NULL);
+  }
+}
+
+/**
+ * \brief Поток ввода: читает клавиши из stdin и кладёт действия в очередь.
  *
- * Инициализирует интерфейс, создаёт окна, обрабатывает ввод и таймер,
- * обновляет экран до завершения игры, затем завершает работу ncurses.
+ * Спит в poll() на stdin. Всё, что пришло одной пачкой, получает одну метку
+ * времени и уходит в очередь по порядку, после чего поток игры будится один
+ * раз. Если очередь полна, клавиша пропускается, а Terminate кладётся
+ * повторными попытками (pushTerminate()). Поток завершается после
+ * Terminate; закрытый терминал тоже даёт Terminate.
+ * \param arg Указатель на GameCtx_t.
+ * \return NULL.
+ */
+static void *inputThread(void *arg) {
+  GameCtx_t *ctx = arg;
+  struct pollfd fd = {STDIN_FILENO, POLLIN, 0};
+  int reading = 1;
+  int esc = 0;
+
+  while (reading) {
+    unsigned char buf[READ_CHUNK];
+    ssize_t n = -1;
+    int pushed = 0;
+
+    if (poll(&fd, 1, -1) > 0) {
+      n = fd.revents & POLLIN ? read(STDIN_FILENO, buf, sizeof buf) : 0;
+    }
+    uint64_t stamp = nowNs();
+
+    for (ssize_t i = 0; reading && i < n; ++i) {
+      int act = skipEscape(&esc, buf[i]) ? -1 : actionProcessing(buf[i]);
+      if (act == Terminate) {
+        pushTerminate(ctx, stamp);
+      } else if (act >= 0) {
+        tetris_inputq_push(ctx->input, (UserAction_t)act, stamp);
+      }
+      pushed = pushed || act >= 0;
+      reading = act != Terminate;
+    }
+    if (reading && (n == 0 || (n < 0 && errno != EINTR && errno != EAGAIN))) {
+      // конец файла или обрыв терминала: клавиш больше не будет
+      pushTerminate(ctx, stamp);
+      pushed = 1;
+      reading = 0;
+    }
+    if (pushed) {
+      notify(&ctx->wake);
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * \brief Пишет статистику в ctx->stats и трассировку в ctx->trace, если
+ * пришёл SIGUSR1. Ошибку записи здесь показать негде (терминалом владеет
+ * ncurses), её сообщит запись после выхода.
+ * \param ctx Данные потока игры.
+ */
+static void dumpOnSignal(const GameCtx_t *ctx) {
+#if HAVE_LINUX_FDS
+  struct signalfd_siginfo si;
+  int got = ctx->sigs >= 0 &&
+            read(ctx->sigs, &si, sizeof si) == (ssize_t)sizeof si;
+#else
+  unsigned char buf[64];
+  int got = 0;
+  while (ctx->sigs >= 0 && read(ctx->sigs, buf, sizeof buf) > 0) {
+    got = 1;
+  }
+#endif
+
+  if (got) {
+    if (ctx->stats) {
+      tetris_stats_dump(ctx->stats);
+    }
+    if (ctx->trace) {
+      tetris_trace_export(ctx->trace);
+    }
+  }
+}
+
+/**
+ * \brief Поток игры: ведёт экземпляр по умолчанию и публикует снимки.
  *
- * \return Код возврата (0 при успешном завершении).
- */
-int main() {
-  srand((unsigned)time(NULL));
-  startNcurses();
-
-  WINDOW *gaming = newwin(FIELD_HEIGHT + 2, 2 * FIELD_WIDTH + 2, 0, 0);
-  WINDOW *statistics = newwin(8, 2 * FIELD_WIDTH, 0, 2 * FIELD_WIDTH + 2);
-  WINDOW *next = newwin(8, 2 * FIELD_WIDTH, 8, 2 * FIELD_WIDTH + 2);
-  setWindows(gaming, statistics, next);
-
-  int game = 1;
-  int ms_storage = 0;
-  UserAction_t act = Start;
-  userInput(act, false);
-  GameInfo_t tmpGS = updateCurrentState();
-  updtScreen(tmpGS, next, gaming, statistics);
-
-  while (game) {
-    int sig = getch();
-    act = actionProcessing(sig);
-
-    if (act == Terminate) {
-      userInput(act, false);
-      game = 0;
-    } else {
+ * Спит в poll(), пока не придёт действие игрока, не наступит срок гравитации
+ * или хода автоигрока. Действия игрока применяются все, что накопились, в
+ * порядке нажатия и до публикации снимка, так что пачка клавиш попадает в
+ * один кадр; автоигрок ходит раз в AI_DELAY, если за это время игрок ничего
+ * не нажал. Гравитация опускает фигуру каждые speed мс. Перед клавишами
+ * движок догоняет часы и повторяет удерживаемую клавишу (advance()), а
+ * удержание, по которому HOLD_GAP_MS не было автоповтора терминала,
+ * снимается. После любого изменения публикуется снимок, метка последней
+ * применённой клавиши сохраняется в applied, и будится основной поток.
+ * По SIGUSR1 пишутся статистика и трассировка движка. Terminate завершает
+ * поток и поднимает done.
+ * \param arg Указатель на GameCtx_t.
+ * \return NULL.
+ */
+static void *gameThread(void *arg) {
+  GameCtx_t *ctx = arg;
+  struct pollfd fds[4] = {{ctx->wake.rd, POLLIN, 0},
+                          {ctx->gravity.fd, POLLIN, 0},
+                          {ctx->sigs, POLLIN, 0},
+                          {ctx->ai_timer.fd, POLLIN, 0}};
+  int running = 1;
+  int pressed = 0;
+  uint64_t due = nowMs() + (uint64_t)updateCurrentState().speed;
+
+  tetris_trace_thread("game");
+  tetris_set_repeat(tetris_default_engine(), ctx->repeat.das, ctx->repeat.arr,
+                    ctx->repeat.sdr);
+  ctx->clock = nowMs();
+  play(ctx, Start);
+  tetris_publish(ctx->snaps, tetris_default_engine());
+  notify(&ctx->redraw);
+  armAt(&ctx->gravity, due);
+  if (ctx->ai) {
+    armEvery(&ctx->ai_timer, AI_DELAY);
+  }
+
+  while (running) {
+    int changed = 0;
+    uint64_t stamp = 0;
+    tetris_input_t ev;
+    UserAction_t act;
+
+    int timeout = pollTimeout(ctx, ctx->held ? HOLD_POLL_MS : -1);
+    poll(fds, ctx->ai ? 4 : 3, timeout);
+    uint64_t now = nowMs();
+    ctx->tick = (now - ctx->start) / TICK_MS;
+
+    if (ctx->held && nowNs() - ctx->key_at >= HOLD_GAP_MS * 1000000ull) {
+      release(ctx);
+    }
+    if (advance(ctx, now)) {
+      changed = pressed = 1;
+    }
+
+    drainWake(&ctx->wake);
+    while (running && tetris_inputq_pop(ctx->input, &ev)) {
+      if (ev.action == Terminate) {
+        running = 0;
+      } else {
+        press(ctx, &ev);
+        stamp = ev.stamp;
+        changed = pressed = 1;
+      }
+    }
+
+    if (running && ctx->ai && fired(&ctx->ai_timer)) {
+      act = pressed ? Up : tetris_ai_action(ctx->ai, tetris_default_engine());
       if (act != Up) {
-        userInput(act, false);
-        tmpGS = updateCurrentState();
+        play(ctx, act);
+        changed = 1;
       }
+      pressed = 0;
+    }
+
+    if (running && fired(&ctx->gravity)) {
+      applyGravity(ctx, &due, nowMs());
+      changed = 1;
+    }
+    dumpOnSignal(ctx);
 
-      ms_storage += DELAY;
-      if (ms_storage > tmpGS.speed) {
-        userInput(Up, false);
-        ms_storage = 0;
-        tmpGS = updateCurrentState();
+    if (running && changed) {
+      tetris_publish(ctx->snaps, tetris_default_engine());
+      if (stamp) {
+        atomic_store_explicit(&ctx->applied, stamp, memory_order_release);
       }
+      notify(&ctx->redraw);
+    }
+  }
+
+  userInput(Terminate, false);
+  atomic_store(&ctx->done, 1);
+  notify(&ctx->redraw);
+  return NULL;
+}
+
+/**
+ * \brief Цикл отрисовки: рисует свежие снимки, пока поток игры не
+ * завершится, затем завершает работу ncurses.
+ *
+ * Спит в poll() на ctx->redraw и, проснувшись, рисует последний снимок, если
+ * его версия сменилась. Если с прошлого кадра поток игры применил новую
+ * клавишу, время от её нажатия до конца вывода кадра добавляется в lat.
+ * applied читается до снимка: тогда снимок уже содержит результат этой
+ * клавиши (он опубликован раньше, чем записан applied).
+ * \param ctx Данные, общие с потоком игры.
+ * \param lat Статистика задержки ввода (дополняется).
+ */
+static void uiLoop(GameCtx_t *ctx, Latency_t *lat) {
+  Screen_t scr = {
+      .gaming = newwin(FIELD_HEIGHT + 2, 2 * FIELD_WIDTH + 2, 0, 0),
+      .statistics = newwin(8, 2 * FIELD_WIDTH, 0, 2 * FIELD_WIDTH + 2),
+      .next = newwin(8, 2 * FIELD_WIDTH, 8, 2 * FIELD_WIDTH + 2)};
+  setWindows(scr.gaming, scr.statistics, scr.next);
+  tetris_trace_thread("ui");
 
-      updtScreen(tmpGS, next, gaming, statistics);
+  struct pollfd fd = {ctx->redraw.rd, POLLIN, 0};
+  uint64_t measured = 0;
+
+  while (!atomic_load(&ctx->done)) {
+    poll(&fd, 1, -1);
+    drainWake(&ctx->redraw);
+
+    uint64_t stamp = atomic_load_explicit(&ctx->applied, memory_order_acquire);
+    const tetris_snapshot_t *snap = tetris_snapshot(ctx->snaps);
+    if (snap->version != scr.shown.version) {
+      updtScreen(&scr, snap);
+    }
+    if (stamp != measured) {
+      uint64_t d = nowNs() - stamp;
+      lat->count += 1;
+      lat->total += d;
+      lat->max = d > lat->max ? d : lat->max;
+      measured = stamp;
     }
-    napms(DELAY);
   }
 
-  endNcurses(gaming, statistics, next);
+  endNcurses(scr.gaming, scr.statistics, scr.next);
+}
+
+#if !HAVE_LINUX_FDS
+/// \brief Конец self-pipe, в который обработчик SIGUSR1 пишет байт (-1 —
+/// некуда).
+static volatile sig_atomic_t sig_pipe = -1;
 
-  return 0;
+/**
+ * \brief Обработчик SIGUSR1: будит поток игры через self-pipe.
+ * \param sig Номер сигнала.
+ */
+static void onSignal(int sig) {
+  int saved = errno;
+  unsigned char b = (unsigned char)sig;
+
+  if (sig_pipe >= 0 && write(sig_pipe, &b, 1) != 1) {
+    // канал переполнен — поток игры и так проснётся
+  }
+  errno = saved;
+}
+#endif
+
+/**
+ * \brief Готовит приём SIGUSR1 до запуска любых потоков, включая потоки
+ * автоигрока. На Linux сигнал блокируется: потоки наследуют маску, и он
+ * приходит только через signalfd потока игры. Иначе ставится обработчик,
+ * который пишет в self-pipe из openFds() (до её открытия сигнал
+ * пропускается).
+ */
+static void catchSignal(void) {
+#if HAVE_LINUX_FDS
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGUSR1);
+  pthread_sigmask(SIG_BLOCK, &set, NULL);
+#else
+  struct sigaction sa;
+  memset(&sa, 0, sizeof sa);
+  sa.sa_handler = onSignal;
+  sigemptyset(&sa.sa_mask);
+  sa.sa_flags = SA_RESTART;
+  sigaction(SIGUSR1, &sa, NULL);
+#endif
+}
+
+/**
+ * \brief Открывает каналы и таймеры GameCtx_t, а если статистика или
+ * трассировка собирается — канал SIGUSR1: signalfd (сигнал к этому моменту
+ * уже заблокирован catchSignal()) или self-pipe для обработчика.
+ * \param ctx Данные потока игры (заполняются дескрипторы).
+ * \return 0 при успехе, -1, если какой-то дескриптор не открылся.
+ */
+static int openFds(GameCtx_t *ctx) {
+  int res = openWake(&ctx->wake);
+
+  res |= openWake(&ctx->redraw);
+  res |= openTimer(&ctx->gravity);
+  res |= openTimer(&ctx->ai_timer);
+  if (ctx->stats || ctx->trace) {
+#if HAVE_LINUX_FDS
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    ctx->sigs = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+#else
+    int fds[2] = {-1, -1};
+    if (openPipe(fds) == 0) {
+      sig_pipe = fds[1];
+    }
+    ctx->sigs = fds[0];
+#endif
+    res |= ctx->sigs < 0 ? -1 : 0;
+  }
+
+  return res;
+}
+
+/**
+ * \brief Закрывает дескрипторы, открытые openFds().
+ * \param ctx Данные потока игры.
+ */
+static void closeFds(GameCtx_t *ctx) {
+  int fds[] = {ctx->wake.rd,
+               ctx->wake.wr != ctx->wake.rd ? ctx->wake.wr : -1,
+               ctx->redraw.rd,
+               ctx->redraw.wr != ctx->redraw.rd ? ctx->redraw.wr : -1,
+               ctx->gravity.fd,
+               ctx->ai_timer.fd,
+               ctx->sigs};
+
+#if !HAVE_LINUX_FDS
+  if (sig_pipe >= 0) {
+    // после выхода из игры сигнал больше не нужен, как и на Linux, где он
+    // остаётся заблокированным
+    int fd = sig_pipe;
+    signal(SIGUSR1, SIG_IGN);
+    sig_pipe = -1;
+    close(fd);
+  }
+#endif
+  for (size_t i = 0; i < sizeof fds / sizeof fds[0]; ++i) {
+    if (fds[i] >= 0) {
+      close(fds[i]);
+    }
+  }
+}
+
+/**
+ * \brief Печатает статистику задержки ввода.
+ * \param lat Статистика.
+ */
+static void printLatency(const Latency_t *lat) {
+  printf("input latency: %ld frames", lat->count);
+  if (lat->count > 0) {
+    printf(", mean %.3f ms, max %.3f ms",
+           (double)lat->total / (double)lat->count / 1e6,
+           (double)lat->max / 1e6);
+  }
+  printf("\n");
+}
+
+/**
+ * \brief Запускает потоки ввода и игры и цикл отрисовки, дожидается конца
+ * игры.
+ * \param ai Автоигрок или NULL.
+ * \param record Файл повтора или NULL.
+ * \param latency 1 — напечатать задержку ввода после выхода.
+ * \param repeat Настройки автоповтора.
+ * \param stats Файл статистики движка или NULL; статистика пишется в него
+ * после выхода и по SIGUSR1.
+ * \param trace Файл трассировки или NULL; пишется так же, как статистика.
+ * \return 0 при успехе, 1, если не удалось начать или дописать повтор или
+ * записать статистику или трассировку.
+ */
+static int gameLoop(tetris_ai_t *ai, const char *record, int latency,
+                    const Repeat_t *repeat, const char *stats,
+                    const char *trace) {
+  GameCtx_t ctx = {.input = tetris_inputq_create(),
+                   .snaps = tetris_snapbuf_create(),
+                   .ai = ai,
+                   .wake = {-1, -1},
+                   .redraw = {-1, -1},
+                   .gravity = {-1, UINT64_MAX, 0},
+                   .ai_timer = {-1, UINT64_MAX, 0},
+                   .repeat = *repeat,
+                   .key = Start,
+                   .stats = stats,
+                   .trace = trace,
+                   .sigs = -1};
+  pthread_t game_thread;
+  pthread_t input_thread;
+  Latency_t lat = {0, 0, 0};
+  int res = 0;
+
+  if (record) {
+    ctx.rec = tetris_record_open(record, tetris_default_engine());
+    if (!ctx.rec) {
+      perror(record);
+      res = 1;
+    }
+  }
+  if (!res && openFds(&ctx) != 0) {
+    perror("Error creating event descriptors");
+    res = 1;
+  }
+  if (stats) {
+    tetris_stats_enable(true);
+  }
+  if (trace) {
+    tetris_trace_enable(true);
+  }
+
+  ctx.start = nowMs();
+  if (!res && ctx.snaps && ctx.input) {
+    startNcurses();
+  }
+  if (!res && ctx.snaps && ctx.input &&
+      pthread_create(&game_thread, NULL, gameThread, &ctx) == 0) {
+    if (pthread_create(&input_thread, NULL, inputThread, &ctx) == 0) {
+      uiLoop(&ctx, &lat);
+      pthread_join(input_thread, NULL);
+    } else {
+      // потока ввода нет, поэтому писатель очереди — этот поток
+      pushTerminate(&ctx, 0);
+      notify(&ctx.wake);
+      endwin();
+      perror("Error starting input thread");
+    }
+    pthread_join(game_thread, NULL);
+  } else if (!res) {
+    endwin();
+    perror("Error starting game thread");
+  }
+  if (latency) {
+    printLatency(&lat);
+  }
+  if (stats && !res && tetris_stats_dump(stats) != 0) {
+    perror(stats);
+    res = 1;
+  }
+  if (trace && !res && tetris_trace_export(trace) != 0) {
+    perror(trace);
+    res = 1;
+  }
+  closeFds(&ctx);
+  tetris_inputq_destroy(ctx.input);
+  tetris_snapbuf_destroy(ctx.snaps);
+  if (tetris_record_close(ctx.rec) != 0) {
+    perror(record);
+    res = 1;
+  }
+
+  return res;
+}
+
+/**
+ * \brief Разбирает число миллисекунд из аргумента командной строки.
+ * \param arg Аргумент.
+ * \param out Число (заполняется при успехе).
+ * \return 0 при успехе, 1, если это не число от 0 до REPEAT_MAX_MS.
+ */
+static int parseMs(const char *arg, int *out) {
+  char *end = NULL;
+  long v = strtol(arg, &end, 10);
+  int res = 1;
+
+  if (end != arg && *end == '\0' && v >= 0 && v <= REPEAT_MAX_MS) {
+    *out = (int)v;
+    res = 0;
+  }
+
+  return res;
+}
+
+/**
+ * \brief Главная функция: разбирает аргументы и запускает игровой цикл
+ * Tetris.
+ *
+ * С ключом --autoplay за игрока ходит встроенный автоигрок, с --record FILE
+ * партия записывается в повтор FILE, с --latency после выхода печатается
+ * задержка ввода, с --stats FILE движок собирает статистику и пишет её в
+ * FILE после выхода и по SIGUSR1, с --trace FILE так же пишется трассировка
+ * (JSON для chrome://tracing или Perfetto). --das, --arr и --sdr задают
+ * автоповтор удерживаемых клавиш, мс. Удержание распознаётся только после
+ * начала автоповтора терминала, поэтому задержка перед повтором по
+ * умолчанию — HOLD_GAP_MS: своя задержка терминала к этому моменту уже
+ * прошла.
+ *
+ * \param argc Число аргументов.
+ * \param argv Аргументы командной строки.
+ * \return Код возврата (0 при успешном завершении, 1 при неверных
+ * аргументах или ошибке записи повтора, статистики или трассировки).
+ */
+int main(int argc, char **argv) {
+  int autoplay = 0;
+  int latency = 0;
+  const char *record = NULL;
+  const char *stats = NULL;
+  const char *trace = NULL;
+  Repeat_t repeat = {HOLD_GAP_MS, ARR_MS, SDR_MS};
+  int res = 0;
+
+  for (int i = 1; i < argc && !res; ++i) {
+    if (strcmp(argv[i], "--autoplay") == 0) {
+      autoplay = 1;
+    } else if (strcmp(argv[i], "--latency") == 0) {
+      latency = 1;
+    } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+      record = argv[++i];
+    } else if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc) {
+      stats = argv[++i];
+    } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+      trace = argv[++i];
+    } else if (strcmp(argv[i], "--das") == 0 && i + 1 < argc) {
+      res = parseMs(argv[++i], &repeat.das);
+    } else if (strcmp(argv[i], "--arr") == 0 && i + 1 < argc) {
+      res = parseMs(argv[++i], &repeat.arr);
+    } else if (strcmp(argv[i], "--sdr") == 0 && i + 1 < argc) {
+      res = parseMs(argv[++i], &repeat.sdr);
+    } else {
+      res = 1;
+    }
+  }
+
+  if (res) {
+    fprintf(stderr,
+            "usage: %s [--autoplay] [--latency] [--record FILE] "
+            "[--stats FILE] [--trace FILE] [--das MS] [--arr MS] "
+            "[--sdr MS]\n",
+            argv[0]);
+  } else {
+    if (stats || trace) {
+      catchSignal();
+    }
+    tetris_ai_t *ai = autoplay ? tetris_ai_create(AI_THREADS) : NULL;
+    res = gameLoop(ai, record, latency, &repeat, stats, trace);
+    tetris_ai_destroy(ai);
+  }
+
+  return res;
 }
\ No newline at end of file
@@ -2,24 +2,46 @@
  * @file game.c
  * @brief Интерфейс между пользовательским вводом и движком игры tetris.
  * Содержит функции для обработки ввода пользователя и получения текущего
- * состояния игры.
+ * состояния игры: userInput/updateCurrentState работают с экземпляром по
+ * умолчанию, функции tetris_* — с явно созданными экземплярами.
  */
 
 #include "game.h"
 
 #include <stdio.h>
 
+#include "../brick_game/tetris/ai.h"
 #include "../brick_game/tetris/back.h"
+#include "../brick_game/tetris/batch.h"
+#include "../brick_game/tetris/input.h"
+#include "../brick_game/tetris/pool.h"
+#include "../brick_game/tetris/repeat.h"
+#include "../brick_game/tetris/replay.h"
+#include "../brick_game/tetris/snapshot.h"
+#include "../brick_game/tetris/stats.h"
+#include "../brick_game/tetris/trace.h"
+#include "../brick_game/tetris/ttable.h"
+
+_Static_assert(TETRIS_FIELD_WIDTH == FIELD_WIDTH &&
+                   TETRIS_FIELD_HEIGHT == FIELD_HEIGHT &&
+                   TETRIS_NEXT_SIZE == PIECE_SIZE,
+               "observation size must match the field");
+_Static_assert(sizeof(GameCore_t) <= TETRIS_CORE_SIZE,
+               "game state must fit tetris_core_t");
 
 /**
  * @brief Обрабатывает действие пользователя и обновляет состояние игры.
+ * Удержание работает так же, как в tetris_step_hold().
  * @param action Тип действия пользователя (UserAction_t):
  *        Start, Pause, Left, Right, Up, Down, Action, Terminate.
  * @param hold   Логический флаг удержания клавиши.
  */
 void userInput(UserAction_t action, bool hold) {
-  (void)hold;
-  updtInfo(action);
+  if (action == Terminate) {
+    updtInfo(action);
+  } else {
+    repeatInput(getParams(), action, hold);
+  }
 }
 
 /**
@@ -30,6 +52,526 @@ void userInput(UserAction_t action, bool hold) {
  * @return текущее состояние игры GameInfo_t.
  */
 GameInfo_t updateCurrentState() {
-  const GameInfo_t *cur = getParams()->data;
-  return *cur;
-}
\ No newline at end of file
+  GameParams_t *params = getParams();
+
+  syncView(params);
+  return *params->data;
+}
+
+/**
+ * @brief Создаёт независимый экземпляр игры.
+ * @param config Параметры экземпляра; NULL — равномерный выбор фигур и зерно
+ * от текущего времени.
+ * @return Дескриптор экземпляра; освобождается через tetris_destroy().
+ */
+tetris_engine_t *tetris_create(const tetris_config_t *config) {
+  return newParams(config);
+}
+
+/**
+ * @brief Применяет действие пользователя к экземпляру игры.
+ * @param engine Экземпляр игры.
+ * @param action Тип действия пользователя (UserAction_t).
+ */
+void tetris_step(tetris_engine_t *engine, UserAction_t action) {
+  updtGame(engine, action);
+}
+
+/**
+ * @brief Применяет действие с учётом удержания клавиши.
+ * Left, Right и Up (мягкий спуск) с hold применяются и начинают удержание:
+ * дальше tetris_advance() повторяет их по часам экземпляра. Повторный вызов
+ * с hold для той же клавиши ничего не делает, вызов без hold — отпускает её.
+ * Всё остальное — обычный tetris_step(); hold у других действий ничего не
+ * значит.
+ * @param engine Экземпляр игры.
+ * @param action Тип действия пользователя (UserAction_t).
+ * @param hold Клавиша удерживается.
+ * @return 1, если действие применено к игре (его нужно писать в повтор),
+ * 0 — только удержание или отпускание.
+ */
+int tetris_step_hold(tetris_engine_t *engine, UserAction_t action,
+                     bool hold) {
+  return repeatInput(engine, action, hold);
+}
+
+/**
+ * @brief Продвигает часы экземпляра и повторяет удерживаемую клавишу, если
+ * подошёл срок: сдвиг — через das мс после нажатия и дальше каждые arr мс,
+ * мягкий спуск — каждые sdr мс (tetris_set_repeat()). Наступившие за вызов
+ * повторы делаются одним проходом по полю. На паузе часы стоят.
+ * @param engine Экземпляр игры.
+ * @param ms Сколько мс прошло с прошлого вызова.
+ * @param action Повторённое действие (заполняется, если клавиша
+ * удерживается).
+ * @return Сколько раз действие применено. Для повтора партии это равно
+ * стольким же tetris_step() с этим действием.
+ */
+int tetris_advance(tetris_engine_t *engine, int ms, UserAction_t *action) {
+  return repeatAdvance(engine, ms, action);
+}
+
+/**
+ * @brief Настраивает автоповтор экземпляра (по умолчанию 167, 33 и 50 мс).
+ * @param engine Экземпляр игры.
+ * @param das Задержка перед первым повтором сдвига, мс.
+ * @param arr Период повторов сдвига, мс; 0 — фигура сразу уходит до упора.
+ * @param sdr Период мягкого спуска, мс (не меньше 1).
+ */
+void tetris_set_repeat(tetris_engine_t *engine, int das, int arr, int sdr) {
+  repeatConfig(&engine->repeat, das, arr, sdr);
+}
+
+/**
+ * @brief Возвращает текущее состояние экземпляра игры.
+ * Указатели field и next ссылаются на данные экземпляра и меняются вместе с
+ * ним; снимок без указателей даёт tetris_observe(). GameInfo_t — кэш,
+ * который обновляется здесь по состоянию партии, поэтому const снимается.
+ * @param engine Экземпляр игры.
+ * @return текущее состояние игры GameInfo_t.
+ */
+GameInfo_t tetris_state(const tetris_engine_t *engine) {
+  GameParams_t *params = (GameParams_t *)engine;
+
+  syncView(params);
+  return *params->data;
+}
+
+/**
+ * @brief Записывает наблюдение за экземпляром игры в буфер вызывающего.
+ * Данные копируются, поэтому буфер не зависит от дальнейших ходов экземпляра.
+ * @param engine Экземпляр игры.
+ * @param out Буфер наблюдения.
+ * @return 0 при успехе, -1, если engine или out равен NULL.
+ */
+int tetris_observe(const tetris_engine_t *engine, tetris_observation_t *out) {
+  int res = -1;
+
+  if (engine && out) {
+    fillObservation(engine, out);
+    res = 0;
+  }
+
+  return res;
+}
+
+/**
+ * @brief Сохраняет партию экземпляра в снимок (одно копирование памяти).
+ * @param engine Экземпляр игры.
+ * @param out Снимок.
+ */
+void tetris_save(const tetris_engine_t *engine, tetris_core_t *out) {
+  saveCore(engine, (GameCore_t *)(void *)out->bytes);
+}
+
+/**
+ * @brief Возвращает экземпляр к снимку, сохранённому tetris_save() с этого
+ * или другого экземпляра. Дальнейшая игра совпадёт с игрой после сохранения
+ * при тех же действиях. Цвета зафиксированных клеток в снимок не входят:
+ * если экземпляр играл другую партию, они восстанавливаются приблизительно.
+ * @param engine Экземпляр игры.
+ * @param core Снимок.
+ */
+void tetris_restore(tetris_engine_t *engine, const tetris_core_t *core) {
+  restoreCore(engine, (const GameCore_t *)(const void *)core->bytes);
+}
+
+/**
+ * @brief Хеш Зобриста позиции: поле, падающая фигура (вид, ориентация,
+ * положение) и следующая фигура. Движок поддерживает его по ходу игры, так
+ * что вызов ничего не считает. Одинаковые позиции, полученные разными
+ * последовательностями ходов, дают одинаковый хеш; счёт, уровень и состояние
+ * генератора в него не входят.
+ * @param engine Экземпляр игры.
+ * @return Хеш.
+ */
+unsigned long long tetris_hash(const tetris_engine_t *engine) {
+  return engine->core.hash;
+}
+
+/**
+ * @brief Создаёт пустую таблицу транспозиций.
+ * @param bytes Объём памяти под таблицу; округляется вниз до степени двойки
+ * (не меньше 64 байт).
+ * @return Таблица или NULL при нехватке памяти.
+ */
+tetris_tt_t *tetris_tt_create(size_t bytes) { return ttCreate(bytes); }
+
+/**
+ * @brief Ищет значение, сохранённое для ключа.
+ * @param tt Таблица.
+ * @param key Ключ, обычно tetris_hash().
+ * @param data Значение (заполняется при попадании).
+ * @return 1 — найдено, 0 — нет (не сохранялось или вытеснено).
+ */
+int tetris_tt_probe(tetris_tt_t *tt, unsigned long long key,
+                    unsigned long long *data) {
+  uint64_t d = 0;
+  int res = ttProbe(tt, key, &d);
+
+  if (res) {
+    *data = d;
+  }
+
+  return res;
+}
+
+/**
+ * @brief Сохраняет значение для ключа. Таблица фиксированного размера, поэтому
+ * запись может вытеснить другую.
+ * @param tt Таблица.
+ * @param key Ключ, обычно tetris_hash().
+ * @param data Значение; 0 зарезервирован под пустую запись и не сохраняется.
+ */
+void tetris_tt_store(tetris_tt_t *tt, unsigned long long key,
+                     unsigned long long data) {
+  ttStore(tt, key, data);
+}
+
+/**
+ * @brief Очищает таблицу. Нельзя вызывать одновременно с другими операциями
+ * над ней.
+ * @param tt Таблица.
+ */
+void tetris_tt_clear(tetris_tt_t *tt) { ttClear(tt); }
+
+/**
+ * @brief Освобождает таблицу.
+ * @param tt Таблица (NULL допустим).
+ */
+void tetris_tt_destroy(tetris_tt_t *tt) { ttDestroy(tt); }
+
+/**
+ * @brief Начинает запись повтора партии экземпляра. Вызывается до Start:
+ * повтор хранит зерно и рекорд экземпляра и воспроизводит партию с начала.
+ * @param path Файл повтора (перезаписывается).
+ * @param engine Экземпляр игры в начальном состоянии.
+ * @return Запись или NULL, если партия уже началась или файл не открылся.
+ */
+tetris_recorder_t *tetris_record_open(const char *path,
+                                     const tetris_engine_t *engine) {
+  return replayCreate(path, engine);
+}
+
+/**
+ * @brief Записывает действие, только что применённое к экземпляру
+ * (tetris_step(), userInput()), вместе с контрольной суммой состояния.
+ * @param rec Запись повтора (NULL — ничего не делать).
+ * @param engine Экземпляр игры.
+ * @param tick Такт, на котором применено действие (не убывает).
+ * @param action Действие.
+ */
+void tetris_record(tetris_recorder_t *rec, const tetris_engine_t *engine,
+                   unsigned long long tick, UserAction_t action) {
+  if (rec) {
+    replayWrite(rec, engine, tick, action);
+  }
+}
+
+/**
+ * @brief Заканчивает запись повтора и закрывает файл.
+ * @param rec Запись повтора (NULL допустим).
+ * @return 0 при успехе, -1, если при записи была ошибка.
+ */
+int tetris_record_close(tetris_recorder_t *rec) { return replayClose(rec); }
+
+/**
+ * @brief Проигрывает повтор без интерфейса с максимальной скоростью и
+ * проверяет, что после каждого действия состояние совпадает с записанным.
+ * @param path Файл повтора.
+ * @param out Итог проигрывания.
+ * @return 0 — совпало, 1 — разошлось (см. out->mismatch), -1 — файл не
+ * читается или повреждён.
+ */
+int tetris_replay(const char *path, tetris_replay_t *out) {
+  return replayRun(path, out);
+}
+
+/**
+ * @brief Открывает повтор для просмотра с переходом к любому такту. Файл
+ * отображается в память и читается по мере надобности.
+ * @param path Файл повтора.
+ * @return Проигрыватель в начале партии или NULL, если файл не читается или
+ * это не повтор.
+ */
+tetris_player_t *tetris_player_open(const char *path) {
+  return replayPlayerOpen(path);
+}
+
+/**
+ * @brief Переходит к такту: экземпляр проигрывателя оказывается в состоянии
+ * после всех действий с тактом не больше заданного. Переход восстанавливает
+ * ближайший ключевой кадр и доигрывает не больше нескольких сотен тактов.
+ * @param player Проигрыватель.
+ * @param tick Такт.
+ * @return 0 при успехе, 1 — состояние разошлось с записанным, -1 — повтор
+ * повреждён.
+ */
+int tetris_player_seek(tetris_player_t *player, unsigned long long tick) {
+  return replaySeek(player, tick);
+}
+
+/**
+ * @brief Экземпляр игры проигрывателя: его можно читать (tetris_observe(),
+ * tetris_state()), но не менять.
+ * @param player Проигрыватель.
+ * @return Экземпляр игры; живёт, пока жив проигрыватель.
+ */
+const tetris_engine_t *tetris_player_engine(const tetris_player_t *player) {
+  return player->params;
+}
+
+/**
+ * @brief Закрывает проигрыватель.
+ * @param player Проигрыватель (NULL допустим).
+ */
+void tetris_player_close(tetris_player_t *player) {
+  replayPlayerClose(player);
+}
+
+/**
+ * @brief Версия двоичного интерфейса, с которой собрана библиотека.
+ * Вызывающий сравнивает её с TETRIS_ABI_VERSION своего заголовка.
+ * @return TETRIS_ABI_VERSION.
+ */
+int tetris_abi_version(void) { return TETRIS_ABI_VERSION; }
+
+/**
+ * @brief Освобождает экземпляр игры; экземпляр из пула возвращается в пул.
+ * @param engine Экземпляр игры (NULL допустим).
+ */
+void tetris_destroy(tetris_engine_t *engine) { freeMemory(engine); }
+
+/**
+ * @brief Возвращает экземпляр игры по умолчанию, с которым работают
+ * userInput() и updateCurrentState() (создаёт его при необходимости).
+ * @return Экземпляр игры по умолчанию.
+ */
+tetris_engine_t *tetris_default_engine(void) { return getParams(); }
+
+/**
+ * @brief Включает или выключает сбор статистики движка во всех потоках.
+ * Выключенный сбор стоит одной проверки флага на действие; накопленное при
+ * выключении не сбрасывается.
+ * @param on true — собирать.
+ */
+void tetris_stats_enable(bool on) { statsEnable(on); }
+
+/**
+ * @brief Складывает статистику всех потоков, которые работали с движком
+ * (включая завершившиеся).
+ * @param out Статистика (заполняется).
+ */
+void tetris_stats_read(tetris_stats_t *out) { statsRead(out); }
+
+/**
+ * @brief Обнуляет статистику всех потоков. Действия, которые другие потоки
+ * выполняют в этот момент, могут остаться в ней.
+ */
+void tetris_stats_reset(void) { statsReset(); }
+
+/**
+ * @brief Квантиль задержки по гистограмме (с точностью до корзины, то есть
+ * до 1/8 значения).
+ * @param lat Задержки одного вида действий из tetris_stats_t.
+ * @param q Доля от 0 до 1 (0.99 — p99).
+ * @return Задержка, нс; 0, если вызовов не было.
+ */
+unsigned long long tetris_stats_percentile(const tetris_latency_t *lat,
+                                           double q) {
+  return statsPercentile(lat, q);
+}
+
+/**
+ * @brief Пишет статистику всех потоков в файл JSON: по каждому действию
+ * число вызовов, среднее, p50/p90/p99/p99.9, максимум и гистограмму, затем
+ * фиксации по снятым линиям, появления фигур и повороты.
+ * @param path Файл (перезаписывается).
+ * @return 0 при успехе, -1 при ошибке (errno сохраняется).
+ */
+int tetris_stats_dump(const char *path) { return statsDump(path); }
+
+/**
+ * @brief Включает или выключает трассировку во всех потоках. Выключенная
+ * трассировка стоит одной проверки флага на отметку; записанные отметки при
+ * выключении остаются.
+ * @param on true — трассировать.
+ */
+void tetris_trace_enable(bool on) { traceEnable(on); }
+
+/**
+ * @brief Отмечает в трассировке начало своего отрезка (например, отрисовки
+ * кадра). Отрезки одного потока должны быть вложены друг в друга.
+ * @param name Имя отрезка; строка должна жить до tetris_trace_export().
+ */
+void tetris_trace_begin(const char *name) { traceBegin(name); }
+
+/**
+ * @brief Отмечает конец отрезка, начатого tetris_trace_begin().
+ * @param name Имя отрезка.
+ */
+void tetris_trace_end(const char *name) { traceEnd(name); }
+
+/**
+ * @brief Даёт вызывающему потоку имя в трассировке. Действует, только если
+ * трассировка уже включена.
+ * @param name Имя; строка должна жить до tetris_trace_export().
+ */
+void tetris_trace_thread(const char *name) { traceThread(name); }
+
+/**
+ * @brief Выгружает последние отметки всех потоков (до 32768 на поток) в
+ * файл JSON формата Chrome Trace Event для chrome://tracing или Perfetto.
+ * Движок отмечает ввод (input), гравитацию (gravity), фиксацию и снятие
+ * линий (lock) и появление фигуры (spawn).
+ * @param path Файл (перезаписывается).
+ * @return 0 при успехе, -1 при ошибке (errno сохраняется).
+ */
+int tetris_trace_export(const char *path) { return traceExport(path); }
+
+/**
+ * @brief Создаёт буфер снимков.
+ * @return Буфер или NULL при нехватке памяти.
+ */
+tetris_snapbuf_t *tetris_snapbuf_create(void) { return snapCreate(); }
+
+/**
+ * @brief Публикует снимок экземпляра игры. Вызывается потоком, который ведёт
+ * этот экземпляр; не ждёт читателя.
+ * @param buf Буфер снимков.
+ * @param engine Экземпляр игры.
+ */
+void tetris_publish(tetris_snapbuf_t *buf, const tetris_engine_t *engine) {
+  snapPublish(buf, engine);
+}
+
+/**
+ * @brief Возвращает последний опубликованный снимок. Вызывается одним
+ * потоком-читателем; не ждёт писателя.
+ * @param buf Буфер снимков.
+ * @return Снимок; не меняется до следующего вызова tetris_snapshot().
+ */
+const tetris_snapshot_t *tetris_snapshot(tetris_snapbuf_t *buf) {
+  return snapRead(buf);
+}
+
+/**
+ * @brief Освобождает буфер снимков.
+ * @param buf Буфер (NULL допустим).
+ */
+void tetris_snapbuf_destroy(tetris_snapbuf_t *buf) { snapDestroy(buf); }
+
+/**
+ * @brief Создаёт пустую очередь действий игрока.
+ * @return Очередь или NULL при нехватке памяти.
+ */
+tetris_inputq_t *tetris_inputq_create(void) { return inputCreate(); }
+
+/**
+ * @brief Кладёт действие в очередь. Вызывается только потоком-писателем.
+ * @param q Очередь.
+ * @param action Действие.
+ * @param stamp Метка времени действия.
+ * @return 1 — положено, 0 — очередь полна (не забрано 256 действий) и
+ * действие потеряно.
+ */
+int tetris_inputq_push(tetris_inputq_t *q, UserAction_t action,
+                       unsigned long long stamp) {
+  return inputPush(q, action, stamp);
+}
+
+/**
+ * @brief Забирает самое старое действие. Вызывается только потоком-читателем.
+ * @param q Очередь.
+ * @param out Действие с меткой времени (заполняется).
+ * @return 1, если действие было, иначе 0.
+ */
+int tetris_inputq_pop(tetris_inputq_t *q, tetris_input_t *out) {
+  return inputPop(q, out);
+}
+
+/**
+ * @brief Освобождает очередь.
+ * @param q Очередь (NULL допустим).
+ */
+void tetris_inputq_destroy(tetris_inputq_t *q) { inputDestroy(q); }
+
+/**
+ * @brief Создаёт пул экземпляров игры.
+ * @param chunk Минимальное число экземпляров, выделяемых за раз (0 — 64).
+ * @return Пул или NULL при нехватке памяти.
+ */
+tetris_pool_t *tetris_pool_create(size_t chunk) { return poolCreate(chunk); }
+
+/**
+ * @brief Выдаёт из пула новый экземпляр игры.
+ * Вернуть экземпляр в пул можно через tetris_destroy().
+ * @param pool Пул.
+ * @param config Параметры экземпляра (NULL — как в tetris_create()).
+ * @return Экземпляр игры или NULL при нехватке памяти.
+ */
+tetris_engine_t *tetris_pool_acquire(tetris_pool_t *pool,
+                                     const tetris_config_t *config) {
+  return poolAcquire(pool, config);
+}
+
+/**
+ * @brief Освобождает пул вместе со всеми выданными из него экземплярами.
+ * @param pool Пул (NULL допустим).
+ */
+void tetris_pool_destroy(tetris_pool_t *pool) { poolDestroy(pool); }
+
+/**
+ * @brief Создаёт автоигрока.
+ * @param threads Число рабочих потоков поиска (0 — считать в вызывающем
+ * потоке).
+ * @return Автоигрок или NULL при нехватке памяти.
+ */
+tetris_ai_t *tetris_ai_create(int threads) { return aiCreate(threads); }
+
+/**
+ * @brief Возвращает следующее действие автоигрока для экземпляра игры.
+ * Действие нужно применить к тому же экземпляру (tetris_step() или
+ * userInput() для экземпляра по умолчанию).
+ * @param ai Автоигрок.
+ * @param engine Экземпляр игры.
+ * @return Действие пользователя.
+ */
+UserAction_t tetris_ai_action(tetris_ai_t *ai, const tetris_engine_t *engine) {
+  return aiAction(ai, engine);
+}
+
+/**
+ * @brief Останавливает потоки автоигрока и освобождает его.
+ * @param ai Автоигрок (NULL допустим).
+ */
+void tetris_ai_destroy(tetris_ai_t *ai) { aiDestroy(ai); }
+
+/**
+ * @brief Создаёт пакет из count полей.
+ * @param count Число полей.
+ * @param config Зерно и способ выбора фигур: поле k получает зерно seed + k
+ * (NULL — зерно от текущего времени).
+ * @return Пакет или NULL при нехватке памяти.
+ */
+tetris_batch_t *tetris_batch_create(int count, const tetris_config_t *config) {
+  return batchCreate(count, config);
+}
+
+/**
+ * @brief Делает один ход на всех полях пакета: действие и тик гравитации.
+ * @param batch Пакет.
+ * @param actions Действия, по одному на поле.
+ * @param rewards Очки за ход по полям (NULL — не нужны).
+ * @param done 1 для полей, где партия закончилась (NULL — не нужно).
+ */
+void tetris_batch_step(tetris_batch_t *batch, const UserAction_t *actions,
+                       int *rewards, unsigned char *done) {
+  batchStep(batch, actions, rewards, done);
+}
+
+/**
+ * @brief Освобождает пакет.
+ * @param batch Пакет (NULL допустим).
+ */
+void tetris_batch_destroy(tetris_batch_t *batch) { batchDestroy(batch); }
@@ -7,6 +7,35 @@
 #define GAME_H
 
 #include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @brief Версия двоичного интерфейса libtetris. Растёт при любом
+ * несовместимом изменении структур и функций этого заголовка; совпадает с
+ * номером в имени разделяемой библиотеки (libtetris.so.1).
+ */
+#define TETRIS_ABI_VERSION 1
+
+/// @brief Размеры поля и буфера следующей фигуры в наблюдении.
+#define TETRIS_FIELD_WIDTH 10
+#define TETRIS_FIELD_HEIGHT 20
+#define TETRIS_NEXT_SIZE 4
+
+/// @brief Сколько линий может снять одна фиксация фигуры.
+#define TETRIS_MAX_LINES 4
+
+/// @brief Размер снимка партии tetris_core_t в байтах.
+#define TETRIS_CORE_SIZE 128
+
+/**
+ * @brief Функции, экспортируемые из libtetris. Библиотека собирается со
+ * скрытыми по умолчанию символами, наружу видно только то, что помечено.
+ */
+#if defined(__GNUC__)
+#define TETRIS_API __attribute__((visibility("default")))
+#else
+#define TETRIS_API
+#endif
 
 /**
  * @brief Возможные действия пользователя в игре.
@@ -38,8 +67,282 @@ typedef struct {
   int pause;
 } GameInfo_t;
 
-void userInput(UserAction_t action, bool hold);
+/**
+ * @brief Способ выбора очередной фигуры.
+ * TETRIS_RANDOM_UNIFORM — каждая фигура независимо и равновероятно,
+ * TETRIS_RANDOM_BAG7 — «мешок»: все семь фигур в случайном порядке, затем
+ * следующий мешок.
+ */
+typedef enum { TETRIS_RANDOM_UNIFORM, TETRIS_RANDOM_BAG7 } tetris_randomizer_t;
+
+/**
+ * @brief Параметры создания экземпляра игры.
+ * Одинаковые seed и randomizer дают одинаковую последовательность фигур.
+ * record_path — файл рекордов: NULL — record.txt в текущем каталоге, пустая
+ * строка — рекорды не сохраняются. Строка должна жить, пока жив экземпляр.
+ */
+typedef struct {
+  unsigned long long seed;
+  tetris_randomizer_t randomizer;
+  const char *record_path;
+} tetris_config_t;
+
+/**
+ * @brief Наблюдение: снимок экземпляра игры, который tetris_observe()
+ * записывает в буфер вызывающего. В отличие от GameInfo_t, в нём нет
+ * указателей на внутренние данные экземпляра, и после записи его можно читать
+ * из любого потока, пока экземпляр продолжает играть.
+ * field и next — цвета клеток (0 — пусто, 1..7 — цвет), падающая фигура
+ * входит в field. piece и next_piece — номера текущей и следующей фигур
+ * (0..6: I, J, L, O, S, T, Z). pause — как в GameInfo_t: 0 — игра, 1 —
+ * пауза, 2 — конец игры. pieces — сколько фигур зафиксировано с начала
+ * партии.
+ */
+typedef struct {
+  unsigned char field[TETRIS_FIELD_HEIGHT][TETRIS_FIELD_WIDTH];
+  unsigned char next[TETRIS_NEXT_SIZE][TETRIS_NEXT_SIZE];
+  int piece;
+  int next_piece;
+  int score;
+  int high_score;
+  int level;
+  int speed;
+  int pause;
+  int pieces;
+} tetris_observation_t;
+
+/**
+ * @brief Снимок, опубликованный через буфер снимков: наблюдение и его
+ * версия. Версии идут подряд с 1, версия 0 — ещё ничего не опубликовано.
+ *
+ * field_version растёт при каждом изменении цветов поля экземпляра, а
+ * row_version[y] — значение field_version, при котором строка y менялась
+ * последний раз. Строки, у которых row_version больше field_version уже
+ * нарисованного снимка, с тех пор поменялись (возможно, через несколько
+ * пропущенных снимков); остальные строки совпадают с нарисованными.
+ * Снимки выделяет библиотека, поэтому поля в конец структуры добавляются
+ * без смены TETRIS_ABI_VERSION.
+ */
+typedef struct {
+  unsigned long long version;
+  tetris_observation_t obs;
+  unsigned long long field_version;
+  unsigned long long row_version[TETRIS_FIELD_HEIGHT];
+} tetris_snapshot_t;
+
+/**
+ * @brief Снимок партии для tetris_save()/tetris_restore(): всё, от чего
+ * зависит дальнейшая игра (поле, фигуры, счёт, уровень, скорость, состояние
+ * генератора). Содержимое непрозрачно, указателей в нём нет: снимок можно
+ * копировать memcpy, хранить в массивах и восстанавливать в любой экземпляр
+ * той же версии библиотеки.
+ */
+typedef struct {
+  _Alignas(8) unsigned char bytes[TETRIS_CORE_SIZE];
+} tetris_core_t;
+
+/**
+ * @brief Действие игрока с меткой времени, например момента нажатия клавиши
+ * (единицы выбирает тот, кто кладёт действие в очередь).
+ */
+typedef struct {
+  UserAction_t action;
+  unsigned long long stamp;
+} tetris_input_t;
+
+/**
+ * @brief Очередь действий игрока от одного потока (например, чтения
+ * клавиатуры) к одному потоку, который ведёт игру. Ни запись, ни чтение не
+ * блокируются; действия забираются в том порядке, в каком положены.
+ */
+typedef struct InputRing tetris_inputq_t;
+
+/**
+ * @brief Буфер снимков (тройной буфер) между одним потоком, который ведёт
+ * игру и публикует снимки, и одним потоком, который их читает (например,
+ * рисует). Ни публикация, ни чтение не блокируются.
+ */
+typedef struct SnapBuffer tetris_snapbuf_t;
+
+/**
+ * @brief Таблица транспозиций: кэш значений по хешу позиции (tetris_hash())
+ * фиксированного размера. Несколько потоков могут читать и писать одну
+ * таблицу одновременно без блокировок.
+ */
+typedef struct TTable tetris_tt_t;
+
+/**
+ * @brief Запись повтора: действия партии с номерами тактов и контрольными
+ * суммами состояния в компактном двоичном файле.
+ */
+typedef struct ReplayWriter tetris_recorder_t;
+
+/**
+ * @brief Проигрыватель повтора с переходом к любому такту через ключевые
+ * кадры; ведёт собственный экземпляр игры.
+ */
+typedef struct ReplayPlayer tetris_player_t;
+
+/**
+ * @brief Итог проигрывания повтора tetris_replay(): сколько событий
+ * проиграно, такт последнего из них, номер первого события, после которого
+ * состояние разошлось с записанным (-1 — не разошлось), счёт и число фигур в
+ * конце.
+ */
+typedef struct {
+  long events;
+  unsigned long long ticks;
+  long mismatch;
+  int score;
+  int pieces;
+} tetris_replay_t;
+
+/// @brief Корзин в гистограмме задержек и видов действий в tetris_stats_t.
+#define TETRIS_STATS_BUCKETS 304
+#define TETRIS_STATS_ACTIONS 8
+
+/**
+ * @brief Задержки одного вида действий: число вызовов, суммарное и
+ * наибольшее время в наносекундах и гистограмма. Корзина k < 8 — ровно k нс;
+ * дальше каждая октава [2^e, 2^(e+1)) делится на 8 равных корзин, так что
+ * корзина не шире 1/8 своих значений. Времена от 2^40 нс — в последней
+ * корзине. Квантили считает tetris_stats_percentile().
+ */
+typedef struct {
+  unsigned long long count;
+  unsigned long long total_ns;
+  unsigned long long max_ns;
+  unsigned long long buckets[TETRIS_STATS_BUCKETS];
+} tetris_latency_t;
+
+/**
+ * @brief Статистика движка, сложенная по всем потокам: задержки действий по
+ * видам (индекс — UserAction_t), число фиксаций фигур по числу снятых ими
+ * линий (lines[0] — ни одной), появления фигур и сколько из них не
+ * поместились, повороты и сколько из них отверг isPossbl, и число потоков,
+ * которые что-то записали.
+ */
+typedef struct {
+  tetris_latency_t actions[TETRIS_STATS_ACTIONS];
+  unsigned long long lines[TETRIS_MAX_LINES + 1];
+  unsigned long long spawns;
+  unsigned long long spawn_fails;
+  unsigned long long rotations;
+  unsigned long long rotate_rejects;
+  int threads;
+} tetris_stats_t;
+
+/**
+ * @brief Непрозрачный дескриптор отдельного экземпляра игры.
+ * Экземпляры полностью независимы, их можно создавать сколько угодно.
+ */
+typedef struct GameParams tetris_engine_t;
+
+/**
+ * @brief Пул экземпляров игры: выдаёт и переиспользует их пачками.
+ * Пул не потокобезопасен, каждому потоку нужен свой.
+ */
+typedef struct EnginePool tetris_pool_t;
+
+/**
+ * @brief Автоигрок: выбирает ходы лучевым поиском по текущей и следующей
+ * фигуре. Один автоигрок может вести одну партию за раз.
+ */
+typedef struct AiPlayer tetris_ai_t;
+
+/**
+ * @brief Пакет из K полей, которые делают ход одновременно (для массовых
+ * прогонов, например обучения с подкреплением). Поля хранятся структурой
+ * массивов, закончившиеся партии сразу начинаются заново.
+ */
+typedef struct BatchEnv tetris_batch_t;
+
+TETRIS_API void userInput(UserAction_t action, bool hold);
+
+TETRIS_API GameInfo_t updateCurrentState();
+
+TETRIS_API tetris_engine_t *tetris_create(const tetris_config_t *config);
+TETRIS_API void tetris_step(tetris_engine_t *engine, UserAction_t action);
+TETRIS_API int tetris_step_hold(tetris_engine_t *engine, UserAction_t action,
+                                bool hold);
+TETRIS_API int tetris_advance(tetris_engine_t *engine, int ms,
+                              UserAction_t *action);
+TETRIS_API void tetris_set_repeat(tetris_engine_t *engine, int das, int arr,
+                                  int sdr);
+TETRIS_API GameInfo_t tetris_state(const tetris_engine_t *engine);
+TETRIS_API void tetris_destroy(tetris_engine_t *engine);
+TETRIS_API int tetris_observe(const tetris_engine_t *engine,
+                              tetris_observation_t *out);
+TETRIS_API int tetris_abi_version(void);
+TETRIS_API void tetris_save(const tetris_engine_t *engine, tetris_core_t *out);
+TETRIS_API void tetris_restore(tetris_engine_t *engine,
+                               const tetris_core_t *core);
+TETRIS_API unsigned long long tetris_hash(const tetris_engine_t *engine);
+
+TETRIS_API tetris_tt_t *tetris_tt_create(size_t bytes);
+TETRIS_API int tetris_tt_probe(tetris_tt_t *tt, unsigned long long key,
+                               unsigned long long *data);
+TETRIS_API void tetris_tt_store(tetris_tt_t *tt, unsigned long long key,
+                                unsigned long long data);
+TETRIS_API void tetris_tt_clear(tetris_tt_t *tt);
+TETRIS_API void tetris_tt_destroy(tetris_tt_t *tt);
+
+TETRIS_API tetris_recorder_t *tetris_record_open(
+    const char *path, const tetris_engine_t *engine);
+TETRIS_API void tetris_record(tetris_recorder_t *rec,
+                              const tetris_engine_t *engine,
+                              unsigned long long tick, UserAction_t action);
+TETRIS_API int tetris_record_close(tetris_recorder_t *rec);
+TETRIS_API int tetris_replay(const char *path, tetris_replay_t *out);
+TETRIS_API tetris_player_t *tetris_player_open(const char *path);
+TETRIS_API int tetris_player_seek(tetris_player_t *player,
+                                  unsigned long long tick);
+TETRIS_API const tetris_engine_t *tetris_player_engine(
+    const tetris_player_t *player);
+TETRIS_API void tetris_player_close(tetris_player_t *player);
+
+TETRIS_API tetris_engine_t *tetris_default_engine(void);
+
+TETRIS_API void tetris_stats_enable(bool on);
+TETRIS_API void tetris_stats_read(tetris_stats_t *out);
+TETRIS_API void tetris_stats_reset(void);
+TETRIS_API unsigned long long tetris_stats_percentile(
+    const tetris_latency_t *lat, double q);
+TETRIS_API int tetris_stats_dump(const char *path);
+
+TETRIS_API void tetris_trace_enable(bool on);
+TETRIS_API void tetris_trace_begin(const char *name);
+TETRIS_API void tetris_trace_end(const char *name);
+TETRIS_API void tetris_trace_thread(const char *name);
+TETRIS_API int tetris_trace_export(const char *path);
+
+TETRIS_API tetris_snapbuf_t *tetris_snapbuf_create(void);
+TETRIS_API void tetris_publish(tetris_snapbuf_t *buf,
+                               const tetris_engine_t *engine);
+TETRIS_API const tetris_snapshot_t *tetris_snapshot(tetris_snapbuf_t *buf);
+TETRIS_API void tetris_snapbuf_destroy(tetris_snapbuf_t *buf);
+
+TETRIS_API tetris_inputq_t *tetris_inputq_create(void);
+TETRIS_API int tetris_inputq_push(tetris_inputq_t *q, UserAction_t action,
+                                  unsigned long long stamp);
+TETRIS_API int tetris_inputq_pop(tetris_inputq_t *q, tetris_input_t *out);
+TETRIS_API void tetris_inputq_destroy(tetris_inputq_t *q);
+
+TETRIS_API tetris_pool_t *tetris_pool_create(size_t chunk);
+TETRIS_API tetris_engine_t *tetris_pool_acquire(tetris_pool_t *pool,
+                                                const tetris_config_t *config);
+TETRIS_API void tetris_pool_destroy(tetris_pool_t *pool);
+
+TETRIS_API tetris_ai_t *tetris_ai_create(int threads);
+TETRIS_API UserAction_t tetris_ai_action(tetris_ai_t *ai,
+                                         const tetris_engine_t *engine);
+TETRIS_API void tetris_ai_destroy(tetris_ai_t *ai);
 
-GameInfo_t updateCurrentState();
+TETRIS_API tetris_batch_t *tetris_batch_create(int count,
+                                               const tetris_config_t *config);
+TETRIS_API void tetris_batch_step(tetris_batch_t *batch,
+                                  const UserAction_t *actions, int *rewards,
+                                  unsigned char *done);
+TETRIS_API void tetris_batch_destroy(tetris_batch_t *batch);
 
 #endif
\ No newline at end of file
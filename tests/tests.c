@@ -1,14 +1,30 @@
 #include <check.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "../layer/game.h"
+#include "../brick_game/tetris/ai.h"
 #include "../brick_game/tetris/back.h"
+#include "../brick_game/tetris/batch.h"
+#include "../brick_game/tetris/input.h"
+#include "../brick_game/tetris/movegen.h"
+#include "../brick_game/tetris/pool.h"
+#include "../brick_game/tetris/record.h"
+#include "../brick_game/tetris/repeat.h"
+#include "../brick_game/tetris/replay.h"
+#include "../brick_game/tetris/snapshot.h"
+#include "../brick_game/tetris/stats.h"
+#include "../brick_game/tetris/trace.h"
+#include "../brick_game/tetris/ttable.h"
+#include "../brick_game/tetris/zobrist.h"
 
 START_TEST(back_setNewShape) {
-  int **shape;
-  int shapes_ref[7][PIECE_SIZE][PIECE_SIZE] = {
+  int shapes_ref[PIECE_COUNT][PIECE_SIZE][PIECE_SIZE] = {
       {{1, 1, 1, 1}, {0, 0, 0, 0}, {0, 0, 0, 0}, {0, 0, 0, 0}},
       {{1, 0, 0, 0}, {1, 1, 1, 0}, {0, 0, 0, 0}, {0, 0, 0, 0}},
       {{0, 0, 1, 0}, {1, 1, 1, 0}, {0, 0, 0, 0}, {0, 0, 0, 0}},
@@ -17,38 +33,29 @@ START_TEST(back_setNewShape) {
       {{0, 1, 0, 0}, {1, 1, 1, 0}, {0, 0, 0, 0}, {0, 0, 0, 0}},
       {{1, 1, 0, 0}, {0, 1, 1, 0}, {0, 0, 0, 0}, {0, 0, 0, 0}}};
 
-  shape = calloc(PIECE_SIZE, sizeof(int *));
-  ck_assert_ptr_nonnull(shape);
-
-  for (int i = 0; i < PIECE_SIZE; i++) {
-    shape[i] = calloc(PIECE_SIZE, sizeof(int));
-    ck_assert_ptr_nonnull(shape[i]);
-  }
-
-  setNewShape(shape);
+  GameParams_t *p = getParams();
+  ck_assert_ptr_nonnull(p);
 
-  int eq = 1;
-  int matched = 0;
-  for (int s = 0; s < 7 && !matched; s++) {
-    for (int i = 0; i < PIECE_SIZE && eq; i++) {
-      for (int j = 0; j < PIECE_SIZE && eq; j++) {
-        if (shape[i][j] != shapes_ref[s][i][j]) {
-          eq = 0;
-        }
+  for (int s = 0; s < PIECE_COUNT; s++) {
+    fillShape(p->data->next, s, 0);
+    for (int i = 0; i < PIECE_SIZE; i++) {
+      for (int j = 0; j < PIECE_SIZE; j++) {
+        ck_assert_int_eq(p->data->next[i][j], shapes_ref[s][i][j]);
       }
     }
-    if (eq) {
-      matched = 1;
-    } else {
-      eq = 1;
-    }
   }
-  ck_assert_msg(matched, "setNewShape produced an unexpected shape pattern");
 
+  setNewShape(p);
+  ck_assert_int_ge(p->core.next_piece, 0);
+  ck_assert_int_lt(p->core.next_piece, PIECE_COUNT);
   for (int i = 0; i < PIECE_SIZE; i++) {
-    free(shape[i]);
+    for (int j = 0; j < PIECE_SIZE; j++) {
+      ck_assert_int_eq(p->data->next[i][j],
+                       shapes_ref[p->core.next_piece][i][j]);
+    }
   }
-  free(shape);
+
+  freeMemory(p);
 }
 END_TEST
 
@@ -57,33 +64,34 @@ START_TEST(back_setStat) {
   GameInfo_t data;
   params.data = &data;
 
-  params.data->score = 123;
-  params.data->high_score = 456;
-  params.data->level = 7;
-  params.data->speed = 2000;
-  params.data->pause = 2;
+  params.core.score = 123;
+  params.core.high_score = 456;
+  params.core.level = 7;
+  params.core.speed = 2000;
+  params.core.pause = 2;
 
   setStat(&params);
 
-  ck_assert_int_eq(params.data->score, 0);
-  ck_assert_int_eq(params.data->high_score, 0);
-  ck_assert_int_eq(params.data->level, 1);
-  ck_assert_int_eq(params.data->speed, 1000);
-  ck_assert_int_eq(params.data->pause, 0);
+  ck_assert_int_eq(params.core.score, 0);
+  ck_assert_int_eq(params.core.high_score, 0);
+  ck_assert_int_eq(params.core.level, 1);
+  ck_assert_int_eq(params.core.speed, 1000);
+  ck_assert_int_eq(params.core.pause, 0);
 }
 END_TEST
 
 START_TEST(back_setCurShape) {
-  GameParams_t *p = malloc(sizeof *p);
+  GameParams_t *p = getParams();
   ck_assert_ptr_nonnull(p);
+  p->cur_shape->x = 7;
+  p->cur_shape->y = 12;
+  p->cur_shape->rot = 2;
 
   setCurShape(p);
 
-  ck_assert_ptr_nonnull(p->cur_shape);
-  ck_assert_ptr_nonnull(p->cur_shape->shape);
-  for (int i = 0; i < PIECE_SIZE; i++) {
-    ck_assert_ptr_nonnull(p->cur_shape->shape[i]);
-  }
+  ck_assert_int_ge(p->cur_shape->piece, 0);
+  ck_assert_int_lt(p->cur_shape->piece, PIECE_COUNT);
+  ck_assert_int_eq(p->cur_shape->rot, 0);
 
   ck_assert_int_eq(p->cur_shape->x, 3);
   ck_assert_int_eq(p->cur_shape->y, 0);
@@ -94,6 +102,29 @@ START_TEST(back_setCurShape) {
 }
 END_TEST
 
+START_TEST(back_newParams_layout) {
+  GameParams_t *p = newParams(NULL);
+  ck_assert_ptr_nonnull(p);
+
+  const char *lo = (const char *)p;
+  const char *hi = lo + sizeof(GameBlock_t);
+  ck_assert_int_eq((size_t)lo % CACHE_LINE, 0);
+  ck_assert_int_eq(sizeof(GameBlock_t) % CACHE_LINE, 0);
+
+  const void *inner[] = {p->data,           p->state,
+                         p->cur_shape,      p->data->field,
+                         p->data->next,     p->data->field[FIELD_HEIGHT - 1],
+                         p->data->next[PIECE_SIZE - 1]};
+  for (size_t i = 0; i < sizeof inner / sizeof inner[0]; i++) {
+    ck_assert((const char *)inner[i] >= lo && (const char *)inner[i] < hi);
+  }
+  ck_assert_ptr_null(p->pool);
+  ck_assert_int_eq(*(p->state), STATE_START);
+
+  freeMemory(p);
+}
+END_TEST
+
 START_TEST(back_getParams) {
   const int expected_high = 123;
   FILE *f = fopen("record.txt", "w");
@@ -110,12 +141,12 @@ START_TEST(back_getParams) {
   ck_assert_ptr_eq(p1, p2);
 
   ck_assert_int_eq(*(p1->state), STATE_START);
-  ck_assert_int_eq(p1->data->score, 0);
-  ck_assert_int_eq(p1->data->level, 1);
-  ck_assert_int_eq(p1->data->speed, 1000);
-  ck_assert_int_eq(p1->data->pause, 0);
+  ck_assert_int_eq(p1->core.score, 0);
+  ck_assert_int_eq(p1->core.level, 1);
+  ck_assert_int_eq(p1->core.speed, 1000);
+  ck_assert_int_eq(p1->core.pause, 0);
 
-  ck_assert_int_eq(p1->data->high_score, expected_high);
+  ck_assert_int_eq(p1->core.high_score, expected_high);
 
   ck_assert_int_eq(p1->cur_shape->x, 3);
   ck_assert_int_eq(p1->cur_shape->y, 0);
@@ -124,6 +155,7 @@ START_TEST(back_getParams) {
 
   int rm = remove("record.txt");
   ck_assert_msg(rm == 0, "Failed to remove record.txt");
+  remove("record.txt.lock");
 
   freeMemory(p1);
 }
@@ -144,23 +176,47 @@ START_TEST(back_clearField) {
 }
 END_TEST
 
+START_TEST(back_setCell) {
+  GameParams_t *params = getParams();
+  clearField(params);
+
+  ck_assert_uint_eq(params->core.rows[0], ROW_EMPTY);
+  ck_assert_uint_eq(params->core.rows[FIELD_HEIGHT], ROW_FULL);
+
+  setCell(params, 4, 0, 3);
+  setCell(params, 4, FIELD_WIDTH - 1, 5);
+  ck_assert_int_eq(params->data->field[4][0], 3);
+  ck_assert_uint_eq(params->core.rows[4],
+                    ROW_EMPTY | (1u << ROW_OFFSET) |
+                        (1u << (ROW_OFFSET + FIELD_WIDTH - 1)));
+
+  setCell(params, 4, 0, 0);
+  ck_assert_int_eq(params->data->field[4][0], 0);
+  ck_assert_uint_eq(params->core.rows[4],
+                    ROW_EMPTY | (1u << (ROW_OFFSET + FIELD_WIDTH - 1)));
+
+  for (int x = 0; x < FIELD_WIDTH; ++x) {
+    setCell(params, 7, x, 1);
+  }
+  ck_assert_uint_eq(params->core.rows[7], ROW_FULL);
+
+  freeMemory(params);
+}
+END_TEST
+
 START_TEST(back_clearShape) {
   GameParams_t *params = getParams();
 
   for (int i = 0; i < FIELD_HEIGHT; i++) {
     for (int j = 0; j < FIELD_WIDTH; j++) {
-      params->data->field[i][j] = 9;
+      setCell(params, i, j, 9);
     }
   }
 
-  int shape_[4][4] = {{1, 0, 0, 0}, {1, 0, 0, 0}, {1, 1, 0, 0}, {0, 0, 0, 0}};
-
-  for (int i = 0; i < 4; i++) {
-    for (int j = 0; j < 4; j++) {
-      params->cur_shape->shape[i][j] = shape_[i][j];
-    }
-  }
-  params->cur_shape->x = 3;
+  /* .#.. / .#.. / .##. */
+  params->cur_shape->piece = PIECE_L;
+  params->cur_shape->rot = 3;
+  params->cur_shape->x = 2;
   params->cur_shape->y = 5;
 
   clearShape(params);
@@ -182,14 +238,10 @@ END_TEST
 
 START_TEST(back_placeShape) {
   GameParams_t *params = getParams();
-  int shape_[4][4] = {{1, 1, 0, 0}, {1, 1, 0, 0}, {0, 0, 0, 0}, {0, 0, 0, 0}};
-
-  for (int i = 0; i < 4; i++) {
-    for (int j = 0; j < 4; j++) {
-      params->cur_shape->shape[i][j] = shape_[i][j];
-    }
-  }
-  params->cur_shape->x = 4;
+  /* .##. / .##. */
+  params->cur_shape->piece = PIECE_O;
+  params->cur_shape->rot = 0;
+  params->cur_shape->x = 3;
   params->cur_shape->y = 6;
   params->cur_shape->color = 5;
 
@@ -210,201 +262,130 @@ START_TEST(back_placeShape) {
 }
 END_TEST
 
-START_TEST(back_cntEmptyColsL) {
-  GameParams_t *params = getParams();
-
-  for (int i = 0; i < 4; i++) {
-    for (int j = 0; j < 4; j++) {
-      params->cur_shape->shape[i][j] = 0;
+START_TEST(back_pieceTable) {
+  for (int p = 0; p < PIECE_COUNT; p++) {
+    for (int r = 0; r < ROT_COUNT; r++) {
+      const PieceGeom_t *g = &pieceTable[p][r];
+      int left = PIECE_SIZE, right = -1, top = PIECE_SIZE, bottom = -1;
+      int cells = 0;
+      for (int i = 0; i < PIECE_SIZE; i++) {
+        for (int j = 0; j < PIECE_SIZE; j++) {
+          if (g->rows[i] & (1u << j)) {
+            cells++;
+            left = j < left ? j : left;
+            right = j > right ? j : right;
+            top = i < top ? i : top;
+            bottom = i > bottom ? i : bottom;
+          }
+        }
+      }
+      ck_assert_int_eq(cells, 4);
+      ck_assert_int_eq(g->left, left);
+      ck_assert_int_eq(g->right, right);
+      ck_assert_int_eq(g->top, top);
+      ck_assert_int_eq(g->bottom, bottom);
+      ck_assert_int_ge(g->next, 0);
+      ck_assert_int_lt(g->next, ROT_COUNT);
     }
   }
-
-  ck_assert_int_eq(cntEmptyColsL(params->cur_shape->shape), PIECE_SIZE);
-
-  params->cur_shape->shape[1][0] = 1;
-  ck_assert_int_eq(cntEmptyColsL(params->cur_shape->shape), 0);
-
-  params->cur_shape->shape[1][0] = 0;
-  params->cur_shape->shape[0][1] = 2;
-  ck_assert_int_eq(cntEmptyColsL(params->cur_shape->shape), 1);
-
-  params->cur_shape->shape[0][1] = 0;
-  params->cur_shape->shape[3][2] = 3;
-  ck_assert_int_eq(cntEmptyColsL(params->cur_shape->shape), 2);
-
-  freeMemory(params);
 }
 END_TEST
 
-START_TEST(back_cntEmptyColsR) {
-  GameParams_t *params = getParams();
+/* Прежний поворот: транспонирование 4x4 и сдвиг вверх (палка — в столбец 1).
+ */
+static void legacyRotate(int src[PIECE_SIZE][PIECE_SIZE],
+                         int dst[PIECE_SIZE][PIECE_SIZE]) {
+  int tmp[PIECE_SIZE][PIECE_SIZE];
+  int vertical = 0;
 
-  for (int i = 0; i < 4; i++) {
-    for (int j = 0; j < 4; j++) {
-      params->cur_shape->shape[i][j] = 0;
+  for (int i = 0; i < PIECE_SIZE; ++i) {
+    for (int j = 0; j < PIECE_SIZE; ++j) {
+      tmp[PIECE_SIZE - 1 - j][i] = src[i][j];
     }
   }
-
-  ck_assert_int_eq(cntEmptyColsR(params->cur_shape->shape), PIECE_SIZE);
-
-  params->cur_shape->shape[2][3] = 1;
-  ck_assert_int_eq(cntEmptyColsR(params->cur_shape->shape), 0);
-
-  params->cur_shape->shape[2][3] = 0;
-  params->cur_shape->shape[0][2] = 2;
-  ck_assert_int_eq(cntEmptyColsR(params->cur_shape->shape), 1);
-
-  params->cur_shape->shape[0][2] = 0;
-  params->cur_shape->shape[3][1] = 3;
-  ck_assert_int_eq(cntEmptyColsR(params->cur_shape->shape), 2);
-
-  freeMemory(params);
-}
-END_TEST
-
-START_TEST(back_height) {
-  GameParams_t *params = getParams();
-
-  for (int i = 0; i < 4; i++) {
-    for (int j = 0; j < 4; j++) {
-      params->cur_shape->shape[i][j] = 0;
+  for (int x = 0; x < PIECE_SIZE; ++x) {
+    int cnt = 0;
+    for (int i = 0; i < PIECE_SIZE; ++i) {
+      cnt += tmp[i][x] != 0;
     }
+    vertical |= cnt == PIECE_SIZE;
   }
-
-  ck_assert_int_eq(height(params->cur_shape->shape), 0);
-
-  params->cur_shape->shape[0][0] = 1;
-  ck_assert_int_eq(height(params->cur_shape->shape), 1);
-
-  params->cur_shape->shape[1][1] = 2;
-  ck_assert_int_eq(height(params->cur_shape->shape), 2);
-
-  params->cur_shape->shape[0][0] = 0;
-  params->cur_shape->shape[1][1] = 0;
-  params->cur_shape->shape[PIECE_SIZE - 1][0] = 3;
-  ck_assert_int_eq(height(params->cur_shape->shape), 1);
-
-  params->cur_shape->shape[PIECE_SIZE - 1][0] = 0;
-  params->cur_shape->shape[1][1] = 1;
-  params->cur_shape->shape[2][2] = 1;
-  params->cur_shape->shape[3][3] = 1;
-  ck_assert_int_eq(height(params->cur_shape->shape), 3);
-
-  params->cur_shape->shape[0][0] = 1;
-  ck_assert_int_eq(height(params->cur_shape->shape), 4);
-
-  freeMemory(params);
-}
-END_TEST
-
-START_TEST(back_isPossbl) {
-  GameParams_t *params = getParams();
-
-  for (int i = 0; i < 4; i++) {
-    for (int j = 0; j < 4; j++) {
-      params->cur_shape->shape[i][j] = 0;
+  for (int i = 0; i < PIECE_SIZE; ++i) {
+    for (int j = 0; j < PIECE_SIZE; ++j) {
+      if (vertical) {
+        dst[i][j] = j == 1;
+      } else {
+        dst[i][j] = i == PIECE_SIZE - 1 ? 0 : tmp[i + 1][j];
+      }
     }
   }
-
-  params->cur_shape->shape[0][0] = 1;
-  params->cur_shape->x = 3;
-  params->cur_shape->y = 5;
-
-  ck_assert_int_eq(isPossbl(params, params->cur_shape->shape,
-                            params->cur_shape->x, params->cur_shape->y),
-                   1);
-  ck_assert_int_eq(isPossbl(params, params->cur_shape->shape,
-                            params->cur_shape->x, FIELD_HEIGHT),
-                   0);
-  ck_assert_int_eq(isPossbl(params, params->cur_shape->shape, -4, 0), 0);
-  ck_assert_int_eq(isPossbl(params, params->cur_shape->shape, FIELD_WIDTH, 0),
-                   0);
-
-  params->cur_shape->shape[0][0] = params->cur_shape->shape[0][1] =
-      params->cur_shape->shape[1][0] = params->cur_shape->shape[1][1] = 1;
-  params->data->field[3][2] = 9;
-  ck_assert_int_eq(isPossbl(params, params->cur_shape->shape, 2, 3), 0);
-
-  freeMemory(params);
 }
-END_TEST
-
-START_TEST(back_isSquare) {
-  GameParams_t *params = getParams();
 
-  for (int i = 0; i < 4; i++) {
-    for (int j = 0; j < 4; j++) {
-      params->cur_shape->shape[i][j] = 0;
+START_TEST(back_pieceTable_rotations) {
+  for (int p = 0; p < PIECE_COUNT; p++) {
+    if (p == PIECE_O) {
+      ck_assert_int_eq(pieceTable[p][0].next, 0);
+      continue;
     }
-  }
-
-  params->cur_shape->shape[0][1] = 1;
-  params->cur_shape->shape[0][2] = 1;
-  params->cur_shape->shape[1][1] = 1;
-  params->cur_shape->shape[1][2] = 1;
-  ck_assert_int_eq(isSquare(params->cur_shape->shape), 1);
-
-  params->cur_shape->shape[1][2] = 0;
-  ck_assert_int_eq(isSquare(params->cur_shape->shape), 0);
-
-  params->cur_shape->shape[0][1] = 0;
-  params->cur_shape->shape[0][2] = 0;
-  params->cur_shape->shape[1][1] = params->cur_shape->shape[1][2] =
-      params->cur_shape->shape[2][1] = params->cur_shape->shape[2][2] = 1;
-  ck_assert_int_eq(isSquare(params->cur_shape->shape), 0);
-
-  freeMemory(params);
-}
-END_TEST
-
-START_TEST(back_isVertical) {
-  int shape[PIECE_SIZE][PIECE_SIZE];
-  for (int i = 0; i < PIECE_SIZE; i++) {
-    for (int j = 0; j < PIECE_SIZE; j++) {
-      if (j == 0) {
-        shape[i][j] = 1;
-      } else {
-        shape[i][j] = 0;
+    int rot = 0;
+    for (int step = 0; step < 2 * ROT_COUNT; step++) {
+      int cur[PIECE_SIZE][PIECE_SIZE], expected[PIECE_SIZE][PIECE_SIZE];
+      for (int i = 0; i < PIECE_SIZE; i++) {
+        for (int j = 0; j < PIECE_SIZE; j++) {
+          cur[i][j] = (pieceTable[p][rot].rows[i] >> j) & 1;
+        }
+      }
+      legacyRotate(cur, expected);
+      rot = pieceTable[p][rot].next;
+      for (int i = 0; i < PIECE_SIZE; i++) {
+        for (int j = 0; j < PIECE_SIZE; j++) {
+          ck_assert_int_eq((pieceTable[p][rot].rows[i] >> j) & 1,
+                           expected[i][j]);
+        }
       }
     }
   }
+}
+END_TEST
 
-  ck_assert_int_eq(isVertical(shape), 1);
+START_TEST(back_isPossbl) {
+  GameParams_t *params = getParams();
 
-  for (int i = 0; i < PIECE_SIZE; i++) {
-    for (int j = 0; j < PIECE_SIZE; j++) {
-      shape[i][j] = 0;
-    }
+  /* .##. / .##. */
+  ck_assert_int_eq(isPossbl(params, PIECE_O, 0, 3, 5), 1);
+  ck_assert_int_eq(isPossbl(params, PIECE_O, 0, 3, FIELD_HEIGHT - 2), 1);
+  ck_assert_int_eq(isPossbl(params, PIECE_O, 0, 3, FIELD_HEIGHT - 1), 0);
+  ck_assert_int_eq(isPossbl(params, PIECE_O, 0, -1, 0), 1);
+  ck_assert_int_eq(isPossbl(params, PIECE_O, 0, -2, 0), 0);
+  ck_assert_int_eq(isPossbl(params, PIECE_O, 0, FIELD_WIDTH - 3, 0), 1);
+  ck_assert_int_eq(isPossbl(params, PIECE_O, 0, FIELD_WIDTH - 2, 0), 0);
+  ck_assert_int_eq(isPossbl(params, PIECE_I, 0, -4, 0), 0);
+  ck_assert_int_eq(isPossbl(params, PIECE_I, 0, FIELD_WIDTH, 0), 0);
+
+  setCell(params, 3, 2, 9);
+  ck_assert_int_eq(isPossbl(params, PIECE_O, 0, 1, 3), 0);
+  ck_assert_int_eq(isPossbl(params, PIECE_O, 0, 1, 2), 0);
+  ck_assert_int_eq(isPossbl(params, PIECE_O, 0, 1, 4), 1);
+  ck_assert_int_eq(isPossbl(params, PIECE_O, 0, 2, 3), 1);
+
+  uint16_t rows[FIELD_HEIGHT + PIECE_SIZE];
+  for (int y = 0; y < FIELD_HEIGHT + PIECE_SIZE; ++y) {
+    rows[y] = y < FIELD_HEIGHT - 1 ? ROW_EMPTY : ROW_FULL;
   }
-  for (int j = 0; j < PIECE_SIZE; j++) {
-    shape[0][j] = 1;
-  }
-  ck_assert_int_eq(isVertical(shape), 0);
+  ck_assert_int_eq(fitsBoard(rows, PIECE_O, 0, 3, FIELD_HEIGHT - 3), 1);
+  ck_assert_int_eq(fitsBoard(rows, PIECE_O, 0, 3, FIELD_HEIGHT - 2), 0);
+  ck_assert_int_eq(fitsBoard(params->core.rows, PIECE_O, 0, 1, 3), 0);
 
-  for (int i = 0; i < PIECE_SIZE; i++) {
-    for (int j = 0; j < PIECE_SIZE; j++) {
-      shape[i][j] = 0;
-    }
-  }
-  shape[0][0] = shape[1][0] = 1;
-  shape[2][1] = shape[3][1] = 1;
-  ck_assert_int_eq(isVertical(shape), 0);
+  freeMemory(params);
 }
 END_TEST
 
 START_TEST(back_rotate) {
   GameParams_t *params = getParams();
+  clearField(params);
 
-  for (int i = 0; i < 4; i++) {
-    for (int j = 0; j < 4; j++) {
-      if (i == 0) {
-        params->cur_shape->shape[i][j] = 1;
-      } else {
-        params->cur_shape->shape[i][j] = 0;
-      }
-    }
-  }
-
+  params->cur_shape->piece = PIECE_I;
+  params->cur_shape->rot = 0;
   params->cur_shape->x = 0;
   params->cur_shape->y = 0;
   params->cur_shape->color = 1;
@@ -412,16 +393,36 @@ START_TEST(back_rotate) {
   placeShape(params);
   rotate(params);
 
+  ck_assert_int_eq(params->cur_shape->rot, 1);
   for (int i = 0; i < PIECE_SIZE; i++) {
     for (int j = 0; j < PIECE_SIZE; j++) {
       int expected_cell = (j == 1) ? 1 : 0;
-      ck_assert_int_eq(params->cur_shape->shape[i][j], expected_cell);
       ck_assert_int_eq(params->data->field[params->cur_shape->y + i]
                                           [params->cur_shape->x + j],
                        expected_cell * params->cur_shape->color);
     }
   }
 
+  rotate(params);
+  ck_assert_int_eq(params->cur_shape->rot, 2);
+  rotate(params);
+  ck_assert_int_eq(params->cur_shape->rot, 1);
+
+  /* упор в стену: горизонтальная палка в столбцах -1..2 не помещается */
+  clearShape(params);
+  params->cur_shape->x = -1;
+  placeShape(params);
+  rotate(params);
+  ck_assert_int_eq(params->cur_shape->rot, 1);
+  clearShape(params);
+
+  params->cur_shape->piece = PIECE_O;
+  params->cur_shape->rot = 0;
+  params->cur_shape->x = 3;
+  placeShape(params);
+  rotate(params);
+  ck_assert_int_eq(params->cur_shape->rot, 0);
+
   freeMemory(params);
 }
 END_TEST
@@ -432,8 +433,8 @@ START_TEST(back_hasCollisBellow) {
 
   ck_assert_int_eq(hasCollisBellow(p), 0);
 
-  p->data->field[1][4] = 1;
-  p->data->field[2][4] = 1;
+  setCell(p, 1, 4, 1);
+  setCell(p, 2, 4, 1);
   ck_assert_int_eq(hasCollisBellow(p), 1);
 
   p->cur_shape->y = FIELD_HEIGHT - 1;
@@ -443,24 +444,82 @@ START_TEST(back_hasCollisBellow) {
 }
 END_TEST
 
+START_TEST(back_ghostY) {
+  GameParams_t *p = getParams();
+  clearField(p);
+  p->cur_shape->piece = PIECE_T;
+  p->cur_shape->rot = 0;
+  p->cur_shape->x = 3;
+  p->cur_shape->y = 0;
+
+  /* .#. / ### над пустым полем */
+  ck_assert_int_eq(ghostY(p), FIELD_HEIGHT - 2);
+
+  setCell(p, 15, 4, 1);
+  ck_assert_int_eq(p->core.skyline[4], 15);
+  ck_assert_int_eq(ghostY(p), 13);
+  placeShape(p);
+  ck_assert_int_eq(ghostY(p), 13);
+  clearShape(p);
+
+  /* фигура задвинута под навес: спуск идёт построчно */
+  setCell(p, 10, 3, 1);
+  p->cur_shape->y = 11;
+  ck_assert_int_eq(ghostY(p), 13);
+
+  setCell(p, 15, 4, 0);
+  ck_assert_int_eq(p->core.skyline[4], FIELD_HEIGHT);
+  ck_assert_int_eq(p->core.skyline[3], 10);
+
+  freeMemory(p);
+}
+END_TEST
+
+START_TEST(back_skyline) {
+  tetris_config_t cfg = {7, TETRIS_RANDOM_UNIFORM, NULL};
+  tetris_engine_t *e = tetris_create(&cfg);
+  const UserAction_t acts[] = {Left, Right, Action, Up, Down, Left, Left};
+  int8_t top[FIELD_WIDTH];
+
+  tetris_step(e, Start);
+  for (int k = 0; k < 2000 && *e->state == STATE_GAME; ++k) {
+    int ghost = ghostY(e);
+    int y = e->cur_shape->y;
+    clearShape(e);
+    while (!hasCollisBellow(e)) e->cur_shape->y++;
+    ck_assert_int_eq(ghost, e->cur_shape->y);
+    e->cur_shape->y = y;
+    placeShape(e);
+
+    tetris_step(e, acts[k % 7]);
+    if (*e->state != STATE_GAME) break;
+
+    for (int x = 0; x < FIELD_WIDTH; ++x) top[x] = e->core.skyline[x];
+    clearShape(e);
+    updtSkyline(e);
+    for (int x = 0; x < FIELD_WIDTH; ++x) ck_assert_int_eq(top[x], e->core.skyline[x]);
+    placeShape(e);
+  }
+
+  tetris_destroy(e);
+}
+END_TEST
+
 START_TEST(back_spawnNew) {
   GameParams_t *p = getParams();
   clearField(p);
   p->cur_shape->x = 5;
   p->cur_shape->y = 5;
 
-  int testNext[PIECE_SIZE][PIECE_SIZE] = {
-      {1, 1, 1, 0}, {1, 0, 0, 0}, {0, 0, 0, 0}, {0, 0, 0, 0}};
-  for (int i = 0; i < PIECE_SIZE; ++i)
-    for (int j = 0; j < PIECE_SIZE; ++j) p->data->next[i][j] = testNext[i][j];
+  p->cur_shape->rot = 2;
+  p->core.next_piece = PIECE_T;
+  int pieces = p->core.pieces;
 
   spawnNew(p);
+  ck_assert_int_eq(p->core.pieces, pieces + 1);
 
-  for (int i = 0; i < PIECE_SIZE; ++i) {
-    for (int j = 0; j < PIECE_SIZE; ++j) {
-      ck_assert_int_eq(p->cur_shape->shape[i][j], testNext[i][j]);
-    }
-  }
+  ck_assert_int_eq(p->cur_shape->piece, PIECE_T);
+  ck_assert_int_eq(p->cur_shape->rot, 0);
 
   ck_assert_int_eq(p->cur_shape->x, 3);
   ck_assert_int_eq(p->cur_shape->y, 0);
@@ -481,22 +540,22 @@ END_TEST
 START_TEST(back_updtScore) {
   GameParams_t *p = getParams();
 
-  ck_assert_int_eq(p->data->score, 0);
+  ck_assert_int_eq(p->core.score, 0);
 
   updtScore(p, 1);
-  ck_assert_int_eq(p->data->score, 100);
+  ck_assert_int_eq(p->core.score, 100);
 
   updtScore(p, 2);
-  ck_assert_int_eq(p->data->score, 400);
+  ck_assert_int_eq(p->core.score, 400);
 
   updtScore(p, 3);
-  ck_assert_int_eq(p->data->score, 1100);
+  ck_assert_int_eq(p->core.score, 1100);
 
   updtScore(p, 4);
-  ck_assert_int_eq(p->data->score, 2600);
+  ck_assert_int_eq(p->core.score, 2600);
 
   updtScore(p, 5);
-  ck_assert_int_eq(p->data->score, 4100);
+  ck_assert_int_eq(p->core.score, 4100);
 
   freeMemory(p);
 }
@@ -512,9 +571,9 @@ START_TEST(back_updtHighScore) {
   GameParams_t *p = getParams();
   ck_assert_ptr_nonnull(p);
 
-  p->data->score = initial_high - 10;
+  p->core.score = initial_high - 10;
   updtHighScore(p);
-  ck_assert_int_eq(p->data->high_score, initial_high);
+  ck_assert_int_eq(p->core.high_score, initial_high);
 
   f = fopen("record.txt", "r");
   ck_assert_ptr_nonnull(f);
@@ -523,19 +582,1250 @@ START_TEST(back_updtHighScore) {
   fclose(f);
   ck_assert_int_eq(file_val, initial_high);
 
-  p->data->score = initial_high + 20;
+  p->core.score = initial_high + 20;
   updtHighScore(p);
-  ck_assert_int_eq(p->data->high_score, initial_high + 20);
+  ck_assert_int_eq(p->core.high_score, initial_high + 20);
+  ck_assert_int_eq(readHighScore(NULL), initial_high + 20);
+  recordFlush();
   f = fopen("record.txt", "r");
   ck_assert_ptr_nonnull(f);
   fscanf(f, "%d", &file_val);
   fclose(f);
-  ck_assert_int_eq(file_val, p->data->high_score);
+  ck_assert_int_eq(file_val, p->core.high_score);
 
   freeMemory(p);
 
   int rm = remove("record.txt");
   ck_assert_msg(rm == 0, "Failed to remove record.txt");
+  remove("record.txt.lock");
+}
+END_TEST
+
+/// \brief Рекорд, записанный в файле (0 — файла нет).
+static int recordOnDisk(const char *path) {
+  int res = 0;
+  FILE *f = fopen(path, "r");
+
+  if (f) {
+    if (fscanf(f, "%d", &res) != 1) {
+      res = 0;
+    }
+    fclose(f);
+  }
+
+  return res;
+}
+
+START_TEST(back_record) {
+  const char *path = "record_test.txt";
+  FILE *f = fopen(path, "w");
+  ck_assert_ptr_nonnull(f);
+  fprintf(f, "%d\n", 500);
+  fclose(f);
+
+  /* рекорд ниже сохранённого не затирает файл */
+  recordSubmit(path, 300);
+  ck_assert_int_eq(recordRead(path), 500);
+  recordFlush();
+  ck_assert_int_eq(recordRead(path), 500);
+
+  tetris_config_t cfg = {1, TETRIS_RANDOM_UNIFORM, path};
+  tetris_engine_t *e = tetris_create(&cfg);
+  ck_assert_int_eq(e->core.high_score, 500);
+  e->core.score = 700;
+  updtHighScore(e);
+  tetris_step(e, Start);
+  tetris_step(e, Pause);
+
+  /* пауза будит поток записи и не ждёт его: рекорд появляется в файле
+     чуть позже */
+  struct timespec step = {0, 1000000L};
+  for (int i = 0; i < 2000 && recordOnDisk(path) != 700; ++i) {
+    nanosleep(&step, NULL);
+  }
+  ck_assert_int_eq(recordOnDisk(path), 700);
+  tetris_destroy(e);
+  remove(path);
+  remove("record_test.txt.lock");
+
+  /* пустой путь — рекорды не сохраняются */
+  tetris_config_t off = {1, TETRIS_RANDOM_UNIFORM, ""};
+  e = tetris_create(&off);
+  ck_assert_int_eq(e->core.high_score, 0);
+  e->core.score = 100;
+  updtHighScore(e);
+  recordFlush();
+  ck_assert_int_eq(recordRead(""), 0);
+  tetris_destroy(e);
+}
+END_TEST
+
+START_TEST(back_record_shutdown) {
+  const char *path = "record_shutdown.txt";
+  char tmp[64];
+
+  remove(path);
+  recordSubmit(path, 900);
+
+  /* потомок не наследует занятые мьютексы и запускает свой поток записи */
+  pid_t pid = fork();
+  if (pid == 0) {
+    recordSubmit(path, 950);
+    recordShutdown();
+    _exit(recordOnDisk(path) == 950 ? 0 : 1);
+  }
+  ck_assert_int_gt(pid, 0);
+  int status = -1;
+  ck_assert_int_eq(waitpid(pid, &status, 0), pid);
+  ck_assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+  /* меньший рекорд родителя не затирает больший рекорд потомка, а после
+     остановки потока временных файлов не остаётся */
+  recordShutdown();
+  ck_assert_int_eq(recordOnDisk(path), 950);
+  snprintf(tmp, sizeof tmp, "%s.%ld.tmp", path, (long)getpid());
+  ck_assert_int_ne(access(tmp, F_OK), 0);
+
+  /* после остановки следующий рекорд снова запускает поток */
+  recordSubmit(path, 1000);
+  recordShutdown();
+  ck_assert_int_eq(recordOnDisk(path), 1000);
+
+  remove(path);
+  remove("record_shutdown.txt.lock");
+}
+END_TEST
+
+START_TEST(back_genPlacements) {
+  uint16_t rows[FIELD_HEIGHT + PIECE_SIZE];
+  Placement_t out[MOVEGEN_MAX];
+  for (int y = 0; y < FIELD_HEIGHT + PIECE_SIZE; ++y) {
+    rows[y] = y < FIELD_HEIGHT ? ROW_EMPTY : ROW_FULL;
+  }
+
+  Shape o = {PIECE_O, 0, 1, 3, 0};
+  ck_assert_int_eq(genPlacements(rows, &o, out), FIELD_WIDTH - 1);
+  for (int k = 0; k < FIELD_WIDTH - 1; ++k) {
+    ck_assert_int_eq(out[k].y, FIELD_HEIGHT - 2);
+  }
+
+  /* горизонтальные ориентации 0 и 2 палки совпадают: 7 + 10 положений */
+  Shape i = {PIECE_I, 0, 1, 3, 0};
+  ck_assert_int_eq(genPlacements(rows, &i, out), 17);
+
+  Shape t = {PIECE_T, 0, 1, 3, 0};
+  ck_assert_int_eq(genPlacements(rows, &t, out), 34);
+
+  /* занятое начальное положение */
+  rows[1] = ROW_FULL;
+  ck_assert_int_eq(genPlacements(rows, &t, out), 0);
+
+  /* навес над столбцами 0..7 на строке 10: под ним O можно задвинуть
+     только справа */
+  rows[1] = ROW_EMPTY;
+  rows[10] = ROW_EMPTY | (uint16_t)(0xFFu << ROW_OFFSET);
+  int n = genPlacements(rows, &o, out);
+  int under = 0;
+  for (int k = 0; k < n; ++k) {
+    under += out[k].y == FIELD_HEIGHT - 2 && out[k].x < 6;
+  }
+  ck_assert_int_eq(under, 7);
+}
+END_TEST
+
+START_TEST(back_placementPath) {
+  uint16_t rows[FIELD_HEIGHT + PIECE_SIZE];
+  UserAction_t path[MOVEGEN_PATH_MAX];
+  for (int y = 0; y < FIELD_HEIGHT + PIECE_SIZE; ++y) {
+    rows[y] = y < FIELD_HEIGHT ? ROW_EMPTY : ROW_FULL;
+  }
+
+  Shape t = {PIECE_T, 0, 1, 3, 0};
+  Placement_t left = {0, FIELD_HEIGHT - 3, 1};
+  int len = placementPath(rows, &t, left, path, MOVEGEN_PATH_MAX);
+  ck_assert_int_eq(len, 5);
+  ck_assert_int_eq(path[len - 1], Down);
+
+  /* задвинуть O под навес: спуститься справа и уйти влево */
+  rows[10] = ROW_EMPTY | (uint16_t)(0xFFu << ROW_OFFSET);
+  Shape o = {PIECE_O, 0, 1, 3, 0};
+  Placement_t tuck = {-1, FIELD_HEIGHT - 2, 0};
+  len = placementPath(rows, &o, tuck, path, MOVEGEN_PATH_MAX);
+  ck_assert_int_gt(len, 0);
+
+  tetris_config_t cfg = {1, TETRIS_RANDOM_UNIFORM, ""};
+  tetris_engine_t *e = tetris_create(&cfg);
+  tetris_step(e, Start);
+  clearShape(e);
+  e->cur_shape->piece = PIECE_O;
+  e->cur_shape->rot = 0;
+  placeShape(e);
+  for (int x = 0; x < 8; ++x) setCell(e, 10, x, 1);
+  for (int k = 0; k < len - 1; ++k) tetris_step(e, path[k]);
+  ck_assert_int_eq(e->cur_shape->x, -1);
+  ck_assert_int_gt(e->cur_shape->y, 10);
+  tetris_step(e, path[len - 1]);
+  ck_assert_uint_eq(e->core.rows[FIELD_HEIGHT - 1],
+                    ROW_EMPTY | (3u << ROW_OFFSET));
+  ck_assert_uint_eq(e->core.rows[FIELD_HEIGHT - 2],
+                    ROW_EMPTY | (3u << ROW_OFFSET));
+
+  ck_assert_int_eq(placementPath(rows, &o, tuck, path, 2), -1);
+  Placement_t inside = {3, 10, 0};
+  ck_assert_int_eq(placementPath(rows, &o, inside, path, MOVEGEN_PATH_MAX),
+                   -1);
+  tetris_destroy(e);
+}
+END_TEST
+
+START_TEST(back_aiFeatures) {
+  uint16_t rows[FIELD_HEIGHT + PIECE_SIZE];
+  for (int y = 0; y < FIELD_HEIGHT + PIECE_SIZE; ++y) {
+    rows[y] = y < FIELD_HEIGHT ? ROW_EMPTY : ROW_FULL;
+  }
+  /* дно без столбца 0, над ним клетка в столбце 1 и навес над столбцом 5 */
+  rows[FIELD_HEIGHT - 1] = ROW_FULL & (uint16_t)~(1u << ROW_OFFSET);
+  rows[FIELD_HEIGHT - 2] |= (uint16_t)(1u << (ROW_OFFSET + 1));
+  rows[FIELD_HEIGHT - 3] |= (uint16_t)(1u << (ROW_OFFSET + 5));
+
+  AiFeatures_t f;
+  aiFeatures(rows, &f);
+  ck_assert_int_eq(f.height, 12);
+  ck_assert_int_eq(f.holes, 1);
+  ck_assert_int_eq(f.bumpiness, 7);
+  ck_assert_int_eq(f.row_trans, 44);
+  ck_assert_int_eq(f.col_trans, 12);
+
+  ck_assert(aiEvaluate(rows, 1) > aiEvaluate(rows, 0));
+}
+END_TEST
+
+START_TEST(layer_tetris_observe) {
+  tetris_config_t cfg = {9, TETRIS_RANDOM_UNIFORM, ""};
+  tetris_engine_t *e = tetris_create(&cfg);
+  tetris_observation_t obs;
+
+  ck_assert_int_eq(tetris_abi_version(), TETRIS_ABI_VERSION);
+  ck_assert_int_eq(tetris_observe(NULL, &obs), -1);
+  ck_assert_int_eq(tetris_observe(e, NULL), -1);
+
+  tetris_step(e, Start);
+  for (int i = 0; i < 8; ++i) {
+    tetris_step(e, i % 2 ? Left : Down);
+  }
+  ck_assert_int_eq(tetris_observe(e, &obs), 0);
+  ck_assert_int_eq(obs.pause, 0);
+  for (int y = 0; y < TETRIS_FIELD_HEIGHT; ++y) {
+    for (int x = 0; x < TETRIS_FIELD_WIDTH; ++x) {
+      ck_assert_int_eq(obs.field[y][x], e->data->field[y][x]);
+    }
+  }
+  for (int y = 0; y < TETRIS_NEXT_SIZE; ++y) {
+    for (int x = 0; x < TETRIS_NEXT_SIZE; ++x) {
+      ck_assert_int_eq(obs.next[y][x], e->data->next[y][x]);
+    }
+  }
+  ck_assert_int_eq(obs.piece, e->cur_shape->piece);
+  ck_assert_int_eq(obs.next_piece, e->core.next_piece);
+  ck_assert_int_eq(obs.score, e->core.score);
+  ck_assert_int_eq(obs.level, e->core.level);
+  ck_assert_int_eq(obs.pause, e->core.pause);
+  ck_assert_int_eq(obs.pieces, e->core.pieces);
+
+  /* снимок не меняется вместе с экземпляром */
+  tetris_observation_t copy = obs;
+  tetris_step(e, Down);
+  ck_assert_int_eq(memcmp(&copy, &obs, sizeof obs), 0);
+  ck_assert_int_ne(obs.pieces, e->core.pieces);
+
+  tetris_destroy(e);
+}
+END_TEST
+
+/* ход i из повторяемой последовательности действий */
+static UserAction_t replayAction(int i) {
+  static const UserAction_t seq[] = {Left, Action, Up, Left, Right,
+                                     Up,   Right,  Down, Action, Up,
+                                     Left, Left,   Down};
+  return seq[i % (int)(sizeof seq / sizeof seq[0])];
+}
+
+/* поле наблюдения без цветов: 1 — клетка занята */
+static void observeCells(tetris_engine_t *e, tetris_observation_t *obs) {
+  tetris_observe(e, obs);
+  for (int y = 0; y < TETRIS_FIELD_HEIGHT; ++y) {
+    for (int x = 0; x < TETRIS_FIELD_WIDTH; ++x) {
+      obs->field[y][x] = obs->field[y][x] != 0;
+    }
+  }
+}
+
+START_TEST(layer_tetris_save_restore) {
+  tetris_config_t cfg = {21, TETRIS_RANDOM_BAG7, ""};
+  tetris_config_t other = {22, TETRIS_RANDOM_UNIFORM, ""};
+  tetris_engine_t *e = tetris_create(&cfg);
+  tetris_engine_t *e2 = tetris_create(&other);
+  tetris_core_t core;
+  tetris_observation_t first;
+  tetris_observation_t again;
+
+  tetris_step(e, Start);
+  for (int i = 0; i < 20; ++i) {
+    tetris_step(e, replayAction(i));
+  }
+  tetris_save(e, &core);
+  for (int i = 0; i < 60; ++i) {
+    tetris_step(e, replayAction(i));
+  }
+  observeCells(e, &first);
+  ck_assert_int_eq(first.pause, 0);
+  ck_assert_int_gt(first.pieces, 5);
+
+  /* тот же экземпляр: после отката игра повторяется */
+  tetris_restore(e, &core);
+  for (int i = 0; i < 60; ++i) {
+    tetris_step(e, replayAction(i));
+  }
+  observeCells(e, &again);
+  ck_assert_int_eq(memcmp(&first, &again, sizeof first), 0);
+
+  /* другой экземпляр продолжает чужую партию так же */
+  tetris_step(e2, Start);
+  tetris_step(e2, Down);
+  tetris_restore(e2, &core);
+  for (int i = 0; i < 60; ++i) {
+    tetris_step(e2, replayAction(i));
+  }
+  observeCells(e2, &again);
+  ck_assert_int_eq(memcmp(&first, &again, sizeof first), 0);
+
+  /* цвета после отката перерисованы по маскам строк */
+  tetris_restore(e2, &core);
+  GameInfo_t info = tetris_state(e2);
+  for (int y = 0; y < FIELD_HEIGHT; ++y) {
+    for (int x = 0; x < FIELD_WIDTH; ++x) {
+      int bit = (e2->core.rows[y] >> (x + ROW_OFFSET)) & 1;
+      ck_assert_int_eq(info.field[y][x] != 0, bit);
+    }
+  }
+  ck_assert_int_eq(info.score, e2->core.score);
+  ck_assert_int_eq(info.level, e2->core.level);
+
+  tetris_destroy(e);
+  tetris_destroy(e2);
+}
+END_TEST
+
+START_TEST(layer_tetris_replay) {
+  const char *path = "test_replay.bin";
+  tetris_config_t cfg = {31, TETRIS_RANDOM_BAG7, ""};
+  tetris_engine_t *e = tetris_create(&cfg);
+  tetris_recorder_t *rec = tetris_record_open(path, e);
+  tetris_replay_t out;
+  long events = 0;
+
+  ck_assert_ptr_nonnull(rec);
+  tetris_step(e, Start);
+  tetris_record(rec, e, 0, Start);
+  for (int i = 0; i < 200 && e->core.state == STATE_GAME; ++i) {
+    tetris_step(e, replayAction(i));
+    tetris_record(rec, e, (unsigned long long)(3 * i + 1), replayAction(i));
+    events = i + 2;
+  }
+  ck_assert_ptr_null(tetris_record_open(path, e));
+  ck_assert_int_eq(tetris_record_close(rec), 0);
+
+  ck_assert_int_eq(tetris_replay(path, &out), 0);
+  ck_assert_int_eq(out.events, events);
+  ck_assert_uint_eq(out.ticks, 3 * (events - 2) + 1);
+  ck_assert_int_eq(out.mismatch, -1);
+  ck_assert_int_eq(out.score, e->core.score);
+  ck_assert_int_eq(out.pieces, e->core.pieces);
+
+  /* событие — байт кода и два байта суммы; такты не дошли до второго
+     ключевого кадра, так что в индексе только начало партии */
+  long end = REPLAY_HEADER_SIZE + 3 * events;
+  FILE *f = fopen(path, "r+b");
+  ck_assert_ptr_nonnull(f);
+  fseek(f, 0, SEEK_END);
+  ck_assert_int_eq(ftell(f), end + REPLAY_KEY_HEADER +
+                                 (long)sizeof(GameCore_t) +
+                                 REPLAY_TRAILER_SIZE);
+  fseek(f, end - 1, SEEK_SET);
+  int last = fgetc(f);
+  fseek(f, end - 1, SEEK_SET);
+  fputc(last ^ 0x40, f);
+  fclose(f);
+  ck_assert_int_eq(tetris_replay(path, &out), 1);
+  ck_assert_int_eq(out.mismatch, events - 1);
+
+  f = fopen(path, "wb");
+  fputs("TRPL", f);
+  fclose(f);
+  ck_assert_int_eq(tetris_replay(path, &out), -1);
+  ck_assert_int_eq(tetris_replay("no_such_replay.bin", &out), -1);
+
+  remove(path);
+  tetris_destroy(e);
+}
+END_TEST
+
+START_TEST(layer_tetris_player_seek) {
+  const char *path = "test_seek.bin";
+  tetris_config_t cfg = {41, TETRIS_RANDOM_UNIFORM, ""};
+  tetris_engine_t *e = tetris_create(&cfg);
+  tetris_recorder_t *rec = tetris_record_open(path, e);
+  tetris_ai_t *ai = tetris_ai_create(0);
+  UserAction_t acts[400];
+  int n = 0;
+
+  tetris_step(e, Start);
+  tetris_record(rec, e, 0, Start);
+  acts[n++] = Start;
+  while (n < 400 && e->core.state == STATE_GAME) {
+    acts[n] = n % 4 ? tetris_ai_action(ai, e) : Up;
+    tetris_step(e, acts[n]);
+    tetris_record(rec, e, (unsigned long long)(5 * n), acts[n]);
+    ++n;
+  }
+  ck_assert_int_eq(n, 400);
+  ck_assert_int_eq(tetris_record_close(rec), 0);
+  tetris_ai_destroy(ai);
+
+  tetris_player_t *player = tetris_player_open(path);
+  ck_assert_ptr_nonnull(player);
+  ck_assert_int_gt(player->r.key_count, 2);
+
+  /* вперёд, назад и снова вперёд — как при перемотке */
+  static const unsigned long long ticks[] = {1000, 3,    1799, 1800, 1801,
+                                             0,    1500, 999,  4000, 257};
+  for (size_t i = 0; i < sizeof ticks / sizeof ticks[0]; ++i) {
+    tetris_engine_t *ref = tetris_create(&cfg);
+    for (int k = 0; k < n && 5ull * (unsigned long long)k <= ticks[i]; ++k) {
+      tetris_step(ref, acts[k]);
+    }
+    ck_assert_int_eq(tetris_player_seek(player, ticks[i]), 0);
+    const tetris_engine_t *got = tetris_player_engine(player);
+    ck_assert_int_eq(memcmp(&got->core, &ref->core, sizeof ref->core), 0);
+    tetris_destroy(ref);
+  }
+
+  tetris_player_close(player);
+  remove(path);
+  tetris_destroy(e);
+}
+END_TEST
+
+START_TEST(back_zobrist) {
+  tetris_config_t cfg = {17, TETRIS_RANDOM_UNIFORM, ""};
+  tetris_engine_t *e = tetris_create(&cfg);
+  tetris_engine_t *e2 = tetris_create(&cfg);
+  tetris_ai_t *ai = tetris_ai_create(0);
+
+  ck_assert_uint_eq(e->core.hash, zobristFull(e));
+  /* инкрементальный хеш совпадает с пересчитанным на каждом ходу, в том
+     числе после снятия линий */
+  tetris_step(e, Start);
+  for (int i = 0; i < 600 && e->core.state == STATE_GAME; ++i) {
+    tetris_step(e, i % 3 ? tetris_ai_action(ai, e) : Up);
+    ck_assert_uint_eq(e->core.hash, zobristFull(e));
+  }
+  ck_assert_int_eq(e->core.state, STATE_GAME);
+  ck_assert_int_gt(e->core.score, 0);
+
+  /* одна позиция разными порядками ходов — один хеш */
+  tetris_destroy(e);
+  e = tetris_create(&cfg);
+  tetris_step(e, Start);
+  tetris_step(e2, Start);
+  unsigned long long start = tetris_hash(e);
+  tetris_step(e, Left);
+  tetris_step(e, Action);
+  tetris_step(e2, Action);
+  tetris_step(e2, Left);
+  ck_assert_int_eq(memcmp(e->cur_shape, e2->cur_shape, sizeof(Shape)), 0);
+  ck_assert_uint_eq(tetris_hash(e), tetris_hash(e2));
+  ck_assert_uint_ne(tetris_hash(e), start);
+
+  /* setCell держит хеш в согласии с полем */
+  setCell(e, 19, 0, 3);
+  setCell(e, 19, 0, 5);
+  ck_assert_uint_eq(e->core.hash, zobristFull(e));
+  setCell(e, 19, 0, 0);
+  ck_assert_uint_eq(tetris_hash(e), tetris_hash(e2));
+
+  tetris_ai_destroy(ai);
+  tetris_destroy(e);
+  tetris_destroy(e2);
+}
+END_TEST
+
+/// \brief Поток для back_ttable_threads: таблица и счётчик чужих значений.
+typedef struct {
+  TTable_t *tt;
+  int id;
+  int wrong;
+  int hits;
+} TtWorker_t;
+
+/**
+ * \brief Пишет и читает пересекающиеся у разных потоков ключи; значение
+ * ключа k всегда k * 3 | 1, так что любое другое — порча.
+ */
+static void *ttWorker(void *arg) {
+  TtWorker_t *w = arg;
+  Rng_t rng;
+
+  rngSeed(&rng, (uint64_t)w->id);
+  for (int i = 0; i < 200000; ++i) {
+    uint64_t key = rngBounded(&rng, 4096) * 0x9E3779B97F4A7C15ULL;
+    uint64_t data = 0;
+    if (i % 2) {
+      ttStore(w->tt, key, key * 3 | 1);
+    } else if (ttProbe(w->tt, key, &data)) {
+      w->hits += 1;
+      w->wrong += data != (key * 3 | 1);
+    }
+  }
+
+  return NULL;
+}
+
+START_TEST(back_ttable_threads) {
+  /* таблица меньше набора ключей: записи всё время вытесняются */
+  TTable_t *tt = ttCreate(16 * 1024);
+  TtWorker_t w[4];
+  pthread_t th[4];
+  uint64_t data = 0;
+
+  ck_assert_ptr_nonnull(tt);
+  ck_assert_uint_eq(tt->mask + 1, 16 * 1024 / sizeof(TtBucket_t));
+  ck_assert_int_eq(ttProbe(tt, 42, &data), 0);
+  ttStore(tt, 42, 7);
+  ck_assert_int_eq(ttProbe(tt, 42, &data), 1);
+  ck_assert_uint_eq(data, 7);
+  ttStore(tt, 42, 9);
+  ck_assert_int_eq(ttProbe(tt, 42, &data), 1);
+  ck_assert_uint_eq(data, 9);
+  ttClear(tt);
+  ck_assert_int_eq(ttProbe(tt, 42, &data), 0);
+
+  for (int i = 0; i < 4; ++i) {
+    w[i] = (TtWorker_t){tt, i, 0, 0};
+    ck_assert_int_eq(pthread_create(&th[i], NULL, ttWorker, &w[i]), 0);
+  }
+  for (int i = 0; i < 4; ++i) {
+    pthread_join(th[i], NULL);
+    ck_assert_int_eq(w[i].wrong, 0);
+    ck_assert_int_gt(w[i].hits, 0);
+  }
+
+  ttDestroy(tt);
+}
+END_TEST
+
+START_TEST(layer_tetris_snapshot) {
+  tetris_config_t cfg = {4, TETRIS_RANDOM_UNIFORM, ""};
+  tetris_engine_t *e = tetris_create(&cfg);
+  tetris_snapbuf_t *buf = tetris_snapbuf_create();
+  ck_assert_ptr_nonnull(buf);
+
+  ck_assert_uint_eq(tetris_snapshot(buf)->version, 0);
+  tetris_step(e, Start);
+  tetris_publish(buf, e);
+  tetris_step(e, Down);
+  tetris_publish(buf, e);
+
+  /* читатель получает последний снимок, и он не меняется до следующего
+     чтения, даже если писатель публикует дальше */
+  const tetris_snapshot_t *snap = tetris_snapshot(buf);
+  ck_assert_uint_eq(snap->version, 2);
+  ck_assert_int_eq(snap->obs.pieces, 1);
+  for (int i = 0; i < 5; ++i) {
+    tetris_step(e, Down);
+    tetris_publish(buf, e);
+  }
+  ck_assert_uint_eq(snap->version, 2);
+  ck_assert_int_eq(snap->obs.pieces, 1);
+  snap = tetris_snapshot(buf);
+  ck_assert_uint_eq(snap->version, 7);
+  ck_assert_int_eq(snap->obs.pieces, e->core.pieces);
+  ck_assert_ptr_eq(tetris_snapshot(buf), snap);
+
+  tetris_snapbuf_destroy(buf);
+  tetris_destroy(e);
+}
+END_TEST
+
+START_TEST(layer_tetris_snapshot_damage) {
+  tetris_config_t cfg = {9, TETRIS_RANDOM_UNIFORM, ""};
+  tetris_engine_t *e = tetris_create(&cfg);
+  tetris_snapbuf_t *buf = tetris_snapbuf_create();
+  tetris_ai_t *ai = tetris_ai_create(0);
+  tetris_snapshot_t old;
+  tetris_core_t core;
+
+  tetris_step(e, Start);
+  tetris_publish(buf, e);
+  old = *tetris_snapshot(buf);
+
+  /* сдвиг фигуры задевает только её строки */
+  tetris_step(e, Left);
+  tetris_publish(buf, e);
+  int damaged = 0;
+  for (int y = 0; y < FIELD_HEIGHT; ++y) {
+    damaged += tetris_snapshot(buf)->row_version[y] > old.field_version;
+  }
+  ck_assert_int_gt(damaged, 0);
+  ck_assert_int_le(damaged, PIECE_SIZE);
+
+  /* читатель пропускает снимки, но любая строка, которая отличается от
+     нарисованной, помечена как изменённая */
+  tetris_save(e, &core);
+  for (int i = 0; i < 600 && e->core.state == STATE_GAME; ++i) {
+    tetris_step(e, i % 3 ? tetris_ai_action(ai, e) : Up);
+    tetris_publish(buf, e);
+    if (i % 5 == 0) {
+      const tetris_snapshot_t *snap = tetris_snapshot(buf);
+      for (int y = 0; y < FIELD_HEIGHT; ++y) {
+        if (memcmp(snap->obs.field[y], old.obs.field[y], FIELD_WIDTH)) {
+          ck_assert_uint_gt(snap->row_version[y], old.field_version);
+        }
+      }
+      old = *snap;
+    }
+  }
+  ck_assert_int_gt(e->core.score, 0);
+
+  /* после отката меняется всё поле */
+  tetris_restore(e, &core);
+  tetris_publish(buf, e);
+  for (int y = 0; y < FIELD_HEIGHT; ++y) {
+    ck_assert_uint_gt(tetris_snapshot(buf)->row_version[y], old.field_version);
+  }
+
+  tetris_ai_destroy(ai);
+  tetris_snapbuf_destroy(buf);
+  tetris_destroy(e);
+}
+END_TEST
+
+/**
+ * \brief Писатель для back_snapshot_threads: каждый снимок целиком заполнен
+ * номером своей версии.
+ */
+static void *snapWriter(void *arg) {
+  SnapBuffer_t *buf = arg;
+
+  for (int v = 1; v <= 20000; ++v) {
+    tetris_snapshot_t *s = snapBegin(buf);
+    memset(s->obs.field, v % 251, sizeof s->obs.field);
+    s->obs.score = v;
+    snapCommit(buf);
+  }
+
+  return NULL;
+}
+
+START_TEST(back_snapshot_threads) {
+  SnapBuffer_t *buf = snapCreate();
+  pthread_t writer;
+  unsigned long long last = 0;
+  ck_assert_int_eq(pthread_create(&writer, NULL, snapWriter, buf), 0);
+
+  while (last < 20000) {
+    const tetris_snapshot_t *s = snapRead(buf);
+    ck_assert_uint_ge(s->version, last);
+    if (s->version > 0) {
+      ck_assert_uint_eq(s->version, (unsigned long long)s->obs.score);
+      for (int y = 0; y < TETRIS_FIELD_HEIGHT; ++y) {
+        for (int x = 0; x < TETRIS_FIELD_WIDTH; ++x) {
+          ck_assert_int_eq(s->obs.field[y][x], s->obs.score % 251);
+        }
+      }
+    }
+    last = s->version;
+  }
+
+  pthread_join(writer, NULL);
+  snapDestroy(buf);
+}
+END_TEST
+
+START_TEST(layer_tetris_inputq) {
+  tetris_inputq_t *q = tetris_inputq_create();
+  tetris_input_t ev;
+  int pushed = 0;
+
+  ck_assert_ptr_nonnull(q);
+  ck_assert_int_eq(tetris_inputq_pop(q, &ev), 0);
+  while (tetris_inputq_push(q, (UserAction_t)(pushed % 8),
+                            (unsigned long long)pushed)) {
+    ++pushed;
+  }
+  ck_assert_int_eq(pushed, INPUT_CAP);
+
+  /* забирается по порядку, и освободившееся место снова доступно */
+  ck_assert_int_eq(tetris_inputq_pop(q, &ev), 1);
+  ck_assert_int_eq(ev.action, Start);
+  ck_assert_uint_eq(ev.stamp, 0);
+  ck_assert_int_eq(tetris_inputq_push(q, Action, 1000), 1);
+  for (int i = 1; i < INPUT_CAP; ++i) {
+    ck_assert_int_eq(tetris_inputq_pop(q, &ev), 1);
+    ck_assert_int_eq(ev.action, (UserAction_t)(i % 8));
+    ck_assert_uint_eq(ev.stamp, (unsigned long long)i);
+  }
+  ck_assert_int_eq(tetris_inputq_pop(q, &ev), 1);
+  ck_assert_uint_eq(ev.stamp, 1000);
+  ck_assert_int_eq(tetris_inputq_pop(q, &ev), 0);
+
+  tetris_inputq_destroy(q);
+}
+END_TEST
+
+/// \brief Писатель для back_input_threads: метка события — его номер.
+static void *inputWriter(void *arg) {
+  InputRing_t *q = arg;
+
+  for (uint64_t i = 1; i <= 200000; ++i) {
+    while (!inputPush(q, (UserAction_t)(i % 8), i)) {
+    }
+  }
+
+  return NULL;
+}
+
+START_TEST(back_input_threads) {
+  InputRing_t *q = inputCreate();
+  pthread_t writer;
+  uint64_t expect = 1;
+  ck_assert_int_eq(pthread_create(&writer, NULL, inputWriter, q), 0);
+
+  /* читатель видит все события ровно по разу и по порядку */
+  while (expect <= 200000) {
+    tetris_input_t ev;
+    if (inputPop(q, &ev)) {
+      ck_assert_uint_eq(ev.stamp, expect);
+      ck_assert_int_eq(ev.action, (UserAction_t)(expect % 8));
+      ++expect;
+    }
+  }
+
+  pthread_join(writer, NULL);
+  inputDestroy(q);
+}
+END_TEST
+
+START_TEST(back_repeat) {
+  tetris_config_t cfg = {23, TETRIS_RANDOM_UNIFORM, ""};
+  tetris_engine_t *e = tetris_create(&cfg);
+  tetris_engine_t *ref = tetris_create(&cfg);
+  tetris_ai_t *ai = tetris_ai_create(0);
+  UserAction_t act = Start;
+
+  tetris_step(e, Start);
+  const PieceGeom_t *g = &pieceTable[e->core.shape.piece][e->core.shape.rot];
+  int x = e->core.shape.x;
+  /* нажатие сдвигает сразу, повторы идут через das и потом каждые arr мс */
+  ck_assert_int_eq(tetris_step_hold(e, Left, true), 1);
+  ck_assert_int_eq(e->core.shape.x, x - 1);
+  ck_assert_int_eq(tetris_step_hold(e, Left, true), 0);
+  ck_assert_int_eq(tetris_advance(e, REPEAT_DAS - 1, &act), 0);
+  ck_assert_int_eq(tetris_advance(e, 1, &act), 1);
+  ck_assert_int_eq(act, Left);
+  ck_assert_int_eq(tetris_advance(e, REPEAT_ARR, &act), 1);
+  ck_assert_int_eq(e->core.shape.x, x - 3);
+  /* долгий интервал — один проход до стены */
+  ck_assert_int_eq(tetris_advance(e, 1000, &act), x + g->left - 3);
+  ck_assert_int_eq(e->core.shape.x + g->left, 0);
+  ck_assert_int_eq(tetris_advance(e, 1000, &act), 0);
+  /* отпускание ничего не двигает, на паузе часы стоят */
+  ck_assert_int_eq(tetris_step_hold(e, Left, false), 0);
+  ck_assert_int_eq(e->core.shape.x + g->left, 0);
+  ck_assert_int_eq(tetris_step_hold(e, Right, true), 1);
+  tetris_step(e, Pause);
+  ck_assert_int_eq(tetris_advance(e, 1000, &act), 0);
+  tetris_step(e, Pause);
+  ck_assert_int_eq(tetris_step_hold(e, Right, false), 0);
+  ck_assert_int_eq(e->core.shape.x + g->left, 1);
+  /* мягкий спуск — каждые sdr мс с самого нажатия */
+  int y = e->core.shape.y;
+  ck_assert_int_eq(tetris_step_hold(e, Up, true), 1);
+  ck_assert_int_eq(tetris_advance(e, 3 * REPEAT_SDR, &act), 3);
+  ck_assert_int_eq(act, Up);
+  ck_assert_int_eq(e->core.shape.y, y + 4);
+  ck_assert_int_eq(tetris_step_hold(e, Up, false), 0);
+
+  /* проход за n повторов даёт то же, что n отдельных шагов, в том числе
+     через фиксацию фигуры */
+  static const UserAction_t moves[] = {Left, Right, Up};
+  for (int i = 0; i < 300 && e->core.state == STATE_GAME; ++i) {
+    tetris_core_t core;
+    int n = 1 + i % 25;
+    tetris_save(e, &core);
+    tetris_restore(ref, &core);
+    repeatMove(e, moves[i % 3], n);
+    for (int k = 0; k < n; ++k) {
+      tetris_step(ref, moves[i % 3]);
+    }
+    ck_assert_int_eq(memcmp(&e->core, &ref->core, sizeof e->core), 0);
+    if (e->core.state == STATE_GAME) {
+      ck_assert_uint_eq(e->core.hash, zobristFull(e));
+      tetris_step(e, tetris_ai_action(ai, e));
+    }
+  }
+
+  tetris_ai_destroy(ai);
+  tetris_destroy(ref);
+  tetris_destroy(e);
+}
+END_TEST
+
+START_TEST(layer_tetris_replay_repeat) {
+  const char *path = "test_repeat.bin";
+  tetris_config_t cfg = {29, TETRIS_RANDOM_UNIFORM, ""};
+  tetris_engine_t *e = tetris_create(&cfg);
+  tetris_recorder_t *rec = tetris_record_open(path, e);
+  unsigned long long tick = 0;
+  long events = 1;
+  UserAction_t act = Start;
+
+  tetris_step(e, Start);
+  tetris_record(rec, e, 0, Start);
+  /* повторы пишутся отдельными событиями одного такта, все с суммой
+     состояния после прохода, как их пишет интерфейс */
+  for (int i = 0; i < 200 && e->core.state == STATE_GAME; ++i) {
+    UserAction_t dir = i % 2 ? Left : Right;
+    tick += 51;
+    tetris_step_hold(e, dir, true);
+    tetris_record(rec, e, tick, dir);
+    ++events;
+    for (int n = tetris_advance(e, REPEAT_DAS + REPEAT_ARR, &act); n > 0;
+         --n) {
+      tetris_record(rec, e, tick + 1, act);
+      ++events;
+    }
+    tetris_step_hold(e, dir, false);
+    tetris_step_hold(e, Up, true);
+    tetris_record(rec, e, tick + 3, Up);
+    ++events;
+    for (int n = tetris_advance(e, 4 * REPEAT_SDR, &act); n > 0; --n) {
+      tetris_record(rec, e, tick + 4, act);
+      ++events;
+    }
+    tetris_step_hold(e, Up, false);
+    tetris_step(e, Down);
+    tetris_record(rec, e, tick + 5, Down);
+    ++events;
+  }
+  ck_assert_int_eq(tetris_record_close(rec), 0);
+
+  tetris_replay_t out;
+  ck_assert_int_eq(tetris_replay(path, &out), 0);
+  ck_assert_int_eq(out.events, events);
+  ck_assert_int_eq(out.score, e->core.score);
+
+  /* ключевые кадры стоят между тактами: переход к любому такту сходится */
+  tetris_player_t *player = tetris_player_open(path);
+  ck_assert_ptr_nonnull(player);
+  ck_assert_int_gt(player->r.key_count, 2);
+  for (long long t = (long long)tick + 5; t >= 0; t -= 7) {
+    ck_assert_int_eq(tetris_player_seek(player, (unsigned long long)t), 0);
+  }
+  ck_assert_int_eq(tetris_player_seek(player, tick + 5), 0);
+  const tetris_engine_t *got = tetris_player_engine(player);
+  ck_assert_int_eq(memcmp(&got->core, &e->core, sizeof e->core), 0);
+
+  tetris_player_close(player);
+  remove(path);
+  tetris_destroy(e);
+}
+END_TEST
+
+START_TEST(back_stats) {
+  tetris_config_t cfg = {31, TETRIS_RANDOM_UNIFORM, ""};
+  GameParams_t *p = newParams(&cfg);
+  tetris_stats_t *st = malloc(sizeof *st);
+  ck_assert_ptr_nonnull(st);
+
+  /* корзины: точные до STATS_SUB нс, дальше не шире 1/8 значения */
+  for (uint64_t v = 0; v < 1000000; v += 1 + v / 64) {
+    int b = statsBucket(v);
+    ck_assert_uint_le(v, statsBucketTop(b));
+    ck_assert_uint_le(statsBucketTop(b) - v, v / 8);
+    ck_assert(b == 0 || statsBucketTop(b - 1) < v);
+  }
+  ck_assert_int_eq(statsBucket(UINT64_MAX), STATS_BUCKETS - 1);
+  ck_assert_uint_eq(statsBucketTop(STATS_BUCKETS - 1),
+                    (1ull << STATS_MAX_BITS) - 1);
+
+  /* выключенная статистика ничего не считает */
+  statsReset();
+  updtGame(p, Start);
+  updtGame(p, Down);
+  statsRead(st);
+  ck_assert_uint_eq(st->actions[Start].count, 0);
+  ck_assert_uint_eq(st->actions[Down].count, 0);
+  ck_assert_uint_eq(st->spawns, 0);
+
+  statsEnable(1);
+  updtGame(p, Down);
+  updtGame(p, Down);
+  for (int i = 0; i < 3; ++i) {
+    updtGame(p, Action);
+  }
+  updtGame(p, Left);
+  statsRead(st);
+  ck_assert_int_ge(st->threads, 1);
+  ck_assert_uint_eq(st->actions[Down].count, 2);
+  ck_assert_uint_eq(st->actions[Action].count, 3);
+  ck_assert_uint_eq(st->actions[Left].count, 1);
+  ck_assert_uint_eq(st->rotations, 3);
+  ck_assert_uint_eq(st->spawns, 2);
+  ck_assert_uint_eq(st->spawn_fails, 0);
+  ck_assert_uint_eq(st->lines[0], 2);
+  for (int a = Start; a <= Action; ++a) {
+    const tetris_latency_t *lat = &st->actions[a];
+    unsigned long long sum = 0;
+    for (int b = 0; b < STATS_BUCKETS; ++b) {
+      sum += lat->buckets[b];
+    }
+    ck_assert_uint_eq(sum, lat->count);
+    ck_assert_uint_le(lat->max_ns, lat->total_ns);
+    ck_assert_uint_le(statsPercentile(lat, 0.5), lat->max_ns);
+    ck_assert_uint_eq(statsPercentile(lat, 1.0), lat->max_ns);
+  }
+
+  /* I, которому не повернуться: под его строкой всё занято */
+  clearShape(p);
+  p->cur_shape->piece = PIECE_I;
+  p->cur_shape->rot = 0;
+  p->cur_shape->x = 3;
+  p->cur_shape->y = 0;
+  for (int y = 1; y < FIELD_HEIGHT; ++y) {
+    p->core.rows[y] = ROW_FULL;
+  }
+  placeShape(p);
+  rotate(p);
+  ck_assert_int_eq(p->cur_shape->rot, 0);
+
+  /* новой фигуре некуда встать */
+  clearShape(p);
+  p->core.rows[0] = ROW_FULL;
+  spawnNew(p);
+
+  /* горизонтальный I закрывает нижнюю строку */
+  GameParams_t *q = newParams(&cfg);
+  updtGame(q, Start);
+  clearShape(q);
+  q->cur_shape->piece = PIECE_I;
+  q->cur_shape->rot = 0;
+  q->cur_shape->x = 3;
+  q->core.rows[FIELD_HEIGHT - 1] =
+      (uint16_t)(ROW_FULL & ~(0xFu << (3 + ROW_OFFSET)));
+  updtSkyline(q);
+  placeShape(q);
+  updtGame(q, Down);
+
+  statsRead(st);
+  ck_assert_uint_eq(st->rotations, 4);
+  ck_assert_uint_eq(st->rotate_rejects, 1);
+  ck_assert_uint_eq(st->spawns, 4);
+  ck_assert_uint_eq(st->spawn_fails, 1);
+  ck_assert_uint_eq(st->lines[1], 1);
+
+  /* удержание без наступивших повторов в статистику не попадает */
+  statsReset();
+  ck_assert_int_eq(repeatInput(q, Left, 1), 1);
+  ck_assert_int_eq(repeatAdvance(q, 0, &(UserAction_t){Start}), 0);
+  ck_assert_int_eq(repeatMove(q, Up, 0), 0);
+  statsRead(st);
+  ck_assert_uint_eq(st->actions[Left].count, 1);
+  ck_assert_uint_eq(st->actions[Up].count, 0);
+
+  statsReset();
+  statsRead(st);
+  ck_assert_uint_eq(st->actions[Down].count, 0);
+  ck_assert_uint_eq(st->actions[Down].max_ns, 0);
+  ck_assert_uint_eq(st->lines[0], 0);
+
+  statsEnable(0);
+  freeMemory(q);
+  freeMemory(p);
+  free(st);
+}
+END_TEST
+
+/// \brief Поток для layer_tetris_stats_threads: свой экземпляр и arg
+/// сдвигов влево.
+static void *statsWorker(void *arg) {
+  tetris_config_t cfg = {37, TETRIS_RANDOM_UNIFORM, ""};
+  tetris_engine_t *e = tetris_create(&cfg);
+
+  tetris_step(e, Start);
+  for (int i = 0; i < *(const int *)arg; ++i) {
+    tetris_step(e, Left);
+  }
+  tetris_destroy(e);
+
+  return NULL;
+}
+
+START_TEST(layer_tetris_stats_threads) {
+  const char *path = "test_stats.json";
+  tetris_stats_t *st = malloc(sizeof *st);
+  int lefts = 5000;
+  pthread_t th[3];
+  char buf[4096] = {0};
+
+  ck_assert_ptr_nonnull(st);
+  tetris_stats_enable(true);
+  tetris_stats_reset();
+
+  /* счётчики потоков складываются при чтении, в том числе завершившихся */
+  for (int i = 0; i < 3; ++i) {
+    ck_assert_int_eq(pthread_create(&th[i], NULL, statsWorker, &lefts), 0);
+  }
+  for (int i = 0; i < 3; ++i) {
+    pthread_join(th[i], NULL);
+  }
+  tetris_stats_read(st);
+  ck_assert_int_ge(st->threads, 3);
+  ck_assert_uint_eq(st->actions[Left].count, 3ull * lefts);
+  ck_assert_uint_eq(st->actions[Start].count, 3);
+  ck_assert_uint_le(tetris_stats_percentile(&st->actions[Left], 0.5),
+                    tetris_stats_percentile(&st->actions[Left], 0.99));
+
+  ck_assert_int_eq(tetris_stats_dump(path), 0);
+  FILE *f = fopen(path, "r");
+  ck_assert_ptr_nonnull(f);
+  size_t n = fread(buf, 1, sizeof buf - 1, f);
+  fclose(f);
+  ck_assert_uint_gt(n, 0);
+  ck_assert_ptr_nonnull(strstr(buf, "\"action\": \"Left\", \"count\": 15000"));
+  ck_assert_ptr_nonnull(strstr(buf, "\"lines_per_lock\": [0, 0, 0, 0, 0]"));
+  ck_assert_int_eq(tetris_stats_dump("no_such_dir/stats.json"), -1);
+
+  tetris_stats_enable(false);
+  remove(path);
+  free(st);
+}
+END_TEST
+
+/// \brief Читает файл целиком в строку (освобождает вызывающий).
+static char *readAll(const char *path) {
+  FILE *f = fopen(path, "r");
+  char *res = NULL;
+
+  if (f) {
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    res = calloc((size_t)size + 1, 1);
+    if (res && fread(res, 1, (size_t)size, f) != (size_t)size) {
+      free(res);
+      res = NULL;
+    }
+    fclose(f);
+  }
+
+  return res;
+}
+
+/// \brief Сколько раз needle встречается в hay.
+static int countOf(const char *hay, const char *needle) {
+  int res = 0;
+
+  for (const char *p = strstr(hay, needle); p; p = strstr(p + 1, needle)) {
+    ++res;
+  }
+
+  return res;
+}
+
+/// \brief Поток для back_trace: отрезков spin больше, чем влезает в буфер.
+static void *traceSpinner(void *arg) {
+  (void)arg;
+  traceThread("spinner");
+  for (int i = 0; i < TRACE_RING / 2 + 100; ++i) {
+    traceBegin("spin");
+    traceEnd("spin");
+  }
+
+  return NULL;
+}
+
+START_TEST(back_trace) {
+  const char *path = "test_trace.json";
+  tetris_config_t cfg = {41, TETRIS_RANDOM_UNIFORM, ""};
+  GameParams_t *p = newParams(&cfg);
+  pthread_t th;
+
+  /* выключенная трассировка ничего не пишет */
+  updtGame(p, Start);
+  updtGame(p, Down);
+
+  traceEnable(1);
+  traceThread("main");
+  updtGame(p, Down);
+  for (int i = 0; i <= FIELD_HEIGHT; ++i) {
+    updtGame(p, Up);
+  }
+  ck_assert_int_eq(pthread_create(&th, NULL, traceSpinner, NULL), 0);
+  pthread_join(th, NULL);
+  ck_assert_int_eq(traceExport(path), 0);
+  traceEnable(0);
+
+  char *json = readAll(path);
+  ck_assert_ptr_nonnull(json);
+  ck_assert_ptr_nonnull(strstr(json, "{\"traceEvents\": ["));
+  ck_assert_int_eq(countOf(json, "\"name\": \"input\", \"ph\": \"B\""), 1);
+  ck_assert_int_eq(countOf(json, "\"name\": \"input\", \"ph\": \"E\""), 1);
+  ck_assert_int_ge(countOf(json, "\"name\": \"gravity\", \"ph\": \"B\""),
+                   FIELD_HEIGHT);
+  /* фигура легла и от Down, и от гравитации */
+  ck_assert_int_ge(countOf(json, "\"name\": \"lock\", \"ph\": \"B\""), 2);
+  ck_assert_int_eq(countOf(json, "\"name\": \"lock\", \"ph\": \"B\""),
+                   countOf(json, "\"name\": \"spawn\", \"ph\": \"E\""));
+  ck_assert_ptr_nonnull(strstr(json, "\"args\": {\"name\": \"main\"}"));
+  ck_assert_ptr_nonnull(strstr(json, "\"args\": {\"name\": \"spinner\"}"));
+
+  /* от переполненного буфера остаются последние отметки, и концы без
+     начала отброшены */
+  int begins = countOf(json, "\"name\": \"spin\", \"ph\": \"B\"");
+  int ends = countOf(json, "\"name\": \"spin\", \"ph\": \"E\"");
+  ck_assert_int_eq(begins, ends);
+  ck_assert_int_le(begins + ends, TRACE_RING);
+  ck_assert_int_ge(begins + ends, TRACE_RING - 2);
+
+  free(json);
+  remove(path);
+  freeMemory(p);
+}
+END_TEST
+
+START_TEST(layer_tetris_trace) {
+  const char *path = "test_trace_layer.json";
+  tetris_config_t cfg = {43, TETRIS_RANDOM_UNIFORM, ""};
+  tetris_engine_t *e = tetris_create(&cfg);
+
+  tetris_trace_enable(true);
+  tetris_step(e, Start);
+  tetris_trace_begin("frame \"1\"");
+  tetris_step(e, Left);
+  tetris_trace_end("frame \"1\"");
+  ck_assert_int_eq(tetris_trace_export(path), 0);
+  ck_assert_int_eq(tetris_trace_export("no_such_dir/trace.json"), -1);
+  tetris_trace_enable(false);
+
+  /* свой отрезок выгружается с экранированным именем, ввод вложен в него */
+  char *json = readAll(path);
+  ck_assert_ptr_nonnull(json);
+  const char *frame = "\"name\": \"frame \\\"1\\\"\", \"ph\": ";
+  const char *begin = strstr(json, frame);
+  ck_assert_ptr_nonnull(begin);
+  ck_assert_int_eq(begin[strlen(frame) + 1], 'B');
+  const char *input = strstr(begin, "\"name\": \"input\", \"ph\": \"B\"");
+  const char *end = strstr(begin + 1, frame);
+  ck_assert_ptr_nonnull(input);
+  ck_assert_ptr_nonnull(end);
+  ck_assert_int_eq(end[strlen(frame) + 1], 'E');
+  ck_assert(input < end);
+
+  free(json);
+  remove(path);
+  tetris_destroy(e);
+}
+END_TEST
+
+START_TEST(layer_tetris_ai) {
+  tetris_config_t cfg = {3, TETRIS_RANDOM_UNIFORM, ""};
+  tetris_engine_t *e = tetris_create(&cfg);
+  tetris_ai_t *ai = tetris_ai_create(2);
+  ck_assert_ptr_nonnull(ai);
+
+  ck_assert_int_eq(tetris_ai_action(ai, e), Start);
+  while (*e->state != STATE_EXIT && e->core.pieces < 500) {
+    tetris_step(e, tetris_ai_action(ai, e));
+  }
+  ck_assert_int_eq(*e->state, STATE_GAME);
+  ck_assert_int_gt(e->core.score, 0);
+
+  tetris_ai_destroy(ai);
+  tetris_destroy(e);
+}
+END_TEST
+
+START_TEST(back_batch_matches_engine) {
+  enum { K = 5 };
+  static const UserAction_t moves[] = {Left, Right, Action, Up, Down};
+  tetris_config_t cfg = {11, TETRIS_RANDOM_BAG7, ""};
+  BatchEnv_t *env = batchCreate(K, &cfg);
+  tetris_engine_t *e[K];
+  UserAction_t acts[K];
+  int rewards[K];
+  uint8_t done[K];
+  int resets = 0;
+  Rng_t rng;
+  ck_assert_ptr_nonnull(env);
+  rngSeed(&rng, 5);
+
+  for (int k = 0; k < K; ++k) {
+    cfg.seed = env->seed[k];
+    e[k] = tetris_create(&cfg);
+    tetris_step(e[k], Start);
+  }
+
+  /* поле пакета повторяет экземпляр игры с тем же зерном, которому после
+     каждого действия (кроме Up и Down) подают тик гравитации */
+  for (int step = 0; step < 3000; ++step) {
+    for (int k = 0; k < K; ++k) {
+      acts[k] = moves[rngBounded(&rng, 5)];
+    }
+    batchStep(env, acts, rewards, done);
+    for (int k = 0; k < K; ++k) {
+      int before = e[k]->core.score;
+      tetris_step(e[k], acts[k]);
+      if (acts[k] != Up && acts[k] != Down && *e[k]->state == STATE_GAME) {
+        tetris_step(e[k], Up);
+      }
+      ck_assert_int_eq(done[k], *e[k]->state == STATE_EXIT);
+      ck_assert_int_eq(rewards[k], e[k]->core.score - before);
+      if (done[k]) {
+        tetris_destroy(e[k]);
+        cfg.seed = env->seed[k];
+        e[k] = tetris_create(&cfg);
+        tetris_step(e[k], Start);
+        ++resets;
+      }
+
+      ck_assert_int_eq(env->piece[k], e[k]->cur_shape->piece);
+      ck_assert_int_eq(env->rot[k], e[k]->cur_shape->rot);
+      ck_assert_int_eq(env->x[k], e[k]->cur_shape->x);
+      ck_assert_int_eq(env->y[k], e[k]->cur_shape->y);
+      ck_assert_int_eq(env->next[k], e[k]->core.next_piece);
+      ck_assert_int_eq(env->score[k], e[k]->core.score);
+      ck_assert_int_eq(env->level[k], e[k]->core.level);
+      ck_assert_int_eq(env->pieces[k], e[k]->core.pieces);
+      clearShape(e[k]);
+      for (int y = 0; y < BATCH_ROWS; ++y) {
+        ck_assert_uint_eq(env->rows[y * K + k], e[k]->core.rows[y]);
+      }
+      placeShape(e[k]);
+    }
+  }
+  ck_assert_int_gt(resets, 0);
+
+  acts[0] = Terminate;
+  batchStep(env, acts, rewards, done);
+  ck_assert_int_eq(done[0], 1);
+  ck_assert_int_eq(env->pieces[0], 0);
+
+  for (int k = 0; k < K; ++k) {
+    tetris_destroy(e[k]);
+  }
+  batchDestroy(env);
+  ck_assert_ptr_null(batchCreate(0, &cfg));
 }
 END_TEST
 
@@ -544,32 +1834,32 @@ START_TEST(back_updtLevel) {
   ck_assert_ptr_nonnull(p);
 
   int new_lev = 600;
-  p->data->score = 500;
+  p->core.score = 500;
   updtLevel(p, &new_lev, 1);
-  ck_assert_int_eq(p->data->level, 1);
+  ck_assert_int_eq(p->core.level, 1);
   ck_assert_int_eq(new_lev, 600);
-  ck_assert_int_eq(p->data->speed, 1000);
+  ck_assert_int_eq(p->core.speed, 1000);
 
-  p->data->score = new_lev;
+  p->core.score = new_lev;
   updtLevel(p, &new_lev, 0);
-  ck_assert_int_eq(p->data->level, 1);
+  ck_assert_int_eq(p->core.level, 1);
   ck_assert_int_eq(new_lev, 600);
-  ck_assert_int_eq(p->data->speed, 1000);
+  ck_assert_int_eq(p->core.speed, 1000);
 
-  int old_speed = p->data->speed;
+  int old_speed = p->core.speed;
   updtLevel(p, &new_lev, 1);
-  ck_assert_int_eq(p->data->level, 2);
+  ck_assert_int_eq(p->core.level, 2);
   ck_assert_int_eq(new_lev, 600 + 600);
-  ck_assert_int_eq(p->data->speed, old_speed - 100);
+  ck_assert_int_eq(p->core.speed, old_speed - 100);
 
-  p->data->level = 10;
+  p->core.level = 10;
   int curr_new_lev = new_lev;
-  int curr_speed = p->data->speed;
-  p->data->score = curr_new_lev + 1000;
+  int curr_speed = p->core.speed;
+  p->core.score = curr_new_lev + 1000;
   updtLevel(p, &new_lev, 1);
-  ck_assert_int_eq(p->data->level, 10);
+  ck_assert_int_eq(p->core.level, 10);
   ck_assert_int_eq(new_lev, curr_new_lev);
-  ck_assert_int_eq(p->data->speed, curr_speed);
+  ck_assert_int_eq(p->core.speed, curr_speed);
 
   freeMemory(p);
 }
@@ -581,24 +1871,31 @@ START_TEST(back_checkLines) {
   clearField(p);
 
   checkLines(p);
-  ck_assert_int_eq(p->data->score, 0);
+  ck_assert_int_eq(p->core.score, 0);
 
   int last = FIELD_HEIGHT - 1;
   for (int x = 0; x < FIELD_WIDTH; ++x) {
-    p->data->field[last][x] = 1;
+    setCell(p, last, x, 1);
   }
 
-  p->data->field[last - 1][0] = 2;
+  setCell(p, last - 1, 0, 2);
 
+  /* линии ищутся в строках последней зафиксированной фигуры */
+  p->cur_shape->piece = PIECE_I;
+  p->cur_shape->rot = 0;
+  p->cur_shape->y = last;
   checkLines(p);
 
   ck_assert_int_eq(p->data->field[last][0], 2);
   for (int x = 1; x < FIELD_WIDTH; ++x) {
     ck_assert_int_eq(p->data->field[last][x], 0);
   }
-  ck_assert_int_eq(p->data->score, 100);
-  ck_assert_int_eq(p->data->high_score, 100);
+  ck_assert_uint_eq(p->core.rows[last], ROW_EMPTY | (1u << ROW_OFFSET));
+  ck_assert_uint_eq(p->core.rows[last - 1], ROW_EMPTY);
+  ck_assert_int_eq(p->core.score, 100);
+  ck_assert_int_eq(p->core.high_score, 100);
 
+  recordFlush();
   FILE *f = fopen("record.txt", "r");
   ck_assert_msg(f != NULL, "record.txt was not created");
   int file_score = 0;
@@ -607,6 +1904,49 @@ START_TEST(back_checkLines) {
   ck_assert_int_eq(file_score, 100);
 
   remove("record.txt");
+  remove("record.txt.lock");
+  freeMemory(p);
+}
+END_TEST
+
+START_TEST(back_checkLines_multi) {
+  GameParams_t *p = getParams();
+  clearField(p);
+  int last = FIELD_HEIGHT - 1;
+
+  /* заполнены last и last - 2, между ними и над ними — по одной клетке */
+  for (int x = 0; x < FIELD_WIDTH; ++x) {
+    setCell(p, last, x, 1);
+    setCell(p, last - 2, x, 1);
+  }
+  setCell(p, last - 1, 5, 3);
+  setCell(p, last - 3, 7, 4);
+
+  p->cur_shape->piece = PIECE_I;
+  p->cur_shape->rot = 1;
+  p->cur_shape->x = 0;
+  p->cur_shape->y = last - 3;
+  checkLines(p);
+
+  ck_assert_int_eq(p->core.score, 300);
+  ck_assert_uint_eq(p->core.rows[last], ROW_EMPTY | (1u << (ROW_OFFSET + 5)));
+  ck_assert_uint_eq(p->core.rows[last - 1],
+                    ROW_EMPTY | (1u << (ROW_OFFSET + 7)));
+  ck_assert_uint_eq(p->core.rows[last - 2], ROW_EMPTY);
+  ck_assert_uint_eq(p->core.rows[last - 3], ROW_EMPTY);
+  for (int y = 0; y < FIELD_HEIGHT; ++y) {
+    for (int x = 0; x < FIELD_WIDTH; ++x) {
+      ck_assert_int_eq(p->data->field[y][x] != 0,
+                       (p->core.rows[y] >> (ROW_OFFSET + x)) & 1);
+    }
+  }
+  ck_assert_int_eq(p->data->field[last][5], 3);
+  ck_assert_int_eq(p->data->field[last - 1][7], 4);
+  ck_assert_int_eq(p->core.skyline[7], last - 1);
+  ck_assert_int_eq(p->core.skyline[0], FIELD_HEIGHT);
+
+  remove("record.txt");
+  remove("record.txt.lock");
   freeMemory(p);
 }
 END_TEST
@@ -622,7 +1962,7 @@ START_TEST(back_autoDown_no_collision) {
 
   ck_assert_int_eq(p->cur_shape->y, old_y + 1);
   ck_assert_int_eq(*(p->state), STATE_START);
-  ck_assert_int_eq(p->data->pause, 0);
+  ck_assert_int_eq(p->core.pause, 0);
 
   freeMemory(p);
 }
@@ -633,7 +1973,9 @@ START_TEST(back_autoDown_collision) {
   ck_assert_ptr_nonnull(p);
   clearField(p);
 
-  p->cur_shape->y = FIELD_HEIGHT - height(p->cur_shape->shape);
+  p->cur_shape->y =
+      FIELD_HEIGHT - 1 -
+      pieceTable[p->cur_shape->piece][p->cur_shape->rot].bottom;
 
   autoDown(p);
 
@@ -649,13 +1991,8 @@ START_TEST(back_down) {
   ck_assert_ptr_nonnull(p);
   clearField(p);
   p->cur_shape->color = 1;
-  for (int i = 0; i < PIECE_SIZE; ++i)
-    for (int j = 0; j < PIECE_SIZE; ++j)
-      if (i == 0) {
-        p->cur_shape->shape[i][j] = 1;
-      } else {
-        p->cur_shape->shape[i][j] = 0;
-      }
+  p->cur_shape->piece = PIECE_I;
+  p->cur_shape->rot = 0;
 
   p->cur_shape->x = 4;
   p->cur_shape->y = 4;
@@ -671,8 +2008,8 @@ START_TEST(back_down) {
 
   ck_assert_int_eq(p->cur_shape->y, 0);
   ck_assert_int_eq(*(p->state), STATE_START);
-  ck_assert_int_eq(p->data->pause, 0);
-  ck_assert_int_eq(p->data->score, 0);
+  ck_assert_int_eq(p->core.pause, 0);
+  ck_assert_int_eq(p->core.score, 0);
 
   freeMemory(p);
 }
@@ -700,10 +2037,10 @@ START_TEST(back_updtInfo) {
   /* test Pause toggling */
   updtInfo(Pause);
   ck_assert_int_eq(*(p->state), STATE_PAUSE);
-  ck_assert_int_eq(p->data->pause, 1);
+  ck_assert_int_eq(p->core.pause, 1);
   updtInfo(Pause);
   ck_assert_int_eq(*(p->state), STATE_GAME);
-  ck_assert_int_eq(p->data->pause, 0);
+  ck_assert_int_eq(p->core.pause, 0);
 
   updtInfo(Down);
   ck_assert_int_eq(p->cur_shape->y, 0);
@@ -726,11 +2063,11 @@ START_TEST(layer_userInput) {
 
   userInput(Pause, true);
   ck_assert_int_eq(*(p->state), STATE_PAUSE);
-  ck_assert_int_eq(p->data->pause, 1);
+  ck_assert_int_eq(p->core.pause, 1);
 
   userInput(Pause, false);
   ck_assert_int_eq(*(p->state), STATE_GAME);
-  ck_assert_int_eq(p->data->pause, 0);
+  ck_assert_int_eq(p->core.pause, 0);
 
   userInput(Terminate, false);
 }
@@ -740,11 +2077,11 @@ START_TEST(layer_updateCurrentState) {
   GameParams_t *p = getParams();
   ck_assert_ptr_nonnull(p);
 
-  p->data->score = 10;
-  p->data->high_score = 20;
-  p->data->level = 3;
-  p->data->speed = 777;
-  p->data->pause = 9;
+  p->core.score = 10;
+  p->core.high_score = 20;
+  p->core.level = 3;
+  p->core.speed = 777;
+  p->core.pause = 9;
   p->data->field[0][0] = 123;
   p->data->next[1][1] = 55;
 
@@ -766,6 +2103,157 @@ START_TEST(layer_updateCurrentState) {
 }
 END_TEST
 
+START_TEST(layer_tetris_engines) {
+  tetris_engine_t *a = tetris_create(NULL);
+  tetris_engine_t *b = tetris_create(NULL);
+  ck_assert_ptr_nonnull(a);
+  ck_assert_ptr_nonnull(b);
+  ck_assert_ptr_ne(a, b);
+
+  tetris_step(a, Start);
+  ck_assert_int_eq(*(a->state), STATE_GAME);
+  ck_assert_int_eq(*(b->state), STATE_START);
+
+  for (int i = 0; i < 200 && *(a->state) == STATE_GAME; i++) {
+    tetris_step(a, Down);
+  }
+  ck_assert_int_eq(*(a->state), STATE_EXIT);
+  ck_assert_int_eq(tetris_state(a).pause, 2);
+  ck_assert_int_eq(*(b->state), STATE_START);
+  ck_assert_int_eq(tetris_state(b).pause, 0);
+
+  tetris_step(b, Start);
+  tetris_step(b, Pause);
+  ck_assert_int_eq(tetris_state(b).pause, 1);
+  tetris_step(b, Terminate);
+  ck_assert_int_eq(*(b->state), STATE_EXIT);
+
+  tetris_destroy(a);
+  tetris_destroy(b);
+}
+END_TEST
+
+START_TEST(layer_restart_after_terminate) {
+  userInput(Start, false);
+  userInput(Terminate, false);
+
+  GameParams_t *p = getParams();
+  ck_assert_ptr_nonnull(p);
+  ck_assert_int_eq(*(p->state), STATE_START);
+  userInput(Start, false);
+  ck_assert_int_eq(*(p->state), STATE_GAME);
+  ck_assert_int_eq(updateCurrentState().score, 0);
+
+  userInput(Terminate, false);
+}
+END_TEST
+
+START_TEST(layer_tetris_pool) {
+  enum { N = 300 };
+  tetris_pool_t *pool = tetris_pool_create(16);
+  ck_assert_ptr_nonnull(pool);
+
+  tetris_engine_t *e[N];
+  for (int i = 0; i < N; i++) {
+    e[i] = tetris_pool_acquire(pool, NULL);
+    ck_assert_ptr_nonnull(e[i]);
+    ck_assert_ptr_eq(e[i]->pool, pool);
+    ck_assert_int_eq((size_t)e[i] % CACHE_LINE, 0);
+    ck_assert_int_eq(tetris_state(e[i]).score, 0);
+  }
+  size_t total = pool->total_blocks;
+  ck_assert_int_ge(total, N);
+
+  tetris_step(e[0], Start);
+  ck_assert_int_eq(*(e[0]->state), STATE_GAME);
+  ck_assert_int_eq(*(e[1]->state), STATE_START);
+
+  for (int i = 0; i < N; i++) {
+    tetris_destroy(e[i]);
+  }
+  for (int i = 0; i < N; i++) {
+    e[i] = tetris_pool_acquire(pool, NULL);
+    ck_assert_int_eq(*(e[i]->state), STATE_START);
+  }
+  ck_assert_int_eq(pool->total_blocks, total);
+
+  tetris_pool_destroy(pool);
+}
+END_TEST
+
+START_TEST(back_rng_seeded) {
+  Rng_t a, b;
+  rngSeed(&a, 42);
+  rngSeed(&b, 42);
+  for (int i = 0; i < 1000; i++) {
+    ck_assert_uint_eq(rngNext(&a), rngNext(&b));
+  }
+  rngSeed(&b, 43);
+  int same = 0;
+  for (int i = 0; i < 100; i++) {
+    same += rngNext(&a) == rngNext(&b);
+  }
+  ck_assert_int_lt(same, 5);
+
+  int hist[PIECE_COUNT] = {0};
+  for (int i = 0; i < 7000; i++) {
+    int v = rngBounded(&a, PIECE_COUNT);
+    ck_assert_int_ge(v, 0);
+    ck_assert_int_lt(v, PIECE_COUNT);
+    hist[v]++;
+  }
+  for (int i = 0; i < PIECE_COUNT; i++) {
+    ck_assert_int_gt(hist[i], 800);
+  }
+}
+END_TEST
+
+START_TEST(back_randomPiece_bag) {
+  tetris_config_t cfg = {.seed = 7, .randomizer = TETRIS_RANDOM_BAG7};
+  GameParams_t *p = newParams(&cfg);
+  ck_assert_int_eq(p->core.bag_left, PIECE_COUNT - 2);
+  p->core.bag_left = 0;
+
+  for (int bag = 0; bag < 50; bag++) {
+    int seen = 0;
+    for (int i = 0; i < PIECE_COUNT; i++) {
+      seen |= 1 << randomPiece(p);
+    }
+    ck_assert_int_eq(seen, (1 << PIECE_COUNT) - 1);
+  }
+
+  freeMemory(p);
+}
+END_TEST
+
+START_TEST(layer_tetris_seed_replays) {
+  tetris_config_t cfg = {.seed = 123456789ULL,
+                         .randomizer = TETRIS_RANDOM_UNIFORM};
+  tetris_engine_t *a = tetris_create(&cfg);
+  tetris_engine_t *b = tetris_create(&cfg);
+
+  tetris_step(a, Start);
+  tetris_step(b, Start);
+  for (int i = 0; i < 300 && *(a->state) == STATE_GAME; i++) {
+    UserAction_t act = (UserAction_t)(Left + i % 5);
+    tetris_step(a, act);
+    tetris_step(b, act);
+    ck_assert_int_eq(a->cur_shape->piece, b->cur_shape->piece);
+    ck_assert_int_eq(a->cur_shape->color, b->cur_shape->color);
+    ck_assert_int_eq(a->core.next_piece, b->core.next_piece);
+  }
+  for (int y = 0; y < FIELD_HEIGHT; y++) {
+    for (int x = 0; x < FIELD_WIDTH; x++) {
+      ck_assert_int_eq(a->data->field[y][x], b->data->field[y][x]);
+    }
+  }
+  ck_assert_int_eq(tetris_state(a).score, tetris_state(b).score);
+
+  tetris_destroy(a);
+  tetris_destroy(b);
+}
+END_TEST
+
 static Suite *tetris_suite(void) {
   Suite *s = suite_create("tetris");
   TCase *tc_core = tcase_create("Core");
@@ -773,23 +2261,31 @@ static Suite *tetris_suite(void) {
   tcase_add_test(tc_core, back_setNewShape);
   tcase_add_test(tc_core, back_setStat);
   tcase_add_test(tc_core, back_setCurShape);
+  tcase_add_test(tc_core, back_newParams_layout);
   tcase_add_test(tc_core, back_getParams);
   tcase_add_test(tc_core, back_clearField);
+  tcase_add_test(tc_core, back_setCell);
   tcase_add_test(tc_core, back_clearShape);
   tcase_add_test(tc_core, back_placeShape);
-  tcase_add_test(tc_core, back_cntEmptyColsL);
-  tcase_add_test(tc_core, back_cntEmptyColsR);
-  tcase_add_test(tc_core, back_height);
+  tcase_add_test(tc_core, back_pieceTable);
+  tcase_add_test(tc_core, back_pieceTable_rotations);
   tcase_add_test(tc_core, back_isPossbl);
-  tcase_add_test(tc_core, back_isSquare);
-  tcase_add_test(tc_core, back_isVertical);
   tcase_add_test(tc_core, back_rotate);
   tcase_add_test(tc_core, back_hasCollisBellow);
+  tcase_add_test(tc_core, back_ghostY);
+  tcase_add_test(tc_core, back_genPlacements);
+  tcase_add_test(tc_core, back_placementPath);
+  tcase_add_test(tc_core, back_aiFeatures);
+  tcase_add_test(tc_core, back_batch_matches_engine);
+  tcase_add_test(tc_core, back_skyline);
   tcase_add_test(tc_core, back_spawnNew);
   tcase_add_test(tc_core, back_updtScore);
   tcase_add_test(tc_core, back_updtHighScore);
+  tcase_add_test(tc_core, back_record);
+  tcase_add_test(tc_core, back_record_shutdown);
   tcase_add_test(tc_core, back_updtLevel);
   tcase_add_test(tc_core, back_checkLines);
+  tcase_add_test(tc_core, back_checkLines_multi);
   tcase_add_test(tc_core, back_autoDown_no_collision);
   tcase_add_test(tc_core, back_autoDown_collision);
   tcase_add_test(tc_core, back_down);
@@ -797,6 +2293,30 @@ static Suite *tetris_suite(void) {
 
   tcase_add_test(tc_core, layer_userInput);
   tcase_add_test(tc_core, layer_updateCurrentState);
+  tcase_add_test(tc_core, layer_tetris_engines);
+  tcase_add_test(tc_core, layer_restart_after_terminate);
+  tcase_add_test(tc_core, layer_tetris_pool);
+  tcase_add_test(tc_core, layer_tetris_observe);
+  tcase_add_test(tc_core, layer_tetris_snapshot);
+  tcase_add_test(tc_core, layer_tetris_snapshot_damage);
+  tcase_add_test(tc_core, layer_tetris_save_restore);
+  tcase_add_test(tc_core, layer_tetris_replay);
+  tcase_add_test(tc_core, layer_tetris_player_seek);
+  tcase_add_test(tc_core, back_snapshot_threads);
+  tcase_add_test(tc_core, layer_tetris_inputq);
+  tcase_add_test(tc_core, back_input_threads);
+  tcase_add_test(tc_core, back_repeat);
+  tcase_add_test(tc_core, layer_tetris_replay_repeat);
+  tcase_add_test(tc_core, back_stats);
+  tcase_add_test(tc_core, layer_tetris_stats_threads);
+  tcase_add_test(tc_core, back_trace);
+  tcase_add_test(tc_core, layer_tetris_trace);
+  tcase_add_test(tc_core, back_zobrist);
+  tcase_add_test(tc_core, back_ttable_threads);
+  tcase_add_test(tc_core, layer_tetris_ai);
+  tcase_add_test(tc_core, back_rng_seeded);
+  tcase_add_test(tc_core, back_randomPiece_bag);
+  tcase_add_test(tc_core, layer_tetris_seed_replays);
 
   suite_add_tcase(s, tc_core);
   return s;
@@ -0,0 +1,667 @@
+/**
+ * \file bench.c
+ * \brief Микробенчмарки горячих путей движка: isPossbl, rotate,
+ * hasCollisBellow, checkLines, down, autoDown и смесь действий через
+ * updtInfo — на трёх наборах позиций: пустое поле, середина партии и поле
+ * перед проигрышем.
+ *
+ * Позиции строятся детерминированно из фиксированных зёрен: фигуры кладёт
+ * встроенный автоигрок, а каждую третью — случайно, пока стакан не дорастёт
+ * до высоты набора, поэтому на поле есть и ровные участки, и дыры. Каждая
+ * операция готовит позицию так, как её видит движок: isPossbl и
+ * hasCollisBellow — с фигурой, снятой с поля, checkLines — сразу после
+ * фиксации фигуры в месте, где она снимает больше всего линий, autoDown и
+ * rotate — с фигурой на случайной высоте над местом приземления.
+ *
+ * Число операций подбирается так, чтобы замер шёл не меньше -m мс; замер
+ * повторяется BENCH_RUNS раз, и берётся лучший. Операции, которые портят
+ * позицию (checkLines, down, autoDown), каждый раз начинаются с позиции из
+ * набора, и время restoreCore() вычитается; остальные идут по BOARD_RUN
+ * операций на позиции. Выделения памяти считаются через --wrap
+ * компоновщика (на macOS его нет, и allocs_per_op там null).
+ *
+ * Результат — JSON в stdout, по замеру на строку. С -c он сравнивается с
+ * сохранённым результатом: замер, ставший медленнее больше чем на -t
+ * процентов (и больше чем на NOISE_NS), — регрессия, и код возврата 1.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../brick_game/tetris/back.h"
+
+/// \brief Позиций в каждом наборе.
+#define CORPUS_SIZE 32
+/// \brief Сколько заранее выбранных аргументов перебирают операции.
+#define ARG_COUNT 1024
+/// \brief Сколько операций подряд идут на одной позиции, если операция её
+/// не портит.
+#define BOARD_RUN 64
+/// \brief Сколько раз повторяется каждый замер (берётся лучший).
+#define BENCH_RUNS 5
+/// \brief Больше стольких фигур при построении позиции не кладётся.
+#define BUILD_PIECES 2000
+/// \brief Больше стольких зёрен на позицию набора не перебирается.
+#define BUILD_TRIES 100
+/// \brief Наибольшая длина имени замера или набора.
+#define NAME_LEN 32
+/// \brief Изменение меньше стольких наносекунд регрессией не считается.
+#define NOISE_NS 0.5
+
+/// \brief Набор позиций: имя, высота стакана и первое зерно.
+typedef struct {
+  const char *name;
+  int height;
+  uint64_t seed;
+} Corpus_t;
+
+/// \brief Аргумент операции: положение фигуры для isPossbl и действие для
+/// смеси updtInfo.
+typedef struct {
+  int8_t rot;
+  int8_t x;
+  int8_t y;
+  UserAction_t action;
+} BenchArg_t;
+
+/**
+ * \brief Замер: операция, подготовка позиции из набора (NULL — позиция как
+ * есть) и fresh — операция портит позицию, поэтому каждая начинается с
+ * позиции из набора.
+ */
+typedef struct {
+  const char *name;
+  int (*op)(GameParams_t *params, const BenchArg_t *arg);
+  void (*prepare)(GameParams_t *params, Rng_t *rng);
+  int fresh;
+} Bench_t;
+
+/// \brief Итог замера.
+typedef struct {
+  char name[NAME_LEN];
+  char corpus[NAME_LEN];
+  double ns;
+  double allocs;
+} Result_t;
+
+/// \brief Параметры запуска.
+typedef struct {
+  int min_ms;
+  double threshold;
+  const char *baseline;
+} BenchConfig_t;
+
+static const Corpus_t corpora[] = {
+    {"empty", 0, 1000}, {"mid", 8, 2000}, {"topout", 15, 3000}};
+
+/// \brief Сюда складываются результаты операций, чтобы компилятор их не
+/// выбросил.
+static volatile int sink;
+
+/// \brief Сколько раз движок выделял память.
+static long allocs;
+
+#ifndef BENCH_NO_WRAP
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t size);
+void *__real_aligned_alloc(size_t align, size_t size);
+
+void *__wrap_malloc(size_t size) {
+  allocs += 1;
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size) {
+  allocs += 1;
+  return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *p, size_t size) {
+  allocs += 1;
+  return __real_realloc(p, size);
+}
+
+void *__wrap_aligned_alloc(size_t align, size_t size) {
+  allocs += 1;
+  return __real_aligned_alloc(align, size);
+}
+#endif
+
+static int opIsPossbl(GameParams_t *params, const BenchArg_t *arg) {
+  return isPossbl(params, params->cur_shape->piece, arg->rot, arg->x, arg->y);
+}
+
+static int opRotate(GameParams_t *params, const BenchArg_t *arg) {
+  (void)arg;
+  rotate(params);
+  return params->cur_shape->rot;
+}
+
+static int opCollis(GameParams_t *params, const BenchArg_t *arg) {
+  (void)arg;
+  return hasCollisBellow(params);
+}
+
+static int opCheckLines(GameParams_t *params, const BenchArg_t *arg) {
+  (void)arg;
+  checkLines(params);
+  return params->core.score;
+}
+
+static int opDown(GameParams_t *params, const BenchArg_t *arg) {
+  (void)arg;
+  down(params);
+  return params->cur_shape->y;
+}
+
+static int opAutoDown(GameParams_t *params, const BenchArg_t *arg) {
+  (void)arg;
+  autoDown(params);
+  return params->cur_shape->y;
+}
+
+static int opUpdtInfo(GameParams_t *params, const BenchArg_t *arg) {
+  updtInfo(arg->action);
+  return params->cur_shape->x;
+}
+
+/// \brief Пустая операция: по ней меряется стоимость restoreCore().
+static int opNothing(GameParams_t *params, const BenchArg_t *arg) {
+  (void)params;
+  (void)arg;
+  return 0;
+}
+
+/**
+ * \brief Опускает фигуру на случайную высоту между текущей и местом
+ * приземления (включительно).
+ * \param params Параметры игры.
+ * \param rng Генератор.
+ */
+static void lowerPiece(GameParams_t *params, Rng_t *rng) {
+  clearShape(params);
+  int land = ghostY(params);
+  params->cur_shape->y += rngBounded(rng, land - params->cur_shape->y + 1);
+  placeShape(params);
+}
+
+/**
+ * \brief Снимает фигуру с поля, как перед проверкой хода.
+ * \param params Параметры игры.
+ * \param rng Генератор (не используется).
+ */
+static void liftPiece(GameParams_t *params, Rng_t *rng) {
+  (void)rng;
+  clearShape(params);
+}
+
+/**
+ * \brief Опускает фигуру на случайную высоту и снимает её с поля.
+ * \param params Параметры игры.
+ * \param rng Генератор.
+ */
+static void lowerLift(GameParams_t *params, Rng_t *rng) {
+  lowerPiece(params, rng);
+  clearShape(params);
+}
+
+/**
+ * \brief Считает строки, которые заполнит фигура в положении s.
+ * \param rows Маски строк поля без фигуры.
+ * \param s Положение фигуры.
+ * \return Число заполненных строк.
+ */
+static int fullRows(const uint16_t *rows, const Shape *s) {
+  const PieceGeom_t *g = &pieceTable[s->piece][s->rot];
+  int res = 0;
+
+  for (int i = g->top; i <= g->bottom; ++i) {
+    uint16_t row = rows[s->y + i] | (uint16_t)(g->rows[i]
+                                               << (s->x + ROW_OFFSET));
+    res += row == ROW_FULL;
+  }
+
+  return res;
+}
+
+/**
+ * \brief Фиксирует фигуру там, где она снимет больше всего линий (при
+ * равенстве — в первом таком положении), но линии не снимает: позиция
+ * такая, какой её получает checkLines().
+ * \param params Параметры игры.
+ * \param rng Генератор (не используется).
+ */
+static void lockBest(GameParams_t *params, Rng_t *rng) {
+  Shape *s = params->cur_shape;
+  Shape pick = *s;
+  int best = -1;
+
+  (void)rng;
+  clearShape(params);
+  Shape start = *s;
+  for (int rot = 0; rot < ROT_COUNT; ++rot) {
+    for (int x = 1 - PIECE_SIZE; x < FIELD_WIDTH; ++x) {
+      if (isPossbl(params, start.piece, rot, x, start.y)) {
+        s->rot = rot;
+        s->x = x;
+        s->y = start.y;
+        s->y = ghostY(params);
+        int full = fullRows(params->core.rows, s);
+        if (full > best) {
+          best = full;
+          pick = *s;
+        }
+      }
+    }
+  }
+  *s = pick;
+  lockShape(params);
+}
+
+/**
+ * \brief Высота стакана: от дна до верхней зафиксированной клетки.
+ * \param params Параметры игры.
+ * \return Число строк.
+ */
+static int stackHeight(const GameParams_t *params) {
+  int top = FIELD_HEIGHT;
+
+  for (int x = 0; x < FIELD_WIDTH; ++x) {
+    if (params->core.skyline[x] < top) {
+      top = params->core.skyline[x];
+    }
+  }
+
+  return FIELD_HEIGHT - top;
+}
+
+/**
+ * \brief Кладёт текущую фигуру: поворачивает, сдвигает на случайное число
+ * столбцов и бросает вниз.
+ * \param params Параметры игры.
+ * \param rng Генератор.
+ */
+static void randomDrop(GameParams_t *params, Rng_t *rng) {
+  int turns = rngBounded(rng, ROT_COUNT);
+  int dx = rngBounded(rng, FIELD_WIDTH + 1) - FIELD_WIDTH / 2;
+
+  for (int i = 0; i < turns; ++i) {
+    updtGame(params, Action);
+  }
+  for (int i = 0; i < abs(dx); ++i) {
+    updtGame(params, dx < 0 ? Left : Right);
+  }
+  updtGame(params, Down);
+}
+
+/**
+ * \brief Строит позицию набора: начинает партию и кладёт фигуры, пока
+ * стакан не дорастёт до высоты набора.
+ * \param corpus Набор.
+ * \param seed Зерно партии.
+ * \param ai Автоигрок.
+ * \param out Позиция (заполняется).
+ * \return 1, если высота достигнута и партия не закончилась, иначе 0.
+ */
+static int buildBoard(const Corpus_t *corpus, uint64_t seed, tetris_ai_t *ai,
+                      GameCore_t *out) {
+  tetris_config_t cfg = {seed, TETRIS_RANDOM_UNIFORM, ""};
+  GameParams_t *params = newParams(&cfg);
+  Rng_t rng;
+  int placed = 0;
+
+  rngSeed(&rng, seed);
+  updtGame(params, Start);
+  while (*params->state == STATE_GAME &&
+         stackHeight(params) < corpus->height && placed < BUILD_PIECES) {
+    if (rngBounded(&rng, 3) == 0) {
+      randomDrop(params, &rng);
+    } else {
+      int pieces = params->core.pieces;
+      while (*params->state == STATE_GAME && params->core.pieces == pieces) {
+        updtGame(params, tetris_ai_action(ai, params));
+      }
+    }
+    ++placed;
+  }
+
+  int res = *params->state == STATE_GAME &&
+            stackHeight(params) >= corpus->height;
+  saveCore(params, out);
+  freeMemory(params);
+
+  return res;
+}
+
+/**
+ * \brief Строит все наборы позиций.
+ * \param boards Позиции, по CORPUS_SIZE на набор (заполняются).
+ * \return 0 при успехе, 1, если какой-то набор не построился.
+ */
+static int buildCorpora(GameCore_t boards[][CORPUS_SIZE]) {
+  tetris_ai_t *ai = tetris_ai_create(0);
+  int n = (int)(sizeof corpora / sizeof corpora[0]);
+  int res = ai ? 0 : 1;
+
+  for (int c = 0; c < n && res == 0; ++c) {
+    uint64_t seed = corpora[c].seed;
+    uint64_t last = seed + (uint64_t)CORPUS_SIZE * BUILD_TRIES;
+    int k = 0;
+    while (k < CORPUS_SIZE && seed < last) {
+      k += buildBoard(&corpora[c], seed++, ai, &boards[c][k]);
+    }
+    res = k < CORPUS_SIZE;
+  }
+  tetris_ai_destroy(ai);
+
+  return res;
+}
+
+/**
+ * \brief Время между двумя отметками.
+ * \param t0 Начало.
+ * \param t1 Конец.
+ * \return Наносекунды.
+ */
+static double elapsedNs(const struct timespec *t0, const struct timespec *t1) {
+  return (double)(t1->tv_sec - t0->tv_sec) * 1e9 +
+         (double)(t1->tv_nsec - t0->tv_nsec);
+}
+
+/**
+ * \brief Выполняет операцию ops раз на позициях набора.
+ * \param b Замер (fresh — каждая операция с позиции из набора).
+ * \param op Операция (для вычитаемого замера — opNothing()).
+ * \param params Экземпляр игры.
+ * \param set Подготовленные позиции.
+ * \param args Аргументы операций.
+ * \param ops Сколько операций.
+ * \param alloc_count Сколько раз выделялась память (заполняется).
+ * \return Время, нс.
+ */
+static double timeRun(const Bench_t *b,
+                      int (*op)(GameParams_t *, const BenchArg_t *),
+                      GameParams_t *params, const GameCore_t *set,
+                      const BenchArg_t *args, long ops, long *alloc_count) {
+  struct timespec t0, t1;
+  long before = allocs;
+  int acc = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (long i = 0; i < ops; ++i) {
+    if (b->fresh) {
+      restoreCore(params, &set[i % CORPUS_SIZE]);
+    } else if (i % BOARD_RUN == 0 || *params->state != STATE_GAME) {
+      restoreCore(params, &set[i / BOARD_RUN % CORPUS_SIZE]);
+    }
+    acc += op(params, &args[i % ARG_COUNT]);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  *alloc_count = allocs - before;
+  sink += acc;
+
+  return elapsedNs(&t0, &t1);
+}
+
+/**
+ * \brief Меряет операцию на наборе: подбирает число операций под min_ms и
+ * берёт лучший из BENCH_RUNS замеров; у портящих позицию операций
+ * вычитается лучший замер одного restoreCore().
+ * \param b Замер.
+ * \param params Экземпляр игры.
+ * \param set Подготовленные позиции.
+ * \param args Аргументы операций.
+ * \param min_ms Наименьшая длительность замера, мс.
+ * \param out Итог (заполняются ns и allocs).
+ */
+static void measure(const Bench_t *b, GameParams_t *params,
+                    const GameCore_t *set, const BenchArg_t *args, int min_ms,
+                    Result_t *out) {
+  long ops = ARG_COUNT;
+  long count = 0;
+  double target = (double)min_ms * 1e6;
+
+  while (timeRun(b, b->op, params, set, args, ops, &count) < target / 4) {
+    ops *= 2;
+  }
+  ops *= 4;
+
+  double best = -1;
+  double base = b->fresh ? -1 : 0;
+  for (int r = 0; r < BENCH_RUNS; ++r) {
+    double t = timeRun(b, b->op, params, set, args, ops, &count);
+    best = best < 0 || t < best ? t : best;
+    if (b->fresh) {
+      long none = 0;
+      t = timeRun(b, opNothing, params, set, args, ops, &none);
+      base = base < 0 || t < base ? t : base;
+    }
+  }
+
+  out->ns = best > base ? (best - base) / (double)ops : 0;
+  out->allocs = (double)count / (double)ops;
+}
+
+/**
+ * \brief Выбирает аргументы операций: положения фигуры в пределах поля и
+ * стен и смесь действий, похожую на игру (чаще всего тик и сдвиги).
+ * \param args Аргументы (заполняются).
+ */
+static void makeArgs(BenchArg_t *args) {
+  static const UserAction_t mix[] = {Left,   Left, Left, Left, Right, Right,
+                                     Right,  Right, Action, Action, Action,
+                                     Up,     Up,   Up,   Up,   Up,    Up,
+                                     Up,     Down, Down};
+  Rng_t rng;
+
+  rngSeed(&rng, 42);
+  for (int i = 0; i < ARG_COUNT; ++i) {
+    args[i].rot = (int8_t)rngBounded(&rng, ROT_COUNT);
+    args[i].x = (int8_t)(rngBounded(&rng, FIELD_WIDTH + 2) - 2);
+    args[i].y = (int8_t)rngBounded(&rng, FIELD_HEIGHT);
+    args[i].action = mix[rngBounded(&rng, (int)(sizeof mix / sizeof mix[0]))];
+  }
+}
+
+/**
+ * \brief Печатает итог замера строкой JSON.
+ * \param r Итог.
+ * \param last 1 — последний замер (без запятой).
+ */
+static void printResult(const Result_t *r, int last) {
+  printf("    {\"name\": \"%s\", \"corpus\": \"%s\", \"ns_per_op\": %.3f, "
+         "\"ops_per_sec\": %.0f, \"allocs_per_op\": ",
+         r->name, r->corpus, r->ns, r->ns > 0 ? 1e9 / r->ns : 0.0);
+#ifdef BENCH_NO_WRAP
+  printf("null");
+#else
+  printf("%.3f", r->allocs);
+#endif
+  printf("}%s\n", last ? "" : ",");
+}
+
+/**
+ * \brief Сравнивает замеры с сохранённым результатом и печатает таблицу в
+ * stderr.
+ * \param cfg Параметры запуска (baseline и threshold).
+ * \param results Замеры.
+ * \param n Число замеров.
+ * \return Число регрессий или -1, если файл не читается.
+ */
+static int compare(const BenchConfig_t *cfg, const Result_t *results, int n) {
+  FILE *f = fopen(cfg->baseline, "r");
+  char line[256];
+  int res = f ? 0 : -1;
+  double *base = calloc((size_t)n, sizeof *base);
+
+  if (!base) {
+    res = -1;
+  }
+  while (res == 0 && fgets(line, sizeof line, f)) {
+    char name[NAME_LEN];
+    char corpus[NAME_LEN];
+    double ns;
+    const char *p = strstr(line, "{\"name\"");
+    if (p && sscanf(p,
+                    "{\"name\": \"%31[^\"]\", \"corpus\": \"%31[^\"]\", "
+                    "\"ns_per_op\": %lf",
+                    name, corpus, &ns) == 3) {
+      for (int i = 0; i < n; ++i) {
+        if (strcmp(results[i].name, name) == 0 &&
+            strcmp(results[i].corpus, corpus) == 0) {
+          base[i] = ns;
+        }
+      }
+    }
+  }
+
+  if (res == 0) {
+    fprintf(stderr, "compare with %s (threshold %.0f%%):\n", cfg->baseline,
+            cfg->threshold);
+    for (int i = 0; i < n; ++i) {
+      const Result_t *r = &results[i];
+      fprintf(stderr, "  %-16s %-8s", r->name, r->corpus);
+      if (base[i] > 0) {
+        double change = (r->ns - base[i]) / base[i] * 100;
+        int slow =
+            change > cfg->threshold && r->ns - base[i] > NOISE_NS;
+        fprintf(stderr, " %10.3f -> %10.3f ns  %+6.1f%%%s\n", base[i], r->ns,
+                change, slow ? "  REGRESSION" : "");
+        res += slow;
+      } else {
+        fprintf(stderr, " %10s -> %10.3f ns  new\n", "-", r->ns);
+      }
+    }
+    fprintf(stderr, "regressions: %d\n", res);
+  }
+  if (f) {
+    fclose(f);
+  }
+  free(base);
+
+  return res;
+}
+
+/**
+ * \brief Печатает справку по параметрам командной строки.
+ * \param prog Имя программы.
+ */
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "usage: %s [-m ms] [-c baseline.json] [-t percent]\n"
+          "  -m  наименьшая длительность одного замера, мс (по умолчанию "
+          "50)\n"
+          "  -c  сравнить с сохранённым результатом; код возврата 1 при "
+          "регрессии\n"
+          "  -t  допустимое замедление, %% (по умолчанию 10)\n",
+          prog);
+}
+
+/**
+ * \brief Разбирает параметры командной строки.
+ * \param argc Число аргументов.
+ * \param argv Аргументы.
+ * \param cfg Параметры запуска (заполняются).
+ * \return 0 при успехе, иначе 1.
+ */
+static int parseArgs(int argc, char **argv, BenchConfig_t *cfg) {
+  int opt;
+  int res = 0;
+
+  while (!res && (opt = getopt(argc, argv, "m:c:t:")) != -1) {
+    if (opt == 'm') {
+      cfg->min_ms = atoi(optarg);
+    } else if (opt == 'c') {
+      cfg->baseline = optarg;
+    } else if (opt == 't') {
+      cfg->threshold = atof(optarg);
+    } else {
+      res = 1;
+    }
+  }
+
+  if (optind != argc || cfg->min_ms <= 0 || cfg->threshold < 0) {
+    res = 1;
+  }
+
+  return res;
+}
+
+int main(int argc, char **argv) {
+  static const Bench_t benches[] = {
+      {"isPossbl", opIsPossbl, liftPiece, 0},
+      {"rotate", opRotate, lowerPiece, 0},
+      {"hasCollisBellow", opCollis, lowerLift, 0},
+      {"checkLines", opCheckLines, lockBest, 1},
+      {"down", opDown, NULL, 1},
+      {"autoDown", opAutoDown, lowerPiece, 1},
+      {"updtInfo_mix", opUpdtInfo, NULL, 0}};
+  enum {
+    BENCH_COUNT = sizeof benches / sizeof benches[0],
+    CORPUS_COUNT = sizeof corpora / sizeof corpora[0]
+  };
+  static GameCore_t boards[CORPUS_COUNT][CORPUS_SIZE];
+  static BenchArg_t args[ARG_COUNT];
+  static Result_t results[BENCH_COUNT * CORPUS_COUNT];
+  BenchConfig_t cfg = {50, 10, NULL};
+
+  if (parseArgs(argc, argv, &cfg)) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (buildCorpora(boards) != 0) {
+    fprintf(stderr, "cannot build board corpora\n");
+    return 1;
+  }
+  makeArgs(args);
+
+  // updtInfo() ходит экземпляром по умолчанию, поэтому меряется всё на нём;
+  // рекорд в файл не пишется
+  GameParams_t *params = getParams();
+  params->record_path = "";
+
+  int n = 0;
+  for (int b = 0; b < BENCH_COUNT; ++b) {
+    for (int c = 0; c < CORPUS_COUNT; ++c) {
+      GameCore_t set[CORPUS_SIZE];
+      Rng_t rng;
+      rngSeed(&rng, corpora[c].seed);
+      for (int k = 0; k < CORPUS_SIZE; ++k) {
+        restoreCore(params, &boards[c][k]);
+        if (benches[b].prepare) {
+          benches[b].prepare(params, &rng);
+        }
+        saveCore(params, &set[k]);
+      }
+      Result_t *r = &results[n++];
+      snprintf(r->name, sizeof r->name, "%s", benches[b].name);
+      snprintf(r->corpus, sizeof r->corpus, "%s", corpora[c].name);
+      measure(&benches[b], params, set, args, cfg.min_ms, r);
+    }
+  }
+
+  printf("{\n  \"min_time_ms\": %d,\n  \"runs\": %d,\n  \"benchmarks\": [\n",
+         cfg.min_ms, BENCH_RUNS);
+  for (int i = 0; i < n; ++i) {
+    printResult(&results[i], i == n - 1);
+  }
+  printf("  ]\n}\n");
+  updtInfo(Terminate);
+
+  int res = 0;
+  if (cfg.baseline) {
+    int slow = compare(&cfg, results, n);
+    if (slow < 0) {
+      perror(cfg.baseline);
+    }
+    res = slow != 0;
+  }
+
+  return res;
+}
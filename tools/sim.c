@@ -0,0 +1,524 @@
+/**
+ * \file sim.c
+ * \brief Пакетный симулятор: прогоняет N партий без ncurses на нескольких
+ * потоках и печатает производительность и распределение очков.
+ *
+ * Каждая партия управляется политикой: random — случайные действия,
+ * script — циклически повторяемая строка действий, heuristic — перебор
+ * всех достижимых положений текущей фигуры с оценкой получившегося поля,
+ * ai — встроенный автоигрок (лучевой поиск с учётом следующей фигуры).
+ *
+ * С -W первая партия (зерно -s) записывается в повтор, а с -P симулятор
+ * вместо партий проигрывает готовый повтор и сверяет контрольные суммы, так
+ * что изменение движка можно проверить на записанных партиях игроков.
+ * С -D движок во всех потоках считает действия, их задержки, снятые линии и
+ * отвергнутые повороты, и после прогона статистика пишется в файл, а с -T
+ * так же пишется трассировка этапов движка.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../brick_game/tetris/ai.h"
+#include "../brick_game/tetris/back.h"
+#include "../brick_game/tetris/movegen.h"
+#include "../brick_game/tetris/replay.h"
+
+/// \brief Сколько случайных переходов делает -P для замера.
+#define SEEK_COUNT 1000
+
+/// \brief Политика выбора действий.
+typedef enum {
+  POLICY_RANDOM,
+  POLICY_SCRIPT,
+  POLICY_HEURISTIC,
+  POLICY_AI
+} Policy_t;
+
+/// \brief Параметры запуска симулятора.
+typedef struct {
+  long games;
+  int threads;
+  Policy_t policy;
+  const char *script;
+  unsigned long long seed;
+  tetris_randomizer_t randomizer;
+  int max_pieces;
+  const char *record_path;
+  const char *replay_out;
+  const char *replay_in;
+  const char *stats_out;
+  const char *trace_out;
+} SimConfig_t;
+
+/// \brief Результат одной партии.
+typedef struct {
+  int score;
+  int pieces;
+} SimResult_t;
+
+/// \brief Общие для всех потоков данные: очередь партий и массив итогов.
+typedef struct {
+  const SimConfig_t *cfg;
+  SimResult_t *results;
+  atomic_long next_game;
+} SimShared_t;
+
+/// \brief План эвристической политики: действия до фиксации фигуры.
+typedef struct {
+  UserAction_t acts[MOVEGEN_PATH_MAX];
+  int len;
+  int pos;
+} Plan_t;
+
+/**
+ * \brief Преобразует символ сценария в действие (клавиши как во фронте,
+ * '.' — тик гравитации).
+ * \param c Символ.
+ * \return Действие.
+ */
+static UserAction_t scriptAction(char c) {
+  UserAction_t res = Up;
+
+  if (c == 'a') {
+    res = Left;
+  } else if (c == 'd') {
+    res = Right;
+  } else if (c == 's') {
+    res = Down;
+  } else if (c == 'r') {
+    res = Action;
+  }
+
+  return res;
+}
+
+/**
+ * \brief Выбирает лучшее положение текущей фигуры: генератор ходов перебирает
+ * все достижимые положения фиксации, поле после каждого оценивается той же
+ * aiEvaluate(), что и у автоигрока, и план — путь к лучшему из них.
+ * \param params Параметры игры (текущая фигура лежит на поле).
+ * \param plan План хода (заполняется).
+ */
+static void planMove(const GameParams_t *params, Plan_t *plan) {
+  const Shape *s = params->cur_shape;
+  const PieceGeom_t *cur = &pieceTable[s->piece][s->rot];
+  uint16_t base[FIELD_HEIGHT + PIECE_SIZE];
+  Placement_t moves[MOVEGEN_MAX];
+  int best = -1;
+  double best_score = -1e300;
+
+  memcpy(base, params->core.rows, sizeof(base));
+  for (int i = cur->top; i <= cur->bottom; ++i) {
+    base[s->y + i] &= (uint16_t)~(cur->rows[i] << (s->x + ROW_OFFSET));
+  }
+
+  int n = genPlacements(base, s, moves);
+  for (int k = 0; k < n; ++k) {
+    uint16_t tmp[FIELD_HEIGHT + PIECE_SIZE];
+    memcpy(tmp, base, sizeof(tmp));
+    int lines = lockPlacement(tmp, s->piece, moves[k]);
+    double score = aiEvaluate(tmp, lines);
+    if (score > best_score) {
+      best_score = score;
+      best = k;
+    }
+  }
+
+  plan->pos = 0;
+  plan->len = best < 0 ? -1
+                       : placementPath(base, s, moves[best], plan->acts,
+                                       MOVEGEN_PATH_MAX);
+}
+
+/**
+ * \brief Играет одну партию до конца игры или лимита фигур.
+ * \param cfg Параметры симулятора.
+ * \param engine Экземпляр игры.
+ * \param rng Генератор для политики random.
+ * \param ai Автоигрок для политики ai.
+ * \param rec Запись повтора партии или NULL.
+ * \return Итог партии.
+ */
+static SimResult_t playGame(const SimConfig_t *cfg, tetris_engine_t *engine,
+                            Rng_t *rng, AiPlayer_t *ai, ReplayWriter_t *rec) {
+  static const UserAction_t moves[] = {Left, Right, Action, Up, Down};
+  size_t script_len = strlen(cfg->script);
+  size_t tick = 0;
+  Plan_t plan;
+  int planned = -1;
+
+  tetris_step(engine, Start);
+  tetris_record(rec, engine, 0, Start);
+  while (*engine->state == STATE_GAME &&
+         engine->core.pieces < cfg->max_pieces) {
+    UserAction_t act = Down;
+
+    if (cfg->policy == POLICY_RANDOM) {
+      act = moves[rngBounded(rng, sizeof(moves) / sizeof(moves[0]))];
+    } else if (cfg->policy == POLICY_SCRIPT) {
+      act = scriptAction(cfg->script[tick % script_len]);
+    } else if (cfg->policy == POLICY_AI) {
+      act = aiAction(ai, engine);
+    } else {
+      if (planned != engine->core.pieces) {
+        planMove(engine, &plan);
+        planned = engine->core.pieces;
+      }
+      if (plan.pos < plan.len) {
+        act = plan.acts[plan.pos++];
+      }
+    }
+
+    tetris_step(engine, act);
+    ++tick;
+    tetris_record(rec, engine, tick, act);
+  }
+
+  SimResult_t res = {engine->core.score, engine->core.pieces};
+  return res;
+}
+
+/**
+ * \brief Рабочий поток: разбирает партии из общей очереди, пока они есть.
+ * У каждого потока свой пул экземпляров.
+ * \param arg Указатель на SimShared_t.
+ * \return NULL.
+ */
+static void *worker(void *arg) {
+  SimShared_t *sh = arg;
+  const SimConfig_t *cfg = sh->cfg;
+  tetris_pool_t *pool = tetris_pool_create(1);
+  AiPlayer_t *ai = cfg->policy == POLICY_AI ? aiCreate(0) : NULL;
+
+  tetris_trace_thread("worker");
+  for (long i = atomic_fetch_add(&sh->next_game, 1);
+       pool && (ai || cfg->policy != POLICY_AI) && i < cfg->games;
+       i = atomic_fetch_add(&sh->next_game, 1)) {
+    tetris_config_t tc = {cfg->seed + (unsigned long long)i, cfg->randomizer,
+                          cfg->record_path};
+    tetris_engine_t *engine = tetris_pool_acquire(pool, &tc);
+    Rng_t rng;
+
+    if (!engine) {
+      break;
+    }
+    ReplayWriter_t *rec = NULL;
+    if (i == 0 && cfg->replay_out) {
+      rec = replayCreate(cfg->replay_out, engine);
+      if (!rec) {
+        perror(cfg->replay_out);
+      }
+    }
+    rngSeed(&rng, tc.seed ^ 0x9e3779b97f4a7c15ull);
+    sh->results[i] = playGame(cfg, engine, &rng, ai, rec);
+    if (replayClose(rec) != 0) {
+      perror(cfg->replay_out);
+    }
+    tetris_destroy(engine);
+  }
+
+  aiDestroy(ai);
+  tetris_pool_destroy(pool);
+  return NULL;
+}
+
+/**
+ * \brief Сравнение целых для qsort.
+ */
+static int cmpInt(const void *a, const void *b) {
+  int x = *(const int *)a;
+  int y = *(const int *)b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * \brief Печатает производительность и распределение очков.
+ * \param cfg Параметры симулятора.
+ * \param results Итоги партий.
+ * \param seconds Время прогона.
+ */
+static void report(const SimConfig_t *cfg, const SimResult_t *results,
+                   double seconds) {
+  static const char *names[] = {"random", "script", "heuristic", "ai"};
+  static const int pct[] = {10, 25, 50, 75, 90, 99};
+  int *scores = malloc(sizeof(int) * (size_t)cfg->games);
+  long long pieces = 0;
+  double sum = 0;
+
+  if (!scores) {
+    perror("malloc");
+    return;
+  }
+  for (long i = 0; i < cfg->games; ++i) {
+    scores[i] = results[i].score;
+    pieces += results[i].pieces;
+    sum += results[i].score;
+  }
+  qsort(scores, (size_t)cfg->games, sizeof(int), cmpInt);
+
+  printf("policy:     %s\n", names[cfg->policy]);
+  printf("randomizer: %s\n",
+         cfg->randomizer == TETRIS_RANDOM_BAG7 ? "bag7" : "uniform");
+  printf("games:      %ld (%d threads, seeds %llu..%llu)\n", cfg->games,
+         cfg->threads, cfg->seed, cfg->seed + (unsigned long long)cfg->games - 1);
+  printf("time:       %.3f s\n", seconds);
+  printf("games/sec:  %.1f\n", cfg->games / seconds);
+  printf("pieces/sec: %.1f (%lld pieces)\n", pieces / seconds, pieces);
+  printf("score:      min %d  mean %.1f  max %d\n", scores[0],
+         sum / cfg->games, scores[cfg->games - 1]);
+  for (size_t k = 0; k < sizeof(pct) / sizeof(pct[0]); ++k) {
+    printf("  p%-3d %d\n", pct[k], scores[(cfg->games - 1) * pct[k] / 100]);
+  }
+
+  free(scores);
+}
+
+/**
+ * \brief Время между двумя отметками.
+ * \param t0 Начало.
+ * \param t1 Конец.
+ * \return Секунды.
+ */
+static double elapsed(const struct timespec *t0, const struct timespec *t1) {
+  return (double)(t1->tv_sec - t0->tv_sec) +
+         (double)(t1->tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+/**
+ * \brief Переходит к случайным тактам повтора и печатает среднее время
+ * перехода.
+ * \param path Файл повтора.
+ * \param ticks Такт последнего события.
+ * \return 0, если все переходы удались, иначе 1.
+ */
+static int seekBench(const char *path, unsigned long long ticks) {
+  tetris_player_t *player = tetris_player_open(path);
+  struct timespec t0, t1;
+  Rng_t rng;
+  int res = player ? 0 : 1;
+
+  rngSeed(&rng, 1);
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (int i = 0; i < SEEK_COUNT && res == 0; ++i) {
+    uint64_t r = (uint64_t)rngNext(&rng) << 32 | rngNext(&rng);
+    res = tetris_player_seek(player, r % (ticks + 1)) != 0;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+
+  if (res == 0) {
+    printf("seek:       %.1f us mean (%d random ticks)\n",
+           elapsed(&t0, &t1) / SEEK_COUNT * 1e6, SEEK_COUNT);
+  }
+  tetris_player_close(player);
+
+  return res;
+}
+
+/**
+ * \brief Проигрывает повтор без интерфейса и печатает скорость, итог
+ * сверки контрольных сумм и время перехода к случайному такту.
+ * \param path Файл повтора.
+ * \return 0, если состояние ни разу не разошлось с записанным, иначе 1.
+ */
+static int playback(const char *path) {
+  tetris_replay_t out;
+  struct timespec t0, t1;
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  int res = tetris_replay(path, &out);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+
+  double seconds = elapsed(&t0, &t1);
+  if (res < 0) {
+    fprintf(stderr, "%s: not a replay or truncated\n", path);
+  } else {
+    printf("replay:     %s\n", path);
+    printf("events:     %ld (%llu ticks)\n", out.events, out.ticks);
+    printf("time:       %.6f s\n", seconds);
+    printf("events/sec: %.1f\n", out.events / (seconds > 0 ? seconds : 1e-9));
+    printf("score:      %d (%d pieces)\n", out.score, out.pieces);
+    if (res == 0) {
+      printf("checksums:  ok\n");
+      res = seekBench(path, out.ticks);
+    } else {
+      printf("checksums:  diverged at event %ld\n", out.mismatch);
+    }
+  }
+
+  return res != 0;
+}
+
+/**
+ * \brief Пишет статистику (-D) и трассировку (-T) движка, собранные всеми
+ * потоками.
+ * \param cfg Параметры симулятора.
+ * \return 0 при успехе или если писать нечего, 1 при ошибке записи.
+ */
+static int writeDumps(const SimConfig_t *cfg) {
+  int res = 0;
+
+  if (cfg->stats_out && tetris_stats_dump(cfg->stats_out) != 0) {
+    perror(cfg->stats_out);
+    res = 1;
+  }
+  if (cfg->trace_out && tetris_trace_export(cfg->trace_out) != 0) {
+    perror(cfg->trace_out);
+    res = 1;
+  }
+
+  return res;
+}
+
+/**
+ * \brief Печатает справку по параметрам командной строки.
+ * \param prog Имя программы.
+ */
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "usage: %s [-n games] [-t threads] [-p random|script|heuristic|ai]\n"
+          "          [-S actions] [-s seed] [-m max_pieces] [-b] [-r file]\n"
+          "          [-W replay] [-P replay] [-D stats] [-T trace]\n"
+          "  -S  сценарий для script: a d r s — как во фронте, '.' — тик\n"
+          "  -b  выбирать фигуры мешком по 7 вместо равномерного выбора\n"
+          "  -r  сохранять рекорд в file (по умолчанию не сохраняется)\n"
+          "  -W  записать первую партию в повтор\n"
+          "  -P  проиграть повтор и сверить контрольные суммы\n"
+          "  -D  собрать статистику движка и записать её в stats (JSON)\n"
+          "  -T  трассировать этапы движка и записать последние отметки\n"
+          "      каждого потока в trace (JSON для Chrome/Perfetto)\n",
+          prog);
+}
+
+/**
+ * \brief Разбирает параметры командной строки.
+ * \param argc Число аргументов.
+ * \param argv Аргументы.
+ * \param cfg Параметры симулятора (заполняются).
+ * \return 0 при успехе, иначе 1.
+ */
+static int parseArgs(int argc, char **argv, SimConfig_t *cfg) {
+  int opt;
+  int res = 0;
+
+  while (!res && (opt = getopt(argc, argv, "n:t:p:S:s:m:br:W:P:D:T:")) != -1) {
+    if (opt == 'n') {
+      cfg->games = atol(optarg);
+    } else if (opt == 't') {
+      cfg->threads = atoi(optarg);
+    } else if (opt == 'p') {
+      if (strcmp(optarg, "random") == 0) {
+        cfg->policy = POLICY_RANDOM;
+      } else if (strcmp(optarg, "script") == 0) {
+        cfg->policy = POLICY_SCRIPT;
+      } else if (strcmp(optarg, "heuristic") == 0) {
+        cfg->policy = POLICY_HEURISTIC;
+      } else if (strcmp(optarg, "ai") == 0) {
+        cfg->policy = POLICY_AI;
+      } else {
+        res = 1;
+      }
+    } else if (opt == 'S') {
+      cfg->script = optarg;
+    } else if (opt == 's') {
+      cfg->seed = strtoull(optarg, NULL, 0);
+    } else if (opt == 'm') {
+      cfg->max_pieces = atoi(optarg);
+    } else if (opt == 'b') {
+      cfg->randomizer = TETRIS_RANDOM_BAG7;
+    } else if (opt == 'r') {
+      cfg->record_path = optarg;
+    } else if (opt == 'W') {
+      cfg->replay_out = optarg;
+    } else if (opt == 'P') {
+      cfg->replay_in = optarg;
+    } else if (opt == 'D') {
+      cfg->stats_out = optarg;
+    } else if (opt == 'T') {
+      cfg->trace_out = optarg;
+    } else {
+      res = 1;
+    }
+  }
+
+  if (cfg->games <= 0 || cfg->threads <= 0 || cfg->max_pieces <= 0 ||
+      cfg->script[0] == '\0') {
+    res = 1;
+  }
+
+  return res;
+}
+
+int main(int argc, char **argv) {
+  long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  SimConfig_t cfg = {1000,
+                     ncpu > 0 ? (int)ncpu : 1,
+                     POLICY_HEURISTIC,
+                     "ar.d.s",
+                     1,
+                     TETRIS_RANDOM_UNIFORM,
+                     10000,
+                     "",
+                     NULL,
+                     NULL,
+                     NULL,
+                     NULL};
+
+  if (parseArgs(argc, argv, &cfg)) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (cfg.stats_out) {
+    tetris_stats_enable(true);
+  }
+  if (cfg.trace_out) {
+    tetris_trace_enable(true);
+  }
+  if (cfg.replay_in) {
+    return playback(cfg.replay_in) | writeDumps(&cfg);
+  }
+  if (cfg.threads > cfg.games) {
+    cfg.threads = (int)cfg.games;
+  }
+
+  SimShared_t sh = {&cfg, calloc((size_t)cfg.games, sizeof(SimResult_t)), 0};
+  pthread_t *tids = calloc((size_t)cfg.threads, sizeof(pthread_t));
+  if (!sh.results || !tids) {
+    perror("calloc");
+    free(sh.results);
+    free(tids);
+    return 1;
+  }
+
+  struct timespec t0, t1;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  int started = 0;
+  while (started < cfg.threads &&
+         pthread_create(&tids[started], NULL, worker, &sh) == 0) {
+    ++started;
+  }
+  if (started == 0) {
+    worker(&sh);
+  }
+  for (int i = 0; i < started; ++i) {
+    pthread_join(tids[i], NULL);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+
+  double seconds = elapsed(&t0, &t1);
+  if (started > 0) {
+    cfg.threads = started;
+  }
+  report(&cfg, sh.results, seconds > 0 ? seconds : 1e-9);
+
+  free(tids);
+  free(sh.results);
+  return writeDumps(&cfg);
+}